@@ -10,16 +10,53 @@
 #include "TraceAndLog.h"
 #include "MetadataMethod.h"
 #include "MetadataModule.h"
+#include "RewriteCache.h"
+#include "InstantiationCache.h"
+#include "FaultPointTable.h"
+#include "TrapTable.h"
 
 USING_DEFAULT_NAMESPACE
 
+DWORD CEngine::m_dwEventMask = 0;
+
 #pragma region Implementation of CEngine
 
+int CEngine::FindMethodInFilter(const CAtlArray<CString> &rvszMethodNames, const CString &rszFullQualifiedMethodName)
+{
+    // Check if the method's full-qualified name equal to someone of the method-filter.
+    for(size_t i = 0; i < rvszMethodNames.GetCount(); i++)
+    {
+        if(rvszMethodNames[i] == rszFullQualifiedMethodName)
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+DWORD CEngine::GetEventMask(void)
+{
+    return m_dwEventMask;
+}
+
 #pragma region Private methods
 
 BOOL CEngine::LoadMethodFilter(void)
 {
-    this->m_vszMethodsToBeTrapped.RemoveAll();  // Clear namelist.
+    // The control thread reloads the method filter while methods are compiled, so it is read
+    // into local lists first, then replaces the current one at once.
+    CMethodFilter xMethodsToBeTrapped;
+    CAtlArray<CStaticFault> vStaticFaults;
+    CMethodFilter xMethodsDisarmed;
+    CAtlArray<CString> vszCallSiteCallees;
+    CAtlArray<CString> vszCallerScopes;
+
+    // Remember the version of the file being read, so unrelated changes in its folder are ignored.
+    WIN32_FILE_ATTRIBUTE_DATA xAttributes;
+    if(::GetFileAttributesEx(CSettings::GetMethodFilterFile(), GetFileExInfoStandard, &xAttributes))
+    {
+        this->m_ftMethodFilterLastWrite = xAttributes.ftLastWriteTime;
+    }
 
     // Open method-filter file.
     CReadTextFile xMethodFilterFile;
@@ -30,55 +67,565 @@ BOOL CEngine::LoadMethodFilter(void)
         return FALSE;
     }
 
-    // Read method-filter file. Each line is one method's full-qualified name.
+    // Read method-filter file. Each line is one method's full-qualified name, optionally
+    // followed by its parameter types in parentheses to select one overload, then by a tab and
+    // the static fault of the method, or the caller scopes of the method (callers=scope;scope...).
+    // A method prefixed with '#' is disarmed: it runs its original code until the API arms it again.
     while(!xMethodFilterFile.IsEndOfFile())
     {
         CString szMethodName = xMethodFilterFile.ReadLine(PREFERRED_QUALIFIED_METHOD_NAME_LENGTH);
+        CStaticFault xStaticFault;
+        CString szCallerScopes;
+        int nTab = szMethodName.Find(_T('\t'));
+        if(0 <= nTab)
+        {
+            CString szDescriptor = szMethodName.Mid(nTab + 1);
+            szMethodName = szMethodName.Left(nTab);
+            if(0 == szDescriptor.Find(CSettings::GetCallerScopesPrefix()))
+            {
+                szCallerScopes = szDescriptor.Mid((int)_tcslen(CSettings::GetCallerScopesPrefix()));
+            }
+            else if(!xStaticFault.Parse(szDescriptor))
+            {
+                EventReportWarning(IDS_REPORT_INVALID_STATIC_FAULT, szMethodName, szDescriptor);
+            }
+        }
         szMethodName.Trim();
+        BOOL bDisarmed = (0 == szMethodName.Find(_T('#')));
+        if(bDisarmed)
+        {
+            szMethodName = szMethodName.Mid(1);
+        }
+        ULONGLONG nSignatureHash = CMethodFilter::SplitParameterList(szMethodName);
         if(!szMethodName.IsEmpty())  // Skip empty lines.
         {
             // Check if the method is in protected namespaces.
-            int i = 0;
-            for(; NULL != CSettings::GetProtectedNamespaceList()[i]; i++)
+            LPCTSTR pstrProtectedNamespace = CSettings::FindProtectedNamespace(szMethodName);
+            if(NULL != pstrProtectedNamespace)
+            {
+                EventReportWarning(IDS_REPORT_METHOD_INSIDE_PROTECTED_NAMESPACE, szMethodName, pstrProtectedNamespace);
+            }
+            else if(!szCallerScopes.IsEmpty())
             {
-                if(0 == szMethodName.Find(CSettings::GetProtectedNamespaceList()[i]))
+                // The calls to the method made by the callers in the scopes are trapped, the
+                // method itself is not. Their gates stay closed while the method is disarmed, so
+                // disarmed call-site rules are kept as well.
+                int nStart = 0;
+                for(CString szCallerScope = szCallerScopes.Tokenize(_T(";"), nStart); 0 <= nStart;
+                    szCallerScope = szCallerScopes.Tokenize(_T(";"), nStart))
                 {
-                    EventReportWarning(IDS_REPORT_METHOD_INSIDE_PROTECTED_NAMESPACE,
-                        szMethodName, CSettings::GetProtectedNamespaceList()[i]);
-                    break;
+                    vszCallSiteCallees.Add(szMethodName);
+                    vszCallerScopes.Add(szCallerScope.Trim());
                 }
             }
-            if(NULL == CSettings::GetProtectedNamespaceList()[i])
+            else
             {
                 // Add method to name list only if not in protected-namespaces.
-                this->m_vszMethodsToBeTrapped.Add(szMethodName);
+                if(bDisarmed)
+                {
+                    xMethodsDisarmed.Add(szMethodName, nSignatureHash);
+                }
+                else
+                {
+                    xMethodsToBeTrapped.Add(szMethodName, nSignatureHash);
+                    vStaticFaults.Add(xStaticFault);
+                }
             }
         }
     }
 
     // Log method filter.
     EventReportInfo(IDS_REPORT_METHOD_FILTER_LIST_HEADER);
-    for(size_t i = 0; i < this->m_vszMethodsToBeTrapped.GetCount(); i++)
+    for(size_t i = 0; i < xMethodsToBeTrapped.GetCount(); i++)
     {
-        EventReportInfo(IDS_REPORT_METHOD_FILTER_LIST_ELEMENT, i, this->m_vszMethodsToBeTrapped[i]);
+        EventReportInfo(IDS_REPORT_METHOD_FILTER_LIST_ELEMENT, i, xMethodsToBeTrapped.GetMethodNames()[i]);
+    }
+    for(size_t i = 0; i < xMethodsDisarmed.GetCount(); i++)
+    {
+        EventReportInfo(IDS_REPORT_METHOD_FILTER_LIST_ELEMENT, xMethodsToBeTrapped.GetCount() + i,
+            _T("#") + xMethodsDisarmed.GetMethodNames()[i]);
+    }
+    for(size_t i = 0; i < vszCallSiteCallees.GetCount(); i++)
+    {
+        EventReportInfo(IDS_REPORT_METHOD_FILTER_LIST_ELEMENT,
+            xMethodsToBeTrapped.GetCount() + xMethodsDisarmed.GetCount() + i,
+            vszCallSiteCallees[i] + _T("\t") + CSettings::GetCallerScopesPrefix() + vszCallerScopes[i]);
     }
     EventReportInfo(IDS_REPORT_METHOD_FILTER_LIST_FOOTER);
 
+    CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csMethodFilter);
+    this->m_xMethodsToBeTrapped.Copy(xMethodsToBeTrapped);
+    this->m_vStaticFaults.Copy(vStaticFaults);
+    this->m_vszMethodsDisarmed.Copy(xMethodsDisarmed.GetMethodNames());
+    this->m_vszCallSiteCallees.Copy(vszCallSiteCallees);
+    this->m_vszCallerScopes.Copy(vszCallerScopes);
+    this->m_xReJitController.SetMethodFilter(xMethodsToBeTrapped.GetMethodNames(),
+        xMethodsToBeTrapped.GetSignatureHashes(), xMethodsDisarmed.GetMethodNames(),
+        xMethodsDisarmed.GetSignatureHashes());
+    this->ForgetInliningDecisions(0);
+    CRewriteCache::ForgetBypassed();
     return TRUE;
 }
 
-BOOL CEngine::ShouldMethodBeTrapped(
-    CString szFullQualifiedMethodName) const
+DWORD CEngine::SelectEventMask(void) const
 {
-    // Check if the method's full-qualified name equal to someone of the method-filter.
-    for(size_t i = 0; i < this->m_vszMethodsToBeTrapped.GetCount(); i++)
+    // An explicit mask from the configuration wins. It is used to measure the cost of single flags.
+    DWORD dwEventMask = 0;
+    if(CSettings::GetEventMaskOverride(&dwEventMask))
+    {
+        EventReportInfo(IDS_REPORT_EVENT_MASK_OVERRIDDEN, dwEventMask);
+        return dwEventMask;
+    }
+
+    // Request only what the active features need. Every flag costs the runtime something, even
+    // if the callback behind it does nothing (e.g. enter/leave probes, disabled inlining).
+    if(this->m_bAttached)
+    {
+        // Inlining can not be disabled and native images can not be rejected after startup, so
+        // JITInlining keeps trapped methods from being inlined into the methods compiled from now on.
+        // Module unloads tell when the compilations and inlining decisions remembered for a module
+        // are out of date.
+        if(!this->IsMethodFilterEmpty() || _T('\0') != CSettings::GetFaultPointAttributeName()[0])
+        {
+            dwEventMask |= COR_PRF_MONITOR_JIT_COMPILATION
+                | COR_PRF_MONITOR_MODULE_LOADS;
+        }
+    }
+    else if(this->m_xReJitController.IsAttached())
+    {
+        // Methods are compiled unmodified, and compiled again with the prologue when armed. Only
+        // the methods of the method filter are kept from being inlined, and native images are
+        // used, since ReJIT replaces their code as well. ReJIT can only be enabled here, even if
+        // no method is armed yet.
+        dwEventMask |= COR_PRF_MONITOR_JIT_COMPILATION
+            | COR_PRF_MONITOR_MODULE_LOADS
+            | COR_PRF_ENABLE_REJIT;
+    }
+    else if(!this->IsMethodFilterEmpty() || _T('\0') != CSettings::GetFaultPointAttributeName()[0])
+    {
+        // Prologues are inserted when trapped methods are JIT-compiled, gates when their callers
+        // are. Trapped methods must not be inlined into their callers, and must not be loaded from
+        // native images (NGEN), otherwise they would never be JIT-compiled. Module loads find the
+        // fault points of a module, and unloads tell when the compilations remembered for a module
+        // are out of date.
+        dwEventMask |= COR_PRF_MONITOR_JIT_COMPILATION
+            | COR_PRF_MONITOR_MODULE_LOADS
+            | COR_PRF_DISABLE_INLINING
+            | COR_PRF_MONITOR_CACHE_SEARCHES;
+    }
+
+    EventReportInfo(IDS_REPORT_EVENT_MASK_SELECTED, dwEventMask);
+    return dwEventMask;
+}
+
+BOOL CEngine::ShouldMethodBeTrapped(const CMetadataMethod &rxMethod, CStaticFault &rxStaticFault) const
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csMethodFilter);
+
+    int nIndex = this->m_xMethodsToBeTrapped.Find(rxMethod.GetFullQualifiedMethodName(), rxMethod.GetSignatureHash());
+    if(0 > nIndex)
+    {
+        return FALSE;
+    }
+    rxStaticFault = this->m_vStaticFaults[nIndex];
+    return TRUE;
+}
+
+BOOL CEngine::FindCallSiteCallees(
+    const CString &rszFullQualifiedMethodName, CAtlArray<CString> &rvszCallees) const
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csMethodFilter);
+
+    for(size_t i = 0; i < this->m_vszCallSiteCallees.GetCount(); i++)
+    {
+        if(IsInCallerScope(this->m_vszCallerScopes[i], rszFullQualifiedMethodName)
+            && 0 > FindMethodInFilter(rvszCallees, this->m_vszCallSiteCallees[i]))
+        {
+            rvszCallees.Add(this->m_vszCallSiteCallees[i]);
+        }
+    }
+    return 0 < rvszCallees.GetCount();
+}
+
+BOOL CEngine::IsInCallerScope(const CString &rszCallerScope, const CString &rszFullQualifiedMethodName)
+{
+    // A scope is either a full-qualified method name, or a namespace or type ending with the
+    // separator, which contains all the methods below it.
+    if(rszCallerScope == rszFullQualifiedMethodName)
+    {
+        return TRUE;
+    }
+    int nLength = rszCallerScope.GetLength();
+    return 0 < nLength
+        && CSettings::GetQualifiedNameSeparatorBeforeMethod()[0] == rszCallerScope[nLength - 1]
+        && 0 == _tcsncmp(rszFullQualifiedMethodName, rszCallerScope, nLength);
+}
+
+BOOL CEngine::IsRewrittenAtJit(FunctionID functionId) const
+{
+    // JITInlining asks about the same callees again and again, from every caller compiled.
+    ULONG nGeneration;
     {
-        if(this->m_vszMethodsToBeTrapped[i] == szFullQualifiedMethodName)
+        CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csInliningDecisions);
+        const CAtlMap<FunctionID, INLINING_DECISION>::CPair *pxPair = this->m_mapInliningDecisions.Lookup(functionId);
+        if(NULL != pxPair)
         {
-            return TRUE;
+            return pxPair->m_value.bRewrittenAtJit;
         }
+        nGeneration = this->m_nInliningDecisionGeneration;
     }
-    return FALSE;
+
+    ClassID classId;
+    ModuleID moduleId;
+    mdMethodDef tkMethodDef;
+    HRESULT hr = this->m_pCorProfilerInfo->GetFunctionInfo(functionId, &classId, &moduleId, &tkMethodDef);
+    if(FAILED(hr))
+    {
+        return TRUE;
+    }
+
+    INLINING_DECISION xDecision = {moduleId, this->IsRewrittenAtJit(moduleId, tkMethodDef)};
+
+    // Not remembered if the method filter was reloaded meanwhile, the decision may be out of date.
+    CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csInliningDecisions);
+    if(nGeneration == this->m_nInliningDecisionGeneration)
+    {
+        this->m_mapInliningDecisions.SetAt(functionId, xDecision);
+    }
+    return xDecision.bRewrittenAtJit;
+}
+
+BOOL CEngine::IsRewrittenAtJit(ModuleID moduleId, mdMethodDef tkMethodDef) const
+{
+    switch(CRewriteCache::Peek(moduleId, tkMethodDef))
+    {
+    case CRewriteCache::OUTCOME_REWRITTEN:
+        return TRUE;
+    case CRewriteCache::OUTCOME_BYPASSED:
+        return FALSE;
+    }
+    if(CFaultPointTable::Contains(moduleId, tkMethodDef))
+    {
+        return TRUE;
+    }
+    if(this->IsMethodFilterEmpty())
+    {
+        return FALSE;
+    }
+
+    try
+    {
+        CMetadataMethod xMethod(tkMethodDef);
+        CMetadataModule xModule(this->m_pCorProfilerInfo, moduleId);
+        xModule.LoadMethodProperties(xMethod);
+        CStaticFault xStaticFault;
+        CAtlArray<CString> vszCallees;
+        return this->ShouldMethodBeTrapped(xMethod, xStaticFault)
+            || this->FindCallSiteCallees(xMethod.GetFullQualifiedMethodName(), vszCallees);
+    }
+    catch(CExceptionAsBreak* /*&sharedExceptionAsBreak*/)
+    {
+        // Error is reported by callee. Keep the method from being inlined, to be safe.
+        return TRUE;
+    }
+}
+
+void CEngine::ForgetInliningDecisions(ModuleID moduleId)
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csInliningDecisions);
+    if(0 == moduleId)
+    {
+        this->m_mapInliningDecisions.RemoveAll();
+        this->m_nInliningDecisionGeneration++;
+        return;
+    }
+
+    POSITION pos = this->m_mapInliningDecisions.GetStartPosition();
+    while(NULL != pos)
+    {
+        POSITION posCurrent = pos;
+        if(moduleId == this->m_mapInliningDecisions.GetNextValue(pos).moduleId)
+        {
+            this->m_mapInliningDecisions.RemoveAtPos(posCurrent);
+        }
+    }
+}
+
+BOOL CEngine::IsMethodFilterEmpty(void) const
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csMethodFilter);
+
+    return 0 == this->m_xMethodsToBeTrapped.GetCount() && 0 == this->m_vszCallSiteCallees.GetCount();
+}
+
+BOOL CEngine::HasCallSiteRules(void) const
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csMethodFilter);
+
+    return 0 < this->m_vszCallSiteCallees.GetCount();
+}
+
+void CEngine::LoadFaultPoints(ModuleID moduleId)
+{
+    LPCTSTR pstrAttributeName = CSettings::GetFaultPointAttributeName();
+    try
+    {
+        CMetadataModule xModule(this->m_pCorProfilerInfo, moduleId);
+        CAtlArray<mdMethodDef> vMethodDefTokens;
+        if(0 < xModule.FindMethodsByCustomAttribute(pstrAttributeName, vMethodDefTokens))
+        {
+            CFaultPointTable::AddModule(moduleId, vMethodDefTokens);
+            EventReportInfo(IDS_REPORT_FAULT_POINTS_FOUND, (ULONG)vMethodDefTokens.GetCount(), moduleId,
+                pstrAttributeName);
+        }
+    }
+    catch(CExceptionAsBreak* /*&sharedExceptionAsBreak*/)
+    {
+        // Error is reported by callee. The methods of the module are matched by name only.
+    }
+}
+
+HRESULT CEngine::InstrumentMethod(
+    ModuleID moduleId, mdMethodDef tkMethodDef, ICorProfilerFunctionControl *pFunctionControl)
+{
+    try
+    {
+        // Fault points are found at module load, so they are trapped without being named. With
+        // an empty method filter, nothing else is, and other methods are bypassed the same way.
+        BOOL bFaultPoint = CFaultPointTable::Contains(moduleId, tkMethodDef);
+        if(!bFaultPoint && this->IsMethodFilterEmpty())
+        {
+            this->RecordOutcome(moduleId, tkMethodDef, pFunctionControl, CRewriteCache::OUTCOME_BYPASSED);
+            return S_OK;
+        }
+
+        CMetadataMethod xCurrentMethod(tkMethodDef);
+        CMetadataModule xCurrentModule(this->m_pCorProfilerInfo, moduleId);
+        xCurrentModule.SetFunctionControl(pFunctionControl);
+
+        xCurrentModule.LoadMethodProperties(xCurrentMethod);
+        CStaticFault xStaticFault;
+        if(bFaultPoint || this->ShouldMethodBeTrapped(xCurrentMethod, xStaticFault))
+        {
+            if(xStaticFault.IsDefined())
+            {
+                DebugTrace(_T("Compile fault into method: %s ..."), xCurrentMethod.GetFullQualifiedMethodName());
+                BOOL bCompiled = FALSE;
+                try
+                {
+                    bCompiled = xCurrentModule.InsertStaticFaultIntoMethod(xCurrentMethod, xStaticFault);
+                }
+                catch(CExceptionAsBreak* /*&sharedExceptionAsBreak*/)
+                {
+                    // Error is reported by callee (e.g. exception type not found). Trap the method instead.
+                }
+                if(bCompiled)
+                {
+                    EventReportInfo(IDS_REPORT_SUCCESSFULLY_COMPILE_FAULT, xCurrentMethod.GetFullQualifiedMethodName(),
+                        xStaticFault.GetDescriptor());
+                    this->RecordOutcome(moduleId, tkMethodDef, pFunctionControl, CRewriteCache::OUTCOME_REWRITTEN);
+                    return S_OK;
+                }
+                EventReportWarning(IDS_REPORT_STATIC_FAULT_NOT_COMPILED, xCurrentMethod.GetFullQualifiedMethodName(),
+                    xStaticFault.GetDescriptor());
+            }
+
+            DebugTrace(_T("Trap method: %s ..."), xCurrentMethod.GetFullQualifiedMethodName());
+            ULONG nTrapId = xCurrentModule.InsertPrologueIntoMethod(xCurrentMethod);
+            EventReportInfo(IDS_REPORT_SUCCESSFULLY_MODIFY_METHOD, xCurrentMethod.GetFullQualifiedMethodName(), nTrapId);
+            this->RecordOutcome(moduleId, tkMethodDef, pFunctionControl, CRewriteCache::OUTCOME_REWRITTEN);
+        }
+        else
+        {
+            // ReJIT only compiles the methods of the method filter, whose callers are trapped at
+            // their first JIT compilation, see InstrumentCallSites.
+            if(NULL == pFunctionControl && this->InsertCallSiteTraps(xCurrentModule, xCurrentMethod))
+            {
+                this->RecordOutcome(moduleId, tkMethodDef, pFunctionControl, CRewriteCache::OUTCOME_REWRITTEN);
+                return S_OK;
+            }
+
+            // Also when a method requested for ReJIT is disarmed meanwhile: it is compiled unmodified.
+            DebugTrace(_T("Bypass method: %s"), xCurrentMethod.GetFullQualifiedMethodName());
+            this->RecordOutcome(moduleId, tkMethodDef, pFunctionControl, CRewriteCache::OUTCOME_BYPASSED);
+        }
+
+    }
+    catch(CExceptionAsBreak* /*&sharedExceptionAsBreak*/)
+    {
+        // Do NOT delete the caught exception. It's shared (static) one.
+        // Catching this exception just mean error in callees and execution should be broken.
+        return E_FAIL;
+    }
+    return S_OK;
+}
+
+HRESULT CEngine::InstrumentCallSites(ModuleID moduleId, mdMethodDef tkMethodDef)
+{
+    try
+    {
+        CMetadataMethod xCurrentMethod(tkMethodDef);
+        CMetadataModule xCurrentModule(this->m_pCorProfilerInfo, moduleId);
+        xCurrentModule.LoadMethodProperties(xCurrentMethod);
+
+        // Methods of the method filter are compiled unmodified here, ReJIT rewrites them when armed.
+        BOOL bTrapped = this->InsertCallSiteTraps(xCurrentModule, xCurrentMethod);
+        this->RecordOutcome(moduleId, tkMethodDef, NULL,
+            bTrapped ? CRewriteCache::OUTCOME_REWRITTEN : CRewriteCache::OUTCOME_BYPASSED);
+    }
+    catch(CExceptionAsBreak* /*&sharedExceptionAsBreak*/)
+    {
+        // Do NOT delete the caught exception. It's shared (static) one.
+        return E_FAIL;
+    }
+    return S_OK;
+}
+
+BOOL CEngine::InsertCallSiteTraps(CMetadataModule &rxModule, CMetadataMethod &rxMethod)
+{
+    // Calls made by the method to callees of call-site rules are gated where they are made.
+    CAtlArray<CString> vszCallees;
+    if(!this->FindCallSiteCallees(rxMethod.GetFullQualifiedMethodName(), vszCallees))
+    {
+        return FALSE;
+    }
+
+    DebugTrace(_T("Trap call sites of method: %s ..."), rxMethod.GetFullQualifiedMethodName());
+    ULONG nCallSiteCount = rxModule.InsertCallSiteTrapsIntoMethod(rxMethod, vszCallees);
+    if(0 == nCallSiteCount)
+    {
+        return FALSE;
+    }
+    EventReportInfo(IDS_REPORT_CALL_SITES_TRAPPED, rxMethod.GetFullQualifiedMethodName(), nCallSiteCount);
+    return TRUE;
+}
+
+void CEngine::RecordOutcome(ModuleID moduleId, mdMethodDef tkMethodDef,
+    ICorProfilerFunctionControl *pFunctionControl, CRewriteCache::OUTCOME nOutcome)
+{
+    // A method rewritten by ReJIT gets a new body at every request, so only first JIT
+    // compilations are remembered.
+    if(NULL == pFunctionControl)
+    {
+        CRewriteCache::Record(moduleId, tkMethodDef, nOutcome);
+    }
+}
+
+BOOL CEngine::StartControlThread(void)
+{
+    this->m_hStopControlThread.Attach(::CreateEvent(NULL, TRUE, FALSE, NULL));
+    this->m_hRefreshMethods.Attach(::CreateEvent(NULL, FALSE, FALSE, NULL));
+    if((NULL == this->m_hStopControlThread) || (NULL == this->m_hRefreshMethods))
+    {
+        EventReportError(IDS_REPORT_FAILED_START_CONTROL_THREAD, ::GetLastError());
+        return FALSE;
+    }
+
+    this->m_hControlThread.Attach(::CreateThread(NULL, 0, &CEngine::ControlThreadProc, this, 0, NULL));
+    if(NULL == this->m_hControlThread)
+    {
+        EventReportError(IDS_REPORT_FAILED_START_CONTROL_THREAD, ::GetLastError());
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void CEngine::StopControlThread(void)
+{
+    if(NULL != this->m_hControlThread)
+    {
+        ::SetEvent(this->m_hStopControlThread);
+        ::WaitForSingleObject(this->m_hControlThread, INFINITE);
+        this->m_hControlThread.Close();
+    }
+}
+
+void CEngine::RunControlThread(void)
+{
+    // The runtime must know this thread before it calls into ICorProfilerInfo, otherwise
+    // RequestReJIT could deadlock with a garbage collection.
+    CComQIPtr<ICorProfilerInfo3> pCorProfilerInfo3(this->m_pCorProfilerInfo);
+    if(NULL != pCorProfilerInfo3)
+    {
+        pCorProfilerInfo3->InitializeCurrentThread();
+    }
+
+    // The API rewrites the method filter to arm or disarm methods, so the folder of the file is
+    // watched. FindFirstChangeNotification can not watch a single file.
+    CString szMethodFilterFolder = CSettings::GetMethodFilterFile();
+    int nSlash = szMethodFilterFolder.ReverseFind(_T('\\'));
+    szMethodFilterFolder = (0 <= nSlash) ? szMethodFilterFolder.Left(nSlash + 1) : CString(_T("."));
+    HANDLE hMethodFilterChanged = ::FindFirstChangeNotification(szMethodFilterFolder, FALSE,
+        FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+
+    // Modules loaded before the thread started are waiting already.
+    this->m_xReJitController.Refresh();
+
+    HANDLE vhEvents[3] = { this->m_hStopControlThread, this->m_hRefreshMethods, hMethodFilterChanged };
+    DWORD nEvents = (INVALID_HANDLE_VALUE == hMethodFilterChanged) ? 2 : 3;
+    for(;;)
+    {
+        BOOL bMethodFilterLoaded = FALSE;
+        DWORD dwWait = ::WaitForMultipleObjects(nEvents, vhEvents, FALSE, INFINITE);
+        if(WAIT_OBJECT_0 + 2 == dwWait)
+        {
+            ::FindNextChangeNotification(hMethodFilterChanged);
+            WIN32_FILE_ATTRIBUTE_DATA xAttributes;
+            if(::GetFileAttributesEx(CSettings::GetMethodFilterFile(), GetFileExInfoStandard, &xAttributes) &&
+                (0 != ::CompareFileTime(&xAttributes.ftLastWriteTime, &this->m_ftMethodFilterLastWrite)))
+            {
+                bMethodFilterLoaded = this->LoadMethodFilter();
+            }
+        }
+        else if(WAIT_OBJECT_0 + 1 != dwWait)
+        {
+            break;  // stopped, or the wait failed
+        }
+        this->m_xReJitController.Refresh();  // reverts the methods disarmed, before detaching
+
+        if(bMethodFilterLoaded && (NULL != pCorProfilerInfo3) && this->RequestDetach(pCorProfilerInfo3))
+        {
+            break;  // the runtime unloads the engine once this thread is gone
+        }
+    }
+
+    if(INVALID_HANDLE_VALUE != hMethodFilterChanged)
+    {
+        ::FindCloseChangeNotification(hMethodFilterChanged);
+    }
+}
+
+BOOL CEngine::RequestDetach(ICorProfilerInfo3 *pCorProfilerInfo3)
+{
+    {
+        CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csMethodFilter);
+        if(0 < this->m_xMethodsToBeTrapped.GetCount() || 0 < this->m_vszCallSiteCallees.GetCount())
+        {
+            return FALSE;
+        }
+    }
+    if(_T('\0') != CSettings::GetFaultPointAttributeName()[0])
+    {
+        return FALSE;  // fault points may be found in modules loaded later
+    }
+
+    HRESULT hr = pCorProfilerInfo3->RequestProfilerDetach(PREFERRED_DETACH_TIME_IN_MILLISECONDS);
+    if(FAILED(hr))
+    {
+        // Expected for an engine loaded at startup, or which rewrote methods (their code calls
+        // into the engine). Keep watching the method filter.
+        EventReportInfo(IDS_REPORT_DETACH_REFUSED, hr);
+        return FALSE;
+    }
+
+    EventReportInfo(IDS_REPORT_DETACH_REQUESTED);
+    return TRUE;
+}
+
+DWORD WINAPI CEngine::ControlThreadProc(LPVOID pvEngine)
+{
+    static_cast<CEngine*>(pvEngine)->RunControlThread();
+    return 0;
 }
 
 #pragma endregion
@@ -110,32 +657,82 @@ STDMETHODIMP CEngine::Initialize(
 
     DebugTrace(_T("Connect to CLR : (ICorProfileInfo*)(0x%08x)"), this->m_pCorProfilerInfo.p);
 
+    // Rewriting methods on demand needs ReJIT (CLR 4.5 and later). Otherwise methods are
+    // rewritten at first JIT compilation, and keep their prologue when disarmed.
+    if(CSettings::IsReJitRequested() && this->m_bAttached)
+    {
+        // COR_PRF_ENABLE_REJIT may only be set at startup.
+        EventReportWarning(IDS_REPORT_REJIT_NOT_AVAILABLE_ON_ATTACH);
+    }
+    else if(CSettings::IsReJitRequested())
+    {
+        CComQIPtr<ICorProfilerInfo4> pCorProfilerInfo4(pICorProfilerInfoUnk);
+        if(NULL == pCorProfilerInfo4)
+        {
+            EventReportWarning(IDS_REPORT_REJIT_NOT_AVAILABLE, E_NOINTERFACE);
+        }
+        else
+        {
+            this->m_xReJitController.Attach(pCorProfilerInfo4);
+        }
+    }
+
     // Set the event mask to specify what events we want to receive.
-    this->m_pCorProfilerInfo->SetEventMask(0
-        // Use this macro to turn off monitoring classes under System namespace.
-#if !defined(BYPASS_CLI_SYSTEM_CLASSES)
-        | COR_PRF_MONITOR_ENTERLEAVE 
-        | COR_PRF_MONITOR_CACHE_SEARCHES
-#endif
-        | COR_PRF_DISABLE_INLINING
-        | COR_PRF_MONITOR_JIT_COMPILATION
-        );
+    DWORD dwEventMask = this->SelectEventMask();
+    HRESULT hr = this->m_pCorProfilerInfo->SetEventMask(dwEventMask);
+    if(FAILED(hr))
+    {
+        EventReportError(IDS_REPORT_FAILED_SET_EVENT_MASK, hr, dwEventMask);
+        return E_FAIL;
+    }
+    m_dwEventMask = dwEventMask;
+
+    // Methods armed or disarmed later are picked up by the control thread, which also detaches
+    // an attached engine once none is armed. Without it, the method filter loaded here stays as is.
+    if(this->m_xReJitController.IsAttached() || this->m_bAttached)
+    {
+        this->StartControlThread();
+    }
 
     return S_OK;
 }
 
+STDMETHODIMP CEngine::Shutdown(void)
+{
+    this->StopControlThread();
+
+    ULONG nCompilations, nSkipped;
+    CRewriteCache::GetCounters(nCompilations, nSkipped);
+    EventReportInfo(IDS_REPORT_JIT_COUNTERS, nCompilations, nSkipped);
+    return S_OK;
+}
+
 STDMETHODIMP CEngine::JITInlining(
     /* [in] */  FunctionID callerId,
     /* [in] */  FunctionID calleeId,
     /* [out] */ BOOL *pfShouldInline)
 {
     UNREFERENCED_PARAMETER(callerId);
-    UNREFERENCED_PARAMETER(calleeId);
 
     DebugTrace(_T("<!-- Enter: MS::WSS::FI::CEngine::JITInlining() --->"));
 
-    // Trapped functions should never be called as inlining, if the CEngine is working.
-    *pfShouldInline = (NULL == this->m_pCorProfilerInfo);
+    // When rewriting on demand, all methods but those of the method filter, and the callers of
+    // call-site rules, may be inlined. The code of a method inlined into its callers would not be
+    // replaced by ReJIT, and its call sites would not be trapped.
+    if(this->m_xReJitController.IsAttached())
+    {
+        ClassID classId;
+        ModuleID moduleId;
+        mdMethodDef tkMethodDef;
+        HRESULT hr = this->m_pCorProfilerInfo->GetFunctionInfo(calleeId, &classId, &moduleId, &tkMethodDef);
+        *pfShouldInline = SUCCEEDED(hr) && !this->m_xReJitController.IsFilteredMethod(moduleId, tkMethodDef)
+            && !(this->HasCallSiteRules() && this->IsRewrittenAtJit(calleeId));
+        return S_OK;
+    }
+
+    // Trapped functions should never be called as inlining, if the CEngine is working. After
+    // attaching, inlining can not be disabled, so only those are kept from being inlined.
+    *pfShouldInline = (NULL == this->m_pCorProfilerInfo) || !this->IsRewrittenAtJit(calleeId);
     return S_OK;
 }
 
@@ -152,6 +749,14 @@ STDMETHODIMP CEngine::JITCompilationStarted(
         return E_FAIL;
     }
 
+    // Methods of the method filter are rewritten on demand by GetReJITParameters, and left alone
+    // at first JIT compilation. Their callers are not compiled again, so call sites are trapped now.
+    BOOL bReJit = this->m_xReJitController.IsAttached();
+    if(bReJit && !this->HasCallSiteRules())
+    {
+        return S_OK;
+    }
+
     // Get module id and method-def token from CLR by function id.
     ClassID classId;
     ModuleID moduleId;
@@ -163,42 +768,142 @@ STDMETHODIMP CEngine::JITCompilationStarted(
         return E_FAIL;
     }
 
-    try
+    // Later compilations of a method-def (e.g. generic instantiations) use the body set at the
+    // first one, so the method is not looked up nor rewritten again.
+    if(CRewriteCache::OUTCOME_UNKNOWN != CRewriteCache::Lookup(moduleId, tkMethodDef))
     {
-        CMetadataMethod xCurrentMethod(tkMethodDef);
-        CMetadataModule xCurrentModule(this->m_pCorProfilerInfo, moduleId);
+        return S_OK;
+    }
 
-        xCurrentModule.LoadMethodProperties(xCurrentMethod);
-        if(this->ShouldMethodBeTrapped(xCurrentMethod.GetFullQualifiedMethodName()))
-        {
-            DebugTrace(_T("Trap method: %s ..."), xCurrentMethod.GetFullQualifiedMethodName());
-            xCurrentModule.InsertPrologueIntoMethod(xCurrentMethod);
-            EventReportInfo(IDS_REPORT_SUCCESSFULLY_MODIFY_METHOD, xCurrentMethod.GetFullQualifiedMethodName());
-        }
-        else
-        {
-            DebugTrace(_T("Bypass method: %s"), xCurrentMethod.GetFullQualifiedMethodName());
-        }
+    if(bReJit)
+    {
+        return this->InstrumentCallSites(moduleId, tkMethodDef);
+    }
+    return this->InstrumentMethod(moduleId, tkMethodDef, NULL);
+}
 
+STDMETHODIMP CEngine::ModuleLoadFinished( 
+    /* [in] */ ModuleID moduleId,
+    /* [in] */ HRESULT hrStatus)
+{
+    DebugTrace(_T("<!-- Enter: MS::WSS::FI::CEngine::ModuleLoadFinished() --->"));
+
+    if(FAILED(hrStatus))
+    {
+        return S_OK;
     }
-    catch(CExceptionAsBreak* /*&sharedExceptionAsBreak*/)
+
+    // Fault points are trapped at JIT compilation, or resolved for ReJIT with the method filter.
+    if(_T('\0') != CSettings::GetFaultPointAttributeName()[0])
     {
-        // Do NOT delete the caught exception. It's shared (static) one.
-        // Catching this exception just mean error in callees and execution should be broken.
-        return E_FAIL;
+        this->LoadFaultPoints(moduleId);
+    }
+    if(this->m_xReJitController.IsAttached())
+    {
+        // ReJIT must not be requested from a callback. The control thread does it.
+        this->m_xReJitController.AddModule(moduleId);
+        ::SetEvent(this->m_hRefreshMethods);
     }
     return S_OK;
 }
 
+STDMETHODIMP CEngine::ModuleUnloadStarted( 
+    /* [in] */ ModuleID moduleId)
+{
+    this->m_xReJitController.RemoveModule(moduleId);
+    this->ForgetInliningDecisions(moduleId);
+    CRewriteCache::RemoveModule(moduleId);
+    CInstantiationCache::RemoveModule(moduleId);
+    CFaultPointTable::RemoveModule(moduleId);
+    CTrapTable::RemoveModule(moduleId);
+    return S_OK;
+}
+
 #pragma endregion
 
-#pragma region Virtual Methods Derived from ICorProfilerCallback2 (Not-Implemented Ones)
+#pragma region Virtual Methods Derived from ICorProfilerCallback4 (Implemented Ones)
 
-STDMETHODIMP CEngine::Shutdown(void)
+STDMETHODIMP CEngine::InitializeForAttach(
+    /* [in] */ IUnknown *pCorProfilerInfoUnk,
+    /* [in] */ void *pvClientData,
+    /* [in] */ UINT cbClientData)
 {
-    return E_NOTIMPL;
+    DebugTrace(_T("<!-- Enter: MS::WSS::FI::CEngine::InitializeForAttach() --->"));
+
+    // The settings come with the attach request. Load them before the event-log is initialized.
+    if(!CSettings::LoadFromClientData(pvClientData, cbClientData))
+    {
+        CEventLog::Initialize();
+        EventReportError(IDS_REPORT_INVALID_CLIENT_DATA, cbClientData);
+        return E_FAIL;
+    }
+
+    this->m_bAttached = TRUE;
+    return this->Initialize(pCorProfilerInfoUnk);
 }
 
+STDMETHODIMP CEngine::ProfilerAttachComplete(void)
+{
+    // Methods compiled from now on are trapped like at startup. Those compiled before keep their code.
+    // The modules loaded before are not reported by ModuleLoadFinished, so their fault points are
+    // found now.
+    CComQIPtr<ICorProfilerInfo3> pCorProfilerInfo3(this->m_pCorProfilerInfo);
+    CComPtr<ICorProfilerModuleEnum> pModuleEnum;
+    if(_T('\0') != CSettings::GetFaultPointAttributeName()[0] && (NULL != pCorProfilerInfo3)
+        && SUCCEEDED(pCorProfilerInfo3->EnumModules(&pModuleEnum)))
+    {
+        ModuleID vModuleIds[16];
+        ULONG nFetched = 0;
+        while(SUCCEEDED(pModuleEnum->Next(_countof(vModuleIds), vModuleIds, &nFetched)) && (0 < nFetched))
+        {
+            for(ULONG i = 0; i < nFetched; i++)
+            {
+                this->LoadFaultPoints(vModuleIds[i]);
+            }
+        }
+    }
+    EventReportInfo(IDS_REPORT_ENGINE_ATTACHED);
+    return S_OK;
+}
+
+STDMETHODIMP CEngine::ProfilerDetachSucceeded(void)
+{
+    // No callback runs any more, and the engine is unloaded right after. The control thread,
+    // which requested the detach, must be gone by then.
+    this->StopControlThread();
+    this->m_hStopControlThread.Close();
+    this->m_hRefreshMethods.Close();
+
+    EventReportInfo(IDS_REPORT_ENGINE_DETACHED);
+    return S_OK;
+}
+
+STDMETHODIMP CEngine::GetReJITParameters(
+    /* [in] */ ModuleID moduleId,
+    /* [in] */ mdMethodDef methodId,
+    /* [in] */ ICorProfilerFunctionControl *pFunctionControl)
+{
+    DebugTrace(_T("<!-- Enter: MS::WSS::FI::CEngine::GetReJITParameters() --->"));
+
+    return this->InstrumentMethod(moduleId, methodId, pFunctionControl);
+}
+
+STDMETHODIMP CEngine::ReJITError(
+    /* [in] */ ModuleID moduleId,
+    /* [in] */ mdMethodDef methodId,
+    /* [in] */ FunctionID functionId,
+    /* [in] */ HRESULT hrStatus)
+{
+    UNREFERENCED_PARAMETER(functionId);
+
+    EventReportWarning(IDS_REPORT_REJIT_FAILED, hrStatus, moduleId, methodId);
+    return S_OK;
+}
+
+#pragma endregion
+
+#pragma region Virtual Methods Derived from ICorProfilerCallback2 (Not-Implemented Ones)
+
 STDMETHODIMP CEngine::AppDomainCreationStarted( 
     /* [in] */ AppDomainID appDomainId)
 {
@@ -280,24 +985,6 @@ STDMETHODIMP CEngine::ModuleLoadStarted(
     return E_NOTIMPL;
 }
 
-STDMETHODIMP CEngine::ModuleLoadFinished( 
-    /* [in] */ ModuleID moduleId,
-    /* [in] */ HRESULT hrStatus)
-{
-    UNREFERENCED_PARAMETER(moduleId);
-    UNREFERENCED_PARAMETER(hrStatus);
-
-    return E_NOTIMPL;
-}
-
-STDMETHODIMP CEngine::ModuleUnloadStarted( 
-    /* [in] */ ModuleID moduleId)
-{
-    UNREFERENCED_PARAMETER(moduleId);
-
-    return E_NOTIMPL;
-}
-
 STDMETHODIMP CEngine::ModuleUnloadFinished( 
     /* [in] */ ModuleID moduleId,
     /* [in] */ HRESULT hrStatus)
@@ -837,4 +1524,78 @@ STDMETHODIMP CEngine::HandleDestroyed(
 
 #pragma endregion
 
-#pragma endregion
\ No newline at end of file
+#pragma region Virtual Methods Derived from ICorProfilerCallback4 (Not-Implemented Ones)
+
+STDMETHODIMP CEngine::ReJITCompilationStarted(
+    /* [in] */ FunctionID functionId,
+    /* [in] */ ReJITID rejitId,
+    /* [in] */ BOOL fIsSafeToBlock)
+{
+    UNREFERENCED_PARAMETER(functionId);
+    UNREFERENCED_PARAMETER(rejitId);
+    UNREFERENCED_PARAMETER(fIsSafeToBlock);
+
+    return E_NOTIMPL;
+}
+
+STDMETHODIMP CEngine::ReJITCompilationFinished(
+    /* [in] */ FunctionID functionId,
+    /* [in] */ ReJITID rejitId,
+    /* [in] */ HRESULT hrStatus,
+    /* [in] */ BOOL fIsSafeToBlock)
+{
+    UNREFERENCED_PARAMETER(functionId);
+    UNREFERENCED_PARAMETER(rejitId);
+    UNREFERENCED_PARAMETER(hrStatus);
+    UNREFERENCED_PARAMETER(fIsSafeToBlock);
+
+    return E_NOTIMPL;
+}
+
+STDMETHODIMP CEngine::MovedReferences2(
+    /* [in] */ ULONG cMovedObjectIDRanges,
+    /* [size_is][in] */ ObjectID oldObjectIDRangeStart[  ],
+    /* [size_is][in] */ ObjectID newObjectIDRangeStart[  ],
+    /* [size_is][in] */ SIZE_T cObjectIDRangeLength[  ])
+{
+    UNREFERENCED_PARAMETER(cMovedObjectIDRanges);
+    UNREFERENCED_PARAMETER(oldObjectIDRangeStart);
+    UNREFERENCED_PARAMETER(newObjectIDRangeStart);
+    UNREFERENCED_PARAMETER(cObjectIDRangeLength);
+
+    return E_NOTIMPL;
+}
+
+STDMETHODIMP CEngine::SurvivingReferences2(
+    /* [in] */ ULONG cSurvivingObjectIDRanges,
+    /* [size_is][in] */ ObjectID objectIDRangeStart[  ],
+    /* [size_is][in] */ SIZE_T cObjectIDRangeLength[  ])
+{
+    UNREFERENCED_PARAMETER(cSurvivingObjectIDRanges);
+    UNREFERENCED_PARAMETER(objectIDRangeStart);
+    UNREFERENCED_PARAMETER(cObjectIDRangeLength);
+
+    return E_NOTIMPL;
+}
+
+#pragma endregion
+
+#pragma endregion
+
+#if defined(FAULT_ENGINE_TEST_EXPORTS)
+
+#pragma region Exported Functions (Called by Tests)
+
+extern "C" BOOL WINAPI FaultEngineGetEventMask(DWORD *pdwEventMask)
+{
+    if(NULL == pdwEventMask)
+    {
+        return FALSE;
+    }
+    *pdwEventMask = CEngine::GetEventMask();
+    return TRUE;
+}
+
+#pragma endregion
+
+#endif // FAULT_ENGINE_TEST_EXPORTS
@@ -6,6 +6,11 @@
 #pragma once
 #include "resource.h"       // main symbols
 #include "FaultInjectionEngine.h"
+#include "StaticFault.h"
+#include "ReJitController.h"
+#include "RewriteCache.h"
+#include "MetadataModule.h"
+#include "MethodFilter.h"
 
 
 #if defined(_WIN32_WCE) && !defined(_CE_DCOM) && !defined(_CE_ALLOW_SINGLE_THREADED_OBJECTS_IN_MTA)
@@ -23,6 +28,10 @@ class ATL_NO_VTABLE CEngine :
 public:
     CEngine()
     {
+        this->m_bAttached = FALSE;
+        this->m_nInliningDecisionGeneration = 0;
+        this->m_ftMethodFilterLastWrite.dwLowDateTime = 0;
+        this->m_ftMethodFilterLastWrite.dwHighDateTime = 0;
     }
 
 DECLARE_REGISTRY_RESOURCEID(IDR_ENGINE)
@@ -30,7 +39,10 @@ DECLARE_REGISTRY_RESOURCEID(IDR_ENGINE)
 
 BEGIN_COM_MAP(CEngine)
     COM_INTERFACE_ENTRY(IEngine)
+    COM_INTERFACE_ENTRY(ICorProfilerCallback)
     COM_INTERFACE_ENTRY(ICorProfilerCallback2)
+    COM_INTERFACE_ENTRY(ICorProfilerCallback3)
+    COM_INTERFACE_ENTRY(ICorProfilerCallback4)
 END_COM_MAP()
 
 
@@ -47,6 +59,16 @@ END_COM_MAP()
     }
 
 public:
+    /// <summary>
+    /// Find the first name of the method filter equal to the full qualified name of a method,
+    /// as methods are matched at JIT compilation. Return its index, or -1 if there is none.
+    /// </summary>
+    static int FindMethodInFilter(const CAtlArray<CString> &rvszMethodNames, const CString &rszFullQualifiedMethodName);
+
+    /// <summary>
+    /// Get the event mask set at initialization, 0 until then.
+    /// </summary>
+    static DWORD GetEventMask(void);
 
 #pragma region Private Member Methods
 private:
@@ -59,19 +81,186 @@ private:
 
     /// <summary>
     /// See if the method should be trapped (prologue insearted). Based on the full
-    /// qualified name of the method.
+    /// qualified name of the method, and the hash of its parameter types if the method filter
+    /// selects overloads of the name. Also get the static fault of the method, if any.
+    /// </summary>
+    BOOL ShouldMethodBeTrapped(const CMetadataMethod &rxMethod, CStaticFault &rxStaticFault) const;
+
+    /// <summary>
+    /// Get the callees whose calls are trapped in the method, i.e. the call-site rules whose
+    /// caller scope contains the method. Return FALSE if there is none.
+    /// </summary>
+    BOOL FindCallSiteCallees(const CString &rszFullQualifiedMethodName, CAtlArray<CString> &rvszCallees) const;
+
+    /// <summary>
+    /// See if a caller scope contains the method: the full qualified name of the method itself,
+    /// or of a namespace or type followed by the separator, for all methods in it.
+    /// </summary>
+    static BOOL IsInCallerScope(const CString &rszCallerScope, const CString &rszFullQualifiedMethodName);
+
+    /// <summary>
+    /// See if the method is or will be rewritten when JIT-compiled: trapped, faulted, or with its
+    /// call sites trapped. Methods which are not compiled yet are looked up in the method filter.
+    /// The answer is remembered per function.
+    /// </summary>
+    BOOL IsRewrittenAtJit(FunctionID functionId) const;
+    BOOL IsRewrittenAtJit(ModuleID moduleId, mdMethodDef tkMethodDef) const;
+
+    /// <summary>
+    /// Forget the answers of IsRewrittenAtJit for the functions of a module being unloaded, whose
+    /// ids may be reused, or for all functions (moduleId is 0) when the method filter changes.
+    /// </summary>
+    void ForgetInliningDecisions(ModuleID moduleId);
+
+    /// <summary>
+    /// See if the method filter traps nothing, neither methods nor call sites. Methods compiled
+    /// then are bypassed without being named, unless they are fault points.
     /// </summary>
-    BOOL ShouldMethodBeTrapped(CString szFullQualifiedMethodName) const;
+    BOOL IsMethodFilterEmpty(void) const;
+
+    /// <summary>
+    /// See if the method filter has call-site rules, disarmed ones included.
+    /// </summary>
+    BOOL HasCallSiteRules(void) const;
+
+    /// <summary>
+    /// Find the methods of a module just loaded which carry the fault point attribute, and add
+    /// them to the fault point table. They are trapped when compiled, without name matching.
+    /// </summary>
+    void LoadFaultPoints(ModuleID moduleId);
+
+    /// <summary>
+    /// Choose the profiler event mask from the configuration and the loaded method filter.
+    /// Only flags needed by active features are requested.
+    /// </summary>
+    DWORD SelectEventMask(void) const;
+
+    /// <summary>
+    /// Insert the prologue (or compile the static fault) into the method, if it is in the
+    /// method filter, or trap its calls to the callees of the call-site rules which cover it.
+    /// pFunctionControl is NULL at first JIT compilation, and set for ReJIT.
+    /// </summary>
+    HRESULT InstrumentMethod(ModuleID moduleId, mdMethodDef tkMethodDef, ICorProfilerFunctionControl *pFunctionControl);
+
+    /// <summary>
+    /// Trap the calls of the method to the callees of the call-site rules which cover it, at its
+    /// first JIT compilation when rewriting on demand. ReJIT compiles only the methods of the
+    /// method filter, so callers are never compiled again.
+    /// </summary>
+    HRESULT InstrumentCallSites(ModuleID moduleId, mdMethodDef tkMethodDef);
+
+    /// <summary>
+    /// Trap the calls of the method to the callees of the call-site rules which cover it.
+    /// Return FALSE if there is none.
+    /// </summary>
+    BOOL InsertCallSiteTraps(CMetadataModule &rxModule, CMetadataMethod &rxMethod);
+
+    /// <summary>
+    /// Remember the outcome of a first JIT compilation, so later ones of the method are skipped.
+    /// </summary>
+    void RecordOutcome(ModuleID moduleId, mdMethodDef tkMethodDef, ICorProfilerFunctionControl *pFunctionControl,
+        CRewriteCache::OUTCOME nOutcome);
+
+    /// <summary>
+    /// Start the thread which reloads the method filter when the API changes it, and requests
+    /// ReJIT or revert of the methods armed or disarmed by the change.
+    /// </summary>
+    BOOL StartControlThread(void);
+
+    /// <summary>
+    /// Stop the thread started by StartControlThread, if any.
+    /// </summary>
+    void StopControlThread(void);
+
+    /// <summary>
+    /// Body of the control thread.
+    /// </summary>
+    void RunControlThread(void);
+
+    /// <summary>
+    /// Ask the runtime to detach the engine once no method is armed. The runtime refuses if any
+    /// method was rewritten, or if flags which can only be set at startup were set.
+    /// Returns TRUE if the engine is being detached.
+    /// </summary>
+    BOOL RequestDetach(ICorProfilerInfo3 *pCorProfilerInfo3);
+
+    static DWORD WINAPI ControlThreadProc(LPVOID pvEngine);
 #pragma endregion
 
 #pragma region Private Member Variables
 private:
     CComQIPtr<ICorProfilerInfo> m_pCorProfilerInfo;  // pointer of CLR
-    CAtlArray<CString> m_vszMethodsToBeTrapped;  // name list of methods to be trapped
+    BOOL m_bAttached;  // loaded into a running process, instead of at startup
+    CMethodFilter m_xMethodsToBeTrapped;  // lines of methods to be trapped
+    CAtlArray<CStaticFault> m_vStaticFaults;  // static fault of each line, may be undefined
+    CAtlArray<CString> m_vszMethodsDisarmed;  // name list of methods which may be armed later
+    CAtlArray<CString> m_vszCallSiteCallees;  // callee of each call-site rule, trapped at its call sites
+    CAtlArray<CString> m_vszCallerScopes;  // caller scope of each call-site rule
+    mutable CComAutoCriticalSection m_csMethodFilter;  // the control thread reloads the method filter
+    FILETIME m_ftMethodFilterLastWrite;  // last write time of the loaded method filter
+    CReJitController m_xReJitController;  // requests ReJIT of armed methods, if rewriting on demand
+    CHandle m_hControlThread;
+    CHandle m_hStopControlThread;  // event set when the profiler shuts down
+    CHandle m_hRefreshMethods;  // event set when a module is loaded
+    static DWORD m_dwEventMask;  // set at initialization, read by tests
+
+    struct INLINING_DECISION
+    {
+        ModuleID moduleId;
+        BOOL bRewrittenAtJit;
+    };
+    mutable CAtlMap<FunctionID, INLINING_DECISION> m_mapInliningDecisions;  // answers of IsRewrittenAtJit
+    mutable ULONG m_nInliningDecisionGeneration;  // incremented whenever all answers are forgotten
+    mutable CComAutoCriticalSection m_csInliningDecisions;  // JITInlining is called on many threads
 #pragma endregion
 
-#pragma region Virtual Methods Derived from ICorProfilerCallback2
+#pragma region Virtual Methods Derived from ICorProfilerCallback4
 public:
+    STDMETHOD(ReJITCompilationStarted)(
+        /* [in] */ FunctionID functionId,
+        /* [in] */ ReJITID rejitId,
+        /* [in] */ BOOL fIsSafeToBlock);
+
+    STDMETHOD(GetReJITParameters)(
+        /* [in] */ ModuleID moduleId,
+        /* [in] */ mdMethodDef methodId,
+        /* [in] */ ICorProfilerFunctionControl *pFunctionControl);
+
+    STDMETHOD(ReJITCompilationFinished)(
+        /* [in] */ FunctionID functionId,
+        /* [in] */ ReJITID rejitId,
+        /* [in] */ HRESULT hrStatus,
+        /* [in] */ BOOL fIsSafeToBlock);
+
+    STDMETHOD(ReJITError)(
+        /* [in] */ ModuleID moduleId,
+        /* [in] */ mdMethodDef methodId,
+        /* [in] */ FunctionID functionId,
+        /* [in] */ HRESULT hrStatus);
+
+    STDMETHOD(MovedReferences2)(
+        /* [in] */ ULONG cMovedObjectIDRanges,
+        /* [size_is][in] */ ObjectID oldObjectIDRangeStart[  ],
+        /* [size_is][in] */ ObjectID newObjectIDRangeStart[  ],
+        /* [size_is][in] */ SIZE_T cObjectIDRangeLength[  ]);
+
+    STDMETHOD(SurvivingReferences2)(
+        /* [in] */ ULONG cSurvivingObjectIDRanges,
+        /* [size_is][in] */ ObjectID objectIDRangeStart[  ],
+        /* [size_is][in] */ SIZE_T cObjectIDRangeLength[  ]);
+
+    // ICorProfilerCallback3
+    STDMETHOD(InitializeForAttach)(
+        /* [in] */ IUnknown *pCorProfilerInfoUnk,
+        /* [in] */ void *pvClientData,
+        /* [in] */ UINT cbClientData);
+
+    STDMETHOD(ProfilerAttachComplete)(void);
+
+    STDMETHOD(ProfilerDetachSucceeded)(void);
+
+    // ICorProfilerCallback2
+
     STDMETHOD(ThreadNameChanged)( 
         /* [in] */ ThreadID threadId,
         /* [in] */ ULONG cchName,
@@ -0,0 +1,87 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include "FaultPointTable.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Implementation of CFaultPointTable
+
+CComAutoCriticalSection CFaultPointTable::m_csModules;
+CAtlMap<ModuleID, CFaultPointTable::FAULT_POINT_SET*> CFaultPointTable::m_mapModules;
+
+void CFaultPointTable::AddModule(ModuleID moduleId, const CAtlArray<mdMethodDef> &rvMethodDefTokens)
+{
+    if(0 == rvMethodDefTokens.GetCount())
+    {
+        return;
+    }
+
+    // Method-def rows are dense, so the set is as large as the last fault point needs.
+    ULONG nMaxRow = 0;
+    for(size_t i = 0; i < rvMethodDefTokens.GetCount(); i++)
+    {
+        nMaxRow = max(nMaxRow, RidFromToken(rvMethodDefTokens[i]));
+    }
+    FAULT_POINT_SET *pvFaultPoints = new FAULT_POINT_SET();
+    pvFaultPoints->SetCount(nMaxRow / 32 + 1);
+    ::memset(pvFaultPoints->GetData(), 0, pvFaultPoints->GetCount() * sizeof(DWORD));
+    for(size_t i = 0; i < rvMethodDefTokens.GetCount(); i++)
+    {
+        ULONG nRow = RidFromToken(rvMethodDefTokens[i]);
+        (*pvFaultPoints)[nRow / 32] |= (1UL << (nRow % 32));
+    }
+
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csModules);
+    FAULT_POINT_SET *pvOldFaultPoints = NULL;
+    if(m_mapModules.Lookup(moduleId, pvOldFaultPoints))
+    {
+        delete pvOldFaultPoints;  // loaded again, e.g. into another app-domain
+    }
+    m_mapModules.SetAt(moduleId, pvFaultPoints);
+}
+
+BOOL CFaultPointTable::Contains(ModuleID moduleId, mdMethodDef tkMethodDef)
+{
+    ULONG nRow = RidFromToken(tkMethodDef);
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csModules);
+    FAULT_POINT_SET *pvFaultPoints = NULL;
+    if(!m_mapModules.Lookup(moduleId, pvFaultPoints) || (nRow / 32 >= pvFaultPoints->GetCount()))
+    {
+        return FALSE;
+    }
+    return (0 != ((*pvFaultPoints)[nRow / 32] & (1UL << (nRow % 32))));
+}
+
+void CFaultPointTable::GetMethods(ModuleID moduleId, CAtlArray<mdMethodDef> &rvMethodDefTokens)
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csModules);
+    FAULT_POINT_SET *pvFaultPoints = NULL;
+    if(!m_mapModules.Lookup(moduleId, pvFaultPoints))
+    {
+        return;
+    }
+    for(ULONG nRow = 0; nRow < pvFaultPoints->GetCount() * 32; nRow++)
+    {
+        if(0 != ((*pvFaultPoints)[nRow / 32] & (1UL << (nRow % 32))))
+        {
+            rvMethodDefTokens.Add(TokenFromRid(nRow, mdtMethodDef));
+        }
+    }
+}
+
+void CFaultPointTable::RemoveModule(ModuleID moduleId)
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csModules);
+    FAULT_POINT_SET *pvFaultPoints = NULL;
+    if(m_mapModules.Lookup(moduleId, pvFaultPoints))
+    {
+        delete pvFaultPoints;
+        m_mapModules.RemoveKey(moduleId);
+    }
+}
+
+#pragma endregion
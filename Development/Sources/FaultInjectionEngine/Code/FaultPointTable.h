@@ -0,0 +1,54 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  Declaration of class CFaultPointTable.
+//  Fault points are the method-defs which carry the fault point attribute, e.g. [FaultPoint],
+//  named by the FAULT_INJECTION_FAULT_POINT_ATTRIBUTE environment variable. They are trapped
+//  without being listed in the method filter. The custom attributes of a module are read once
+//  when the module is loaded, and its fault points kept as a set of method-def tokens: one bit
+//  per row of the method-def table. JIT compilation then tells a fault point by its token alone,
+//  without building nor matching the name of the method.
+//
+
+#pragma once
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Declaration of CFaultPointTable
+
+class CFaultPointTable
+{
+public:
+    /// <summary>
+    /// Remember the fault points of a module being loaded.
+    /// </summary>
+    static void AddModule(ModuleID moduleId, const CAtlArray<mdMethodDef> &rvMethodDefTokens);
+
+    /// <summary>
+    /// See if the method is a fault point of the module.
+    /// </summary>
+    static BOOL Contains(ModuleID moduleId, mdMethodDef tkMethodDef);
+
+    /// <summary>
+    /// Get the fault points of a module, to be rewritten by ReJIT.
+    /// </summary>
+    static void GetMethods(ModuleID moduleId, CAtlArray<mdMethodDef> &rvMethodDefTokens);
+
+    /// <summary>
+    /// Forget the fault points of a module being unloaded. Its module id may be reused by the runtime.
+    /// </summary>
+    static void RemoveModule(ModuleID moduleId);
+
+private:
+    typedef CAtlArray<DWORD> FAULT_POINT_SET;  // bit n of dword n / 32 is set for method-def row n
+
+    static CComAutoCriticalSection m_csModules;  // JIT compilation happens on many threads
+    static CAtlMap<ModuleID, FAULT_POINT_SET*> m_mapModules;  // only the modules with fault points
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
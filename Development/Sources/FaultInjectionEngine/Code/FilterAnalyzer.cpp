@@ -0,0 +1,342 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include <atlfile.h>
+#include "FilterAnalyzer.h"
+#include "MetadataModule.h"
+#include "MetadataSnapshot.h"
+#include "MethodFilter.h"
+#include "OfflineProfilerInfo.h"
+#include "OfflineRewriter.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Implementation of CFilterAnalyzer
+
+BOOL CFilterAnalyzer::Analyze(const CAtlArray<CString> &rvszAssemblyPaths, const CAtlArray<CString> &rvszMethodNames,
+                              const CAtlArray<ULONGLONG> &rvnSignatureHashes,
+                              const CAtlArray<CString> &rvszProtectedNames, LPCTSTR pstrReportFile,
+                              ULONG &rnResolvedCount, ULONG &rnUnresolvedCount)
+{
+    ASSERT(NULL != pstrReportFile);
+
+    CWriteTextFile xReportFile;
+    xReportFile.Open(pstrReportFile);
+    if(!xReportFile.IsOpened())
+    {
+        EventReportError(IDS_REPORT_FAILED_CREATE_REPORT, pstrReportFile);
+        return FALSE;
+    }
+
+    // The lines are looked up as by the engine. A method can only match a line which ends with
+    // its name, so only the methods whose last part of the name is in the filter are named.
+    CMethodFilter xMethodFilter;
+    CAtlMap<CString, BOOL, CStringElementTraits<CString> > mapNonQualifiedNames;
+    for(size_t i = 0; i < rvszMethodNames.GetCount(); i++)
+    {
+        xMethodFilter.Add(rvszMethodNames[i], rvnSignatureHashes[i]);
+        mapNonQualifiedNames.SetAt(GetNonQualifiedName(rvszMethodNames[i]), TRUE);
+    }
+
+    CAutoVectorPtr<MODULE_RESULT> pResults;
+    if((0 < rvszAssemblyPaths.GetCount()) && !pResults.Allocate(rvszAssemblyPaths.GetCount()))
+    {
+        EventReportError(IDS_REPORT_FAILED_ALLOC, E_OUTOFMEMORY, rvszAssemblyPaths.GetCount() * sizeof(MODULE_RESULT));
+        return FALSE;
+    }
+    ANALYZE_JOB xJob = {&rvszAssemblyPaths, &xMethodFilter, &mapNonQualifiedNames, pResults, 0};
+
+    // Same threading as the offline rewriter: assemblies are independent, so the threads only
+    // share the index of the next one.
+    SYSTEM_INFO xSystemInfo;
+    ::GetSystemInfo(&xSystemInfo);
+    size_t nThreadCount = min(min((size_t)xSystemInfo.dwNumberOfProcessors, (size_t)MAXIMUM_WAIT_OBJECTS),
+        rvszAssemblyPaths.GetCount());
+    CAtlArray<HANDLE> vhThreads;
+    for(size_t i = 0; i < nThreadCount; i++)
+    {
+        HANDLE hThread = ::CreateThread(NULL, 0, AnalyzeThreadProc, &xJob, 0, NULL);
+        if(NULL == hThread)
+        {
+            EventReportError(IDS_REPORT_FAILED_START_REWRITE_THREAD, HRESULT_FROM_WIN32(::GetLastError()));
+            break;
+        }
+        vhThreads.Add(hThread);
+    }
+
+    if(0 == vhThreads.GetCount())
+    {
+        AnalyzeThreadProc(&xJob);
+    }
+    else
+    {
+        ::WaitForMultipleObjects((DWORD)vhThreads.GetCount(), vhThreads.GetData(), TRUE, INFINITE);
+        for(size_t i = 0; i < vhThreads.GetCount(); i++)
+        {
+            ::CloseHandle(vhThreads[i]);
+        }
+    }
+
+    // Count the methods trapped for each line, across all assemblies.
+    CAtlArray<ULONG> vnOverloadCounts;
+    vnOverloadCounts.SetCount(rvszMethodNames.GetCount());
+    for(size_t i = 0; i < rvszMethodNames.GetCount(); i++)
+    {
+        vnOverloadCounts[i] = 0;
+    }
+    for(size_t i = 0; i < rvszAssemblyPaths.GetCount(); i++)
+    {
+        for(size_t j = 0; j < pResults[i].vMatchedNameIndexes.GetCount(); j++)
+        {
+            vnOverloadCounts[pResults[i].vMatchedNameIndexes[j]]++;
+        }
+    }
+    rnResolvedCount = 0;
+    for(size_t i = 0; i < rvszMethodNames.GetCount(); i++)
+    {
+        if(0 < vnOverloadCounts[i])
+        {
+            rnResolvedCount++;
+        }
+    }
+    rnUnresolvedCount = (ULONG)rvszMethodNames.GetCount() - rnResolvedCount;
+
+    // Tab-separated, one record per line, so that the report is easy to filter and compare. A name
+    // with several parameter lists has a line per list, told apart by its hash, 0 for all overloads.
+    CString szLine;
+    szLine.Format(_T("Filter\t%u lines\t%u resolved\t%u unresolved\t%u protected\n"),
+        (ULONG)(rvszMethodNames.GetCount() + rvszProtectedNames.GetCount()), rnResolvedCount, rnUnresolvedCount,
+        (ULONG)rvszProtectedNames.GetCount());
+    BOOL bWritten = xReportFile.WriteText(szLine);
+    for(size_t i = 0; i < rvszAssemblyPaths.GetCount(); i++)
+    {
+        const MODULE_RESULT &rResult = pResults[i];
+        if(FAILED(rResult.hr))
+        {
+            szLine.Format(_T("Skipped\t%s\t0x%08X\n"), (LPCTSTR)rvszAssemblyPaths[i], rResult.hr);
+        }
+        else
+        {
+            szLine.Format(_T("Module\t%s\t%u methods\t%u candidates\t%I64u comparisons\t%u trapped\n"),
+                (LPCTSTR)rvszAssemblyPaths[i], rResult.nMethodCount, rResult.nCandidateCount,
+                rResult.nComparisonCount, (ULONG)rResult.vMatchedNameIndexes.GetCount());
+        }
+        bWritten = bWritten && xReportFile.WriteText(szLine);
+    }
+    for(size_t i = 0; i < rvszMethodNames.GetCount(); i++)
+    {
+        if(0 < vnOverloadCounts[i])
+        {
+            szLine.Format(_T("Resolved\t%s\t%016I64X\t%u overloads\n"), (LPCTSTR)rvszMethodNames[i],
+                rvnSignatureHashes[i], vnOverloadCounts[i]);
+            bWritten = bWritten && xReportFile.WriteText(szLine);
+        }
+    }
+    for(size_t i = 0; i < rvszMethodNames.GetCount(); i++)
+    {
+        if(0 == vnOverloadCounts[i])
+        {
+            szLine.Format(_T("Unresolved\t%s\t%016I64X\n"), (LPCTSTR)rvszMethodNames[i], rvnSignatureHashes[i]);
+            bWritten = bWritten && xReportFile.WriteText(szLine);
+        }
+    }
+    for(size_t i = 0; i < rvszProtectedNames.GetCount(); i++)
+    {
+        szLine.Format(_T("Protected\t%s\n"), (LPCTSTR)rvszProtectedNames[i]);
+        bWritten = bWritten && xReportFile.WriteText(szLine);
+    }
+    if(!bWritten)
+    {
+        EventReportError(IDS_REPORT_FAILED_CREATE_REPORT, pstrReportFile);
+        return FALSE;
+    }
+
+    EventReportInfo(IDS_REPORT_FILTER_ANALYZED, rnResolvedCount, rnUnresolvedCount, pstrReportFile);
+    return TRUE;
+}
+
+DWORD WINAPI CFilterAnalyzer::AnalyzeThreadProc(LPVOID pvJob)
+{
+    ANALYZE_JOB *pJob = static_cast<ANALYZE_JOB*>(pvJob);
+    const CAtlArray<CString> &rvszAssemblyPaths = *pJob->pvszAssemblyPaths;
+    LONG nIndex;
+    while((nIndex = ::InterlockedIncrement(&pJob->nNextAssembly) - 1) < (LONG)rvszAssemblyPaths.GetCount())
+    {
+        // Module ids only tell the assemblies apart, so the index will do.
+        AnalyzeAssembly(rvszAssemblyPaths[nIndex], (ModuleID)(nIndex + 1), *pJob->pxMethodFilter,
+            *pJob->pmapNonQualifiedNames, pJob->pResults[nIndex]);
+    }
+    return 0;
+}
+
+void CFilterAnalyzer::AnalyzeAssembly(LPCTSTR pstrAssemblyPath, ModuleID moduleId,
+                                      const CMethodFilter &rxMethodFilter,
+                                      const CAtlMap<CString, BOOL, CStringElementTraits<CString> > &rmapNonQualifiedNames,
+                                      MODULE_RESULT &rResult)
+{
+    rResult.nMethodCount = 0;
+    rResult.nCandidateCount = 0;
+    rResult.nComparisonCount = 0;
+    rResult.vMatchedNameIndexes.RemoveAll();
+
+    // The metadata is only read, so a snapshot of the mapped file is enough.
+    CMetadataSnapshot xSnapshot;
+    rResult.hr = xSnapshot.Open(pstrAssemblyPath);
+    if(FAILED(rResult.hr))
+    {
+        return;
+    }
+    COfflineProfilerInfo xProfilerInfo(static_cast<IMetaDataImport2*>(&xSnapshot), xSnapshot.GetImage(),
+        xSnapshot.GetImageSize(), xSnapshot.GetSections(), xSnapshot.GetSectionCount());
+    IMetaDataImport *pMetaDataImport = static_cast<IMetaDataImport2*>(&xSnapshot);
+    try
+    {
+        CMetadataModule xModule(CComQIPtr<ICorProfilerInfo>(static_cast<ICorProfilerInfo*>(&xProfilerInfo)), moduleId);
+
+        HCORENUM hTypeDefEnum = NULL;
+        mdTypeDef vTypeDefs[64];
+        ULONG nTypeDefCount = 0;
+        while(SUCCEEDED(pMetaDataImport->EnumTypeDefs(&hTypeDefEnum, vTypeDefs, _countof(vTypeDefs), &nTypeDefCount))
+            && (0 < nTypeDefCount))
+        {
+            for(ULONG i = 0; i < nTypeDefCount; i++)
+            {
+                HCORENUM hMethodEnum = NULL;
+                mdMethodDef vMethodDefs[64];
+                ULONG nMethodDefCount = 0;
+                while(SUCCEEDED(pMetaDataImport->EnumMethodsWithName(&hMethodEnum, vTypeDefs[i], NULL, vMethodDefs,
+                    _countof(vMethodDefs), &nMethodDefCount)) && (0 < nMethodDefCount))
+                {
+                    for(ULONG j = 0; j < nMethodDefCount; j++)
+                    {
+                        rResult.nMethodCount++;
+
+                        // Methods without IL are never JIT compiled, so the engine never sees them.
+                        WCHAR vMethodName[PREFERRED_NONQUALIFIED_METHOD_NAME_LENGTH];
+                        ULONG nMethodNameLength = 0;
+                        ULONG nMethodCodeRVA = 0;
+                        HRESULT hr = pMetaDataImport->GetMethodProps(vMethodDefs[j], NULL, vMethodName,
+                            _countof(vMethodName), &nMethodNameLength, NULL, NULL, NULL, &nMethodCodeRVA, NULL);
+                        if(FAILED(hr) || (0 == nMethodCodeRVA))
+                        {
+                            continue;
+                        }
+                        rResult.nCandidateCount++;
+
+                        // Longer names are truncated, and always named in full. The engine finds no
+                        // line for the name of the others, so it compares none of their hashes.
+                        if((nMethodNameLength <= _countof(vMethodName))
+                            && (NULL == rmapNonQualifiedNames.Lookup(GetNonQualifiedName(CString(vMethodName)))))
+                        {
+                            continue;
+                        }
+
+                        // Name the method and look it up like the engine at JIT compilation.
+                        CMetadataMethod xMethodInfo(vMethodDefs[j]);
+                        xModule.LoadMethodProperties(xMethodInfo);
+                        ULONG nComparisonCount = 0;
+                        int nIndex = rxMethodFilter.Find(xMethodInfo.GetFullQualifiedMethodName(),
+                            xMethodInfo.GetSignatureHash(), &nComparisonCount);
+                        rResult.nComparisonCount += nComparisonCount;
+                        if(0 <= nIndex)
+                        {
+                            rResult.vMatchedNameIndexes.Add((size_t)nIndex);
+                        }
+                    }
+                }
+                pMetaDataImport->CloseEnum(hMethodEnum);
+            }
+        }
+        pMetaDataImport->CloseEnum(hTypeDefEnum);
+    }
+    catch(CExceptionAsBreak* /*&sharedExceptionAsBreak*/)
+    {
+        rResult.hr = E_FAIL;     // error is reported by callee
+    }
+}
+
+CString CFilterAnalyzer::GetNonQualifiedName(const CString &rszMethodName)
+{
+    // The text after the last separator, e.g. "ctor" for both ".ctor" and "Type..ctor", so that
+    // it is the same for the name of a method and for its full-qualified name.
+    LPCTSTR pstrSeparator = CSettings::GetQualifiedNameSeparatorBeforeMethod();
+    int nSeparatorLength = (int)_tcslen(pstrSeparator);
+    int nOffset = 0;
+    for(int nFound = rszMethodName.Find(pstrSeparator); 0 <= nFound; nFound = rszMethodName.Find(pstrSeparator, nFound + 1))
+    {
+        nOffset = nFound + nSeparatorLength;
+    }
+    return rszMethodName.Mid(nOffset);
+}
+
+#pragma endregion
+
+#pragma region Exported Functions (Called by Tests)
+
+extern "C" BOOL WINAPI FaultEngineAnalyzeFilter(LPCWSTR *ppstrAssemblyPaths, ULONG nAssemblyCount,
+                                                LPCWSTR pstrMethodFilterFile, LPCWSTR pstrReportFile,
+                                                ULONG *pnResolvedCount, ULONG *pnUnresolvedCount)
+{
+    if(((NULL == ppstrAssemblyPaths) && (0 < nAssemblyCount)) || (NULL == pstrMethodFilterFile)
+        || (NULL == pstrReportFile) || (NULL == pnResolvedCount) || (NULL == pnUnresolvedCount))
+    {
+        return FALSE;
+    }
+    CEventLog::Initialize();
+
+    CAtlArray<CString> vszMethodNames;
+    CAtlArray<ULONGLONG> vnSignatureHashes;
+    CAtlArray<CString> vszProtectedNames;
+    if(!COfflineRewriter::LoadMethodFilter(CW2CT(pstrMethodFilterFile), vszMethodNames, vnSignatureHashes,
+        &vszProtectedNames))
+    {
+        return FALSE;
+    }
+    CAtlArray<CString> vszAssemblyPaths;
+    for(ULONG i = 0; i < nAssemblyCount; i++)
+    {
+        vszAssemblyPaths.Add(CString(ppstrAssemblyPaths[i]));
+    }
+    return CFilterAnalyzer::Analyze(vszAssemblyPaths, vszMethodNames, vnSignatureHashes, vszProtectedNames,
+        CW2CT(pstrReportFile), *pnResolvedCount, *pnUnresolvedCount);
+}
+
+// Command line: rundll32 FaultInjectionEngine.dll,FaultEngineAnalyzeW <report file> <method filter>
+// <assembly or folder>... The summary is reported in the event log of the engine.
+extern "C" void CALLBACK FaultEngineAnalyzeW(HWND /*hWnd*/, HINSTANCE /*hInstance*/, LPWSTR pstrCmdLine,
+                                             int /*nCmdShow*/)
+{
+    int nArgumentCount = 0;
+    LPWSTR *ppstrArguments = ::CommandLineToArgvW(pstrCmdLine, &nArgumentCount);
+    if(NULL == ppstrArguments)
+    {
+        return;
+    }
+    if(3 <= nArgumentCount)
+    {
+        CEventLog::Initialize();
+
+        CAtlArray<CString> vszMethodNames;
+        CAtlArray<ULONGLONG> vnSignatureHashes;
+        CAtlArray<CString> vszProtectedNames;
+        if(COfflineRewriter::LoadMethodFilter(CW2CT(ppstrArguments[1]), vszMethodNames, vnSignatureHashes,
+            &vszProtectedNames))
+        {
+            CAtlArray<CString> vszAssemblyPaths;
+            for(int i = 2; i < nArgumentCount; i++)
+            {
+                COfflineRewriter::AddAssemblyPaths(ppstrArguments[i], vszAssemblyPaths);
+            }
+            ULONG nResolvedCount = 0;
+            ULONG nUnresolvedCount = 0;
+            CFilterAnalyzer::Analyze(vszAssemblyPaths, vszMethodNames, vnSignatureHashes, vszProtectedNames,
+                CW2CT(ppstrArguments[0]), nResolvedCount, nUnresolvedCount);
+        }
+    }
+    ::LocalFree(ppstrArguments);
+}
+
+#pragma endregion
@@ -0,0 +1,63 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  Declaration of class CFilterAnalyzer.
+//  Resolves the method filter against assemblies on disk, without running them, and reports
+//  which methods the engine would trap. Each assembly is mapped into memory as a metadata
+//  snapshot, and every method with a body is named by CMetadataModule and looked up in a
+//  CMethodFilter by name and parameter types, as at JIT compilation. The report lists the
+//  resolved lines with the hashes of their parameter lists and their overload counts, the
+//  unresolved lines, and per module the number of candidate methods and of signature hashes the
+//  engine would compare. Assemblies are analyzed in parallel.
+//
+
+#pragma once
+
+#include "MethodFilter.h"
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Declaration of CFilterAnalyzer
+
+class CFilterAnalyzer
+{
+public:
+    /// <summary>
+    /// Resolve the method filter against the assemblies and write the report as a text file.
+    /// Return the number of filter lines which resolve to methods, and of those which do not.
+    /// </summary>
+    static BOOL Analyze(const CAtlArray<CString> &rvszAssemblyPaths, const CAtlArray<CString> &rvszMethodNames,
+        const CAtlArray<ULONGLONG> &rvnSignatureHashes, const CAtlArray<CString> &rvszProtectedNames,
+        LPCTSTR pstrReportFile, ULONG &rnResolvedCount, ULONG &rnUnresolvedCount);
+
+private:
+    struct MODULE_RESULT
+    {
+        HRESULT hr;                             // fails if the file is not an assembly
+        ULONG nMethodCount;
+        ULONG nCandidateCount;                  // methods with a body, i.e. JIT compiled
+        ULONGLONG nComparisonCount;             // lines whose hashes the engine compares for the candidates
+        CAtlArray<size_t> vMatchedNameIndexes;  // one per trapped method
+    };
+
+    struct ANALYZE_JOB
+    {
+        const CAtlArray<CString> *pvszAssemblyPaths;
+        const CMethodFilter *pxMethodFilter;
+        const CAtlMap<CString, BOOL, CStringElementTraits<CString> > *pmapNonQualifiedNames;
+        MODULE_RESULT *pResults;
+        volatile LONG nNextAssembly;
+    };
+
+    static DWORD WINAPI AnalyzeThreadProc(LPVOID pvJob);
+    static void AnalyzeAssembly(LPCTSTR pstrAssemblyPath, ModuleID moduleId, const CMethodFilter &rxMethodFilter,
+        const CAtlMap<CString, BOOL, CStringElementTraits<CString> > &rmapNonQualifiedNames, MODULE_RESULT &rResult);
+    static CString GetNonQualifiedName(const CString &rszMethodName);
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
@@ -0,0 +1,455 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include "ILInstructionList.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Implementation of CILInstructionList
+
+// Resolve an offset of the decoded code to the instruction there, NULL for the end of the code.
+static BOOL ResolveOffset(const CAtlArray<POSITION> &rvPositions, LONGLONG nOffset, POSITION &rpos)
+{
+    if(nOffset == (LONGLONG)(rvPositions.GetCount()))
+    {
+        rpos = NULL;
+        return TRUE;
+    }
+    if((nOffset < 0) || (nOffset > (LONGLONG)(rvPositions.GetCount())))
+    {
+        return FALSE;
+    }
+    rpos = rvPositions[(size_t)nOffset];
+    return (NULL != rpos);  // not in the middle of an instruction
+}
+
+BOOL CILInstructionList::Decode(const CMemoryRef &rxCode, const CILMethodSect &rxSect)
+{
+    LPCBYTE pCode = (LPCBYTE)(rxCode.GetBaseAddress());
+    ULONG nCodeSize = (ULONG)(rxCode.GetSize());
+    this->m_lstInstructions.RemoveAll();
+    this->m_vSwitchTargets.RemoveAll();
+    this->m_vClauses.RemoveAll();
+
+    // Pass 1: decode the instructions, keeping the offsets of branch targets aside
+    CAtlArray<POSITION> vPositions;
+    CAtlArray<LONGLONG> vSwitchOffsets;
+    if(!vPositions.SetCount(nCodeSize))
+    {
+        return FALSE;
+    }
+    for(ULONG i = 0; i < nCodeSize; i++)
+    {
+        vPositions[i] = NULL;
+    }
+
+    ULONG nOffset = 0;
+    while(nOffset < nCodeSize)
+    {
+        ULONG nOpcodeSize, nOperandSize;
+        INSTRUCTION xInstruction = { IL_OP_INVALID, 0, NULL, 0, 0, nOffset };
+        xInstruction.nOpcode = CILOpcodes::Decode(pCode, nCodeSize, nOffset, nOpcodeSize);
+        if((IL_OP_INVALID == xInstruction.nOpcode) ||
+            !CILOpcodes::GetOperandSize(xInstruction.nOpcode, pCode, nCodeSize, nOffset + nOpcodeSize, nOperandSize))
+        {
+            return FALSE;
+        }
+        LPCBYTE pOperand = pCode + nOffset + nOpcodeSize;
+        ULONG nNext = nOffset + nOpcodeSize + nOperandSize;
+
+        switch(CILOpcodes::GetInfo(xInstruction.nOpcode).nOperand)
+        {
+        case IL_OPERAND_SHORT_BR:
+            xInstruction.nOperand = (ULONGLONG)((LONGLONG)nNext + *(const signed char*)pOperand);
+            break;
+        case IL_OPERAND_BR:
+            xInstruction.nOperand = (ULONGLONG)((LONGLONG)nNext + *(UNALIGNED const LONG*)pOperand);
+            break;
+        case IL_OPERAND_SWITCH:
+            xInstruction.nFirstSwitchTarget = (ULONG)(vSwitchOffsets.GetCount());
+            xInstruction.nSwitchTargetCount = *(UNALIGNED const DWORD*)pOperand;
+            for(ULONG i = 1; i <= xInstruction.nSwitchTargetCount; i++)
+            {
+                vSwitchOffsets.Add((LONGLONG)nNext + ((UNALIGNED const LONG*)pOperand)[i]);
+            }
+            break;
+        default:
+            ::memcpy(&(xInstruction.nOperand), pOperand, nOperandSize);
+            break;
+        }
+
+        vPositions[nOffset] = this->m_lstInstructions.AddTail(xInstruction);
+        nOffset = nNext;
+    }
+
+    // Pass 2: refer to the target instructions instead of their offsets
+    for(POSITION pos = this->m_lstInstructions.GetHeadPosition(); NULL != pos; )
+    {
+        INSTRUCTION &rInstruction = this->m_lstInstructions.GetNext(pos);
+        BYTE nOperand = CILOpcodes::GetInfo(rInstruction.nOpcode).nOperand;
+        if((IL_OPERAND_SHORT_BR == nOperand) || (IL_OPERAND_BR == nOperand))
+        {
+            if(!ResolveOffset(vPositions, (LONGLONG)(rInstruction.nOperand), rInstruction.posTarget))
+            {
+                return FALSE;
+            }
+            rInstruction.nOperand = 0;
+        }
+    }
+    if(!this->m_vSwitchTargets.SetCount(vSwitchOffsets.GetCount()))
+    {
+        return FALSE;
+    }
+    for(size_t i = 0; i < vSwitchOffsets.GetCount(); i++)
+    {
+        if(!ResolveOffset(vPositions, vSwitchOffsets[i], this->m_vSwitchTargets[i]))
+        {
+            return FALSE;
+        }
+    }
+
+    for(CILMethodSect xSect = rxSect; !xSect.IsNull(); xSect = xSect.GetNextSection())
+    {
+        if(!xSect.IsExceptionHandler())
+        {
+            continue;
+        }
+        int nClauseCount = xSect.GetExceptionHandlerClauseCount();
+        for(int i = 0; i < nClauseCount; i++)
+        {
+            ULONG nFlags, nTryOffset, nTryLength, nHandlerOffset, nHandlerLength, nClassTokenOrFilterOffset;
+            if(xSect.IsFat())
+            {
+                IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT &rClause = xSect.GetFatExceptionHandlerClause(i);
+                nFlags = rClause.Flags;
+                nTryOffset = rClause.TryOffset;
+                nTryLength = rClause.TryLength;
+                nHandlerOffset = rClause.HandlerOffset;
+                nHandlerLength = rClause.HandlerLength;
+                nClassTokenOrFilterOffset = rClause.ClassToken;
+            }
+            else
+            {
+                IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_SMALL &rClause = xSect.GetSmallExceptionHandlerClause(i);
+                nFlags = rClause.Flags;
+                nTryOffset = rClause.TryOffset;
+                nTryLength = rClause.TryLength;
+                nHandlerOffset = rClause.HandlerOffset;
+                nHandlerLength = rClause.HandlerLength;
+                nClassTokenOrFilterOffset = rClause.ClassToken;
+            }
+
+            EXCEPTION_CLAUSE xClause = { nFlags, NULL, NULL, NULL, NULL, NULL, mdTokenNil };
+            if(!ResolveOffset(vPositions, nTryOffset, xClause.posTryBegin) ||
+                !ResolveOffset(vPositions, (LONGLONG)nTryOffset + nTryLength, xClause.posTryEnd) ||
+                !ResolveOffset(vPositions, nHandlerOffset, xClause.posHandlerBegin) ||
+                !ResolveOffset(vPositions, (LONGLONG)nHandlerOffset + nHandlerLength, xClause.posHandlerEnd))
+            {
+                return FALSE;
+            }
+            if(nFlags & COR_ILEXCEPTION_CLAUSE_FILTER)
+            {
+                if(!ResolveOffset(vPositions, nClassTokenOrFilterOffset, xClause.posFilterBegin))
+                {
+                    return FALSE;
+                }
+            }
+            else
+            {
+                xClause.tkClass = nClassTokenOrFilterOffset;
+            }
+            this->m_vClauses.Add(xClause);
+        }
+    }
+    return TRUE;
+}
+
+POSITION CILInstructionList::InsertBefore(POSITION pos, IL_OPCODE_ID nOpcode, ULONGLONG nOperand)
+{
+    BYTE nOperandKind = CILOpcodes::GetInfo(nOpcode).nOperand;
+    ASSERT((IL_OPERAND_SHORT_BR != nOperandKind) && (IL_OPERAND_BR != nOperandKind) && (IL_OPERAND_SWITCH != nOperandKind));
+
+    INSTRUCTION xInstruction = { nOpcode, nOperand, NULL, 0, 0, 0 };
+    return (NULL == pos)
+        ? this->m_lstInstructions.AddTail(xInstruction) : this->m_lstInstructions.InsertBefore(pos, xInstruction);
+}
+
+POSITION CILInstructionList::InsertBranchBefore(POSITION pos, IL_OPCODE_ID nOpcode, POSITION posTarget)
+{
+    ASSERT(IL_OP_INVALID != GetBranchForm(nOpcode, FALSE));
+
+    INSTRUCTION xInstruction = { nOpcode, 0, posTarget, 0, 0, 0 };
+    return (NULL == pos)
+        ? this->m_lstInstructions.AddTail(xInstruction) : this->m_lstInstructions.InsertBefore(pos, xInstruction);
+}
+
+void CILInstructionList::RetargetBranches(POSITION posFrom, POSITION posTo)
+{
+    for(POSITION pos = this->m_lstInstructions.GetHeadPosition(); NULL != pos; )
+    {
+        INSTRUCTION &rInstruction = this->m_lstInstructions.GetNext(pos);
+        if(rInstruction.posTarget == posFrom)
+        {
+            BYTE nOperand = CILOpcodes::GetInfo(rInstruction.nOpcode).nOperand;
+            if((IL_OPERAND_SHORT_BR == nOperand) || (IL_OPERAND_BR == nOperand))
+            {
+                rInstruction.posTarget = posTo;
+            }
+        }
+    }
+    for(size_t i = 0; i < this->m_vSwitchTargets.GetCount(); i++)
+    {
+        if(this->m_vSwitchTargets[i] == posFrom)
+        {
+            this->m_vSwitchTargets[i] = posTo;
+        }
+    }
+    for(size_t i = 0; i < this->m_vClauses.GetCount(); i++)
+    {
+        POSITION* vClausePositions[] = {
+            &(this->m_vClauses[i].posTryBegin), &(this->m_vClauses[i].posTryEnd),
+            &(this->m_vClauses[i].posHandlerBegin), &(this->m_vClauses[i].posHandlerEnd),
+            &(this->m_vClauses[i].posFilterBegin) };
+        for(int j = 0; j < _countof(vClausePositions); j++)
+        {
+            if(*(vClausePositions[j]) == posFrom)
+            {
+                *(vClausePositions[j]) = posTo;
+            }
+        }
+    }
+}
+
+void CILInstructionList::RemoveAt(POSITION pos)
+{
+    ASSERT(NULL != pos);
+    this->RetargetBranches(pos, this->GetNext(pos));
+    this->m_lstInstructions.RemoveAt(pos);
+}
+
+ULONG CILInstructionList::Layout(void)
+{
+    // Start with the short form of every branch, then lengthen those whose target is out of
+    // reach. Code only grows at each round, so a short branch in reach stays in reach.
+    for(POSITION pos = this->m_lstInstructions.GetHeadPosition(); NULL != pos; )
+    {
+        INSTRUCTION &rInstruction = this->m_lstInstructions.GetNext(pos);
+        IL_OPCODE_ID nShortForm = GetBranchForm(rInstruction.nOpcode, TRUE);
+        if(IL_OP_INVALID != nShortForm)
+        {
+            rInstruction.nOpcode = nShortForm;
+        }
+    }
+
+    BOOL bLengthened;
+    do
+    {
+        ULONG nOffset = 0;
+        for(POSITION pos = this->m_lstInstructions.GetHeadPosition(); NULL != pos; )
+        {
+            INSTRUCTION &rInstruction = this->m_lstInstructions.GetNext(pos);
+            rInstruction.nOffset = nOffset;
+            nOffset += this->GetInstructionSize(rInstruction);
+        }
+        this->m_nCodeSize = nOffset;
+
+        bLengthened = FALSE;
+        for(POSITION pos = this->m_lstInstructions.GetHeadPosition(); NULL != pos; )
+        {
+            INSTRUCTION &rInstruction = this->m_lstInstructions.GetNext(pos);
+            if(IL_OPERAND_SHORT_BR == CILOpcodes::GetInfo(rInstruction.nOpcode).nOperand)
+            {
+                LONG nDisplacement = (LONG)(this->GetTargetOffset(rInstruction.posTarget))
+                    - (LONG)(rInstruction.nOffset + this->GetInstructionSize(rInstruction));
+                if((nDisplacement < -128) || (nDisplacement > 127))
+                {
+                    rInstruction.nOpcode = GetBranchForm(rInstruction.nOpcode, FALSE);
+                    bLengthened = TRUE;
+                }
+            }
+        }
+    }
+    while(bLengthened);
+
+    return this->m_nCodeSize;
+}
+
+void CILInstructionList::Encode(LPBYTE pTarget) const
+{
+    for(POSITION pos = this->m_lstInstructions.GetHeadPosition(); NULL != pos; )
+    {
+        const INSTRUCTION &rInstruction = this->m_lstInstructions.GetNext(pos);
+        const IL_OPCODE_INFO &rInfo = CILOpcodes::GetInfo(rInstruction.nOpcode);
+        ULONG nSize = this->GetInstructionSize(rInstruction);
+        LONG nNext = (LONG)(rInstruction.nOffset + nSize);
+        LPBYTE pInstruction = pTarget + rInstruction.nOffset;
+
+        if(0xFF < rInfo.nCode)
+        {
+            *(pInstruction++) = IL_CODE_PREFIX;
+        }
+        *(pInstruction++) = (BYTE)(rInfo.nCode);
+
+        switch(rInfo.nOperand)
+        {
+        case IL_OPERAND_SHORT_BR:
+            *pInstruction = (BYTE)(signed char)((LONG)(this->GetTargetOffset(rInstruction.posTarget)) - nNext);
+            break;
+        case IL_OPERAND_BR:
+            *(UNALIGNED LONG*)pInstruction = (LONG)(this->GetTargetOffset(rInstruction.posTarget)) - nNext;
+            break;
+        case IL_OPERAND_SWITCH:
+            *(UNALIGNED DWORD*)pInstruction = rInstruction.nSwitchTargetCount;
+            for(ULONG i = 0; i < rInstruction.nSwitchTargetCount; i++)
+            {
+                ((UNALIGNED LONG*)pInstruction)[i + 1] =
+                    (LONG)(this->GetTargetOffset(this->m_vSwitchTargets[rInstruction.nFirstSwitchTarget + i])) - nNext;
+            }
+            break;
+        default:
+            ::memcpy(pInstruction, &(rInstruction.nOperand), pTarget + nNext - pInstruction);
+            break;
+        }
+    }
+}
+
+void CILInstructionList::EncodeExceptionClauses(IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT *pClauses) const
+{
+    for(size_t i = 0; i < this->m_vClauses.GetCount(); i++)
+    {
+        const EXCEPTION_CLAUSE &rClause = this->m_vClauses[i];
+        pClauses[i].Flags = (CorExceptionFlag)(rClause.nFlags);
+        pClauses[i].TryOffset = this->GetTargetOffset(rClause.posTryBegin);
+        pClauses[i].TryLength = this->GetTargetOffset(rClause.posTryEnd) - pClauses[i].TryOffset;
+        pClauses[i].HandlerOffset = this->GetTargetOffset(rClause.posHandlerBegin);
+        pClauses[i].HandlerLength = this->GetTargetOffset(rClause.posHandlerEnd) - pClauses[i].HandlerOffset;
+        if(rClause.nFlags & COR_ILEXCEPTION_CLAUSE_FILTER)
+            pClauses[i].FilterOffset = this->GetTargetOffset(rClause.posFilterBegin);
+        else
+            pClauses[i].ClassToken = rClause.tkClass;
+    }
+}
+
+IL_OPCODE_ID CILInstructionList::GetBranchForm(IL_OPCODE_ID nOpcode, BOOL bShort)
+{
+    static const IL_OPCODE_ID s_vBranchForms[][2] =
+    {
+        { IL_OP_BR_S,       IL_OP_BR },
+        { IL_OP_BRFALSE_S,  IL_OP_BRFALSE },
+        { IL_OP_BRTRUE_S,   IL_OP_BRTRUE },
+        { IL_OP_BEQ_S,      IL_OP_BEQ },
+        { IL_OP_BGE_S,      IL_OP_BGE },
+        { IL_OP_BGT_S,      IL_OP_BGT },
+        { IL_OP_BLE_S,      IL_OP_BLE },
+        { IL_OP_BLT_S,      IL_OP_BLT },
+        { IL_OP_BNE_UN_S,   IL_OP_BNE_UN },
+        { IL_OP_BGE_UN_S,   IL_OP_BGE_UN },
+        { IL_OP_BGT_UN_S,   IL_OP_BGT_UN },
+        { IL_OP_BLE_UN_S,   IL_OP_BLE_UN },
+        { IL_OP_BLT_UN_S,   IL_OP_BLT_UN },
+        { IL_OP_LEAVE_S,    IL_OP_LEAVE },
+    };
+    for(int i = 0; i < _countof(s_vBranchForms); i++)
+    {
+        if((s_vBranchForms[i][0] == nOpcode) || (s_vBranchForms[i][1] == nOpcode))
+        {
+            return s_vBranchForms[i][bShort ? 0 : 1];
+        }
+    }
+    return IL_OP_INVALID;  // not a branch
+}
+
+ULONG CILInstructionList::GetInstructionSize(const INSTRUCTION &rInstruction) const
+{
+    const IL_OPCODE_INFO &rInfo = CILOpcodes::GetInfo(rInstruction.nOpcode);
+    ULONG nSize = (0xFF < rInfo.nCode) ? 2 : 1;
+    switch(rInfo.nOperand)
+    {
+    case IL_OPERAND_NONE:
+        break;
+    case IL_OPERAND_SHORT_VAR:
+    case IL_OPERAND_SHORT_I:
+    case IL_OPERAND_SHORT_BR:
+        nSize += 1;
+        break;
+    case IL_OPERAND_VAR:
+        nSize += 2;
+        break;
+    case IL_OPERAND_I8:
+    case IL_OPERAND_R:
+        nSize += 8;
+        break;
+    case IL_OPERAND_SWITCH:
+        nSize += sizeof(DWORD) * (rInstruction.nSwitchTargetCount + 1);
+        break;
+    default:
+        nSize += 4;
+        break;
+    }
+    return nSize;
+}
+
+ULONG CILInstructionList::GetTargetOffset(POSITION pos) const
+{
+    return (NULL == pos) ? this->m_nCodeSize : this->m_lstInstructions.GetAt(pos).nOffset;
+}
+
+#pragma endregion
+
+#if defined(FAULT_ENGINE_TEST_EXPORTS)
+
+#pragma region Exported Functions (Called by Tests)
+
+extern "C" BOOL WINAPI FaultEngineBenchmarkILCodec(const BYTE *pCode, ULONG nCodeSize, ULONG nIterations,
+                                                  LONGLONG *pnTicks, ULONG *pnEncodedSize)
+{
+    if((NULL == pCode) || (NULL == pnTicks) || (NULL == pnEncodedSize) || (0 == nIterations))
+    {
+        return FALSE;
+    }
+
+    // Decode and encode the code again and again, without exception clauses
+    CAtlArray<BYTE> vEncoded;
+    LARGE_INTEGER xStartTime, xEndTime;
+    ::QueryPerformanceCounter(&xStartTime);
+    for(ULONG i = 0; i < nIterations; i++)
+    {
+        CILInstructionList xInstructions;
+        if(!xInstructions.Decode(CMemoryRef(pCode, nCodeSize), CILMethodSect()))
+        {
+            return FALSE;
+        }
+        if(!vEncoded.SetCount(xInstructions.Layout()))
+        {
+            return FALSE;
+        }
+        xInstructions.Encode(vEncoded.GetData());
+    }
+    ::QueryPerformanceCounter(&xEndTime);
+
+    // The encoded code must decode and encode to itself
+    CILInstructionList xInstructions;
+    CAtlArray<BYTE> vReencoded;
+    if(!xInstructions.Decode(CMemoryRef(vEncoded.GetData(), vEncoded.GetCount()), CILMethodSect()) ||
+        !vReencoded.SetCount(xInstructions.Layout()))
+    {
+        return FALSE;
+    }
+    xInstructions.Encode(vReencoded.GetData());
+    if((vReencoded.GetCount() != vEncoded.GetCount()) ||
+        (0 != ::memcmp(vReencoded.GetData(), vEncoded.GetData(), vEncoded.GetCount())))
+    {
+        return FALSE;
+    }
+
+    *pnTicks = xEndTime.QuadPart - xStartTime.QuadPart;
+    *pnEncodedSize = (ULONG)(vEncoded.GetCount());
+    return TRUE;
+}
+
+#pragma endregion
+
+#endif // FAULT_ENGINE_TEST_EXPORTS
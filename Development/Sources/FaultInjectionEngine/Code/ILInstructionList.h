@@ -0,0 +1,117 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  Declaration of class CILInstructionList.
+//  Decodes IL code into a list of instructions, which may be edited and encoded again.
+//  Branches, switch tables and exception clauses refer to the position of their target
+//  instruction instead of an offset, so instructions can be inserted or removed anywhere;
+//  Layout picks the short form of each branch whenever its target is in reach, and computes
+//  the new offsets of the instructions and of the exception clauses.
+//
+
+#pragma once
+
+#include "MemoryRef.h"
+#include "ILMethodSect.h"
+#include "ILOpcodes.h"
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Declaration of CILInstructionList
+
+class CILInstructionList
+{
+public:
+    struct INSTRUCTION
+    {
+        IL_OPCODE_ID nOpcode;
+        ULONGLONG nOperand;         // the raw bits of the operand, except for branches and switch
+        POSITION posTarget;         // target of a branch; NULL for the end of the code
+        ULONG nFirstSwitchTarget;   // index of the first target of a switch
+        ULONG nSwitchTargetCount;
+        ULONG nOffset;              // offset in the decoded code, then in the laid out code
+    };
+
+    struct EXCEPTION_CLAUSE
+    {
+        ULONG nFlags;               // CorExceptionFlag
+        POSITION posTryBegin;
+        POSITION posTryEnd;         // first instruction after the block; NULL for the end of the code
+        POSITION posHandlerBegin;
+        POSITION posHandlerEnd;
+        POSITION posFilterBegin;    // filter clauses only
+        mdToken tkClass;            // typed handlers only
+    };
+
+public:
+    CILInstructionList(void) : m_nCodeSize(0) {};
+
+public:
+    /// <summary>
+    /// Decode the code and its exception clauses (a null section if there is none).
+    /// Return FALSE if the code is not valid IL.
+    /// </summary>
+    BOOL Decode(const CMemoryRef &rxCode, const CILMethodSect &rxSect);
+
+    POSITION GetHeadPosition(void) const { return this->m_lstInstructions.GetHeadPosition(); }
+    POSITION GetNext(POSITION pos) const { this->m_lstInstructions.GetNext(pos); return pos; }
+    INSTRUCTION& GetAt(POSITION pos) { return this->m_lstInstructions.GetAt(pos); }
+    size_t GetCount(void) const { return this->m_lstInstructions.GetCount(); }
+
+    /// <summary>
+    /// Insert an instruction without branch operand before the given one (at the end if NULL).
+    /// Branches to the given instruction still go there, see RetargetBranches.
+    /// </summary>
+    POSITION InsertBefore(POSITION pos, IL_OPCODE_ID nOpcode, ULONGLONG nOperand = 0);
+
+    /// <summary>
+    /// Insert a branch (short or long form, Layout picks the right one) before the given instruction.
+    /// </summary>
+    POSITION InsertBranchBefore(POSITION pos, IL_OPCODE_ID nOpcode, POSITION posTarget);
+
+    /// <summary>
+    /// Make the branches, switch targets and exception clauses which refer to an instruction
+    /// refer to another one, e.g. to the first of the instructions inserted before it.
+    /// </summary>
+    void RetargetBranches(POSITION posFrom, POSITION posTo);
+
+    /// <summary>
+    /// Remove an instruction. What refers to it refers to the next instruction instead.
+    /// </summary>
+    void RemoveAt(POSITION pos);
+
+    /// <summary>
+    /// Pick the form of every branch and compute the offsets. Return the size of the code.
+    /// </summary>
+    ULONG Layout(void);
+
+    /// <summary>
+    /// Write the code laid out by Layout into the target, which has room for its size.
+    /// </summary>
+    void Encode(LPBYTE pTarget) const;
+
+    ULONG GetExceptionClauseCount(void) const { return (ULONG)(this->m_vClauses.GetCount()); }
+
+    /// <summary>
+    /// Write the exception clauses with the offsets computed by Layout, in the fat format.
+    /// </summary>
+    void EncodeExceptionClauses(IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT *pClauses) const;
+
+protected:
+    static IL_OPCODE_ID GetBranchForm(IL_OPCODE_ID nOpcode, BOOL bShort);
+    ULONG GetInstructionSize(const INSTRUCTION &rInstruction) const;
+    ULONG GetTargetOffset(POSITION pos) const;
+
+protected:
+    CAtlList<INSTRUCTION> m_lstInstructions;
+    CAtlArray<POSITION> m_vSwitchTargets;
+    CAtlArray<EXCEPTION_CLAUSE> m_vClauses;
+    ULONG m_nCodeSize;  // set by Layout
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
@@ -58,8 +58,14 @@ ULONG CILMethodHeader::GetCodeSize(void) const
 
 void CILMethodHeader::SetCodeSize(ULONG nSize)
 {
-    ASSERT(this->IsFat());  // Currently not support tiny header.
-    this->PtrFatHeader()->SetCodeSize(nSize);
+    if(this->IsTiny())
+    {
+        // The code size shares the byte with the format flags.
+        ASSERT(nSize < (1 << (8 - (CorILMethod_FormatShift - 1))));
+        this->PtrTinyHeader()->Flags_CodeSize = (BYTE)((nSize << (CorILMethod_FormatShift - 1)) | CorILMethod_TinyFormat);
+    }
+    else
+        this->PtrFatHeader()->SetCodeSize(nSize);
 }
 
 ULONG CILMethodHeader::GetMaxStack(void) const
@@ -72,8 +78,12 @@ ULONG CILMethodHeader::GetMaxStack(void) const
 
 void CILMethodHeader::SetMaxStack(ULONG nMaxStack)
 {
-    ASSERT(this->IsFat());
-    this->PtrFatHeader()->SetMaxStack(nMaxStack);
+    if(this->IsTiny())
+    {
+        ASSERT(nMaxStack <= 8);  // implied by the tiny format
+    }
+    else
+        this->PtrFatHeader()->SetMaxStack(nMaxStack);
 }
 
 mdSignature CILMethodHeader::GetLocalVarToken(void) const
@@ -0,0 +1,94 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include "ILOpcodes.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Implementation of CILOpcodes
+
+const IL_OPCODE_INFO CILOpcodes::m_vInfos[IL_OP_COUNT + 1] =
+{
+#define IL_OPCODE_INFO_ENTRY(Name, Text, Code, Operand, Pop, Push, Flow) \
+    { Text, Code, IL_OPERAND_##Operand, IL_FLOW_##Flow, Pop, Push },
+    IL_OPCODE_LIST(IL_OPCODE_INFO_ENTRY)
+#undef IL_OPCODE_INFO_ENTRY
+    { "<invalid>", 0xFFFF, IL_OPERAND_NONE, IL_FLOW_THROW, 0, 0 }
+};
+
+IL_OPCODE_ID CILOpcodes::Decode(LPCBYTE pCode, ULONG nCodeSize, ULONG nOffset, ULONG &rnOpcodeSize)
+{
+    if(nOffset >= nCodeSize)
+    {
+        return IL_OP_INVALID;
+    }
+
+    USHORT nCode = pCode[nOffset];
+    rnOpcodeSize = 1;
+    if(IL_CODE_PREFIX == nCode)
+    {
+        if(nOffset + 1 >= nCodeSize)
+        {
+            return IL_OP_INVALID;
+        }
+        nCode = (USHORT)((IL_CODE_PREFIX << 8) | pCode[nOffset + 1]);
+        rnOpcodeSize = 2;
+    }
+
+    // The compiler turns the dense cases into lookup tables
+    switch(nCode)
+    {
+#define IL_OPCODE_CASE(Name, Text, Code, Operand, Pop, Push, Flow) \
+    case Code: return IL_OP_##Name;
+    IL_OPCODE_LIST(IL_OPCODE_CASE)
+#undef IL_OPCODE_CASE
+    default:
+        return IL_OP_INVALID;
+    }
+}
+
+BOOL CILOpcodes::GetOperandSize(IL_OPCODE_ID nOpcode, LPCBYTE pCode, ULONG nCodeSize, ULONG nOffset,
+                                ULONG &rnOperandSize)
+{
+    switch(m_vInfos[nOpcode].nOperand)
+    {
+    case IL_OPERAND_NONE:
+        rnOperandSize = 0;
+        break;
+    case IL_OPERAND_SHORT_VAR:
+    case IL_OPERAND_SHORT_I:
+    case IL_OPERAND_SHORT_BR:
+        rnOperandSize = 1;
+        break;
+    case IL_OPERAND_VAR:
+        rnOperandSize = 2;
+        break;
+    case IL_OPERAND_I8:
+    case IL_OPERAND_R:
+        rnOperandSize = 8;
+        break;
+    case IL_OPERAND_SWITCH:
+        if(nOffset + sizeof(DWORD) > nCodeSize)
+        {
+            return FALSE;
+        }
+        {
+            ULONGLONG nTargets = *(UNALIGNED const DWORD*)(pCode + nOffset);
+            if(nOffset + sizeof(DWORD) * (nTargets + 1) > nCodeSize)
+            {
+                return FALSE;
+            }
+            rnOperandSize = (ULONG)(sizeof(DWORD) * (nTargets + 1));
+        }
+        break;
+    default:
+        rnOperandSize = 4;  // int32, float32, branch offset and tokens
+        break;
+    }
+    return (nOffset + rnOperandSize <= nCodeSize);
+}
+
+#pragma endregion
@@ -0,0 +1,332 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  The ECMA-335 (Partition III) opcode table.
+//  IL_OPCODE_LIST is the single list of all opcodes; the tables of the engine are expanded
+//  from it, so they can not disagree. Each entry is
+//      IL_OPCODE(Name, Text, Code, Operand, Pop, Push, Flow)
+//  Code is the byte of one-byte opcodes, or 0xFE00 + second byte for two-byte opcodes.
+//  Pop and Push count stack slots; IL_STACK_VAR means it depends on the signature of the
+//  operand (calls) or of the method (ret).
+//
+
+#pragma once
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Opcode List
+
+#define IL_OPCODE_LIST(IL_OPCODE) \
+    IL_OPCODE(NOP,            "nop",            0x00,   NONE,       0, 0, NEXT)         \
+    IL_OPCODE(BREAK,          "break",          0x01,   NONE,       0, 0, NEXT)         \
+    IL_OPCODE(LDARG_0,        "ldarg.0",        0x02,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDARG_1,        "ldarg.1",        0x03,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDARG_2,        "ldarg.2",        0x04,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDARG_3,        "ldarg.3",        0x05,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDLOC_0,        "ldloc.0",        0x06,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDLOC_1,        "ldloc.1",        0x07,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDLOC_2,        "ldloc.2",        0x08,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDLOC_3,        "ldloc.3",        0x09,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(STLOC_0,        "stloc.0",        0x0A,   NONE,       1, 0, NEXT)         \
+    IL_OPCODE(STLOC_1,        "stloc.1",        0x0B,   NONE,       1, 0, NEXT)         \
+    IL_OPCODE(STLOC_2,        "stloc.2",        0x0C,   NONE,       1, 0, NEXT)         \
+    IL_OPCODE(STLOC_3,        "stloc.3",        0x0D,   NONE,       1, 0, NEXT)         \
+    IL_OPCODE(LDARG_S,        "ldarg.s",        0x0E,   SHORT_VAR,  0, 1, NEXT)         \
+    IL_OPCODE(LDARGA_S,       "ldarga.s",       0x0F,   SHORT_VAR,  0, 1, NEXT)         \
+    IL_OPCODE(STARG_S,        "starg.s",        0x10,   SHORT_VAR,  1, 0, NEXT)         \
+    IL_OPCODE(LDLOC_S,        "ldloc.s",        0x11,   SHORT_VAR,  0, 1, NEXT)         \
+    IL_OPCODE(LDLOCA_S,       "ldloca.s",       0x12,   SHORT_VAR,  0, 1, NEXT)         \
+    IL_OPCODE(STLOC_S,        "stloc.s",        0x13,   SHORT_VAR,  1, 0, NEXT)         \
+    IL_OPCODE(LDNULL,         "ldnull",         0x14,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDC_I4_M1,      "ldc.i4.m1",      0x15,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDC_I4_0,       "ldc.i4.0",       0x16,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDC_I4_1,       "ldc.i4.1",       0x17,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDC_I4_2,       "ldc.i4.2",       0x18,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDC_I4_3,       "ldc.i4.3",       0x19,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDC_I4_4,       "ldc.i4.4",       0x1A,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDC_I4_5,       "ldc.i4.5",       0x1B,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDC_I4_6,       "ldc.i4.6",       0x1C,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDC_I4_7,       "ldc.i4.7",       0x1D,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDC_I4_8,       "ldc.i4.8",       0x1E,   NONE,       0, 1, NEXT)         \
+    IL_OPCODE(LDC_I4_S,       "ldc.i4.s",       0x1F,   SHORT_I,    0, 1, NEXT)         \
+    IL_OPCODE(LDC_I4,         "ldc.i4",         0x20,   I,          0, 1, NEXT)         \
+    IL_OPCODE(LDC_I8,         "ldc.i8",         0x21,   I8,         0, 1, NEXT)         \
+    IL_OPCODE(LDC_R4,         "ldc.r4",         0x22,   SHORT_R,    0, 1, NEXT)         \
+    IL_OPCODE(LDC_R8,         "ldc.r8",         0x23,   R,          0, 1, NEXT)         \
+    IL_OPCODE(DUP,            "dup",            0x25,   NONE,       1, 2, NEXT)         \
+    IL_OPCODE(POP,            "pop",            0x26,   NONE,       1, 0, NEXT)         \
+    IL_OPCODE(JMP,            "jmp",            0x27,   METHOD,     0, 0, RETURN)       \
+    IL_OPCODE(CALL,           "call",           0x28,   METHOD,     IL_STACK_VAR, IL_STACK_VAR, CALL) \
+    IL_OPCODE(CALLI,          "calli",          0x29,   SIG,        IL_STACK_VAR, IL_STACK_VAR, CALL) \
+    IL_OPCODE(RET,            "ret",            0x2A,   NONE,       IL_STACK_VAR, 0, RETURN) \
+    IL_OPCODE(BR_S,           "br.s",           0x2B,   SHORT_BR,   0, 0, BRANCH)       \
+    IL_OPCODE(BRFALSE_S,      "brfalse.s",      0x2C,   SHORT_BR,   1, 0, COND_BRANCH)  \
+    IL_OPCODE(BRTRUE_S,       "brtrue.s",       0x2D,   SHORT_BR,   1, 0, COND_BRANCH)  \
+    IL_OPCODE(BEQ_S,          "beq.s",          0x2E,   SHORT_BR,   2, 0, COND_BRANCH)  \
+    IL_OPCODE(BGE_S,          "bge.s",          0x2F,   SHORT_BR,   2, 0, COND_BRANCH)  \
+    IL_OPCODE(BGT_S,          "bgt.s",          0x30,   SHORT_BR,   2, 0, COND_BRANCH)  \
+    IL_OPCODE(BLE_S,          "ble.s",          0x31,   SHORT_BR,   2, 0, COND_BRANCH)  \
+    IL_OPCODE(BLT_S,          "blt.s",          0x32,   SHORT_BR,   2, 0, COND_BRANCH)  \
+    IL_OPCODE(BNE_UN_S,       "bne.un.s",       0x33,   SHORT_BR,   2, 0, COND_BRANCH)  \
+    IL_OPCODE(BGE_UN_S,       "bge.un.s",       0x34,   SHORT_BR,   2, 0, COND_BRANCH)  \
+    IL_OPCODE(BGT_UN_S,       "bgt.un.s",       0x35,   SHORT_BR,   2, 0, COND_BRANCH)  \
+    IL_OPCODE(BLE_UN_S,       "ble.un.s",       0x36,   SHORT_BR,   2, 0, COND_BRANCH)  \
+    IL_OPCODE(BLT_UN_S,       "blt.un.s",       0x37,   SHORT_BR,   2, 0, COND_BRANCH)  \
+    IL_OPCODE(BR,             "br",             0x38,   BR,         0, 0, BRANCH)       \
+    IL_OPCODE(BRFALSE,        "brfalse",        0x39,   BR,         1, 0, COND_BRANCH)  \
+    IL_OPCODE(BRTRUE,         "brtrue",         0x3A,   BR,         1, 0, COND_BRANCH)  \
+    IL_OPCODE(BEQ,            "beq",            0x3B,   BR,         2, 0, COND_BRANCH)  \
+    IL_OPCODE(BGE,            "bge",            0x3C,   BR,         2, 0, COND_BRANCH)  \
+    IL_OPCODE(BGT,            "bgt",            0x3D,   BR,         2, 0, COND_BRANCH)  \
+    IL_OPCODE(BLE,            "ble",            0x3E,   BR,         2, 0, COND_BRANCH)  \
+    IL_OPCODE(BLT,            "blt",            0x3F,   BR,         2, 0, COND_BRANCH)  \
+    IL_OPCODE(BNE_UN,         "bne.un",         0x40,   BR,         2, 0, COND_BRANCH)  \
+    IL_OPCODE(BGE_UN,         "bge.un",         0x41,   BR,         2, 0, COND_BRANCH)  \
+    IL_OPCODE(BGT_UN,         "bgt.un",         0x42,   BR,         2, 0, COND_BRANCH)  \
+    IL_OPCODE(BLE_UN,         "ble.un",         0x43,   BR,         2, 0, COND_BRANCH)  \
+    IL_OPCODE(BLT_UN,         "blt.un",         0x44,   BR,         2, 0, COND_BRANCH)  \
+    IL_OPCODE(SWITCH,         "switch",         0x45,   SWITCH,     1, 0, COND_BRANCH)  \
+    IL_OPCODE(LDIND_I1,       "ldind.i1",       0x46,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(LDIND_U1,       "ldind.u1",       0x47,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(LDIND_I2,       "ldind.i2",       0x48,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(LDIND_U2,       "ldind.u2",       0x49,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(LDIND_I4,       "ldind.i4",       0x4A,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(LDIND_U4,       "ldind.u4",       0x4B,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(LDIND_I8,       "ldind.i8",       0x4C,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(LDIND_I,        "ldind.i",        0x4D,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(LDIND_R4,       "ldind.r4",       0x4E,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(LDIND_R8,       "ldind.r8",       0x4F,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(LDIND_REF,      "ldind.ref",      0x50,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(STIND_REF,      "stind.ref",      0x51,   NONE,       2, 0, NEXT)         \
+    IL_OPCODE(STIND_I1,       "stind.i1",       0x52,   NONE,       2, 0, NEXT)         \
+    IL_OPCODE(STIND_I2,       "stind.i2",       0x53,   NONE,       2, 0, NEXT)         \
+    IL_OPCODE(STIND_I4,       "stind.i4",       0x54,   NONE,       2, 0, NEXT)         \
+    IL_OPCODE(STIND_I8,       "stind.i8",       0x55,   NONE,       2, 0, NEXT)         \
+    IL_OPCODE(STIND_R4,       "stind.r4",       0x56,   NONE,       2, 0, NEXT)         \
+    IL_OPCODE(STIND_R8,       "stind.r8",       0x57,   NONE,       2, 0, NEXT)         \
+    IL_OPCODE(ADD,            "add",            0x58,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(SUB,            "sub",            0x59,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(MUL,            "mul",            0x5A,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(DIV,            "div",            0x5B,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(DIV_UN,         "div.un",         0x5C,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(REM,            "rem",            0x5D,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(REM_UN,         "rem.un",         0x5E,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(AND,            "and",            0x5F,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(OR,             "or",             0x60,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(XOR,            "xor",            0x61,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(SHL,            "shl",            0x62,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(SHR,            "shr",            0x63,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(SHR_UN,         "shr.un",         0x64,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(NEG,            "neg",            0x65,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(NOT,            "not",            0x66,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_I1,        "conv.i1",        0x67,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_I2,        "conv.i2",        0x68,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_I4,        "conv.i4",        0x69,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_I8,        "conv.i8",        0x6A,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_R4,        "conv.r4",        0x6B,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_R8,        "conv.r8",        0x6C,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_U4,        "conv.u4",        0x6D,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_U8,        "conv.u8",        0x6E,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CALLVIRT,       "callvirt",       0x6F,   METHOD,     IL_STACK_VAR, IL_STACK_VAR, CALL) \
+    IL_OPCODE(CPOBJ,          "cpobj",          0x70,   TYPE,       2, 0, NEXT)         \
+    IL_OPCODE(LDOBJ,          "ldobj",          0x71,   TYPE,       1, 1, NEXT)         \
+    IL_OPCODE(LDSTR,          "ldstr",          0x72,   STRING,     0, 1, NEXT)         \
+    IL_OPCODE(NEWOBJ,         "newobj",         0x73,   METHOD,     IL_STACK_VAR, 1, CALL) \
+    IL_OPCODE(CASTCLASS,      "castclass",      0x74,   TYPE,       1, 1, NEXT)         \
+    IL_OPCODE(ISINST,         "isinst",         0x75,   TYPE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_R_UN,      "conv.r.un",      0x76,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(UNBOX,          "unbox",          0x79,   TYPE,       1, 1, NEXT)         \
+    IL_OPCODE(THROW,          "throw",          0x7A,   NONE,       1, 0, THROW)        \
+    IL_OPCODE(LDFLD,          "ldfld",          0x7B,   FIELD,      1, 1, NEXT)         \
+    IL_OPCODE(LDFLDA,         "ldflda",         0x7C,   FIELD,      1, 1, NEXT)         \
+    IL_OPCODE(STFLD,          "stfld",          0x7D,   FIELD,      2, 0, NEXT)         \
+    IL_OPCODE(LDSFLD,         "ldsfld",         0x7E,   FIELD,      0, 1, NEXT)         \
+    IL_OPCODE(LDSFLDA,        "ldsflda",        0x7F,   FIELD,      0, 1, NEXT)         \
+    IL_OPCODE(STSFLD,         "stsfld",         0x80,   FIELD,      1, 0, NEXT)         \
+    IL_OPCODE(STOBJ,          "stobj",          0x81,   TYPE,       2, 0, NEXT)         \
+    IL_OPCODE(CONV_OVF_I1_UN, "conv.ovf.i1.un", 0x82,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_I2_UN, "conv.ovf.i2.un", 0x83,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_I4_UN, "conv.ovf.i4.un", 0x84,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_I8_UN, "conv.ovf.i8.un", 0x85,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_U1_UN, "conv.ovf.u1.un", 0x86,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_U2_UN, "conv.ovf.u2.un", 0x87,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_U4_UN, "conv.ovf.u4.un", 0x88,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_U8_UN, "conv.ovf.u8.un", 0x89,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_I_UN,  "conv.ovf.i.un",  0x8A,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_U_UN,  "conv.ovf.u.un",  0x8B,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(BOX,            "box",            0x8C,   TYPE,       1, 1, NEXT)         \
+    IL_OPCODE(NEWARR,         "newarr",         0x8D,   TYPE,       1, 1, NEXT)         \
+    IL_OPCODE(LDLEN,          "ldlen",          0x8E,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(LDELEMA,        "ldelema",        0x8F,   TYPE,       2, 1, NEXT)         \
+    IL_OPCODE(LDELEM_I1,      "ldelem.i1",      0x90,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(LDELEM_U1,      "ldelem.u1",      0x91,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(LDELEM_I2,      "ldelem.i2",      0x92,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(LDELEM_U2,      "ldelem.u2",      0x93,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(LDELEM_I4,      "ldelem.i4",      0x94,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(LDELEM_U4,      "ldelem.u4",      0x95,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(LDELEM_I8,      "ldelem.i8",      0x96,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(LDELEM_I,       "ldelem.i",       0x97,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(LDELEM_R4,      "ldelem.r4",      0x98,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(LDELEM_R8,      "ldelem.r8",      0x99,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(LDELEM_REF,     "ldelem.ref",     0x9A,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(STELEM_I,       "stelem.i",       0x9B,   NONE,       3, 0, NEXT)         \
+    IL_OPCODE(STELEM_I1,      "stelem.i1",      0x9C,   NONE,       3, 0, NEXT)         \
+    IL_OPCODE(STELEM_I2,      "stelem.i2",      0x9D,   NONE,       3, 0, NEXT)         \
+    IL_OPCODE(STELEM_I4,      "stelem.i4",      0x9E,   NONE,       3, 0, NEXT)         \
+    IL_OPCODE(STELEM_I8,      "stelem.i8",      0x9F,   NONE,       3, 0, NEXT)         \
+    IL_OPCODE(STELEM_R4,      "stelem.r4",      0xA0,   NONE,       3, 0, NEXT)         \
+    IL_OPCODE(STELEM_R8,      "stelem.r8",      0xA1,   NONE,       3, 0, NEXT)         \
+    IL_OPCODE(STELEM_REF,     "stelem.ref",     0xA2,   NONE,       3, 0, NEXT)         \
+    IL_OPCODE(LDELEM,         "ldelem",         0xA3,   TYPE,       2, 1, NEXT)         \
+    IL_OPCODE(STELEM,         "stelem",         0xA4,   TYPE,       3, 0, NEXT)         \
+    IL_OPCODE(UNBOX_ANY,      "unbox.any",      0xA5,   TYPE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_I1,    "conv.ovf.i1",    0xB3,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_U1,    "conv.ovf.u1",    0xB4,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_I2,    "conv.ovf.i2",    0xB5,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_U2,    "conv.ovf.u2",    0xB6,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_I4,    "conv.ovf.i4",    0xB7,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_U4,    "conv.ovf.u4",    0xB8,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_I8,    "conv.ovf.i8",    0xB9,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_U8,    "conv.ovf.u8",    0xBA,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(REFANYVAL,      "refanyval",      0xC2,   TYPE,       1, 1, NEXT)         \
+    IL_OPCODE(CKFINITE,       "ckfinite",       0xC3,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(MKREFANY,       "mkrefany",       0xC6,   TYPE,       1, 1, NEXT)         \
+    IL_OPCODE(LDTOKEN,        "ldtoken",        0xD0,   TOKEN,      0, 1, NEXT)         \
+    IL_OPCODE(CONV_U2,        "conv.u2",        0xD1,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_U1,        "conv.u1",        0xD2,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_I,         "conv.i",         0xD3,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_I,     "conv.ovf.i",     0xD4,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(CONV_OVF_U,     "conv.ovf.u",     0xD5,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(ADD_OVF,        "add.ovf",        0xD6,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(ADD_OVF_UN,     "add.ovf.un",     0xD7,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(MUL_OVF,        "mul.ovf",        0xD8,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(MUL_OVF_UN,     "mul.ovf.un",     0xD9,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(SUB_OVF,        "sub.ovf",        0xDA,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(SUB_OVF_UN,     "sub.ovf.un",     0xDB,   NONE,       2, 1, NEXT)         \
+    IL_OPCODE(ENDFINALLY,     "endfinally",     0xDC,   NONE,       0, 0, RETURN)       \
+    IL_OPCODE(LEAVE,          "leave",          0xDD,   BR,         0, 0, BRANCH)       \
+    IL_OPCODE(LEAVE_S,        "leave.s",        0xDE,   SHORT_BR,   0, 0, BRANCH)       \
+    IL_OPCODE(STIND_I,        "stind.i",        0xDF,   NONE,       2, 0, NEXT)         \
+    IL_OPCODE(CONV_U,         "conv.u",         0xE0,   NONE,       1, 1, NEXT)         \
+    IL_OPCODE(ARGLIST,        "arglist",        0xFE00, NONE,       0, 1, NEXT)         \
+    IL_OPCODE(CEQ,            "ceq",            0xFE01, NONE,       2, 1, NEXT)         \
+    IL_OPCODE(CGT,            "cgt",            0xFE02, NONE,       2, 1, NEXT)         \
+    IL_OPCODE(CGT_UN,         "cgt.un",         0xFE03, NONE,       2, 1, NEXT)         \
+    IL_OPCODE(CLT,            "clt",            0xFE04, NONE,       2, 1, NEXT)         \
+    IL_OPCODE(CLT_UN,         "clt.un",         0xFE05, NONE,       2, 1, NEXT)         \
+    IL_OPCODE(LDFTN,          "ldftn",          0xFE06, METHOD,     0, 1, NEXT)         \
+    IL_OPCODE(LDVIRTFTN,      "ldvirtftn",      0xFE07, METHOD,     1, 1, NEXT)         \
+    IL_OPCODE(LDARG,          "ldarg",          0xFE09, VAR,        0, 1, NEXT)         \
+    IL_OPCODE(LDARGA,         "ldarga",         0xFE0A, VAR,        0, 1, NEXT)         \
+    IL_OPCODE(STARG,          "starg",          0xFE0B, VAR,        1, 0, NEXT)         \
+    IL_OPCODE(LDLOC,          "ldloc",          0xFE0C, VAR,        0, 1, NEXT)         \
+    IL_OPCODE(LDLOCA,         "ldloca",         0xFE0D, VAR,        0, 1, NEXT)         \
+    IL_OPCODE(STLOC,          "stloc",          0xFE0E, VAR,        1, 0, NEXT)         \
+    IL_OPCODE(LOCALLOC,       "localloc",       0xFE0F, NONE,       1, 1, NEXT)         \
+    IL_OPCODE(ENDFILTER,      "endfilter",      0xFE11, NONE,       1, 0, RETURN)       \
+    IL_OPCODE(UNALIGNED_,     "unaligned.",     0xFE12, SHORT_I,    0, 0, PREFIX)       \
+    IL_OPCODE(VOLATILE,       "volatile.",      0xFE13, NONE,       0, 0, PREFIX)       \
+    IL_OPCODE(TAILCALL,       "tail.",          0xFE14, NONE,       0, 0, PREFIX)       \
+    IL_OPCODE(INITOBJ,        "initobj",        0xFE15, TYPE,       1, 0, NEXT)         \
+    IL_OPCODE(CONSTRAINED,    "constrained.",   0xFE16, TYPE,       0, 0, PREFIX)       \
+    IL_OPCODE(CPBLK,          "cpblk",          0xFE17, NONE,       3, 0, NEXT)         \
+    IL_OPCODE(INITBLK,        "initblk",        0xFE18, NONE,       3, 0, NEXT)         \
+    IL_OPCODE(NO,             "no.",            0xFE19, SHORT_I,    0, 0, PREFIX)       \
+    IL_OPCODE(RETHROW,        "rethrow",        0xFE1A, NONE,       0, 0, THROW)        \
+    IL_OPCODE(SIZEOF,         "sizeof",         0xFE1C, TYPE,       0, 1, NEXT)         \
+    IL_OPCODE(REFANYTYPE,     "refanytype",     0xFE1D, NONE,       1, 1, NEXT)         \
+    IL_OPCODE(READONLY,       "readonly.",      0xFE1E, NONE,       0, 0, PREFIX)
+
+#pragma endregion
+
+#pragma region Declaration of CILOpcodes
+
+#define IL_STACK_VAR    (-1)
+#define IL_CODE_PREFIX  0xFE  // first byte of two-byte opcodes
+
+enum IL_OPCODE_ID
+{
+#define IL_OPCODE_ENUM(Name, Text, Code, Operand, Pop, Push, Flow)  IL_OP_##Name,
+    IL_OPCODE_LIST(IL_OPCODE_ENUM)
+#undef IL_OPCODE_ENUM
+    IL_OP_COUNT,
+    IL_OP_INVALID = IL_OP_COUNT
+};
+
+enum IL_OPERAND
+{
+    IL_OPERAND_NONE,
+    IL_OPERAND_SHORT_VAR,   // unsigned int8 index of argument or local
+    IL_OPERAND_VAR,         // unsigned int16 index of argument or local
+    IL_OPERAND_SHORT_I,     // int8
+    IL_OPERAND_I,           // int32
+    IL_OPERAND_I8,          // int64
+    IL_OPERAND_SHORT_R,     // float32
+    IL_OPERAND_R,           // float64
+    IL_OPERAND_SHORT_BR,    // int8 offset from the next instruction
+    IL_OPERAND_BR,          // int32 offset from the next instruction
+    IL_OPERAND_SWITCH,      // uint32 count, then int32 offsets from the next instruction
+    IL_OPERAND_METHOD,      // MethodDef, MemberRef or MethodSpec token
+    IL_OPERAND_FIELD,       // FieldDef or MemberRef token
+    IL_OPERAND_TYPE,        // TypeDef, TypeRef or TypeSpec token
+    IL_OPERAND_TOKEN,       // any of the three above
+    IL_OPERAND_STRING,      // user string token
+    IL_OPERAND_SIG,         // StandAloneSig token
+};
+
+enum IL_FLOW
+{
+    IL_FLOW_NEXT,           // goes on with the next instruction
+    IL_FLOW_CALL,           // goes on with the next instruction after the call
+    IL_FLOW_PREFIX,         // modifies the next instruction
+    IL_FLOW_BRANCH,         // goes on at the target only
+    IL_FLOW_COND_BRANCH,    // goes on at the targets, or with the next instruction
+    IL_FLOW_RETURN,         // leaves the method, the handler or the filter
+    IL_FLOW_THROW,          // leaves through an exception
+};
+
+struct IL_OPCODE_INFO
+{
+    LPCSTR pszName;
+    USHORT nCode;
+    BYTE nOperand;          // IL_OPERAND
+    BYTE nFlow;             // IL_FLOW
+    signed char nPop;       // or IL_STACK_VAR
+    signed char nPush;      // or IL_STACK_VAR
+};
+
+class CILOpcodes
+{
+public:
+    /// <summary>
+    /// Get the opcode of the instruction at the given offset of the code, and the size of the
+    /// opcode (1 or 2 bytes). Return IL_OP_INVALID if the bytes are not an opcode.
+    /// </summary>
+    static IL_OPCODE_ID Decode(LPCBYTE pCode, ULONG nCodeSize, ULONG nOffset, ULONG &rnOpcodeSize);
+
+    /// <summary>
+    /// Get the size of the operand of the instruction, whose opcode ends at the given offset.
+    /// Return FALSE if the operand does not fit in the code.
+    /// </summary>
+    static BOOL GetOperandSize(IL_OPCODE_ID nOpcode, LPCBYTE pCode, ULONG nCodeSize, ULONG nOffset,
+        ULONG &rnOperandSize);
+
+    /// <summary>
+    /// Get the table entry of the opcode.
+    /// </summary>
+    static const IL_OPCODE_INFO& GetInfo(IL_OPCODE_ID nOpcode)
+    {
+        ASSERT(nOpcode <= IL_OP_INVALID);
+        return m_vInfos[nOpcode];
+    }
+
+private:
+    static const IL_OPCODE_INFO m_vInfos[IL_OP_COUNT + 1];
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
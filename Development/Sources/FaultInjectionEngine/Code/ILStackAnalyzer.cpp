@@ -0,0 +1,340 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include "ILStackAnalyzer.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Implementation of CILStackAnalyzer
+
+CILStackAnalyzer::CILStackAnalyzer(IMetaDataImport *pMetaDataImport)
+    : m_pMetaDataImport(pMetaDataImport), m_nCodeSize(0)
+{
+}
+
+BOOL CILStackAnalyzer::ComputeMaxStack(const CMemoryRef &rxCode, const CILMethodSect &rxSect, ULONG &rnMaxStack)
+{
+    LPCBYTE pCode = (LPCBYTE)(rxCode.GetBaseAddress());
+    this->m_nCodeSize = (ULONG)(rxCode.GetSize());
+    if(!this->m_vDepths.SetCount(this->m_nCodeSize))
+    {
+        return FALSE;
+    }
+    for(ULONG i = 0; i < this->m_nCodeSize; i++)
+    {
+        this->m_vDepths[i] = -1;
+    }
+    this->m_vPending.RemoveAll();
+
+    LONG nMaxStack = 0;
+    if(!this->AddEntry(0, 0))
+    {
+        return FALSE;
+    }
+
+    // The try blocks are entered with an empty stack, catch handlers and filters with the
+    // exception object, finally and fault handlers with an empty stack.
+    for(CILMethodSect xSect = rxSect; !xSect.IsNull(); xSect = xSect.GetNextSection())
+    {
+        if(!xSect.IsExceptionHandler())
+        {
+            continue;
+        }
+        int nClauseCount = xSect.GetExceptionHandlerClauseCount();
+        for(int i = 0; i < nClauseCount; i++)
+        {
+            ULONG nFlags, nTryOffset, nHandlerOffset, nFilterOffset;
+            if(xSect.IsFat())
+            {
+                IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT &rClause = xSect.GetFatExceptionHandlerClause(i);
+                nFlags = rClause.Flags;
+                nTryOffset = rClause.TryOffset;
+                nHandlerOffset = rClause.HandlerOffset;
+                nFilterOffset = rClause.FilterOffset;
+            }
+            else
+            {
+                IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_SMALL &rClause = xSect.GetSmallExceptionHandlerClause(i);
+                nFlags = rClause.Flags;
+                nTryOffset = rClause.TryOffset;
+                nHandlerOffset = rClause.HandlerOffset;
+                nFilterOffset = rClause.FilterOffset;
+            }
+
+            LONG nHandlerDepth = 0;
+            if(nFlags & COR_ILEXCEPTION_CLAUSE_FILTER)
+            {
+                if(!this->AddEntry(nFilterOffset, 1))
+                {
+                    return FALSE;
+                }
+                nHandlerDepth = 1;
+            }
+            else if(!(nFlags & (COR_ILEXCEPTION_CLAUSE_FINALLY | COR_ILEXCEPTION_CLAUSE_FAULT)))
+            {
+                nHandlerDepth = 1;
+            }
+            if(!this->AddEntry(nTryOffset, 0) || !this->AddEntry(nHandlerOffset, nHandlerDepth))
+            {
+                return FALSE;
+            }
+            if(nMaxStack < nHandlerDepth)
+            {
+                nMaxStack = nHandlerDepth;
+            }
+        }
+    }
+
+    // Walk the instructions from each entry, until the flow leaves or reaches an instruction
+    // walked already (or pending).
+    while(!this->m_vPending.IsEmpty())
+    {
+        ULONG nOffset = this->m_vPending[this->m_vPending.GetCount() - 1];
+        this->m_vPending.RemoveAt(this->m_vPending.GetCount() - 1);
+        LONG nDepth = this->m_vDepths[nOffset];
+
+        for(;;)
+        {
+            ULONG nOpcodeSize, nOperandSize;
+            IL_OPCODE_ID nOpcode = CILOpcodes::Decode(pCode, this->m_nCodeSize, nOffset, nOpcodeSize);
+            if((IL_OP_INVALID == nOpcode) ||
+                !CILOpcodes::GetOperandSize(nOpcode, pCode, this->m_nCodeSize, nOffset + nOpcodeSize, nOperandSize))
+            {
+                return FALSE;
+            }
+            const IL_OPCODE_INFO &rInfo = CILOpcodes::GetInfo(nOpcode);
+            LPCBYTE pOperand = pCode + nOffset + nOpcodeSize;
+            ULONG nNext = nOffset + nOpcodeSize + nOperandSize;
+
+            LONG nPop = rInfo.nPop;
+            LONG nPush = rInfo.nPush;
+            if(IL_OP_RET == nOpcode)
+            {
+                nPop = nDepth;  // the return value, if any; the flow ends here
+            }
+            else if((IL_STACK_VAR == nPop) || (IL_STACK_VAR == nPush))
+            {
+                if(!this->GetCallStackChange(nOpcode, *(UNALIGNED const DWORD*)pOperand, nPop, nPush))
+                {
+                    return FALSE;
+                }
+            }
+            if(nDepth < nPop)
+            {
+                return FALSE;  // stack underflow
+            }
+            nDepth += nPush - nPop;
+            if(nMaxStack < nDepth)
+            {
+                nMaxStack = nDepth;
+            }
+
+            switch(rInfo.nFlow)
+            {
+            case IL_FLOW_BRANCH:
+                {
+                    LONG nDisplacement = (IL_OPERAND_SHORT_BR == rInfo.nOperand)
+                        ? *(const signed char*)pOperand : *(UNALIGNED const LONG*)pOperand;
+                    if((IL_OP_LEAVE == nOpcode) || (IL_OP_LEAVE_S == nOpcode))
+                    {
+                        nDepth = 0;  // leave empties the stack
+                    }
+                    if(!this->AddBranchTarget(nNext, nDisplacement, nDepth))
+                    {
+                        return FALSE;
+                    }
+                }
+                break;
+
+            case IL_FLOW_COND_BRANCH:
+                if(IL_OP_SWITCH == nOpcode)
+                {
+                    ULONG nTargets = *(UNALIGNED const DWORD*)pOperand;
+                    for(ULONG i = 1; i <= nTargets; i++)
+                    {
+                        if(!this->AddBranchTarget(nNext, ((UNALIGNED const LONG*)pOperand)[i], nDepth))
+                        {
+                            return FALSE;
+                        }
+                    }
+                }
+                else
+                {
+                    LONG nDisplacement = (IL_OPERAND_SHORT_BR == rInfo.nOperand)
+                        ? *(const signed char*)pOperand : *(UNALIGNED const LONG*)pOperand;
+                    if(!this->AddBranchTarget(nNext, nDisplacement, nDepth))
+                    {
+                        return FALSE;
+                    }
+                }
+                break;
+
+            default:
+                break;
+            }
+
+            if((IL_FLOW_BRANCH == rInfo.nFlow) || (IL_FLOW_RETURN == rInfo.nFlow) || (IL_FLOW_THROW == rInfo.nFlow))
+            {
+                break;  // no fall through
+            }
+            if(nNext == this->m_nCodeSize)
+            {
+                if(0 != nDepth)
+                {
+                    return FALSE;  // falls through into the following code with a non-empty stack
+                }
+                break;
+            }
+            if(0 <= this->m_vDepths[nNext])
+            {
+                if(this->m_vDepths[nNext] != nDepth)
+                {
+                    return FALSE;  // inconsistent stack depth
+                }
+                break;
+            }
+            this->m_vDepths[nNext] = nDepth;
+            nOffset = nNext;
+        }
+    }
+
+    rnMaxStack = (ULONG)nMaxStack;
+    return TRUE;
+}
+
+BOOL CILStackAnalyzer::AddEntry(ULONG nOffset, LONG nDepth)
+{
+    if(nOffset >= this->m_nCodeSize)
+    {
+        return (0 == this->m_nCodeSize) && (0 == nOffset);  // empty code
+    }
+    if(0 <= this->m_vDepths[nOffset])
+    {
+        return (this->m_vDepths[nOffset] == nDepth);
+    }
+    this->m_vDepths[nOffset] = nDepth;
+    this->m_vPending.Add(nOffset);
+    return TRUE;
+}
+
+BOOL CILStackAnalyzer::AddBranchTarget(ULONG nOffset, LONG nDisplacement, LONG nDepth)
+{
+    LONGLONG nTarget = (LONGLONG)nOffset + nDisplacement;
+    if((nTarget < 0) || (nTarget > this->m_nCodeSize))
+    {
+        return FALSE;
+    }
+    if(nTarget == this->m_nCodeSize)
+    {
+        return (0 == nDepth);  // goes on with the following code
+    }
+    return this->AddEntry((ULONG)nTarget, nDepth);
+}
+
+BOOL CILStackAnalyzer::GetCallStackChange(IL_OPCODE_ID nOpcode, mdToken tkOperand, LONG &rnPop, LONG &rnPush)
+{
+    if(this->m_pMetaDataImport == NULL)
+    {
+        return FALSE;  // code analyzed without its module
+    }
+
+    PCCOR_SIGNATURE pSignature = NULL;
+    ULONG nSignatureSize = 0;
+    HRESULT hr;
+    switch(TypeFromToken(tkOperand))
+    {
+    case mdtMethodDef:
+        hr = this->m_pMetaDataImport->GetMethodProps(tkOperand, NULL, NULL, 0, NULL, NULL,
+            &pSignature, &nSignatureSize, NULL, NULL);
+        break;
+    case mdtMemberRef:
+        hr = this->m_pMetaDataImport->GetMemberRefProps(tkOperand, NULL, NULL, 0, NULL, &pSignature, &nSignatureSize);
+        break;
+    case mdtMethodSpec:
+        {
+            // the instantiation has the signature of the generic method
+            CComQIPtr<IMetaDataImport2> pMetaDataImport2(this->m_pMetaDataImport);
+            mdToken tkGenericMethod;
+            if((pMetaDataImport2 == NULL) ||
+                FAILED(pMetaDataImport2->GetMethodSpecProps(tkOperand, &tkGenericMethod, NULL, NULL)))
+            {
+                return FALSE;
+            }
+            return this->GetCallStackChange(nOpcode, tkGenericMethod, rnPop, rnPush);
+        }
+    case mdtSignature:
+        hr = this->m_pMetaDataImport->GetSigFromToken(tkOperand, &pSignature, &nSignatureSize);
+        break;
+    default:
+        return FALSE;
+    }
+    if(FAILED(hr) || (nSignatureSize < 3))
+    {
+        return FALSE;
+    }
+
+    // calling convention, generic parameter count, parameter count, return type
+    PCCOR_SIGNATURE pEndOfSignature = pSignature + nSignatureSize;
+    ULONG nCallingConvention = ::CorSigUncompressCallingConv(pSignature);
+    if(nCallingConvention & IMAGE_CEE_CS_CALLCONV_GENERIC)
+    {
+        ::CorSigUncompressData(pSignature);
+    }
+    LONG nParamCount = (LONG)(::CorSigUncompressData(pSignature));
+    while((pSignature < pEndOfSignature) &&
+        ((ELEMENT_TYPE_CMOD_REQD == *pSignature) || (ELEMENT_TYPE_CMOD_OPT == *pSignature)))
+    {
+        pSignature++;
+        ::CorSigUncompressToken(pSignature);
+    }
+    if(pSignature >= pEndOfSignature)
+    {
+        return FALSE;
+    }
+    BOOL bReturnsValue = (ELEMENT_TYPE_VOID != *pSignature);
+
+    rnPop = nParamCount;
+    if((nCallingConvention & IMAGE_CEE_CS_CALLCONV_HASTHIS) && !(nCallingConvention & IMAGE_CEE_CS_CALLCONV_EXPLICITTHIS))
+    {
+        rnPop++;  // this
+    }
+    switch(nOpcode)
+    {
+    case IL_OP_NEWOBJ:
+        rnPop = nParamCount;  // this is created, and pushed
+        rnPush = 1;
+        break;
+    case IL_OP_CALLI:
+        rnPop++;  // the function pointer
+        rnPush = bReturnsValue ? 1 : 0;
+        break;
+    default:
+        rnPush = bReturnsValue ? 1 : 0;
+        break;
+    }
+    return TRUE;
+}
+
+#pragma endregion
+
+#if defined(FAULT_ENGINE_TEST_EXPORTS)
+
+#pragma region Exported Functions (Called by Tests)
+
+extern "C" BOOL WINAPI FaultEngineComputeMaxStack(const BYTE *pCode, ULONG nCodeSize, ULONG *pnMaxStack)
+{
+    if((NULL == pCode) || (NULL == pnMaxStack))
+    {
+        return FALSE;
+    }
+    // Without metadata, code which calls a method can't be analyzed.
+    CILStackAnalyzer xStackAnalyzer(NULL);
+    return xStackAnalyzer.ComputeMaxStack(CMemoryRef(pCode, nCodeSize), CILMethodSect(), *pnMaxStack);
+}
+
+#pragma endregion
+
+#endif // FAULT_ENGINE_TEST_EXPORTS
@@ -0,0 +1,54 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  Declaration of class CILStackAnalyzer.
+//  Computes the exact max stack of IL code by walking its instructions once. The walk starts
+//  at the first instruction and at the entries of the exception handlers, and follows the
+//  branches; each instruction is visited once, since IL requires the stack depth at an
+//  instruction to be the same on every path which reaches it.
+//  The prologue and the original code are analyzed apart: the prologue only goes on with the
+//  original code with an empty stack, so the max stack of the rewritten method is the larger
+//  of the two.
+//
+
+#pragma once
+
+#include "MemoryRef.h"
+#include "ILMethodSect.h"
+#include "ILOpcodes.h"
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Declaration of CILStackAnalyzer
+
+class CILStackAnalyzer
+{
+public:
+    CILStackAnalyzer(IMetaDataImport *pMetaDataImport);
+
+public:
+    /// <summary>
+    /// Compute the max stack of the code, whose exception handlers are in the given sections
+    /// (a null section if there is none). Branches to the end of the code go on with code which
+    /// follows it, and must have an empty stack. Return FALSE if the code is not valid IL.
+    /// </summary>
+    BOOL ComputeMaxStack(const CMemoryRef &rxCode, const CILMethodSect &rxSect, ULONG &rnMaxStack);
+
+protected:
+    BOOL AddEntry(ULONG nOffset, LONG nDepth);
+    BOOL AddBranchTarget(ULONG nOffset, LONG nDisplacement, LONG nDepth);
+    BOOL GetCallStackChange(IL_OPCODE_ID nOpcode, mdToken tkOperand, LONG &rnPop, LONG &rnPush);
+
+protected:
+    CComPtr<IMetaDataImport> m_pMetaDataImport;
+    ULONG m_nCodeSize;
+    CAtlArray<LONG> m_vDepths;  // stack depth at each instruction reached so far, -1 otherwise
+    CAtlArray<ULONG> m_vPending;  // offsets reached by a branch or a handler, not walked yet
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
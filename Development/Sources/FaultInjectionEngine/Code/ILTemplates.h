@@ -22,6 +22,22 @@ const IMAGE_COR_ILMETHOD_FAT imageDefaultILMethodFatHeader =
     /* LocalVarSigTok */    0   // should be corrected dynamically
 };
 
+//---------------------------------------------------------
+// The IL-Method FAT Header for tiny ones which get no local-var (sterotype for those convert
+// from tiny ones by the compact prologue or a static fault). There is nothing to zero-initialize.
+const IMAGE_COR_ILMETHOD_FAT imageDefaultILMethodFatHeaderWithoutLocals =
+{
+    /* Flags */             CorILMethod_FatFormat,
+    /* Size (in dwords) */  sizeof(IMAGE_COR_ILMETHOD_FAT) / sizeof(DWORD),
+    /* MaxStack */          0,  // should be corrected dynamically
+    /* CodeSize */          0,  // should be corrected dynamically
+    /* LocalVarSigTok */    0
+};
+
+// A tiny header keeps the code size in 6 bits, and implies a max-stack of 8 and no local-var.
+const ULONG IL_SIZE__MAX_TINY_CODE  = 63;
+const ULONG IL_NUMBER__MAX_TINY_STACK = 8;
+
 //---------------------------------------------------------
 // The default IL-Method FAT (EH)Section (sterotype for those convert from small ones).
 const IMAGE_COR_ILMETHOD_SECT_FAT imageDefaultILMethodFatSection =
@@ -31,43 +47,574 @@ const IMAGE_COR_ILMETHOD_SECT_FAT imageDefaultILMethodFatSection =
 };
 
 //---------------------------------------------------------
-// Prologue IL code template
-
-const BYTE IL_CODE__PROLOGUE[] = {
-    0xFE,0x0D,  0,0,        // IL__0 (4):  ldloca  "throwException"
-    0xFE,0x0D,  0,0,        // IL__4 (4):  ldloca  "returnValue"
-    0x28,       0,0,0,0,    // IL__8 (5):  call  "static bool Trap(Exception&, Object&)"
-    0x2C,       21,         // IL_13 (2):  brfalse.s  ORIGINAL_CODE
-    0xFE,0x0C,  0,0,        // IL_15 (4):  ldloc  "throwException"
-    0x2C,       5,          // IL_19 (2):  brfalse.s  RETURN_SECTION
-    0xFE,0x0C,  0,0,        // IL_21 (4):  ldloc  "throwException"
-    0x7A,                   // IL_25 (1):  throw
+// Prologue IL code templates, one per variant: call counting with Interlocked.Increment or with
+// a plain increment, and a method with or without return value. Object, value-type and generic
+// return types share the same code, since the local-var "returnValue" carries the type.
+// Each template is a packed struct of instructions, so the offsets of its values and the
+// distances of its branches follow from its layout; a prologue is one copy plus the stores
+// listed by its IL_PROLOGUE_TEMPLATE below.
+
+#pragma pack(push, 1)
+
+struct IL_INSTR_LOAD_ADDRESS    // ldc.i8  "address";  conv.u
+{
+    BYTE nLdcI8;
+    ULONGLONG nAddress;
+    BYTE nConvU;
+};
+
+struct IL_INSTR_LOCAL           // ldloc or ldloca  "local-var"
+{
+    BYTE vOpcode[2];
+    WORD nIndex;
+};
+
+struct IL_INSTR_CALL            // call  "method"
+{
+    BYTE nCall;
+    DWORD tkMethod;
+};
+
+struct IL_INSTR_SHORT_BRANCH    // brfalse.s or blt.s  "target"
+{
+    BYTE nOpcode;
+    BYTE nDistance;
+};
+
+// Goes to the original code while the method is disarmed.
+struct IL_PROLOGUE_ARMED
+{
+    IL_INSTR_LOAD_ADDRESS xArmedFlag;   // ldc.i8  "address of armed flag";  conv.u
+    BYTE nLdindU1;                      // ldind.u1
+    IL_INSTR_SHORT_BRANCH xDisarmed;    // brfalse.s  ORIGINAL_CODE
+};
+
+// Counts the call with Interlocked.Increment, leaving the new count on the stack.
+struct IL_PROLOGUE_ATOMIC_COUNT
+{
+    IL_INSTR_LOAD_ADDRESS xCallCounter; // ldc.i8  "address of call counter";  conv.u
+    IL_INSTR_CALL xIncrement;           // call  "static int Interlocked.Increment(int&)"
+};
+
+// Counts the call with a plain increment instead of Interlocked.Increment, which is cheaper
+// but may lose concurrent calls. stind.i4 consumes the new count, so it is loaded again.
+struct IL_PROLOGUE_FAST_COUNT
+{
+    IL_INSTR_LOAD_ADDRESS xCallCounter; // ldc.i8  "address of call counter";  conv.u
+    BYTE vIncrement[5];                 // dup;  ldind.i4;  ldc.i4.1;  add;  stind.i4
+    IL_INSTR_LOAD_ADDRESS xCallCounterAgain;    // ldc.i8  "address of call counter";  conv.u
+    BYTE nLdindI4;                      // ldind.i4
+};
+
+// Goes to the original code until the count reaches the threshold, then pushes the trap id.
+struct IL_PROLOGUE_GATE
+{
+    IL_INSTR_LOAD_ADDRESS xThreshold;   // ldc.i8  "address of threshold";  conv.u
+    BYTE nLdindI4;                      // ldind.i4
+    IL_INSTR_SHORT_BRANCH xBelowThreshold;  // blt.s  ORIGINAL_CODE
+    BYTE nLdcI4;                        // ldc.i4  "trap id"
+    DWORD nTrapId;
+};
+
+// Calls "static bool Trap<T>(int, Exception&, T&)", then throws or returns as the fault says.
+struct IL_PROLOGUE_TRAP
+{
+    IL_INSTR_LOCAL xThrowExceptionAddress;  // ldloca  "throwException"
+    IL_INSTR_LOCAL xReturnValueAddress; // ldloca  "returnValue"
+    IL_INSTR_CALL xTrap;                // call  "static bool Trap<T>(int, Exception&, T&)"
+    IL_INSTR_SHORT_BRANCH xNoFault;     // brfalse.s  ORIGINAL_CODE
+    IL_INSTR_LOCAL xThrowException;     // ldloc  "throwException"
+    IL_INSTR_SHORT_BRANCH xNoException; // brfalse.s  RETURN_SECTION
+    IL_INSTR_LOCAL xThrowExceptionAgain;    // ldloc  "throwException"
+    BYTE nThrow;                        // throw
     // RETURN_SECTION:
-    0xFE,0x0C,  0,0,        // IL_26 (4):  ldloc  "returnValue"
-    0xA5,       0,0,0,0,    // IL_30 (5):  unbox.any  "token of return-type"
-    0x2A,                   // IL_35 (1):  ret
+    IL_INSTR_LOCAL xReturnValue;        // ldloc  "returnValue"
+    BYTE nRet;                          // ret
+};
+
+// Calls "static bool Trap(int, Exception&)" for methods without return value.
+struct IL_PROLOGUE_TRAP_VOID
+{
+    IL_INSTR_LOCAL xThrowExceptionAddress;  // ldloca  "throwException"
+    IL_INSTR_CALL xTrap;                // call  "static bool Trap(int, Exception&)"
+    IL_INSTR_SHORT_BRANCH xNoFault;     // brfalse.s  ORIGINAL_CODE
+    IL_INSTR_LOCAL xThrowException;     // ldloc  "throwException"
+    IL_INSTR_SHORT_BRANCH xNoException; // brfalse.s  RETURN_SECTION
+    IL_INSTR_LOCAL xThrowExceptionAgain;    // ldloc  "throwException"
+    BYTE nThrow;                        // throw
+    // RETURN_SECTION:
+    BYTE nRet;                          // ret
+};
+
+struct IL_PROLOGUE_ATOMIC
+{
+    IL_PROLOGUE_ARMED xArmed;
+    IL_PROLOGUE_ATOMIC_COUNT xCount;
+    IL_PROLOGUE_GATE xGate;
+    IL_PROLOGUE_TRAP xTrap;
+    // ORIGINAL_CODE:
+};
+
+struct IL_PROLOGUE_ATOMIC_VOID
+{
+    IL_PROLOGUE_ARMED xArmed;
+    IL_PROLOGUE_ATOMIC_COUNT xCount;
+    IL_PROLOGUE_GATE xGate;
+    IL_PROLOGUE_TRAP_VOID xTrap;
     // ORIGINAL_CODE:
+};
+
+struct IL_PROLOGUE_FAST
+{
+    IL_PROLOGUE_ARMED xArmed;
+    IL_PROLOGUE_FAST_COUNT xCount;
+    IL_PROLOGUE_GATE xGate;
+    IL_PROLOGUE_TRAP xTrap;
+    // ORIGINAL_CODE:
+};
+
+struct IL_PROLOGUE_FAST_VOID
+{
+    IL_PROLOGUE_ARMED xArmed;
+    IL_PROLOGUE_FAST_COUNT xCount;
+    IL_PROLOGUE_GATE xGate;
+    IL_PROLOGUE_TRAP_VOID xTrap;
+    // ORIGINAL_CODE:
+};
+
+#pragma pack(pop)
+
+// The distance of a short branch of a template, from the instruction which follows it to the
+// original code, or to the RETURN_SECTION of its trap part.
+#define IL_DISTANCE__TO_ORIGINAL_CODE(prologue, next)   (BYTE)(sizeof(prologue) - offsetof(prologue, next))
+#define IL_DISTANCE__TO_RETURN_SECTION(trap)    (BYTE)(offsetof(trap, nThrow) + 1 - offsetof(trap, xThrowExceptionAgain))
+
+#define IL_INIT__ARMED(prologue) \
+    { { 0x21, 0, 0xE0 }, 0x47, { 0x2C, IL_DISTANCE__TO_ORIGINAL_CODE(prologue, xCount) } }
+#define IL_INIT__ATOMIC_COUNT \
+    { { 0x21, 0, 0xE0 }, { 0x28, 0 } }
+#define IL_INIT__FAST_COUNT \
+    { { 0x21, 0, 0xE0 }, { 0x25, 0x4A, 0x17, 0x58, 0x54 }, { 0x21, 0, 0xE0 }, 0x4A }
+#define IL_INIT__GATE(prologue) \
+    { { 0x21, 0, 0xE0 }, 0x4A, { 0x32, IL_DISTANCE__TO_ORIGINAL_CODE(prologue, xGate.nLdcI4) }, 0x20, 0 }
+#define IL_INIT__TRAP(prologue) \
+    { { { 0xFE, 0x0D }, 0 }, { { 0xFE, 0x0D }, 0 }, { 0x28, 0 }, \
+      { 0x2C, IL_DISTANCE__TO_ORIGINAL_CODE(prologue, xTrap.xThrowException) }, \
+      { { 0xFE, 0x0C }, 0 }, { 0x2C, IL_DISTANCE__TO_RETURN_SECTION(IL_PROLOGUE_TRAP) }, \
+      { { 0xFE, 0x0C }, 0 }, 0x7A, { { 0xFE, 0x0C }, 0 }, 0x2A }
+#define IL_INIT__TRAP_VOID(prologue) \
+    { { { 0xFE, 0x0D }, 0 }, { 0x28, 0 }, \
+      { 0x2C, IL_DISTANCE__TO_ORIGINAL_CODE(prologue, xTrap.xThrowException) }, \
+      { { 0xFE, 0x0C }, 0 }, { 0x2C, IL_DISTANCE__TO_RETURN_SECTION(IL_PROLOGUE_TRAP_VOID) }, \
+      { { 0xFE, 0x0C }, 0 }, 0x7A, 0x2A }
+
+const IL_PROLOGUE_ATOMIC IL_CODE__PROLOGUE_ATOMIC = {
+    IL_INIT__ARMED(IL_PROLOGUE_ATOMIC), IL_INIT__ATOMIC_COUNT,
+    IL_INIT__GATE(IL_PROLOGUE_ATOMIC), IL_INIT__TRAP(IL_PROLOGUE_ATOMIC) };
+const IL_PROLOGUE_ATOMIC_VOID IL_CODE__PROLOGUE_ATOMIC_VOID = {
+    IL_INIT__ARMED(IL_PROLOGUE_ATOMIC_VOID), IL_INIT__ATOMIC_COUNT,
+    IL_INIT__GATE(IL_PROLOGUE_ATOMIC_VOID), IL_INIT__TRAP_VOID(IL_PROLOGUE_ATOMIC_VOID) };
+const IL_PROLOGUE_FAST IL_CODE__PROLOGUE_FAST = {
+    IL_INIT__ARMED(IL_PROLOGUE_FAST), IL_INIT__FAST_COUNT,
+    IL_INIT__GATE(IL_PROLOGUE_FAST), IL_INIT__TRAP(IL_PROLOGUE_FAST) };
+const IL_PROLOGUE_FAST_VOID IL_CODE__PROLOGUE_FAST_VOID = {
+    IL_INIT__ARMED(IL_PROLOGUE_FAST_VOID), IL_INIT__FAST_COUNT,
+    IL_INIT__GATE(IL_PROLOGUE_FAST_VOID), IL_INIT__TRAP_VOID(IL_PROLOGUE_FAST_VOID) };
+
+// Where the values of a prologue go. An offset of 0 means the template has no such value.
+struct IL_PROLOGUE_TEMPLATE
+{
+    const void *pCode;
+    ULONG nSize;
+    ULONG nArmedFlag;           // 8-bytes address of the armed flag of the method
+    ULONG nCallCounter;         // 8-bytes address of the call counter of the method
+    ULONG nFastCallCounter;     // ditto, for the fast count only
+    ULONG nIncrement;           // 4-bytes method token of "Interlocked.Increment", for the atomic count only
+    ULONG nThreshold;           // 8-bytes address of the threshold of the method
+    ULONG nTrapId;              // 4-bytes trap id of the method
+    ULONG nCallTrap;            // 4-bytes method token of "Trap"
+    ULONG vThrowException[3];   // 2-bytes local-var index of "throwException"
+    ULONG vReturnValue[2];      // 2-bytes local-var index of "returnValue"
+};
+
+#define IL_TEMPLATE__COMMON(prologue) \
+    sizeof(prologue), offsetof(prologue, xArmed.xArmedFlag.nAddress), offsetof(prologue, xCount.xCallCounter.nAddress)
+#define IL_TEMPLATE__GATE(prologue) \
+    offsetof(prologue, xGate.xThreshold.nAddress), offsetof(prologue, xGate.nTrapId), offsetof(prologue, xTrap.xTrap.tkMethod), \
+    { offsetof(prologue, xTrap.xThrowExceptionAddress.nIndex), offsetof(prologue, xTrap.xThrowException.nIndex), \
+      offsetof(prologue, xTrap.xThrowExceptionAgain.nIndex) }
+
+const IL_PROLOGUE_TEMPLATE IL_PROLOGUE__ATOMIC = {
+    &IL_CODE__PROLOGUE_ATOMIC, IL_TEMPLATE__COMMON(IL_PROLOGUE_ATOMIC),
+    0, offsetof(IL_PROLOGUE_ATOMIC, xCount.xIncrement.tkMethod), IL_TEMPLATE__GATE(IL_PROLOGUE_ATOMIC),
+    { offsetof(IL_PROLOGUE_ATOMIC, xTrap.xReturnValueAddress.nIndex), offsetof(IL_PROLOGUE_ATOMIC, xTrap.xReturnValue.nIndex) } };
+const IL_PROLOGUE_TEMPLATE IL_PROLOGUE__ATOMIC_VOID = {
+    &IL_CODE__PROLOGUE_ATOMIC_VOID, IL_TEMPLATE__COMMON(IL_PROLOGUE_ATOMIC_VOID),
+    0, offsetof(IL_PROLOGUE_ATOMIC_VOID, xCount.xIncrement.tkMethod), IL_TEMPLATE__GATE(IL_PROLOGUE_ATOMIC_VOID),
+    { 0, 0 } };
+const IL_PROLOGUE_TEMPLATE IL_PROLOGUE__FAST = {
+    &IL_CODE__PROLOGUE_FAST, IL_TEMPLATE__COMMON(IL_PROLOGUE_FAST),
+    offsetof(IL_PROLOGUE_FAST, xCount.xCallCounterAgain.nAddress), 0, IL_TEMPLATE__GATE(IL_PROLOGUE_FAST),
+    { offsetof(IL_PROLOGUE_FAST, xTrap.xReturnValueAddress.nIndex), offsetof(IL_PROLOGUE_FAST, xTrap.xReturnValue.nIndex) } };
+const IL_PROLOGUE_TEMPLATE IL_PROLOGUE__FAST_VOID = {
+    &IL_CODE__PROLOGUE_FAST_VOID, IL_TEMPLATE__COMMON(IL_PROLOGUE_FAST_VOID),
+    offsetof(IL_PROLOGUE_FAST_VOID, xCount.xCallCounterAgain.nAddress), 0, IL_TEMPLATE__GATE(IL_PROLOGUE_FAST_VOID),
+    { 0, 0 } };
+
+// The fast count with return value is the largest variant, and all fit short branches.
+C_ASSERT(sizeof(IL_PROLOGUE_FAST) >= sizeof(IL_PROLOGUE_ATOMIC));
+C_ASSERT(sizeof(IL_PROLOGUE_FAST) >= sizeof(IL_PROLOGUE_FAST_VOID));
+C_ASSERT(sizeof(IL_PROLOGUE_FAST) <= 127);
+const ULONG IL_SIZE__MAX_PROLOGUE = sizeof(IL_PROLOGUE_FAST);
+
+//---------------------------------------------------------
+// Compact prologue IL code templates. Trap(int) keeps the outcome of the fault on the current
+// thread, so the prologue needs no local-var and tiny methods may keep their tiny header. Its
+// parts are concatenated without nop padding: armed flag, call counting, gate, trap id, call
+// to Trap, fault, return, and what a disarmed method goes through.
+
+// Goes to DISARMED while the method is disarmed. Leaves the address of the call counter on the
+// stack in both cases, the armed flag being found at a fixed offset from it.
+const BYTE IL_CODE__COMPACT_ARMED[] = {
+    0x21,       0,0,0,0,0,0,0,0,    // IL__0 (9):  ldc.i8  "address of call counter"
+    0xE0,                   // IL__9 (1):  conv.u
+    0x25,                   // IL_10 (1):  dup
+    0x1E,                   // IL_11 (1):  ldc.i4.8  "offset of armed flag"
+    0x58,                   // IL_12 (1):  add
+    0x47,                   // IL_13 (1):  ldind.u1
+    0x2C,       0,          // IL_14 (2):  brfalse.s  DISARMED
+    0
+};
+
+const ULONG IL_OFFSET__COMPACT_CALL_COUNTER = 1;  // replace as 8-bytes address of the call counter
+const ULONG IL_OFFSET__COMPACT_ARMED_FLAG   = 8;  // offset of the armed flag from the call counter
+const ULONG IL_OFFSET__COMPACT_BRFALSE_DISARMED = 15;  // replace as 1-byte distance from IL_16 to DISARMED
+
+// Counts the call with Interlocked.Increment, leaving the new count on the stack.
+const BYTE IL_CODE__COMPACT_ATOMIC_COUNT[] = {
+    0x28,       0,0,0,0,    // IL__0 (5):  call  "static int Interlocked.Increment(int&)"
+    0
+};
+
+const ULONG IL_OFFSET__COMPACT_INCREMENT = 1;  // replace as 4-bytes method token of "Interlocked.Increment"
+
+// Counts the call with a plain increment, leaving the new count on the stack.
+const BYTE IL_CODE__COMPACT_FAST_COUNT[] = {
+    0x25,                   // IL__0 (1):  dup
+    0x25,                   // IL__1 (1):  dup
+    0x4A,                   // IL__2 (1):  ldind.i4
+    0x17,                   // IL__3 (1):  ldc.i4.1
+    0x58,                   // IL__4 (1):  add
+    0x54,                   // IL__5 (1):  stind.i4
+    0x4A,                   // IL__6 (1):  ldind.i4
+    0
+};
+
+// Goes to the original code until the count reaches the threshold.
+const BYTE IL_CODE__COMPACT_GATE[] = {
+    0x21,       0,0,0,0,0,0,0,0,    // IL__0 (9):  ldc.i8  "address of threshold"
+    0xE0,                   // IL__9 (1):  conv.u
+    0x4A,                   // IL_10 (1):  ldind.i4
+    0x32,       0,          // IL_11 (2):  blt.s  ORIGINAL_CODE
     0
 };
 
-const ULONG IL_OFFSET__LOCALVAR_1[] = {2, 17, 23, 0};    // replace as 2-bytes local-var index of "throwException"
-const ULONG IL_OFFSET__LOCALVAR_2[] = {6, 28, 0};    // replace as 2-bytes local-var index of "returnValue"
-const ULONG IL_OFFSET__CALL_TRAP    = 9;    // replace as 4-bytes method token of "Trap"
+const ULONG IL_OFFSET__COMPACT_THRESHOLD = 1;   // replace as 8-bytes address of the threshold
+const ULONG IL_OFFSET__COMPACT_BLT      = 12;   // replace as 1-byte distance from IL_13 to the original code
 
-const ULONG IL_SIZE__PROLOGUE       = 36;
-const ULONG IL_SIZE__RETURN_VOID    = 10;
-const ULONG IL_SIZE__RETURN_OBJECT  = 6;
-const ULONG IL_OFFSET__RETURN       = 26;
-const ULONG IL_OFFSET__UNBOX        = 30;
-const ULONG IL_OFFSET__RETURN_TYPE  = 31;
+// Pushes the trap id, in its short form for the first trap ids.
+const BYTE IL_CODE__COMPACT_SHORT_TRAP_ID[] = {
+    0x1F,       0,          // IL__0 (2):  ldc.i4.s  "trap id"
+    0
+};
 
-const BYTE IL_CODE__JUST_RETURN[] = {
-    0x2A,                   // IL_26 (1):  ret
-    0,0,0,0,0,0,0,0,0,      // IL_27 (9):  nop, ..., nop
+const BYTE IL_CODE__COMPACT_TRAP_ID[] = {
+    0x20,       0,0,0,0,    // IL__0 (5):  ldc.i4  "trap id"
+    0
+};
+
+const ULONG IL_OFFSET__COMPACT_TRAP_ID  = 1;    // replace as 1-byte or 4-bytes trap id of the method
+const ULONG IL_NUMBER__MAX_SHORT_TRAP_ID = 127;
+
+const BYTE IL_CODE__COMPACT_CALL_TRAP[] = {
+    0x28,       0,0,0,0,    // IL__0 (5):  call  "static bool Trap(int)"
+    0x2C,       0,          // IL__5 (2):  brfalse.s  ORIGINAL_CODE
+    0
+};
+
+const ULONG IL_OFFSET__COMPACT_CALL_TRAP = 1;   // replace as 4-bytes method token of "Trap"
+const ULONG IL_OFFSET__COMPACT_BRFALSE  = 6;    // replace as 1-byte distance from IL__7 to the original code
+
+// Throws the exception of the fault, if any, then returns.
+const BYTE IL_CODE__COMPACT_FAULT[] = {
+    0x28,       0,0,0,0,    // IL__0 (5):  call  "static Exception TakeFaultedException()"
+    0x25,                   // IL__5 (1):  dup
+    0x2C,       1,          // IL__6 (2):  brfalse.s  RETURN_SECTION
+    0x7A,                   // IL__8 (1):  throw
+    // RETURN_SECTION:
+    0x26,                   // IL__9 (1):  pop
+    0
+};
+
+const ULONG IL_OFFSET__COMPACT_TAKE_EXCEPTION = 1;  // replace as 4-bytes method token of "TakeFaultedException"
+
+const BYTE IL_CODE__COMPACT_RETURN_VALUE[] = {
+    0x28,       0,0,0,0,    // IL__0 (5):  call  "static T TakeFaultedReturnValue<T>()"
+    0x2A,                   // IL__5 (1):  ret
+    0
+};
+
+const ULONG IL_OFFSET__COMPACT_TAKE_RETURN_VALUE = 1;  // replace as 4-bytes method-spec token of "TakeFaultedReturnValue<T>"
+
+const BYTE IL_CODE__COMPACT_RETURN_VOID[] = {
+    0x2A,                   // IL__0 (1):  ret
+    0
+};
+
+// Reached only by the branch of the armed flag, which is the only one to leave a value on the
+// stack. The other branches go to the original code with an empty stack.
+const BYTE IL_CODE__COMPACT_DISARMED[] = {
+    // DISARMED:
+    0x26,                   // IL__0 (1):  pop  "address of call counter"
+    // ORIGINAL_CODE:
+    0
+};
+
+// Each template above ends with a 0 which is not part of the code.
+const ULONG IL_SIZE__MAX_COMPACT_PROLOGUE = (sizeof(IL_CODE__COMPACT_ARMED) - 1) + (sizeof(IL_CODE__COMPACT_FAST_COUNT) - 1)
+    + (sizeof(IL_CODE__COMPACT_GATE) - 1) + (sizeof(IL_CODE__COMPACT_TRAP_ID) - 1) + (sizeof(IL_CODE__COMPACT_CALL_TRAP) - 1)
+    + (sizeof(IL_CODE__COMPACT_FAULT) - 1) + (sizeof(IL_CODE__COMPACT_RETURN_VALUE) - 1) + (sizeof(IL_CODE__COMPACT_DISARMED) - 1);
+
+//---------------------------------------------------------
+// Offline prologue IL code templates, written into assemblies on disk by COfflineRewriter. No
+// engine runs in the process, so there is neither trap id nor gate: the prologue calls
+// "static bool Trap(Exception&, object&)", which finds the method by walking the stack.
+
+#pragma pack(push, 1)
+
+struct IL_PROLOGUE_OFFLINE
+{
+    IL_INSTR_LOCAL xThrowExceptionAddress;  // ldloca  "throwException"
+    IL_INSTR_LOCAL xReturnValueAddress; // ldloca  "returnValue"
+    IL_INSTR_CALL xTrap;                // call  "static bool Trap(Exception&, object&)"
+    IL_INSTR_SHORT_BRANCH xNoFault;     // brfalse.s  ORIGINAL_CODE
+    IL_INSTR_LOCAL xThrowException;     // ldloc  "throwException"
+    IL_INSTR_SHORT_BRANCH xNoException; // brfalse.s  RETURN_SECTION
+    IL_INSTR_LOCAL xThrowExceptionAgain;    // ldloc  "throwException"
+    BYTE nThrow;                        // throw
+    // RETURN_SECTION:
+    IL_INSTR_LOCAL xReturnValue;        // ldloc  "returnValue"
+    BYTE nUnboxAny;                     // unbox.any  "return type"
+    DWORD tkReturnType;
+    BYTE nRet;                          // ret
+    // ORIGINAL_CODE:
+};
+
+// The local-var "returnValue" is still passed to Trap, and dropped.
+struct IL_PROLOGUE_OFFLINE_VOID
+{
+    IL_INSTR_LOCAL xThrowExceptionAddress;  // ldloca  "throwException"
+    IL_INSTR_LOCAL xReturnValueAddress; // ldloca  "returnValue"
+    IL_INSTR_CALL xTrap;                // call  "static bool Trap(Exception&, object&)"
+    IL_INSTR_SHORT_BRANCH xNoFault;     // brfalse.s  ORIGINAL_CODE
+    IL_INSTR_LOCAL xThrowException;     // ldloc  "throwException"
+    IL_INSTR_SHORT_BRANCH xNoException; // brfalse.s  RETURN_SECTION
+    IL_INSTR_LOCAL xThrowExceptionAgain;    // ldloc  "throwException"
+    BYTE nThrow;                        // throw
+    // RETURN_SECTION:
+    BYTE nRet;                          // ret
+    // ORIGINAL_CODE:
+};
+
+#pragma pack(pop)
+
+#define IL_INIT__OFFLINE_TRAP(prologue) \
+    { { 0xFE, 0x0D }, 0 }, { { 0xFE, 0x0D }, 0 }, { 0x28, 0 }, \
+    { 0x2C, IL_DISTANCE__TO_ORIGINAL_CODE(prologue, xThrowException) }, \
+    { { 0xFE, 0x0C }, 0 }, { 0x2C, IL_DISTANCE__TO_RETURN_SECTION(prologue) }, \
+    { { 0xFE, 0x0C }, 0 }, 0x7A
+
+const IL_PROLOGUE_OFFLINE IL_CODE__OFFLINE_PROLOGUE = {
+    IL_INIT__OFFLINE_TRAP(IL_PROLOGUE_OFFLINE), { { 0xFE, 0x0C }, 0 }, 0xA5, 0, 0x2A };
+const IL_PROLOGUE_OFFLINE_VOID IL_CODE__OFFLINE_PROLOGUE_VOID = {
+    IL_INIT__OFFLINE_TRAP(IL_PROLOGUE_OFFLINE_VOID), 0x2A };
+
+// Where the values of an offline prologue go, see IL_PROLOGUE_TEMPLATE.
+struct IL_OFFLINE_PROLOGUE_TEMPLATE
+{
+    const void *pCode;
+    ULONG nSize;
+    ULONG nCallTrap;            // 4-bytes method token of "Trap"
+    ULONG nReturnType;          // 4-bytes type-spec token of the return type, 0 if void
+    ULONG vThrowException[3];   // 2-bytes local-var index of "throwException"
+    ULONG vReturnValue[2];      // 2-bytes local-var index of "returnValue", 0 if unused
+};
+
+#define IL_TEMPLATE__OFFLINE_TRAP(prologue) \
+    sizeof(prologue), offsetof(prologue, xTrap.tkMethod)
+#define IL_TEMPLATE__OFFLINE_THROW_EXCEPTION(prologue) \
+    { offsetof(prologue, xThrowExceptionAddress.nIndex), offsetof(prologue, xThrowException.nIndex), \
+      offsetof(prologue, xThrowExceptionAgain.nIndex) }
+
+const IL_OFFLINE_PROLOGUE_TEMPLATE IL_OFFLINE_PROLOGUE = {
+    &IL_CODE__OFFLINE_PROLOGUE, IL_TEMPLATE__OFFLINE_TRAP(IL_PROLOGUE_OFFLINE),
+    offsetof(IL_PROLOGUE_OFFLINE, tkReturnType), IL_TEMPLATE__OFFLINE_THROW_EXCEPTION(IL_PROLOGUE_OFFLINE),
+    { offsetof(IL_PROLOGUE_OFFLINE, xReturnValueAddress.nIndex), offsetof(IL_PROLOGUE_OFFLINE, xReturnValue.nIndex) } };
+const IL_OFFLINE_PROLOGUE_TEMPLATE IL_OFFLINE_PROLOGUE_VOID = {
+    &IL_CODE__OFFLINE_PROLOGUE_VOID, IL_TEMPLATE__OFFLINE_TRAP(IL_PROLOGUE_OFFLINE_VOID),
+    0, IL_TEMPLATE__OFFLINE_THROW_EXCEPTION(IL_PROLOGUE_OFFLINE_VOID),
+    { offsetof(IL_PROLOGUE_OFFLINE_VOID, xReturnValueAddress.nIndex), 0 } };
+
+C_ASSERT(sizeof(IL_PROLOGUE_OFFLINE) >= sizeof(IL_PROLOGUE_OFFLINE_VOID));
+const ULONG IL_SIZE__MAX_OFFLINE_PROLOGUE = sizeof(IL_PROLOGUE_OFFLINE);
+
+//---------------------------------------------------------
+// Static fault IL code templates, which take the place of the prologue
+
+const BYTE IL_CODE__THROW_FAULT[] = {
+    0x73,       0,0,0,0,    // IL__0 (5):  newobj  "default constructor of the exception"
+    0x7A,                   // IL__5 (1):  throw
+    // ORIGINAL_CODE:
+    0
+};
+
+const BYTE IL_CODE__RETURN_NULL_FAULT[] = {
+    0x14,                   // IL__0 (1):  ldnull
+    0x2A,                   // IL__1 (1):  ret
+    // ORIGINAL_CODE:
+    0
+};
+
+const BYTE IL_CODE__RETURN_VOID_FAULT[] = {
+    0x2A,                   // IL__0 (1):  ret
     // ORIGINAL_CODE:
     0
 };
 
-const ULONG IL_NUMBER__MIN_STACK    = 2;
+const BYTE IL_CODE__RETURN_I4_FAULT[] = {
+    0x20,       0,0,0,0,    // IL__0 (5):  ldc.i4  "value"
+    0x2A,                   // IL__5 (1):  ret
+    // ORIGINAL_CODE:
+    0
+};
+
+const BYTE IL_CODE__RETURN_I8_FAULT[] = {
+    0x21,       0,0,0,0,0,0,0,0,    // IL__0 (9):  ldc.i8  "value"
+    0x2A,                   // IL__9 (1):  ret
+    // ORIGINAL_CODE:
+    0
+};
+
+const BYTE IL_CODE__RETURN_R4_FAULT[] = {
+    0x22,       0,0,0,0,    // IL__0 (5):  ldc.r4  "value"
+    0x2A,                   // IL__5 (1):  ret
+    // ORIGINAL_CODE:
+    0
+};
+
+const BYTE IL_CODE__RETURN_R8_FAULT[] = {
+    0x23,       0,0,0,0,0,0,0,0,    // IL__0 (9):  ldc.r8  "value"
+    0x2A,                   // IL__9 (1):  ret
+    // ORIGINAL_CODE:
+    0
+};
+
+const ULONG IL_OFFSET__STATIC_FAULT_OPERAND = 1;  // replace as constructor token or value
+
+// Latency fault, which falls through to the original code after the delay
+const BYTE IL_CODE__DELAY_FAULT[] = {
+    0x20,       0,0,0,0,    // IL__0 (5):  ldc.i4  "latency id"
+    0x21,       0,0,0,0,0,0,0,0,    // IL__5 (9):  ldc.i8  "address of CLatencyFault::InjectById"
+    0xD3,                   // IL_14 (1):  conv.i
+    0x29,       0,0,0,0,    // IL_15 (5):  calli  "unmanaged stdcall void(int)"
+    // ORIGINAL_CODE:
+    0
+};
+
+const ULONG IL_OFFSET__LATENCY_ID   = 1;    // replace as 4-bytes latency id
+const ULONG IL_OFFSET__LATENCY_ROUTINE = 6; // replace as 8-bytes address of the latency routine
+const ULONG IL_OFFSET__LATENCY_SIG  = 16;   // replace as 4-bytes stand-alone signature token
+
+// Signature of the latency routine "unmanaged stdcall void(int)"
+const COR_SIGNATURE SIG__LATENCY_ROUTINE[] = {
+    IMAGE_CEE_CS_CALLCONV_STDCALL,  // unmanaged stdcall
+    1,                              // parameter count
+    ELEMENT_TYPE_VOID,              // return type
+    ELEMENT_TYPE_I4                 // latency id
+};
+
+// Signature of the default constructor "instance void .ctor()"
+const COR_SIGNATURE SIG__DEFAULT_CONSTRUCTOR[] = {
+    IMAGE_CEE_CS_CALLCONV_HASTHIS,  // instance
+    0,                              // parameter count
+    ELEMENT_TYPE_VOID               // return type
+};
+
+// Signature of "static int Interlocked.Increment(int&)"
+const COR_SIGNATURE SIG__INTERLOCKED_INCREMENT[] = {
+    IMAGE_CEE_CS_CALLCONV_DEFAULT,  // static
+    1,                              // parameter count
+    ELEMENT_TYPE_I4,                // return type
+    ELEMENT_TYPE_BYREF,             // location
+    ELEMENT_TYPE_I4
+};
+
+//---------------------------------------------------------
+// Leading part of the signatures of "static bool Trap<T>(int, Exception&, T&)" and of
+// "static bool Trap(int, Exception&)". Only the scope-independent bytes are compared (type
+// tokens differ from scope to scope), which is enough to tell the overloads of Trap apart.
+
+const COR_SIGNATURE SIG_PREFIX__TRAP[] = {
+    IMAGE_CEE_CS_CALLCONV_GENERIC,  // static, generic
+    1,                              // generic parameter count
+    3,                              // parameter count
+    ELEMENT_TYPE_BOOLEAN,           // return type
+    ELEMENT_TYPE_I4                 // trap id
+};
+
+const COR_SIGNATURE SIG_PREFIX__TRAP_VOID[] = {
+    IMAGE_CEE_CS_CALLCONV_DEFAULT,  // static
+    2,                              // parameter count
+    ELEMENT_TYPE_BOOLEAN,           // return type
+    ELEMENT_TYPE_I4                 // trap id
+};
+
+// Leading part of the signatures of "static bool Trap(int)", "static Exception TakeFaultedException()"
+// and "static T TakeFaultedReturnValue<T>()", called by the compact prologue.
+
+const COR_SIGNATURE SIG_PREFIX__TRAP_COMPACT[] = {
+    IMAGE_CEE_CS_CALLCONV_DEFAULT,  // static
+    1,                              // parameter count
+    ELEMENT_TYPE_BOOLEAN,           // return type
+    ELEMENT_TYPE_I4                 // trap id
+};
+
+const COR_SIGNATURE SIG_PREFIX__TAKE_FAULTED_EXCEPTION[] = {
+    IMAGE_CEE_CS_CALLCONV_DEFAULT,  // static
+    0,                              // parameter count
+    ELEMENT_TYPE_CLASS              // return type
+};
+
+const COR_SIGNATURE SIG__TAKE_FAULTED_RETURN_VALUE[] = {
+    IMAGE_CEE_CS_CALLCONV_GENERIC,  // static, generic
+    1,                              // generic parameter count
+    0,                              // parameter count
+    ELEMENT_TYPE_MVAR,              // return type
+    0                               // T
+};
+
+// Leading part of the signature of "static bool Trap(Exception&, object&)", called by the offline
+// prologue, and the type of its local-var "returnValue".
+
+const COR_SIGNATURE SIG_PREFIX__TRAP_OFFLINE[] = {
+    IMAGE_CEE_CS_CALLCONV_DEFAULT,  // static
+    2,                              // parameter count
+    ELEMENT_TYPE_BOOLEAN,           // return type
+    ELEMENT_TYPE_BYREF              // exception
+};
+
+const COR_SIGNATURE SIG__OBJECT[] = {
+    ELEMENT_TYPE_OBJECT
+};
 
 END_DEFAULT_NAMESPACE
@@ -0,0 +1,114 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include "InstantiationCache.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Implementation of CInstantiationCache
+
+CComAutoCriticalSection CInstantiationCache::m_csTokens;
+CAtlMap<CInstantiationCache::INSTANTIATION_KEY, mdMethodSpec, CInstantiationCache::CInstantiationKeyTraits>
+    CInstantiationCache::m_mapTokens;
+volatile LONG CInstantiationCache::m_nLookups = 0;
+volatile LONG CInstantiationCache::m_nHits = 0;
+
+mdMethodSpec CInstantiationCache::Lookup(ModuleID moduleId, mdToken tkGenericMethod, PCCOR_SIGNATURE pvTypeArgument,
+                                         ULONG nTypeArgumentSize)
+{
+    ::InterlockedIncrement(&m_nLookups);
+
+    INSTANTIATION_KEY xKey;
+    if(!MakeKey(moduleId, tkGenericMethod, pvTypeArgument, nTypeArgumentSize, xKey))
+    {
+        return mdMethodSpecNil;
+    }
+    mdMethodSpec tkMethodSpec = mdMethodSpecNil;
+    {
+        CComCritSecLock<CComAutoCriticalSection> xLock(m_csTokens);
+        m_mapTokens.Lookup(xKey, tkMethodSpec);
+    }
+
+    if(mdMethodSpecNil != tkMethodSpec)
+    {
+        ::InterlockedIncrement(&m_nHits);
+    }
+    return tkMethodSpec;
+}
+
+void CInstantiationCache::Add(ModuleID moduleId, mdToken tkGenericMethod, PCCOR_SIGNATURE pvTypeArgument,
+                              ULONG nTypeArgumentSize, mdMethodSpec tkMethodSpec)
+{
+    INSTANTIATION_KEY xKey;
+    if(!MakeKey(moduleId, tkGenericMethod, pvTypeArgument, nTypeArgumentSize, xKey))
+    {
+        return;
+    }
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csTokens);
+    m_mapTokens.SetAt(xKey, tkMethodSpec);
+}
+
+void CInstantiationCache::RemoveModule(ModuleID moduleId)
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csTokens);
+    POSITION pos = m_mapTokens.GetStartPosition();
+    while(NULL != pos)
+    {
+        POSITION posCurrent = pos;
+        if(m_mapTokens.GetNext(pos)->m_key.moduleId == moduleId)
+        {
+            m_mapTokens.RemoveAtPos(posCurrent);
+        }
+    }
+}
+
+void CInstantiationCache::GetCounters(ULONG &rnLookups, ULONG &rnHits)
+{
+    rnLookups = static_cast<ULONG>(m_nLookups);
+    rnHits = static_cast<ULONG>(m_nHits);
+}
+
+BOOL CInstantiationCache::MakeKey(ModuleID moduleId, mdToken tkGenericMethod, PCCOR_SIGNATURE pvTypeArgument,
+                                  ULONG nTypeArgumentSize, INSTANTIATION_KEY &rxKey)
+{
+    if(nTypeArgumentSize > MAX_CACHED_SIGNATURE_SIZE)
+    {
+        return FALSE;
+    }
+    rxKey.moduleId = moduleId;
+    rxKey.tkGenericMethod = tkGenericMethod;
+    rxKey.nSignatureSize = nTypeArgumentSize;
+    ::memcpy(rxKey.vSignature, pvTypeArgument, nTypeArgumentSize);
+
+    // FNV-1a of the signature, mixed with the token and the module id (an aligned pointer)
+    ULONG nHash = 2166136261U;
+    for(ULONG i = 0; i < nTypeArgumentSize; i++)
+    {
+        nHash = (nHash ^ pvTypeArgument[i]) * 16777619U;
+    }
+    rxKey.nHash = (nHash ^ tkGenericMethod) * 31 + static_cast<ULONG>(moduleId >> 4);
+    return TRUE;
+}
+
+#pragma endregion
+
+#if defined(FAULT_ENGINE_TEST_EXPORTS)
+
+#pragma region Exported Functions (Called by Tests)
+
+extern "C" BOOL WINAPI FaultEngineGetInstantiationCounters(ULONG *pnLookups, ULONG *pnHits)
+{
+    if((NULL == pnLookups) || (NULL == pnHits))
+    {
+        return FALSE;
+    }
+    CInstantiationCache::GetCounters(*pnLookups, *pnHits);
+    return TRUE;
+}
+
+#pragma endregion
+
+#endif // FAULT_ENGINE_TEST_EXPORTS
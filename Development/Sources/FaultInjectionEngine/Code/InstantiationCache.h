@@ -0,0 +1,87 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  Declaration of class CInstantiationCache.
+//  Trap<T> and TakeFaultedReturnValue<T> are instantiated with the return type of every trapped
+//  method, and many methods of a module return the same type, e.g. Task<T> in asynchronous
+//  code or List<T>. The method-spec token defined for a generic method and a return type is
+//  remembered per module, keyed by the raw bytes of the return type signature, so that later
+//  methods reuse it instead of defining it again in the metadata.
+//
+
+#pragma once
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Declaration of CInstantiationCache
+
+class CInstantiationCache
+{
+public:
+    // Longer signatures (deeply nested generic instances) are not cached.
+    static const ULONG MAX_CACHED_SIGNATURE_SIZE = 64;
+
+    /// <summary>
+    /// Get the method-spec token of the generic method instantiated with the type argument in
+    /// the module, or mdMethodSpecNil if it is not cached. Count the lookup.
+    /// </summary>
+    static mdMethodSpec Lookup(ModuleID moduleId, mdToken tkGenericMethod, PCCOR_SIGNATURE pvTypeArgument,
+        ULONG nTypeArgumentSize);
+
+    /// <summary>
+    /// Remember the method-spec token of the generic method instantiated with the type argument.
+    /// </summary>
+    static void Add(ModuleID moduleId, mdToken tkGenericMethod, PCCOR_SIGNATURE pvTypeArgument,
+        ULONG nTypeArgumentSize, mdMethodSpec tkMethodSpec);
+
+    /// <summary>
+    /// Forget the tokens of a module being unloaded. Its module id may be reused by the runtime.
+    /// </summary>
+    static void RemoveModule(ModuleID moduleId);
+
+    /// <summary>
+    /// Get the number of lookups so far, and how many of them found a token.
+    /// </summary>
+    static void GetCounters(ULONG &rnLookups, ULONG &rnHits);
+
+private:
+    struct INSTANTIATION_KEY
+    {
+        ModuleID moduleId;
+        mdToken tkGenericMethod;
+        ULONG nHash;            // of the signature, computed once by MakeKey
+        ULONG nSignatureSize;
+        COR_SIGNATURE vSignature[MAX_CACHED_SIGNATURE_SIZE];
+    };
+
+    class CInstantiationKeyTraits : public CElementTraitsBase<INSTANTIATION_KEY>
+    {
+    public:
+        static ULONG Hash(const INSTANTIATION_KEY &rxKey)
+        {
+            return rxKey.nHash;
+        }
+
+        static bool CompareElements(const INSTANTIATION_KEY &rxKey1, const INSTANTIATION_KEY &rxKey2)
+        {
+            return (rxKey1.nHash == rxKey2.nHash) && (rxKey1.moduleId == rxKey2.moduleId) &&
+                (rxKey1.tkGenericMethod == rxKey2.tkGenericMethod) && (rxKey1.nSignatureSize == rxKey2.nSignatureSize) &&
+                (0 == ::memcmp(rxKey1.vSignature, rxKey2.vSignature, rxKey1.nSignatureSize));
+        }
+    };
+
+    static BOOL MakeKey(ModuleID moduleId, mdToken tkGenericMethod, PCCOR_SIGNATURE pvTypeArgument,
+        ULONG nTypeArgumentSize, INSTANTIATION_KEY &rxKey);
+
+    static CComAutoCriticalSection m_csTokens;  // JIT compilation happens on many threads
+    static CAtlMap<INSTANTIATION_KEY, mdMethodSpec, CInstantiationKeyTraits> m_mapTokens;
+    static volatile LONG m_nLookups;
+    static volatile LONG m_nHits;
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
@@ -0,0 +1,219 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include <math.h>
+#include "LatencyFault.h"
+#include "TraceAndLog.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Helper Functions
+
+// The waitable timer fires up to one timer period (1ms by default on Windows) late, so sleeping
+// stops that much before the deadline and the rest is waited by yielding.
+static const LONGLONG TIMER_SLACK_IN_NANOSECONDS = 1000000;
+
+static LONGLONG GetPerformanceFrequency(void)
+{
+    LARGE_INTEGER xFrequency;
+    ::QueryPerformanceFrequency(&xFrequency);
+    return xFrequency.QuadPart;
+}
+
+static const LONGLONG _nPerformanceFrequency = GetPerformanceFrequency();
+
+// SplitMix64, a good 64-bit mixer of a weak seed (clock, thread and a counter)
+static ULONGLONG MixBits(ULONGLONG nSeed)
+{
+    nSeed += 0x9E3779B97F4A7C15ULL;
+    nSeed = (nSeed ^ (nSeed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    nSeed = (nSeed ^ (nSeed >> 27)) * 0x94D049BB133111EBULL;
+    return nSeed ^ (nSeed >> 31);
+}
+
+// Uniform in (0, 1], from 32 random bits
+static double ToUnitInterval(ULONG nBits)
+{
+    return ((double)nBits + 1.0) / 4294967296.0;
+}
+
+#pragma endregion
+
+#pragma region Implementation of CLatencyFault
+
+CComAutoCriticalSection CLatencyFault::m_csSpecs;
+CLatencyFault::LATENCY_SPEC CLatencyFault::m_vSpecs[PREFERRED_MAX_LATENCY_FAULT_COUNT];
+volatile LONG CLatencyFault::m_nSpecCount = 0;
+volatile LONG CLatencyFault::m_nDrawCount = 0;
+
+BOOL CLatencyFault::Parse(LPCTSTR pstrArgument, LATENCY_SPEC &rxSpec)
+{
+    ASSERT(NULL != pstrArgument);
+
+    // <mode>:<distribution>:<parameter 1>:<parameter 2>
+    CString szArgument(pstrArgument);
+    CString vszFields[4];
+    int nPosition = 0;
+    int nField;
+    for(nField = 0; nField < 4; nField++)
+    {
+        vszFields[nField] = szArgument.Tokenize(_T(":"), nPosition);
+        if(vszFields[nField].IsEmpty())
+        {
+            return FALSE;
+        }
+    }
+    if(-1 != nPosition)
+    {
+        return FALSE;  // extra fields
+    }
+
+    if(vszFields[0] == _T("spin"))
+        rxSpec.nMode = WAIT_SPIN;
+    else if(vszFields[0] == _T("yield"))
+        rxSpec.nMode = WAIT_YIELD;
+    else if(vszFields[0] == _T("sleep"))
+        rxSpec.nMode = WAIT_SLEEP;
+    else
+        return FALSE;
+
+    if(vszFields[1] == _T("fixed"))
+        rxSpec.nDistribution = DISTRIBUTION_FIXED;
+    else if(vszFields[1] == _T("uniform"))
+        rxSpec.nDistribution = DISTRIBUTION_UNIFORM;
+    else if(vszFields[1] == _T("lognormal"))
+        rxSpec.nDistribution = DISTRIBUTION_LOGNORMAL;
+    else
+        return FALSE;
+
+    LPTSTR pstrEnd;
+    rxSpec.fParameter1 = _tcstod(vszFields[2], &pstrEnd);
+    if(_T('\0') != *pstrEnd)
+    {
+        return FALSE;
+    }
+    rxSpec.fParameter2 = _tcstod(vszFields[3], &pstrEnd);
+    if(_T('\0') != *pstrEnd)
+    {
+        return FALSE;
+    }
+
+    return (0 <= rxSpec.fParameter1) && (0 <= rxSpec.fParameter2) &&
+        ((DISTRIBUTION_UNIFORM != rxSpec.nDistribution) || (rxSpec.fParameter1 <= rxSpec.fParameter2));
+}
+
+BOOL CLatencyFault::Register(const LATENCY_SPEC &rxSpec, ULONG &rnLatencyId)
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csSpecs);
+    if(m_nSpecCount >= PREFERRED_MAX_LATENCY_FAULT_COUNT)
+    {
+        return FALSE;
+    }
+
+    // Filled in before the count is published, the prologue only gets ids below the count.
+    rnLatencyId = (ULONG)m_nSpecCount;
+    m_vSpecs[rnLatencyId] = rxSpec;
+    ::InterlockedIncrement(&m_nSpecCount);
+    return TRUE;
+}
+
+void CLatencyFault::Inject(const LATENCY_SPEC &rxSpec)
+{
+    Wait(rxSpec.nMode, DrawNanoseconds(rxSpec));
+}
+
+void WINAPI CLatencyFault::InjectById(int nLatencyId)
+{
+    if((0 <= nLatencyId) && (nLatencyId < m_nSpecCount))
+    {
+        Inject(m_vSpecs[nLatencyId]);
+    }
+}
+
+double CLatencyFault::DrawNanoseconds(const LATENCY_SPEC &rxSpec)
+{
+    if(DISTRIBUTION_FIXED == rxSpec.nDistribution)
+    {
+        return rxSpec.fParameter1;
+    }
+
+    LARGE_INTEGER xNow;
+    ::QueryPerformanceCounter(&xNow);
+    ULONGLONG nBits = MixBits((ULONGLONG)xNow.QuadPart ^ ((ULONGLONG)::GetCurrentThreadId() << 32) ^
+        (ULONGLONG)::InterlockedIncrement(&m_nDrawCount));
+    double fUniform1 = ToUnitInterval((ULONG)nBits);
+    double fUniform2 = ToUnitInterval((ULONG)(nBits >> 32));
+
+    if(DISTRIBUTION_UNIFORM == rxSpec.nDistribution)
+    {
+        return rxSpec.fParameter1 + (rxSpec.fParameter2 - rxSpec.fParameter1) * fUniform1;
+    }
+
+    // Box-Muller transform gives a standard normal sample
+    ASSERT(DISTRIBUTION_LOGNORMAL == rxSpec.nDistribution);
+    const double PI = 3.14159265358979323846;
+    double fNormal = ::sqrt(-2.0 * ::log(fUniform1)) * ::cos(2.0 * PI * fUniform2);
+    return rxSpec.fParameter1 * ::exp(rxSpec.fParameter2 * fNormal);
+}
+
+void CLatencyFault::Wait(WAIT_MODE nMode, double fNanoseconds)
+{
+    LARGE_INTEGER xNow;
+    ::QueryPerformanceCounter(&xNow);
+    LONGLONG nDeadline = xNow.QuadPart + (LONGLONG)(fNanoseconds * _nPerformanceFrequency / 1e9);
+
+    if(WAIT_SLEEP == nMode)
+    {
+        LONGLONG nSleepIn100Nanoseconds = ((LONGLONG)fNanoseconds - TIMER_SLACK_IN_NANOSECONDS) / 100;
+        if(0 < nSleepIn100Nanoseconds)
+        {
+            HANDLE hTimer = ::CreateWaitableTimer(NULL, TRUE, NULL);
+            if(NULL != hTimer)
+            {
+                LARGE_INTEGER xDueTime;
+                xDueTime.QuadPart = -nSleepIn100Nanoseconds;  // negative for relative time
+                if(::SetWaitableTimer(hTimer, &xDueTime, 0, NULL, NULL, FALSE))
+                {
+                    ::WaitForSingleObject(hTimer, INFINITE);
+                }
+                ::CloseHandle(hTimer);
+            }
+        }
+    }
+
+    for(;;)
+    {
+        ::QueryPerformanceCounter(&xNow);
+        if(xNow.QuadPart >= nDeadline)
+        {
+            break;
+        }
+        if(WAIT_SPIN == nMode)
+        {
+            YieldProcessor();
+        }
+        else
+        {
+            ::SwitchToThread();
+        }
+    }
+}
+
+#pragma endregion
+
+#pragma region Exported Functions (Called by LatencyFault)
+
+extern "C" void WINAPI FaultEngineInjectLatency(int nMode, int nDistribution, double fParameter1, double fParameter2)
+{
+    CLatencyFault::LATENCY_SPEC xSpec;
+    xSpec.nMode = (CLatencyFault::WAIT_MODE)nMode;
+    xSpec.nDistribution = (CLatencyFault::DISTRIBUTION)nDistribution;
+    xSpec.fParameter1 = fParameter1;
+    xSpec.fParameter2 = fParameter2;
+    CLatencyFault::Inject(xSpec);
+}
+
+#pragma endregion
@@ -0,0 +1,85 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  Declaration of class CLatencyFault.
+//  A latency fault delays the call of the faulted method, which then runs its original code.
+//  The delay is drawn from a distribution on every call and waited natively, either by
+//  spinning, by yielding the processor or by sleeping on a high resolution timer, so it is
+//  much more precise than a Thread.Sleep called from a managed fault.
+//  A static latency fault is given in the method filter as
+//      delay=<spin|yield|sleep>:<fixed|uniform|lognormal>:<parameter 1>:<parameter 2>
+//  where the parameters are (delay, unused), (minimum, maximum) or (median, sigma), all
+//  durations in nanoseconds. The prologue calls the engine directly by calli.
+//
+
+#pragma once
+
+#include "Settings.h"
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Declaration of CLatencyFault
+
+class CLatencyFault
+{
+public:
+    enum WAIT_MODE
+    {
+        WAIT_SPIN,
+        WAIT_YIELD,
+        WAIT_SLEEP,
+    };
+
+    enum DISTRIBUTION
+    {
+        DISTRIBUTION_FIXED,
+        DISTRIBUTION_UNIFORM,
+        DISTRIBUTION_LOGNORMAL,
+    };
+
+    struct LATENCY_SPEC
+    {
+        WAIT_MODE nMode;
+        DISTRIBUTION nDistribution;
+        double fParameter1;
+        double fParameter2;
+    };
+
+public:
+    /// <summary>
+    /// Parse the argument of a "delay=" fault descriptor. Return FALSE if it is malformed.
+    /// </summary>
+    static BOOL Parse(LPCTSTR pstrArgument, LATENCY_SPEC &rxSpec);
+
+    /// <summary>
+    /// Keep the latency for a prologue and get its id, which the prologue passes to InjectById.
+    /// Return FALSE if there is no room for another latency.
+    /// </summary>
+    static BOOL Register(const LATENCY_SPEC &rxSpec, ULONG &rnLatencyId);
+
+    /// <summary>
+    /// Draw a delay and wait for it.
+    /// </summary>
+    static void Inject(const LATENCY_SPEC &rxSpec);
+
+    /// <summary>
+    /// Called by the prologue through calli. Must keep the signature SIG__LATENCY_ROUTINE.
+    /// </summary>
+    static void WINAPI InjectById(int nLatencyId);
+
+private:
+    static double DrawNanoseconds(const LATENCY_SPEC &rxSpec);
+    static void Wait(WAIT_MODE nMode, double fNanoseconds);
+
+    static CComAutoCriticalSection m_csSpecs;
+    static LATENCY_SPEC m_vSpecs[PREFERRED_MAX_LATENCY_FAULT_COUNT];  // read by prologues without lock
+    static volatile LONG m_nSpecCount;
+    static volatile LONG m_nDrawCount;  // makes draws on the same clock tick differ
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
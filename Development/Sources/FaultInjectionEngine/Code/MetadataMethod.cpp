@@ -55,3 +55,15 @@ const CMethodDefSigBlob& CMetadataMethod::GetMethodSignature(void) const
     ASSERT(this->IsMetadataLoaded(METADATA_METHOD_SIGNATURE));
     return this->m_xMethodSignature;
 };
+
+void CMetadataMethod::SetSignatureHash(ULONGLONG nSignatureHash)
+{
+    this->m_nSignatureHash = nSignatureHash;
+    this->SetMetadataLoaded(METADATA_SIGNATURE_HASH);
+};
+
+ULONGLONG CMetadataMethod::GetSignatureHash(void) const
+{
+    ASSERT(this->IsMetadataLoaded(METADATA_SIGNATURE_HASH));
+    return this->m_nSignatureHash;
+};
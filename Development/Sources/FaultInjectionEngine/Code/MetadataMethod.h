@@ -30,12 +30,15 @@ public:
     void SetILMethodBody(LPVOID pMemory, ULONG nSize);
     const CMethodDefSigBlob& GetMethodSignature(void) const;
     void SetMethodSignature(PCCOR_SIGNATURE pMethodSignature, ULONG nMethodSignatureSize);
+    ULONGLONG GetSignatureHash(void) const;
+    void SetSignatureHash(ULONGLONG nSignatureHash);
 
 private:
     mdMethodDef m_tkMethodDef;
     CString m_szFullQualifiedMethodName;
     CILMethodBody m_xILMethodBody;
     CMethodDefSigBlob m_xMethodSignature;
+    ULONGLONG m_nSignatureHash;  // hash of the canonical parameter types, 0 if they can not be named
 
 private:
     // Following methods are used to ensure every metadata should be loaded (set) before
@@ -61,6 +64,7 @@ private:
         METADATA_FULL_QUALIFIED_METHOD_NAME   = 0x0002,
         METADATA_IL_METHOD_BODY               = 0x0004,
         METADATA_METHOD_SIGNATURE             = 0x0005,
+        METADATA_SIGNATURE_HASH               = 0x0008,
         METADATA_NULL         = 0x0000
     };
 };
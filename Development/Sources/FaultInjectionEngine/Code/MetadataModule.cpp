@@ -9,6 +9,13 @@
 #include "Exceptions.h"
 #include "TraceAndLog.h"
 #include "ILTemplates.h"
+#include "TrapTable.h"
+#include "RewriteCache.h"
+#include "InstantiationCache.h"
+#include "StaticFault.h"
+#include "ILStackAnalyzer.h"
+#include "ILInstructionList.h"
+#include "MethodFilter.h"
 
 USING_DEFAULT_NAMESPACE
 
@@ -68,6 +75,13 @@ void CMetadataModule::AttachMetadata(CComQIPtr<ICorProfilerInfo> pCorProfilerInf
     ASSERT(NULL != this->m_pMethodMalloc);
 }
 
+void CMetadataModule::SetFunctionControl(ICorProfilerFunctionControl *pFunctionControl)
+{
+    // The new method body goes to the function control instead of SetILFunctionBody, which can
+    // only replace the body of a method before its first JIT compilation.
+    this->m_pFunctionControl = pFunctionControl;
+}
+
 void CMetadataModule::LoadMethodProperties(CMetadataMethod& rMethodInfo)
 {
     ASSERT(NULL != this->m_pMetaDataImport);
@@ -107,6 +121,175 @@ void CMetadataModule::LoadMethodProperties(CMetadataMethod& rMethodInfo)
     rMethodInfo.SetFullQualifiedMethodName(this->RetrieveFullQualifiedTypeName(tkEnclosingTypeDef)
         + CSettings::GetQualifiedNameSeparatorBeforeMethod() + szMethodName);
     rMethodInfo.SetMethodSignature(pvMethodSignature, nMethodSignatureSize);
+    rMethodInfo.SetSignatureHash(this->HashCanonicalParameters(rMethodInfo.GetMethodSignature()));
+}
+
+ULONGLONG CMetadataModule::HashCanonicalParameters(const CMethodDefSigBlob &rxSignature)
+{
+    // Reduce the parameter types to their canonical form (see CCanonicalSigHash), as
+    // CMethodFilter does with the parameter list of a method filter line. Methods with
+    // parameters which a line can not name (e.g. generic parameters, pointers) get 0, and are
+    // only selected by lines without parameter list.
+    //  Param ::= CustomMod* ( TYPEDBYREF | [BYREF] Type )
+    ULONG nParamCount = 0;
+    PCCOR_SIGNATURE pSignature = rxSignature.LocateParameters(nParamCount);
+    if(NULL == pSignature)
+    {
+        return 0;
+    }
+
+    CCanonicalSigHash xHash;
+    for(ULONG i = 0; i < nParamCount; i++)
+    {
+        CorElementType nElementType = rxSignature.BypassOptCustomMod(pSignature);
+        BOOL bByRef = (ELEMENT_TYPE_BYREF == nElementType);
+        if(bByRef)
+        {
+            nElementType = rxSignature.BypassOptCustomMod(pSignature);
+        }
+        if(!this->HashCanonicalType(rxSignature, nElementType, pSignature, xHash))
+        {
+            return 0;
+        }
+        if(bByRef)
+        {
+            xHash.AddElementType(ELEMENT_TYPE_BYREF);
+        }
+        xHash.AddElementType(ELEMENT_TYPE_SENTINEL);
+    }
+    return xHash.GetHash();
+}
+
+BOOL CMetadataModule::HashCanonicalType(const CSignatureBlob &rxSignature, CorElementType nElementType,
+                                        PCCOR_SIGNATURE &rpSignature, CCanonicalSigHash &rxHash)
+{
+    // Array suffixes follow their element type, the inner array first: SZARRAY ARRAY I4 [rank 2],
+    // i.e. "System.Int32[][,]", is I4 ARRAY 2 SZARRAY.
+    switch(nElementType)
+    {
+    case ELEMENT_TYPE_BOOLEAN        :
+    case ELEMENT_TYPE_CHAR           :
+    case ELEMENT_TYPE_I1             :
+    case ELEMENT_TYPE_U1             :
+    case ELEMENT_TYPE_I2             :
+    case ELEMENT_TYPE_U2             :
+    case ELEMENT_TYPE_I4             :
+    case ELEMENT_TYPE_U4             :
+    case ELEMENT_TYPE_I8             :
+    case ELEMENT_TYPE_U8             :
+    case ELEMENT_TYPE_R4             :
+    case ELEMENT_TYPE_R8             :
+    case ELEMENT_TYPE_I              :
+    case ELEMENT_TYPE_U              :
+    case ELEMENT_TYPE_STRING         :
+    case ELEMENT_TYPE_OBJECT         :
+    case ELEMENT_TYPE_TYPEDBYREF     :
+        rxHash.AddElementType(nElementType);
+        return TRUE;
+
+    case ELEMENT_TYPE_VALUETYPE      :
+    case ELEMENT_TYPE_CLASS          :
+        {
+            CString szTypeName = this->RetrieveCanonicalTypeName(rxSignature, rpSignature);
+            if(szTypeName.IsEmpty())
+            {
+                return FALSE;
+            }
+            // Types of mscorlib itself refer to System.Int32 and the like by token.
+            CorElementType nPrimitiveType = CSignatureBlob::FindPrimitiveType(szTypeName);
+            if(ELEMENT_TYPE_END != nPrimitiveType)
+            {
+                rxHash.AddElementType(nPrimitiveType);
+                return TRUE;
+            }
+            rxHash.AddElementType(ELEMENT_TYPE_CLASS);
+            rxHash.AddTypeName(szTypeName, szTypeName.GetLength());
+            return TRUE;
+        }
+
+    case ELEMENT_TYPE_GENERICINST    :
+        {
+            // "List`1" of Int32 is "System.Collections.Generic.List<System.Int32>". Types nested
+            // in generic types are not supported, and generic arguments must be closed.
+            nElementType = ::CorSigUncompressElementType(rpSignature);
+            rxSignature.EnsureWithin(rpSignature);
+            if((ELEMENT_TYPE_CLASS != nElementType) && (ELEMENT_TYPE_VALUETYPE != nElementType))
+            {
+                return FALSE;
+            }
+            CString szTypeName = this->RetrieveCanonicalTypeName(rxSignature, rpSignature);
+            int nBacktick = szTypeName.Find(_T('`'));
+            if((0 > nBacktick) || (0 <= szTypeName.Find(CSettings::GetQualifiedNameSeparatorBeforeNestedType(), nBacktick)))
+            {
+                return FALSE;
+            }
+            rxHash.AddElementType(ELEMENT_TYPE_GENERICINST);
+            rxHash.AddTypeName(szTypeName, nBacktick);
+
+            ULONG nGenericArgumentCount = ::CorSigUncompressData(rpSignature);
+            rxSignature.EnsureWithin(rpSignature);
+            for(ULONG i = 0; i < nGenericArgumentCount; i++)
+            {
+                nElementType = rxSignature.BypassOptCustomMod(rpSignature);
+                if(!this->HashCanonicalType(rxSignature, nElementType, rpSignature, rxHash))
+                {
+                    return FALSE;
+                }
+            }
+            rxHash.AddElementType(ELEMENT_TYPE_END);
+            return TRUE;
+        }
+
+    case ELEMENT_TYPE_SZARRAY        :
+        nElementType = rxSignature.BypassOptCustomMod(rpSignature);
+        if(!this->HashCanonicalType(rxSignature, nElementType, rpSignature, rxHash))
+        {
+            return FALSE;
+        }
+        rxHash.AddElementType(ELEMENT_TYPE_SZARRAY);
+        return TRUE;
+
+    case ELEMENT_TYPE_ARRAY          :
+        {
+            //  ARRAY Type ArrayShape, where ArrayShape ::= Rank NumSizes Size* NumLoBounds LoBound*
+            nElementType = ::CorSigUncompressElementType(rpSignature);
+            rxSignature.EnsureWithin(rpSignature);
+            if(!this->HashCanonicalType(rxSignature, nElementType, rpSignature, rxHash))
+            {
+                return FALSE;
+            }
+            PCCOR_SIGNATURE pRank = rpSignature;
+            ULONG nRank = ::CorSigUncompressData(pRank);
+            if((0 == nRank) || (MAXBYTE < nRank) || !rxSignature.ParseArrayShapeSig(rpSignature))
+            {
+                return FALSE;
+            }
+            // A line names a multi-dimensional array of rank 1 as "[]", like a vector.
+            if(1 == nRank)
+            {
+                rxHash.AddElementType(ELEMENT_TYPE_SZARRAY);
+            }
+            else
+            {
+                rxHash.AddElementType(ELEMENT_TYPE_ARRAY);
+                rxHash.AddByte((BYTE)nRank);
+            }
+            return TRUE;
+        }
+
+    default:
+        // PTR, FNPTR, VAR, MVAR and the like can not be named by the formal signature of a rule.
+        return FALSE;
+    }
+}
+
+CString CMetadataModule::RetrieveCanonicalTypeName(const CSignatureBlob &rxSignature, PCCOR_SIGNATURE &rpSignature)
+{
+    mdToken tkType = ::CorSigUncompressToken(rpSignature);
+    rxSignature.EnsureWithin(rpSignature);
+    return (mdtTypeDef == TypeFromToken(tkType))
+        ? this->RetrieveFullQualifiedTypeName(tkType)
+        : this->RetrieveFullQualifiedTypeRefName(tkType);
 }
 
 CString CMetadataModule::RetrieveFullQualifiedTypeName(mdTypeDef tkTypeDef)
@@ -156,6 +339,138 @@ CString CMetadataModule::RetrieveFullQualifiedTypeName(mdTypeDef tkTypeDef)
     return szTypeName;
 }
 
+CString CMetadataModule::RetrieveFullQualifiedTypeRefName(mdTypeRef tkTypeRef)
+{
+    ASSERT(NULL != this->m_pMetaDataImport);
+
+    CString szTypeName;
+    ULONG nTypeNameLength;
+    mdToken tkResolutionScope;
+    HRESULT hr = this->m_pMetaDataImport->GetTypeRefProps(tkTypeRef, &tkResolutionScope,
+        szTypeName.GetBufferSetLength(PREFERRED_QUALIFIED_TYPE_NAME_LENGTH),
+        PREFERRED_QUALIFIED_TYPE_NAME_LENGTH, &nTypeNameLength);
+    if(SUCCEEDED(hr) && (nTypeNameLength > PREFERRED_QUALIFIED_TYPE_NAME_LENGTH))
+    {
+        hr = this->m_pMetaDataImport->GetTypeRefProps(tkTypeRef, &tkResolutionScope,
+            szTypeName.GetBufferSetLength(nTypeNameLength), nTypeNameLength, &nTypeNameLength);
+    }
+    if(FAILED(hr))
+    {
+        EventReportError(IDS_REPORT_FAILED_GET_TYPE_PROPS, hr, tkTypeRef);
+        CExceptionAsBreak::Throw();
+    }
+    szTypeName.ReleaseBufferSetLength(nTypeNameLength - 1);
+
+    // A type whose resolution scope is another type reference is nested into it.
+    if(mdtTypeRef == TypeFromToken(tkResolutionScope))
+    {
+        return this->RetrieveFullQualifiedTypeRefName(tkResolutionScope)
+            + CSettings::GetQualifiedNameSeparatorBeforeNestedType() + szTypeName;
+    }
+
+    return szTypeName;
+}
+
+CString CMetadataModule::RetrieveFullQualifiedMemberName(mdToken tkMember, PCCOR_SIGNATURE &rpvSignature,
+                                                         ULONG &rnSignatureSize)
+{
+    ASSERT(NULL != this->m_pMetaDataImport);
+
+    // Name the method called by a call instruction as LoadMethodProperties names the method
+    // itself, so it is matched with the method filter. Return an empty name if not supported.
+    CString szMemberName;
+    ULONG nMemberNameLength;
+    mdToken tkParent;
+    HRESULT hr;
+    switch(TypeFromToken(tkMember))
+    {
+    case mdtMethodDef:
+        hr = this->m_pMetaDataImport->GetMethodProps(tkMember, &tkParent,
+            szMemberName.GetBufferSetLength(PREFERRED_NONQUALIFIED_METHOD_NAME_LENGTH),
+            PREFERRED_NONQUALIFIED_METHOD_NAME_LENGTH, &nMemberNameLength, NULL,
+            &rpvSignature, &rnSignatureSize, NULL, NULL);
+        if(SUCCEEDED(hr) && (nMemberNameLength > PREFERRED_NONQUALIFIED_METHOD_NAME_LENGTH))
+        {
+            hr = this->m_pMetaDataImport->GetMethodProps(tkMember, &tkParent,
+                szMemberName.GetBufferSetLength(nMemberNameLength), nMemberNameLength, &nMemberNameLength, NULL,
+                &rpvSignature, &rnSignatureSize, NULL, NULL);
+        }
+        break;
+
+    case mdtMemberRef:
+        hr = this->m_pMetaDataImport->GetMemberRefProps(tkMember, &tkParent,
+            szMemberName.GetBufferSetLength(PREFERRED_NONQUALIFIED_METHOD_NAME_LENGTH),
+            PREFERRED_NONQUALIFIED_METHOD_NAME_LENGTH, &nMemberNameLength, &rpvSignature, &rnSignatureSize);
+        if(SUCCEEDED(hr) && (nMemberNameLength > PREFERRED_NONQUALIFIED_METHOD_NAME_LENGTH))
+        {
+            hr = this->m_pMetaDataImport->GetMemberRefProps(tkMember, &tkParent,
+                szMemberName.GetBufferSetLength(nMemberNameLength), nMemberNameLength, &nMemberNameLength,
+                &rpvSignature, &rnSignatureSize);
+        }
+        break;
+
+    default:
+        return CString();  // instantiations of generic methods (method specs)
+    }
+    if(FAILED(hr))
+    {
+        EventReportError(IDS_REPORT_FAILED_GET_METHOD_PROPS, hr, tkMember);
+        CExceptionAsBreak::Throw();
+    }
+    szMemberName.ReleaseBufferSetLength(nMemberNameLength - 1);
+
+    CString szTypeName;
+    switch(TypeFromToken(tkParent))
+    {
+    case mdtTypeDef:
+        szTypeName = this->RetrieveFullQualifiedTypeName(tkParent);
+        break;
+
+    case mdtTypeRef:
+        szTypeName = this->RetrieveFullQualifiedTypeRefName(tkParent);
+        break;
+
+    case mdtTypeSpec:
+        {
+            // A method of an instantiated generic type is named after the generic type. Open
+            // instantiations are left alone, the caller's type parameters can't be resolved.
+            PCCOR_SIGNATURE pvTypeSpec;
+            ULONG nTypeSpecSize;
+            hr = this->m_pMetaDataImport->GetTypeSpecFromToken(tkParent, &pvTypeSpec, &nTypeSpecSize);
+            if(FAILED(hr) || (3 > nTypeSpecSize) || (ELEMENT_TYPE_GENERICINST != pvTypeSpec[0]))
+            {
+                return CString();
+            }
+            for(ULONG i = 0; i < nTypeSpecSize; i++)
+            {
+                if((ELEMENT_TYPE_VAR == pvTypeSpec[i]) || (ELEMENT_TYPE_MVAR == pvTypeSpec[i]))
+                {
+                    return CString();  // or a token byte of the same value, which is skipped as well
+                }
+            }
+            PCCOR_SIGNATURE pTempSignature = pvTypeSpec + 2;  // GENERICINST (CLASS | VALUETYPE)
+            mdToken tkGenericType = ::CorSigUncompressToken(pTempSignature);
+            szTypeName = (mdtTypeDef == TypeFromToken(tkGenericType))
+                ? this->RetrieveFullQualifiedTypeName(tkGenericType)
+                : this->RetrieveFullQualifiedTypeRefName(tkGenericType);
+        }
+        break;
+
+    case mdtMethodDef:
+        {
+            // Call site of a vararg method of this module, which keeps the signature of the call site.
+            PCCOR_SIGNATURE pvMethodSignature;
+            ULONG nMethodSignatureSize;
+            return this->RetrieveFullQualifiedMemberName(tkParent, pvMethodSignature, nMethodSignatureSize);
+        }
+
+    default:
+        return CString();  // global functions of other modules
+    }
+
+    return szTypeName + CSettings::GetQualifiedNameSeparatorBeforeMethod() + szMemberName;
+}
+
 void CMetadataModule::LoadILMethodBody(CMetadataMethod &rMethodInfo)
 {
     ASSERT(NULL != this->m_pCorProfilerInfo);
@@ -177,37 +492,49 @@ void CMetadataModule::LoadILMethodBody(CMetadataMethod &rMethodInfo)
     return;
 }
 
-CILMethodSect CMetadataModule::PrepareILMethodSect(CMetadataMethod &rMethodInfo, ULONG nShiftOffset, CAtlArray<BYTE> &vAllocator)
+size_t CMetadataModule::MeasureILMethodSect(const CILMethodSect &rxOldILMethodSect)
 {
-    ASSERT(rMethodInfo.GetILMethodBody().GetHeader().IsFat());
+    size_t nSize = 0;
+    for(CILMethodSect xOldILMethodSect = rxOldILMethodSect; !xOldILMethodSect.IsNull();
+        xOldILMethodSect = xOldILMethodSect.GetNextSection())
+    {
+        if(xOldILMethodSect.IsExceptionHandler())
+        {
+            // FAT EH, whatever the original one is small or fat. It is dword aligned already.
+            ASSERT(0 == (sizeof(IMAGE_COR_ILMETHOD_SECT_FAT) & (sizeof(DWORD)-1)));
+            ASSERT(0 == (sizeof(IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT) & (sizeof(DWORD)-1)));
+            nSize += sizeof(IMAGE_COR_ILMETHOD_SECT_FAT) +
+                xOldILMethodSect.GetExceptionHandlerClauseCount() * sizeof(IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT);
+        }
+        else
+        {
+            // Optional IL table, copied as is. The next section must start dword aligned.
+            nSize += (xOldILMethodSect.GetSectionDataSize() + (sizeof(DWORD)-1)) & ~(sizeof(DWORD)-1);
+        }
+    }
+    return nSize;
+}
 
-    CILMethodSect xOldILMethodSect = rMethodInfo.GetILMethodBody().GetSect();
-    if(xOldILMethodSect.IsNull())
-        return xOldILMethodSect; // return a null memory-ref
-    
-    vAllocator.RemoveAll();
-    do
+void CMetadataModule::EncodeILMethodSect(const CILMethodSect &rxOldILMethodSect, ULONG nShiftOffset, LPBYTE pTarget)
+{
+    for(CILMethodSect xOldILMethodSect = rxOldILMethodSect; !xOldILMethodSect.IsNull();
+        xOldILMethodSect = xOldILMethodSect.GetNextSection())
     {
-        size_t nSizeBeforeAppending = (ULONG)(vAllocator.GetCount());
+        size_t nEncodedSize;
         if(xOldILMethodSect.IsExceptionHandler())
         {
             int nExceptionHandlerClauseCount = xOldILMethodSect.GetExceptionHandlerClauseCount();
             ASSERT(0 < nExceptionHandlerClauseCount);
-
-            // prepare FAT EH, whatever the original one is small or fat.
-            ASSERT(0 == (sizeof(IMAGE_COR_ILMETHOD_SECT_FAT) & (sizeof(DWORD)-1)));  // Make sure the FAT EH is dword align.
-            size_t nAppendedSize = sizeof(IMAGE_COR_ILMETHOD_SECT_FAT) +
+            nEncodedSize = sizeof(IMAGE_COR_ILMETHOD_SECT_FAT) +
                 nExceptionHandlerClauseCount * sizeof(IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT);
-            nAppendedSize = (nAppendedSize + (sizeof(DWORD)-1)) & (~(sizeof(DWORD)-1));  // make it dword align
-            vAllocator.SetCount(nSizeBeforeAppending + nAppendedSize);  // allocate buffer for appended data
-            CILMethodSect xTargetSect(vAllocator.GetData() + nSizeBeforeAppending, nAppendedSize);  // refer to appended buffer
+            CILMethodSect xTargetSect(pTarget, nEncodedSize);  // refer to the target buffer
 
             if(xOldILMethodSect.IsFat())
             {
                 // It's FAT exception-handler. Copy data and shift offset
-                DebugTrace(_T("Old Section Size: %d; AppendedSize: %d"), xOldILMethodSect.GetSectionDataSize(),nAppendedSize);
-                ASSERT(xOldILMethodSect.GetSectionDataSize() == nAppendedSize);
-                xTargetSect.MemoryCopy(xOldILMethodSect, xOldILMethodSect.GetSectionDataSize());
+                DebugTrace(_T("Old Section Size: %d; EncodedSize: %d"), xOldILMethodSect.GetSectionDataSize(), nEncodedSize);
+                ASSERT(xOldILMethodSect.GetSectionDataSize() == nEncodedSize);
+                xTargetSect.MemoryCopy(xOldILMethodSect, nEncodedSize);
 
                 for(int i = 0; i < nExceptionHandlerClauseCount; i++)
                 {
@@ -240,7 +567,7 @@ CILMethodSect CMetadataModule::PrepareILMethodSect(CMetadataMethod &rMethodInfo,
                     CMemoryRef((&imageDefaultILMethodFatSection), sizeof(imageDefaultILMethodFatSection)));
                 
                 xTargetSect.SetAsHasMoreSections(xOldILMethodSect.AreThereMoreSections());  // correct MORE_SECTS flag
-                xTargetSect.SetSectionDataSize(nExceptionHandlerClauseCount * sizeof(IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT));  // correct data-size
+                xTargetSect.SetSectionDataSize(nEncodedSize);  // correct data-size, which includes the section header
 
                 for(int i = 0; i < nExceptionHandlerClauseCount; i++)
                 {
@@ -268,19 +595,16 @@ CILMethodSect CMetadataModule::PrepareILMethodSect(CMetadataMethod &rMethodInfo,
         }
         else
         {
-            // It's optional IL Table. Just copy the data
-            size_t nAppendedSize = xOldILMethodSect.GetSectionDataSize();
-            vAllocator.SetCount(nSizeBeforeAppending + nAppendedSize);  // allocate buffer for appended data
-            CILMethodSect xTargetSect(vAllocator.GetData() + nSizeBeforeAppending, nAppendedSize);  // refer to appended buffer
-            xTargetSect.MemoryCopy(xOldILMethodSect, nAppendedSize);  // copy data
+            // It's optional IL Table. Copy the data, then pad it up to the next section.
+            size_t nDataSize = xOldILMethodSect.GetSectionDataSize();
+            nEncodedSize = (nDataSize + (sizeof(DWORD)-1)) & ~(sizeof(DWORD)-1);
+            ::memcpy(pTarget, xOldILMethodSect.GetBaseAddress(), nDataSize);
+            ::memset(pTarget + nDataSize, 0, nEncodedSize - nDataSize);
         }
 
         // navigate to next section
-        xOldILMethodSect = xOldILMethodSect.GetNextSection();
+        pTarget += nEncodedSize;
     }
-    while(!xOldILMethodSect.IsNull());
-
-    return CILMethodSect((LPVOID)(vAllocator.GetData()), (ULONG)(vAllocator.GetCount()));
 }
 
 ULONG CMetadataModule::FindAllAssembliesByName(LPCTSTR pstrAssemblyName,
@@ -391,7 +715,8 @@ ULONG CMetadataModule::FindAllTypesByAssemblyAndName(LPCTSTR pstrAssemblyName, L
 ULONG CMetadataModule::FindAllMethodsByAssemblyAndName(LPCTSTR pstrAssemblyName, LPCTSTR pstrTypeName, LPCTSTR pstrMethodName,
                                                        CAtlArray<CComQIPtr<IMetaDataImport,&IID_IMetaDataImport> > &rvpAssembliesMetaDataImport,
                                                        CAtlArray<mdTypeDef> &rvTypeDefTokens, 
-                                                       CAtlArray<mdMethodDef> &rvMethodDefTokens)
+                                                       CAtlArray<mdMethodDef> &rvMethodDefTokens,
+                                                       PCCOR_SIGNATURE pvSignaturePrefix, ULONG nSignaturePrefixSize)
 {
     ASSERT(NULL != pstrAssemblyName);
     ASSERT(NULL != pstrTypeName);
@@ -407,8 +732,10 @@ ULONG CMetadataModule::FindAllMethodsByAssemblyAndName(LPCTSTR pstrAssemblyName,
     for(ULONG i = 0; i < nCount; )
     {
         mdMethodDef tkMethodDef;
-        HRESULT hr = rvpAssembliesMetaDataImport[i]->FindMethod(rvTypeDefTokens[i],
-            pstrMethodName, NULL, NULL, &tkMethodDef);
+        HRESULT hr = (NULL == pvSignaturePrefix)
+            ? rvpAssembliesMetaDataImport[i]->FindMethod(rvTypeDefTokens[i], pstrMethodName, NULL, NULL, &tkMethodDef)
+            : FindMethodBySignaturePrefix(rvpAssembliesMetaDataImport[i], rvTypeDefTokens[i], pstrMethodName,
+                pvSignaturePrefix, nSignaturePrefixSize, tkMethodDef);
         if(SUCCEEDED(hr))
         {
             rvMethodDefTokens.Add(tkMethodDef);
@@ -439,6 +766,184 @@ ULONG CMetadataModule::FindAllMethodsByAssemblyAndName(LPCTSTR pstrAssemblyName,
     return nCount;
 }
 
+ULONG CMetadataModule::FindMethodsByFullQualifiedName(const CAtlArray<CString> &rvszMethodNames,
+                                                     const CAtlArray<ULONGLONG> &rvnSignatureHashes,
+                                                     CAtlArray<mdMethodDef> &rvMethodDefTokens,
+                                                     CAtlArray<size_t> &rvNameIndexes)
+{
+    ASSERT(NULL != this->m_pMetaDataImport);
+    ASSERT(rvszMethodNames.GetCount() == rvnSignatureHashes.GetCount());
+
+    rvMethodDefTokens.RemoveAll();
+    rvNameIndexes.RemoveAll();
+    if(0 == rvszMethodNames.GetCount())
+    {
+        return 0;
+    }
+
+    // Names of nested types are separated by the same character as method names, so a name can
+    // not be split into type and method. Match the names of all types in the module instead.
+    HCORENUM hTypeDefEnum = NULL;
+    mdTypeDef vTypeDefs[64];
+    ULONG nTypeDefCount = 0;
+    while(SUCCEEDED(this->m_pMetaDataImport->EnumTypeDefs(&hTypeDefEnum, vTypeDefs, _countof(vTypeDefs), &nTypeDefCount))
+        && (0 < nTypeDefCount))
+    {
+        for(ULONG i = 0; i < nTypeDefCount; i++)
+        {
+            CString szTypePrefix = this->RetrieveFullQualifiedTypeName(vTypeDefs[i])
+                + CSettings::GetQualifiedNameSeparatorBeforeMethod();
+            for(size_t n = 0; n < rvszMethodNames.GetCount(); n++)
+            {
+                const CString &rszMethodName = rvszMethodNames[n];
+                if((rszMethodName.GetLength() <= szTypePrefix.GetLength())
+                    || (0 != _tcsncmp(rszMethodName, szTypePrefix, szTypePrefix.GetLength())))
+                {
+                    continue;
+                }
+
+                // The overloads of the method selected by the line, like at JIT compilation
+                CString szNonQualifiedMethodName = rszMethodName.Mid(szTypePrefix.GetLength());
+                HCORENUM hMethodEnum = NULL;
+                mdMethodDef vMethodDefs[PREFERRED_OVERLOADED_METHOD_COUNT];
+                ULONG nMethodDefCount = 0;
+                while(SUCCEEDED(this->m_pMetaDataImport->EnumMethodsWithName(&hMethodEnum, vTypeDefs[i],
+                    szNonQualifiedMethodName, vMethodDefs, _countof(vMethodDefs), &nMethodDefCount))
+                    && (0 < nMethodDefCount))
+                {
+                    for(ULONG j = 0; j < nMethodDefCount; j++)
+                    {
+                        if(0 != rvnSignatureHashes[n])
+                        {
+                            CMetadataMethod xMethodInfo(vMethodDefs[j]);
+                            this->LoadMethodProperties(xMethodInfo);
+                            if(!CMethodFilter::Selects(rvnSignatureHashes[n], xMethodInfo.GetSignatureHash()))
+                            {
+                                continue;
+                            }
+                        }
+                        rvMethodDefTokens.Add(vMethodDefs[j]);
+                        rvNameIndexes.Add(n);
+                    }
+                }
+                this->m_pMetaDataImport->CloseEnum(hMethodEnum);
+            }
+        }
+    }
+    this->m_pMetaDataImport->CloseEnum(hTypeDefEnum);
+
+    DebugTrace(_T("%d methods of the method filter are found in module 0x%X"), rvMethodDefTokens.GetCount(),
+        this->m_moduleId);
+    return (ULONG)rvMethodDefTokens.GetCount();
+}
+
+ULONG CMetadataModule::FindMethodsByCustomAttribute(LPCTSTR pstrAttributeName,
+                                                   CAtlArray<mdMethodDef> &rvMethodDefTokens)
+{
+    ASSERT(NULL != this->m_pMetaDataImport);
+    ASSERT(NULL != pstrAttributeName);
+
+    rvMethodDefTokens.RemoveAll();
+    if(_T('\0') == pstrAttributeName[0])
+    {
+        return 0;
+    }
+
+    // An attribute is named by its constructor, which is a method def of this module or a member
+    // ref to another. The name of a constructor is the type name followed by ".ctor". A name
+    // without a namespace matches the attribute type in any namespace.
+    CString szConstructorSuffix = CString(pstrAttributeName)
+        + CSettings::GetQualifiedNameSeparatorBeforeMethod() + _T(".ctor");
+    BOOL bNonQualified = (NULL == _tcschr(pstrAttributeName, _T('.')));
+
+    // One pass over the custom attributes of the module, rather than GetCustomAttributeByName on
+    // every method. Constructors are named once, whatever the number of attributes they build.
+    CAtlMap<mdToken, BOOL> mapConstructors;
+    HCORENUM hEnum = NULL;
+    mdCustomAttribute vCustomAttributes[64];
+    ULONG nCustomAttributeCount = 0;
+    while(SUCCEEDED(this->m_pMetaDataImport->EnumCustomAttributes(&hEnum, mdTokenNil, mdTokenNil,
+        vCustomAttributes, _countof(vCustomAttributes), &nCustomAttributeCount)) && (0 < nCustomAttributeCount))
+    {
+        for(ULONG i = 0; i < nCustomAttributeCount; i++)
+        {
+            mdToken tkOwner;
+            mdToken tkConstructor;
+            if(FAILED(this->m_pMetaDataImport->GetCustomAttributeProps(vCustomAttributes[i], &tkOwner,
+                &tkConstructor, NULL, NULL)) || (mdtMethodDef != TypeFromToken(tkOwner)))
+            {
+                continue;
+            }
+
+            BOOL bMatched;
+            if(!mapConstructors.Lookup(tkConstructor, bMatched))
+            {
+                PCCOR_SIGNATURE pvSignature;
+                ULONG nSignatureSize;
+                CString szConstructorName = this->RetrieveFullQualifiedMemberName(tkConstructor, pvSignature,
+                    nSignatureSize);
+                int nPrefixLength = szConstructorName.GetLength() - szConstructorSuffix.GetLength();
+                bMatched = (0 <= nPrefixLength)
+                    && (0 == _tcscmp((LPCTSTR)szConstructorName + nPrefixLength, szConstructorSuffix));
+                if(bMatched && (0 < nPrefixLength))
+                {
+                    // A full name matches whole, a name alone only after a namespace or an enclosing type.
+                    TCHAR chSeparator = szConstructorName[nPrefixLength - 1];
+                    bMatched = bNonQualified
+                        && ((_T('.') == chSeparator)
+                            || (CSettings::GetQualifiedNameSeparatorBeforeNestedType()[0] == chSeparator));
+                }
+                mapConstructors.SetAt(tkConstructor, bMatched);
+            }
+            if(bMatched)
+            {
+                rvMethodDefTokens.Add(tkOwner);
+            }
+        }
+    }
+    this->m_pMetaDataImport->CloseEnum(hEnum);
+
+    DebugTrace(_T("%d methods carry the attribute %s in module 0x%X"), rvMethodDefTokens.GetCount(),
+        pstrAttributeName, this->m_moduleId);
+    return (ULONG)rvMethodDefTokens.GetCount();
+}
+
+HRESULT CMetadataModule::FindMethodBySignaturePrefix(IMetaDataImport *pMetaDataImport, mdTypeDef tkTypeDef,
+                                                     LPCTSTR pstrMethodName, PCCOR_SIGNATURE pvSignaturePrefix,
+                                                     ULONG nSignaturePrefixSize, mdMethodDef &rtkMethodDef)
+{
+    ASSERT(NULL != pMetaDataImport);
+    ASSERT(NULL != pvSignaturePrefix);
+
+    // FindMethod() needs the whole signature, which contains scope-dependent type tokens. So
+    // enumerate the overloads and compare the leading part of their signatures instead.
+    HCORENUM hEnum = NULL;
+    mdMethodDef vtkMethodDefs[PREFERRED_OVERLOADED_METHOD_COUNT];
+    ULONG nCount = 0;
+    HRESULT hr;
+    while(S_OK == (hr = pMetaDataImport->EnumMethodsWithName(&hEnum, tkTypeDef, pstrMethodName,
+        vtkMethodDefs, PREFERRED_OVERLOADED_METHOD_COUNT, &nCount)))
+    {
+        for(ULONG i = 0; i < nCount; i++)
+        {
+            PCCOR_SIGNATURE pvSignature = NULL;
+            ULONG nSignatureSize = 0;
+            if(SUCCEEDED(pMetaDataImport->GetMethodProps(vtkMethodDefs[i], NULL, NULL, 0, NULL, NULL,
+                &pvSignature, &nSignatureSize, NULL, NULL))
+                && (nSignatureSize >= nSignaturePrefixSize)
+                && (0 == ::memcmp(pvSignature, pvSignaturePrefix, nSignaturePrefixSize)))
+            {
+                pMetaDataImport->CloseEnum(hEnum);
+                rtkMethodDef = vtkMethodDefs[i];
+                return S_OK;
+            }
+        }
+    }
+    pMetaDataImport->CloseEnum(hEnum);
+
+    return FAILED(hr) ? hr : CLDB_E_RECORD_NOTFOUND;
+}
+
 mdTypeRef CMetadataModule::EmitTypeRefToken(LPCTSTR pstrAssemblyName, LPCTSTR pstrTypeName)
 {
     ASSERT(NULL != pstrTypeName);
@@ -470,7 +975,8 @@ mdTypeRef CMetadataModule::EmitTypeRefToken(LPCTSTR pstrAssemblyName, LPCTSTR ps
     return mdTypeRefNil;
 }
 
-mdMemberRef CMetadataModule::EmitMethodRefToken(LPCTSTR pstrAssemblyName, LPCTSTR pstrTypeName, LPCTSTR pstrMethodName)
+mdMemberRef CMetadataModule::EmitMethodRefToken(LPCTSTR pstrAssemblyName, LPCTSTR pstrTypeName, LPCTSTR pstrMethodName,
+                                                PCCOR_SIGNATURE pvSignaturePrefix, ULONG nSignaturePrefixSize)
 {
     ASSERT(NULL != pstrTypeName);
     ASSERT(NULL != pstrMethodName);
@@ -482,7 +988,7 @@ mdMemberRef CMetadataModule::EmitMethodRefToken(LPCTSTR pstrAssemblyName, LPCTST
     CAtlArray<CComQIPtr<IMetaDataImport, &IID_IMetaDataImport> > vpAssembliesMetaDataImport;
 
     ULONG nCount = this->FindAllMethodsByAssemblyAndName(pstrAssemblyName, pstrTypeName, pstrMethodName,
-        vpAssembliesMetaDataImport, vtkTypeDefTokens, vtkMethodDefTokens);
+        vpAssembliesMetaDataImport, vtkTypeDefTokens, vtkMethodDefTokens, pvSignaturePrefix, nSignaturePrefixSize);
 
     for(ULONG i = 0; i < nCount; i++)
     {
@@ -511,7 +1017,57 @@ mdMemberRef CMetadataModule::EmitMethodRefToken(LPCTSTR pstrAssemblyName, LPCTST
     return mdMemberRefNil;
 }
 
-WORD CMetadataModule::EmitNewLocalVarToken(mdSignature tkOldLocalVarToken, mdSignature &tkNewLocalVarToken)
+mdTypeSpec CMetadataModule::EmitTypeSpecToken(PCCOR_SIGNATURE pvType, ULONG nTypeSize)
+{
+    ASSERT(NULL != pvType);
+    ASSERT(0 < nTypeSize);
+
+    mdTypeSpec tkTypeSpec = mdTypeSpecNil;
+    HRESULT hr = this->m_pMetaDataEmit->GetTokenFromTypeSpec(pvType, nTypeSize, &tkTypeSpec);
+    if(FAILED(hr))
+    {
+        EventReportError(IDS_REPORT_FAILED_GET_TOKEN_FROM_TYPESPEC, hr, pvType, nTypeSize);
+        CExceptionAsBreak::Throw();
+    }
+    return tkTypeSpec;
+}
+
+mdMethodSpec CMetadataModule::EmitMethodSpecToken(mdMemberRef tkGenericMethodRef, PCCOR_SIGNATURE pvTypeArgument,
+                                                  ULONG nTypeArgumentSize)
+{
+    ASSERT(NULL != pvTypeArgument);
+    ASSERT(0 < nTypeArgumentSize);
+
+    // Many methods of a module return the same type, which is instantiated once.
+    mdMethodSpec tkMethodSpec = CInstantiationCache::Lookup(this->m_moduleId, tkGenericMethodRef,
+        pvTypeArgument, nTypeArgumentSize);
+    if(mdMethodSpecNil != tkMethodSpec)
+    {
+        return tkMethodSpec;
+    }
+
+    //  MethodSpec ::= GENERICINST GenArgCount Type Type*
+    CAtlArray<COR_SIGNATURE> vInstantiation;
+    vInstantiation.SetCount(2 + nTypeArgumentSize);
+    vInstantiation[0] = IMAGE_CEE_CS_CALLCONV_GENERICINST;
+    vInstantiation[1] = 1;
+    ::memcpy(&vInstantiation[2], pvTypeArgument, nTypeArgumentSize);
+
+    CComQIPtr<IMetaDataEmit2, &IID_IMetaDataEmit2> pMetaDataEmit2 = this->m_pMetaDataEmit;
+    HRESULT hr = (pMetaDataEmit2 == NULL) ? E_NOINTERFACE : pMetaDataEmit2->DefineMethodSpec(tkGenericMethodRef,
+        vInstantiation.GetData(), (ULONG)vInstantiation.GetCount(), &tkMethodSpec);
+    if(FAILED(hr))
+    {
+        EventReportError(IDS_REPORT_FAILED_DEFINE_METHOD_SPEC, hr, tkGenericMethodRef);
+        CExceptionAsBreak::Throw();
+    }
+    DebugTrace(_T("Successfully emit method-spec token 0x%08X for 0x%08X"), tkMethodSpec, tkGenericMethodRef);
+    CInstantiationCache::Add(this->m_moduleId, tkGenericMethodRef, pvTypeArgument, nTypeArgumentSize, tkMethodSpec);
+    return tkMethodSpec;
+}
+
+WORD CMetadataModule::EmitNewLocalVarToken(mdSignature tkOldLocalVarToken, PCCOR_SIGNATURE pvReturnType, ULONG nReturnTypeSize,
+                                           mdSignature &tkNewLocalVarToken)
 {
     DebugTrace(_T("Old Local Var Signature Token: %x\n"), tkOldLocalVarToken);
 
@@ -544,10 +1100,13 @@ WORD CMetadataModule::EmitNewLocalVarToken(mdSignature tkOldLocalVarToken, mdSig
 
     mdTypeRef tkExceptionTypeRef = this->EmitTypeRefToken(NULL, _T("System.Exception"));
 
-    PCOR_SIGNATURE vLocalVarSignature = new COR_SIGNATURE[5 * sizeof(DWORD) + nOldLocalVarSigNetPartSize];
+    // "returnValue" has the return type of the method, and is not needed if it returns void
+    ULONG nNewLocalVarCount = (0 < nReturnTypeSize) ? 2 : 1;
+
+    PCOR_SIGNATURE vLocalVarSignature = new COR_SIGNATURE[5 * sizeof(DWORD) + nOldLocalVarSigNetPartSize + nReturnTypeSize];
     PCOR_SIGNATURE signatureNewLocalVar = vLocalVarSignature;
     *signatureNewLocalVar++ = IMAGE_CEE_CS_CALLCONV_LOCAL_SIG;
-    signatureNewLocalVar += CorSigCompressData(2 + nOldLocalVarCount, signatureNewLocalVar);
+    signatureNewLocalVar += CorSigCompressData(nNewLocalVarCount + nOldLocalVarCount, signatureNewLocalVar);
 
     if(0 < nOldLocalVarCount)
     {
@@ -559,7 +1118,12 @@ WORD CMetadataModule::EmitNewLocalVarToken(mdSignature tkOldLocalVarToken, mdSig
 
     signatureNewLocalVar += CorSigCompressElementType(ELEMENT_TYPE_CLASS, signatureNewLocalVar); // throwException
     signatureNewLocalVar += CorSigCompressToken(tkExceptionTypeRef, signatureNewLocalVar);
-    signatureNewLocalVar += CorSigCompressElementType(ELEMENT_TYPE_OBJECT, signatureNewLocalVar); // returnValue
+    if(0 < nReturnTypeSize)
+    {
+        ASSERT(NULL != pvReturnType);
+        ::memmove(signatureNewLocalVar, pvReturnType, nReturnTypeSize); // returnValue
+        signatureNewLocalVar += nReturnTypeSize;
+    }
     ULONG nSize = (ULONG)(signatureNewLocalVar - vLocalVarSignature);
     DebugTrace(_T("New Local Var Signature Size: %d\n"), nSize);
 
@@ -577,122 +1141,914 @@ WORD CMetadataModule::EmitNewLocalVarToken(mdSignature tkOldLocalVarToken, mdSig
     return (WORD)nOldLocalVarCount;  // also the index of new inserted local-var
 }
 
-void CMetadataModule::InsertPrologueIntoMethod(CMetadataMethod &rMethodInfo)
+GUID CMetadataModule::GetModuleVersionId(void)
+{
+    ASSERT(NULL != this->m_pMetaDataImport);
+
+    GUID xModuleVersionId;
+    HRESULT hr = this->m_pMetaDataImport->GetScopeProps(NULL, 0, NULL, &xModuleVersionId);
+    if(FAILED(hr))
+    {
+        EventReportError(IDS_REPORT_FAILED_GET_SCOPE_PROPS, hr, this->m_moduleId);
+        CExceptionAsBreak::Throw();
+    }
+    return xModuleVersionId;
+}
+
+ULONG CMetadataModule::InsertPrologueIntoMethod(CMetadataMethod &rMethodInfo)
 {
     this->LoadILMethodBody(rMethodInfo);
 
-    CILMethodHeader xOldILMethodHeader = rMethodInfo.GetILMethodBody().GetHeader();
+    // Return type of the method, which is also the type of local-var "returnValue"
+    PCCOR_SIGNATURE pvReturnType;
+    ULONG nReturnTypeSize;
+    this->ParseReturnType(rMethodInfo, pvReturnType, nReturnTypeSize);
 
-    CILMethodHeader xNewILMethodHeader;
-    CILMethodSect xNewILMethodSect;
-    CAtlArray<BYTE> vNewILMethodAllocation;
-    if(xOldILMethodHeader.IsTiny())
+    if(CSettings::IsPrologueCompact())
     {
-        DebugDump(xOldILMethodHeader, _T("Original TINY IL Method Header"));
-        xNewILMethodHeader.Attach((LPVOID)(&imageDefaultILMethodFatHeader), sizeof(imageDefaultILMethodFatHeader));
+        return this->InsertCompactPrologueIntoMethod(rMethodInfo, pvReturnType, nReturnTypeSize);
     }
-    else
-    {
-        ASSERT(xOldILMethodHeader.IsFat());
-        DebugDump(xOldILMethodHeader, _T("Original FAT IL Method Header"));
-        xNewILMethodHeader = xOldILMethodHeader;
-
-        DebugDump(rMethodInfo.GetILMethodBody().GetSect(), _T("Original IL Method Sect"));
 
-        DebugTrace(_T("SECT_EH_SMALL: %d; SECT_EH_CLAUSE: %d; SectDataSize: %d"),
-            sizeof(IMAGE_COR_ILMETHOD_SECT_EH_SMALL), sizeof(IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_SMALL),
-            rMethodInfo.GetILMethodBody().GetSect().GetSectionDataSize());
+    // EmitLocalVarToken()
+    mdSignature tkNewLocalVar;
+    WORD nIndexOfNewLocalVar = this->EmitNewLocalVarToken(rMethodInfo.GetILMethodBody().GetHeader().GetLocalVarToken(),
+        pvReturnType, nReturnTypeSize, tkNewLocalVar);
 
-        xNewILMethodSect = this->PrepareILMethodSect(rMethodInfo, IL_SIZE__PROLOGUE,vNewILMethodAllocation);
+    // Find method FaultDispatcher.Trap<T>(int, out Exception, out T) and instantiate it with the
+    // return type, or FaultDispatcher.Trap(int, out Exception) if there is no return value.
+    mdToken tkTrapMethodRef;
+    if(0 < nReturnTypeSize)
+    {
+        mdMemberRef tkGenericTrapMethodRef = this->EmitMethodRefToken(
+            CSettings::GetDispatcherAssemblyName(),
+            CSettings::GetDispatcherFullQualifiedClassName(),
+            CSettings::GetDispatcherNonQualifiedMethodName(),
+            SIG_PREFIX__TRAP, sizeof(SIG_PREFIX__TRAP));
+        tkTrapMethodRef = this->EmitMethodSpecToken(tkGenericTrapMethodRef, pvReturnType, nReturnTypeSize);
+    }
+    else
+    {
+        tkTrapMethodRef = this->EmitMethodRefToken(
+            CSettings::GetDispatcherAssemblyName(),
+            CSettings::GetDispatcherFullQualifiedClassName(),
+            CSettings::GetDispatcherNonQualifiedMethodName(),
+            SIG_PREFIX__TRAP_VOID, sizeof(SIG_PREFIX__TRAP_VOID));
     }
-    DebugDump(xNewILMethodSect, _T("New FAT IL Method Section"));
 
-    // Calcurate New ILMethodBody size
-    ULONG nNewILMethodCodeSize = IL_SIZE__PROLOGUE + xNewILMethodHeader.GetCodeSize();
-    nNewILMethodCodeSize = (nNewILMethodCodeSize + (sizeof(DWORD)-1)) & ~(sizeof(DWORD)-1);
-    ULONG nNewILMethodBodySize =
-        (ULONG)(xNewILMethodHeader.GetSize() + nNewILMethodCodeSize + xNewILMethodSect.GetSectionDataSize());
+    // Assign trap id, which is passed to Trap to identify the method.
+    ULONG nTrapId = CTrapTable::Register(this->m_moduleId, this->GetModuleVersionId(),
+        rMethodInfo.GetMethodDefToken(), rMethodInfo.GetFullQualifiedMethodName());
 
-    // Allocate new ILMethodBody memory
-    LPBYTE pMethodILBody = (LPBYTE)(this->m_pMethodMalloc->Alloc(nNewILMethodBodySize));
-    if(NULL == pMethodILBody)
+    // Write Prologue: copy the template of the variant, then store the values at its offsets.
+    BOOL bAtomic = CSettings::IsCallCountingAtomic();
+    const IL_PROLOGUE_TEMPLATE &rTemplate = (0 < nReturnTypeSize)
+        ? (bAtomic ? IL_PROLOGUE__ATOMIC : IL_PROLOGUE__FAST)
+        : (bAtomic ? IL_PROLOGUE__ATOMIC_VOID : IL_PROLOGUE__FAST_VOID);
+    BYTE vPrologue[IL_SIZE__MAX_PROLOGUE];
+    ::memcpy(vPrologue, rTemplate.pCode, rTemplate.nSize);
+
+    // set local-var index
+    int i;
+    for(i = 0; i < _countof(rTemplate.vThrowException); i++)
     {
-        EventReportError(IDS_REPORT_FAILED_ALLOC, E_OUTOFMEMORY, nNewILMethodBodySize);
-        CExceptionAsBreak::Throw();
+        *(UNALIGNED WORD*)(vPrologue + rTemplate.vThrowException[i]) = nIndexOfNewLocalVar;
+    }
+    for(i = 0; (i < _countof(rTemplate.vReturnValue)) && (0 != rTemplate.vReturnValue[i]); i++)
+    {
+        *(UNALIGNED WORD*)(vPrologue + rTemplate.vReturnValue[i]) = (WORD)(nIndexOfNewLocalVar + 1);
+    }
+    // set gate, as 64-bit addresses which conv.u narrows down on 32-bit platforms
+    CTrapTable::TRAP_GATE *pGate = CTrapTable::GetGate(nTrapId);
+    ULONGLONG nCallCounterAddress = (ULONGLONG)(UINT_PTR)&pGate->nCalls;
+    *(UNALIGNED ULONGLONG*)(vPrologue + rTemplate.nArmedFlag) = (ULONGLONG)(UINT_PTR)&pGate->bArmed;
+    *(UNALIGNED ULONGLONG*)(vPrologue + rTemplate.nCallCounter) = nCallCounterAddress;
+    *(UNALIGNED ULONGLONG*)(vPrologue + rTemplate.nThreshold) = (ULONGLONG)(UINT_PTR)&pGate->nThreshold;
+    if(bAtomic)
+    {
+        *(UNALIGNED DWORD*)(vPrologue + rTemplate.nIncrement) = this->EmitMethodRefToken(
+            CSettings::GetCLISystemAssemblyName(), _T("System.Threading.Interlocked"), _T("Increment"),
+            SIG__INTERLOCKED_INCREMENT, sizeof(SIG__INTERLOCKED_INCREMENT));
     }
-    memset(pMethodILBody, 0, nNewILMethodBodySize);
+    else
+    {
+        *(UNALIGNED ULONGLONG*)(vPrologue + rTemplate.nFastCallCounter) = nCallCounterAddress;
+    }
+    // set trap id and method call
+    *(UNALIGNED DWORD*)(vPrologue + rTemplate.nTrapId) = nTrapId;
+    *(UNALIGNED DWORD*)(vPrologue + rTemplate.nCallTrap) = tkTrapMethodRef;
 
-    // EmitLocalVarToken()
-    mdSignature tkNewLocalVar;
-    WORD nIndexOfNewLocalVar = this->EmitNewLocalVarToken(xOldILMethodHeader.GetLocalVarToken(), tkNewLocalVar);
+    this->RewriteILMethodBody(rMethodInfo, CMemoryRef(vPrologue, rTemplate.nSize), tkNewLocalVar);
+    return nTrapId;
+}
 
-    // Copy and adjust new header
-    CILMethodBody xNewILMethodBody(pMethodILBody, nNewILMethodBodySize);
-    xNewILMethodBody.MemoryCopy(xNewILMethodHeader);
-    xNewILMethodHeader = xNewILMethodBody.GetHeader();
+void CMetadataModule::InsertOfflinePrologueIntoMethod(CMetadataMethod &rMethodInfo)
+{
+    this->LoadILMethodBody(rMethodInfo);
 
-    xNewILMethodHeader.SetCodeSize(xOldILMethodHeader.GetCodeSize() + IL_SIZE__PROLOGUE);
-    ULONG nMaxStack = xOldILMethodHeader.GetMaxStack();
-    if(nMaxStack < IL_NUMBER__MIN_STACK)
-        nMaxStack = IL_NUMBER__MIN_STACK;
-    xNewILMethodHeader.SetMaxStack(nMaxStack);
-    xNewILMethodHeader.SetLocalVarToken(tkNewLocalVar);
-    DebugDump(xNewILMethodHeader, _T("New FAT IL Method Header"));
+    PCCOR_SIGNATURE pvReturnType;
+    ULONG nReturnTypeSize;
+    this->ParseReturnType(rMethodInfo, pvReturnType, nReturnTypeSize);
 
-    // Find method FaultDispatcher.Trap
+    // The return value comes back as an object, whatever the return type.
+    mdSignature tkNewLocalVar;
+    WORD nIndexOfNewLocalVar = this->EmitNewLocalVarToken(rMethodInfo.GetILMethodBody().GetHeader().GetLocalVarToken(),
+        SIG__OBJECT, sizeof(SIG__OBJECT), tkNewLocalVar);
+
+    // Find method FaultDispatcher.Trap(out Exception, out object).
     mdMemberRef tkTrapMethodRef = this->EmitMethodRefToken(
         CSettings::GetDispatcherAssemblyName(),
         CSettings::GetDispatcherFullQualifiedClassName(),
-        CSettings::GetDispatcherNonQualifiedMethodName());
+        CSettings::GetDispatcherNonQualifiedMethodName(),
+        SIG_PREFIX__TRAP_OFFLINE, sizeof(SIG_PREFIX__TRAP_OFFLINE));
+
+    // Write Prologue: copy the template of the variant, then store the values at its offsets.
+    const IL_OFFLINE_PROLOGUE_TEMPLATE &rTemplate = (0 < nReturnTypeSize) ? IL_OFFLINE_PROLOGUE : IL_OFFLINE_PROLOGUE_VOID;
+    BYTE vPrologue[IL_SIZE__MAX_OFFLINE_PROLOGUE];
+    ::memcpy(vPrologue, rTemplate.pCode, rTemplate.nSize);
 
-    // Write Prologue
-    xNewILMethodBody.MemoryCopyAt(xNewILMethodHeader.GetSize(),
-        CMemoryRef(IL_CODE__PROLOGUE, IL_SIZE__PROLOGUE));
-    // set local-var index
     int i;
-    for(i = 0; 0 != IL_OFFSET__LOCALVAR_1[i]; i++)
+    for(i = 0; i < _countof(rTemplate.vThrowException); i++)
+    {
+        *(UNALIGNED WORD*)(vPrologue + rTemplate.vThrowException[i]) = nIndexOfNewLocalVar;
+    }
+    for(i = 0; (i < _countof(rTemplate.vReturnValue)) && (0 != rTemplate.vReturnValue[i]); i++)
+    {
+        *(UNALIGNED WORD*)(vPrologue + rTemplate.vReturnValue[i]) = (WORD)(nIndexOfNewLocalVar + 1);
+    }
+    *(UNALIGNED DWORD*)(vPrologue + rTemplate.nCallTrap) = tkTrapMethodRef;
+    if(0 < nReturnTypeSize)
+    {
+        // unbox.any casts reference types, and unboxes value types and type parameters.
+        *(UNALIGNED DWORD*)(vPrologue + rTemplate.nReturnType) = this->EmitTypeSpecToken(pvReturnType, nReturnTypeSize);
+    }
+
+    this->RewriteILMethodBody(rMethodInfo, CMemoryRef(vPrologue, rTemplate.nSize), tkNewLocalVar);
+}
+
+ULONG CMetadataModule::InsertCompactPrologueIntoMethod(CMetadataMethod &rMethodInfo, PCCOR_SIGNATURE pvReturnType,
+                                                       ULONG nReturnTypeSize)
+{
+    // Find methods FaultDispatcher.Trap(int) and TakeFaultedException(), and TakeFaultedReturnValue<T>()
+    // instantiated with the return type if there is a return value.
+    mdMemberRef tkTrapMethodRef = this->EmitMethodRefToken(
+        CSettings::GetDispatcherAssemblyName(),
+        CSettings::GetDispatcherFullQualifiedClassName(),
+        CSettings::GetDispatcherNonQualifiedMethodName(),
+        SIG_PREFIX__TRAP_COMPACT, sizeof(SIG_PREFIX__TRAP_COMPACT));
+    mdMemberRef tkTakeExceptionMethodRef = this->EmitMethodRefToken(
+        CSettings::GetDispatcherAssemblyName(),
+        CSettings::GetDispatcherFullQualifiedClassName(),
+        _T("TakeFaultedException"),
+        SIG_PREFIX__TAKE_FAULTED_EXCEPTION, sizeof(SIG_PREFIX__TAKE_FAULTED_EXCEPTION));
+    mdToken tkTakeReturnValueMethodRef = mdMethodSpecNil;
+    if(0 < nReturnTypeSize)
+    {
+        mdMemberRef tkGenericTakeReturnValueMethodRef = this->EmitMethodRefToken(
+            CSettings::GetDispatcherAssemblyName(),
+            CSettings::GetDispatcherFullQualifiedClassName(),
+            _T("TakeFaultedReturnValue"),
+            SIG__TAKE_FAULTED_RETURN_VALUE, sizeof(SIG__TAKE_FAULTED_RETURN_VALUE));
+        tkTakeReturnValueMethodRef = this->EmitMethodSpecToken(tkGenericTakeReturnValueMethodRef, pvReturnType,
+            nReturnTypeSize);
+    }
+
+    // Assign trap id, which is passed to Trap to identify the method.
+    ULONG nTrapId = CTrapTable::Register(this->m_moduleId, this->GetModuleVersionId(),
+        rMethodInfo.GetMethodDefToken(), rMethodInfo.GetFullQualifiedMethodName());
+    CTrapTable::TRAP_GATE *pGate = CTrapTable::GetGate(nTrapId);
+    ULONGLONG nCallCounterAddress = (ULONGLONG)(UINT_PTR)&pGate->nCalls;
+    ULONGLONG nThresholdAddress = (ULONGLONG)(UINT_PTR)&pGate->nThreshold;
+    C_ASSERT(0 == offsetof(CTrapTable::TRAP_GATE, nCalls));
+    C_ASSERT(IL_OFFSET__COMPACT_ARMED_FLAG == offsetof(CTrapTable::TRAP_GATE, bArmed));
+
+    // Size the parts first, the branches skip the parts after them.
+    BOOL bAtomic = CSettings::IsCallCountingAtomic();
+    BOOL bShortTrapId = (nTrapId <= IL_NUMBER__MAX_SHORT_TRAP_ID);
+    ULONG nArmedSize = sizeof(IL_CODE__COMPACT_ARMED) - 1;
+    ULONG nCountSize = bAtomic ? sizeof(IL_CODE__COMPACT_ATOMIC_COUNT) - 1 : sizeof(IL_CODE__COMPACT_FAST_COUNT) - 1;
+    ULONG nGateSize = sizeof(IL_CODE__COMPACT_GATE) - 1;
+    ULONG nTrapIdSize = bShortTrapId ? sizeof(IL_CODE__COMPACT_SHORT_TRAP_ID) - 1 : sizeof(IL_CODE__COMPACT_TRAP_ID) - 1;
+    ULONG nCallTrapSize = sizeof(IL_CODE__COMPACT_CALL_TRAP) - 1;
+    ULONG nFaultSize = sizeof(IL_CODE__COMPACT_FAULT) - 1;
+    ULONG nReturnSize = (0 < nReturnTypeSize) ? sizeof(IL_CODE__COMPACT_RETURN_VALUE) - 1 : sizeof(IL_CODE__COMPACT_RETURN_VOID) - 1;
+    ULONG nDisarmedSize = sizeof(IL_CODE__COMPACT_DISARMED) - 1;
+    ULONG nPrologueSize = nArmedSize + nCountSize + nGateSize + nTrapIdSize + nCallTrapSize + nFaultSize + nReturnSize
+        + nDisarmedSize;
+
+    BYTE vPrologue[IL_SIZE__MAX_COMPACT_PROLOGUE];
+    CMemoryRef xPrologue(vPrologue, nPrologueSize);
+    ULONG nOffset = 0;
+
+    // armed flag, whose branch is relative to the next instruction
+    BYTE nDisarmedDistance = (BYTE)((nPrologueSize - nDisarmedSize) - (nOffset + IL_OFFSET__COMPACT_BRFALSE_DISARMED + 1));
+    xPrologue.MemoryCopyAt(nOffset, CMemoryRef(IL_CODE__COMPACT_ARMED, nArmedSize));
+    xPrologue.MemoryCopyAt(nOffset + IL_OFFSET__COMPACT_CALL_COUNTER, CMemoryRef(&nCallCounterAddress, sizeof(ULONGLONG)));
+    xPrologue.MemoryCopyAt(nOffset + IL_OFFSET__COMPACT_BRFALSE_DISARMED, CMemoryRef(&nDisarmedDistance, sizeof(BYTE)));
+    nOffset += nArmedSize;
+
+    // call counting, on the address of the call counter left by the armed flag
+    if(bAtomic)
     {
-        xNewILMethodBody.MemoryCopyAt(xNewILMethodHeader.GetSize() + IL_OFFSET__LOCALVAR_1[i],
-            CMemoryRef(&nIndexOfNewLocalVar, sizeof(WORD))); // faultedException
+        mdMemberRef tkIncrementMethodRef = this->EmitMethodRefToken(
+            CSettings::GetCLISystemAssemblyName(), _T("System.Threading.Interlocked"), _T("Increment"),
+            SIG__INTERLOCKED_INCREMENT, sizeof(SIG__INTERLOCKED_INCREMENT));
+        xPrologue.MemoryCopyAt(nOffset, CMemoryRef(IL_CODE__COMPACT_ATOMIC_COUNT, nCountSize));
+        xPrologue.MemoryCopyAt(nOffset + IL_OFFSET__COMPACT_INCREMENT, CMemoryRef(&tkIncrementMethodRef, sizeof(DWORD)));
     }
-    nIndexOfNewLocalVar++; // faultedReturnValue
-    for(i = 0; 0 != IL_OFFSET__LOCALVAR_2[i]; i++)
+    else
     {
-        xNewILMethodBody.MemoryCopyAt(xNewILMethodHeader.GetSize() + IL_OFFSET__LOCALVAR_2[i],
-            CMemoryRef(&nIndexOfNewLocalVar, sizeof(WORD))); // faultedReturnValue
+        xPrologue.MemoryCopyAt(nOffset, CMemoryRef(IL_CODE__COMPACT_FAST_COUNT, nCountSize));
     }
-    // set method call
-    xNewILMethodBody.MemoryCopyAt(xNewILMethodHeader.GetSize() + IL_OFFSET__CALL_TRAP,
-        CMemoryRef(&tkTrapMethodRef, sizeof(DWORD)));  //
+    nOffset += nCountSize;
 
-    // fix by return-type
-    mdToken tkReturnType;
-    switch(this->ParseReturnType(rMethodInfo, tkReturnType))
+    // gate, whose branch is relative to the next instruction
+    BYTE nBltDistance = (BYTE)(nPrologueSize - (nOffset + IL_OFFSET__COMPACT_BLT + 1));
+    xPrologue.MemoryCopyAt(nOffset, CMemoryRef(IL_CODE__COMPACT_GATE, nGateSize));
+    xPrologue.MemoryCopyAt(nOffset + IL_OFFSET__COMPACT_THRESHOLD, CMemoryRef(&nThresholdAddress, sizeof(ULONGLONG)));
+    xPrologue.MemoryCopyAt(nOffset + IL_OFFSET__COMPACT_BLT, CMemoryRef(&nBltDistance, sizeof(BYTE)));
+    nOffset += nGateSize;
+
+    // trap id
+    if(bShortTrapId)
+    {
+        BYTE nShortTrapId = (BYTE)nTrapId;
+        xPrologue.MemoryCopyAt(nOffset, CMemoryRef(IL_CODE__COMPACT_SHORT_TRAP_ID, nTrapIdSize));
+        xPrologue.MemoryCopyAt(nOffset + IL_OFFSET__COMPACT_TRAP_ID, CMemoryRef(&nShortTrapId, sizeof(BYTE)));
+    }
+    else
     {
-    case ELEMENT_TYPE_VOID:
-        xNewILMethodBody.MemoryCopyAt(xNewILMethodHeader.GetSize() + IL_OFFSET__RETURN,
-            CMemoryRef(IL_CODE__JUST_RETURN, IL_SIZE__RETURN_VOID));
+        xPrologue.MemoryCopyAt(nOffset, CMemoryRef(IL_CODE__COMPACT_TRAP_ID, nTrapIdSize));
+        xPrologue.MemoryCopyAt(nOffset + IL_OFFSET__COMPACT_TRAP_ID, CMemoryRef(&nTrapId, sizeof(DWORD)));
+    }
+    nOffset += nTrapIdSize;
+
+    // call to Trap, whose branch is relative to the next instruction
+    BYTE nBrfalseDistance = (BYTE)(nPrologueSize - (nOffset + IL_OFFSET__COMPACT_BRFALSE + 1));
+    xPrologue.MemoryCopyAt(nOffset, CMemoryRef(IL_CODE__COMPACT_CALL_TRAP, nCallTrapSize));
+    xPrologue.MemoryCopyAt(nOffset + IL_OFFSET__COMPACT_CALL_TRAP, CMemoryRef(&tkTrapMethodRef, sizeof(DWORD)));
+    xPrologue.MemoryCopyAt(nOffset + IL_OFFSET__COMPACT_BRFALSE, CMemoryRef(&nBrfalseDistance, sizeof(BYTE)));
+    nOffset += nCallTrapSize;
+
+    // fault
+    xPrologue.MemoryCopyAt(nOffset, CMemoryRef(IL_CODE__COMPACT_FAULT, nFaultSize));
+    xPrologue.MemoryCopyAt(nOffset + IL_OFFSET__COMPACT_TAKE_EXCEPTION, CMemoryRef(&tkTakeExceptionMethodRef, sizeof(DWORD)));
+    nOffset += nFaultSize;
+
+    // return
+    if(0 < nReturnTypeSize)
+    {
+        xPrologue.MemoryCopyAt(nOffset, CMemoryRef(IL_CODE__COMPACT_RETURN_VALUE, nReturnSize));
+        xPrologue.MemoryCopyAt(nOffset + IL_OFFSET__COMPACT_TAKE_RETURN_VALUE,
+            CMemoryRef(&tkTakeReturnValueMethodRef, sizeof(DWORD)));
+    }
+    else
+    {
+        xPrologue.MemoryCopyAt(nOffset, CMemoryRef(IL_CODE__COMPACT_RETURN_VOID, nReturnSize));
+    }
+    nOffset += nReturnSize;
+
+    // disarmed, the address of the call counter is popped before the original code
+    xPrologue.MemoryCopyAt(nOffset, CMemoryRef(IL_CODE__COMPACT_DISARMED, nDisarmedSize));
+    ASSERT(nOffset + nDisarmedSize == nPrologueSize);
+
+    // The local-vars of the method are kept as they are.
+    this->RewriteILMethodBody(rMethodInfo, xPrologue, mdSignatureNil);
+    return nTrapId;
+}
+
+BOOL CMetadataModule::InsertStaticFaultIntoMethod(CMetadataMethod &rMethodInfo, const CStaticFault &rxStaticFault)
+{
+    ASSERT(rxStaticFault.IsDefined());
+
+    this->LoadILMethodBody(rMethodInfo);
+
+    // The return instruction must match the return type of the method
+    CMethodDefSigBlob xMethodSigBlob = rMethodInfo.GetMethodSignature();
+    PCCOR_SIGNATURE pTempSignature = xMethodSigBlob.LocateReturnType();
+    CorElementType nElementType = ::CorSigUncompressElementType(pTempSignature);
+    xMethodSigBlob.EnsureWithin(pTempSignature);
+
+    BYTE vCode[32];
+    CMemoryRef xCode;
+    switch(rxStaticFault.GetKind())
+    {
+    case CStaticFault::FAULT_THROW:
+        {
+            mdMemberRef tkConstructorRef = this->EmitMethodRefToken(rxStaticFault.GetAssemblyName(),
+                rxStaticFault.GetTypeName(), _T(".ctor"), SIG__DEFAULT_CONSTRUCTOR, sizeof(SIG__DEFAULT_CONSTRUCTOR));
+            xCode.Attach(vCode, sizeof(IL_CODE__THROW_FAULT) - 1);
+            xCode.MemoryCopy(CMemoryRef(IL_CODE__THROW_FAULT, xCode.GetSize()));
+            xCode.MemoryCopyAt(IL_OFFSET__STATIC_FAULT_OPERAND, CMemoryRef(&tkConstructorRef, sizeof(DWORD)));
+        }
+        break;
+
+    case CStaticFault::FAULT_RETURN_NULL:
+        switch(nElementType)
+        {
+        case ELEMENT_TYPE_VOID:
+            xCode.Attach(vCode, sizeof(IL_CODE__RETURN_VOID_FAULT) - 1);
+            xCode.MemoryCopy(CMemoryRef(IL_CODE__RETURN_VOID_FAULT, xCode.GetSize()));
+            break;
+        case ELEMENT_TYPE_STRING:
+        case ELEMENT_TYPE_CLASS:
+        case ELEMENT_TYPE_OBJECT:
+        case ELEMENT_TYPE_SZARRAY:
+        case ELEMENT_TYPE_ARRAY:
+            xCode.Attach(vCode, sizeof(IL_CODE__RETURN_NULL_FAULT) - 1);
+            xCode.MemoryCopy(CMemoryRef(IL_CODE__RETURN_NULL_FAULT, xCode.GetSize()));
+            break;
+        case ELEMENT_TYPE_GENERICINST:
+            if(ELEMENT_TYPE_CLASS == ::CorSigUncompressElementType(pTempSignature))
+            {
+                xCode.Attach(vCode, sizeof(IL_CODE__RETURN_NULL_FAULT) - 1);
+                xCode.MemoryCopy(CMemoryRef(IL_CODE__RETURN_NULL_FAULT, xCode.GetSize()));
+            }
+            break;
+        default:
+            break;  // value types can not be null, FaultDispatcher reports it
+        }
         break;
-    case ELEMENT_TYPE_OBJECT:
-        xNewILMethodBody.MemoryCopyAt(xNewILMethodHeader.GetSize() + IL_OFFSET__UNBOX,
-            CMemoryRef(IL_CODE__JUST_RETURN, IL_SIZE__RETURN_OBJECT));
+
+    case CStaticFault::FAULT_RETURN_VALUE:
+        {
+            // The value must have exactly the return type. Otherwise it would be boxed (return
+            // type is object) or converted, which is left to FaultDispatcher.
+            LPCTSTR pstrTypeName = NULL;
+            switch(nElementType)
+            {
+            case ELEMENT_TYPE_BOOLEAN   : pstrTypeName = _T("System.Boolean");    break;
+            case ELEMENT_TYPE_CHAR      : pstrTypeName = _T("System.Char");       break;
+            case ELEMENT_TYPE_I1        : pstrTypeName = _T("System.SByte");      break;
+            case ELEMENT_TYPE_U1        : pstrTypeName = _T("System.Byte");       break;
+            case ELEMENT_TYPE_I2        : pstrTypeName = _T("System.Int16");      break;
+            case ELEMENT_TYPE_U2        : pstrTypeName = _T("System.UInt16");     break;
+            case ELEMENT_TYPE_I4        : pstrTypeName = _T("System.Int32");      break;
+            case ELEMENT_TYPE_U4        : pstrTypeName = _T("System.UInt32");     break;
+            case ELEMENT_TYPE_I8        : pstrTypeName = _T("System.Int64");      break;
+            case ELEMENT_TYPE_U8        : pstrTypeName = _T("System.UInt64");     break;
+            case ELEMENT_TYPE_R4        : pstrTypeName = _T("System.Single");     break;
+            case ELEMENT_TYPE_R8        : pstrTypeName = _T("System.Double");     break;
+            default                     : break;
+            }
+            if((NULL == pstrTypeName) || (0 != _tcscmp(pstrTypeName, rxStaticFault.GetTypeName())))
+            {
+                break;
+            }
+
+            switch(nElementType)
+            {
+            case ELEMENT_TYPE_I8:
+                {
+                    LONGLONG nValue = rxStaticFault.GetIntegerValue();
+                    xCode.Attach(vCode, sizeof(IL_CODE__RETURN_I8_FAULT) - 1);
+                    xCode.MemoryCopy(CMemoryRef(IL_CODE__RETURN_I8_FAULT, xCode.GetSize()));
+                    xCode.MemoryCopyAt(IL_OFFSET__STATIC_FAULT_OPERAND, CMemoryRef(&nValue, sizeof(LONGLONG)));
+                }
+                break;
+            case ELEMENT_TYPE_U8:
+                {
+                    ULONGLONG nValue = rxStaticFault.GetUnsignedIntegerValue();
+                    xCode.Attach(vCode, sizeof(IL_CODE__RETURN_I8_FAULT) - 1);
+                    xCode.MemoryCopy(CMemoryRef(IL_CODE__RETURN_I8_FAULT, xCode.GetSize()));
+                    xCode.MemoryCopyAt(IL_OFFSET__STATIC_FAULT_OPERAND, CMemoryRef(&nValue, sizeof(ULONGLONG)));
+                }
+                break;
+            case ELEMENT_TYPE_R4:
+                {
+                    float fValue = (float)rxStaticFault.GetRealValue();
+                    xCode.Attach(vCode, sizeof(IL_CODE__RETURN_R4_FAULT) - 1);
+                    xCode.MemoryCopy(CMemoryRef(IL_CODE__RETURN_R4_FAULT, xCode.GetSize()));
+                    xCode.MemoryCopyAt(IL_OFFSET__STATIC_FAULT_OPERAND, CMemoryRef(&fValue, sizeof(float)));
+                }
+                break;
+            case ELEMENT_TYPE_R8:
+                {
+                    double fValue = rxStaticFault.GetRealValue();
+                    xCode.Attach(vCode, sizeof(IL_CODE__RETURN_R8_FAULT) - 1);
+                    xCode.MemoryCopy(CMemoryRef(IL_CODE__RETURN_R8_FAULT, xCode.GetSize()));
+                    xCode.MemoryCopyAt(IL_OFFSET__STATIC_FAULT_OPERAND, CMemoryRef(&fValue, sizeof(double)));
+                }
+                break;
+            default:
+                {
+                    // 32-bit and smaller integers are all loaded by ldc.i4
+                    DWORD nValue = (ELEMENT_TYPE_U4 == nElementType)
+                        ? (DWORD)rxStaticFault.GetUnsignedIntegerValue() : (DWORD)rxStaticFault.GetIntegerValue();
+                    xCode.Attach(vCode, sizeof(IL_CODE__RETURN_I4_FAULT) - 1);
+                    xCode.MemoryCopy(CMemoryRef(IL_CODE__RETURN_I4_FAULT, xCode.GetSize()));
+                    xCode.MemoryCopyAt(IL_OFFSET__STATIC_FAULT_OPERAND, CMemoryRef(&nValue, sizeof(DWORD)));
+                }
+                break;
+            }
+        }
         break;
+
+    case CStaticFault::FAULT_DELAY:
+        {
+            ULONG nLatencyId;
+            if(!CLatencyFault::Register(rxStaticFault.GetLatency(), nLatencyId))
+            {
+                break;  // FaultDispatcher delays the call instead
+            }
+
+            mdSignature tkLatencyRoutineSig;
+            HRESULT hr = this->m_pMetaDataEmit->GetTokenFromSig(SIG__LATENCY_ROUTINE, sizeof(SIG__LATENCY_ROUTINE),
+                &tkLatencyRoutineSig);
+            if(FAILED(hr))
+            {
+                EventReportError(IDS_REPORT_FAILED_GET_TOKEN_FROM_SIG, hr, SIG__LATENCY_ROUTINE, sizeof(SIG__LATENCY_ROUTINE));
+                CExceptionAsBreak::Throw();
+            }
+
+            // as a 64-bit address which conv.i narrows down on 32-bit platforms
+            ULONGLONG nRoutineAddress = (ULONGLONG)(UINT_PTR)&CLatencyFault::InjectById;
+            xCode.Attach(vCode, sizeof(IL_CODE__DELAY_FAULT) - 1);
+            xCode.MemoryCopy(CMemoryRef(IL_CODE__DELAY_FAULT, xCode.GetSize()));
+            xCode.MemoryCopyAt(IL_OFFSET__LATENCY_ID, CMemoryRef(&nLatencyId, sizeof(DWORD)));
+            xCode.MemoryCopyAt(IL_OFFSET__LATENCY_ROUTINE, CMemoryRef(&nRoutineAddress, sizeof(ULONGLONG)));
+            xCode.MemoryCopyAt(IL_OFFSET__LATENCY_SIG, CMemoryRef(&tkLatencyRoutineSig, sizeof(DWORD)));
+        }
+        break;
+
     default:
-        xNewILMethodBody.MemoryCopyAt(xNewILMethodHeader.GetSize() + IL_OFFSET__RETURN_TYPE,
-            CMemoryRef(&tkReturnType, sizeof(DWORD)));
         break;
     }
 
-    // TODO: copy the old code ... and SEH
-    xNewILMethodBody.GetCode().MemoryCopyAt(IL_SIZE__PROLOGUE,
-        rMethodInfo.GetILMethodBody().GetCode());
-    if(!xNewILMethodSect.IsNull())
-        xNewILMethodBody.GetSect().MemoryCopy(xNewILMethodSect);
+    if(xCode.IsNull())
+    {
+        return FALSE;  // not compilable for this method
+    }
+
+    this->RewriteILMethodBody(rMethodInfo, xCode, mdSignatureNil);
+    return TRUE;
+}
+
+ULONG CMetadataModule::InsertCallSiteTrapsIntoMethod(CMetadataMethod &rMethodInfo, const CAtlArray<CString> &rvszCallees)
+{
+    this->LoadILMethodBody(rMethodInfo);
+    LARGE_INTEGER xStartTime;
+    ::QueryPerformanceCounter(&xStartTime);
+
+    // The code is laid out again with its exception clauses, other sections would be out of date.
+    CILMethodHeader xOldILMethodHeader = rMethodInfo.GetILMethodBody().GetHeader();
+    CILMethodSect xOldILMethodSect;
+    if(xOldILMethodHeader.IsFat())
+        xOldILMethodSect = rMethodInfo.GetILMethodBody().GetSect();
+    for(CILMethodSect xSect = xOldILMethodSect; !xSect.IsNull(); xSect = xSect.GetNextSection())
+    {
+        if(!xSect.IsExceptionHandler())
+        {
+            DebugTrace(_T("Method 0x%X has optional IL tables, its call sites are not trapped"),
+                rMethodInfo.GetMethodDefToken());
+            return 0;
+        }
+    }
+
+    CILInstructionList xInstructions;
+    if(!xInstructions.Decode(rMethodInfo.GetILMethodBody().GetCode(), xOldILMethodSect))
+    {
+        DebugTrace(_T("IL code of method 0x%X not decoded, its call sites are not trapped"),
+            rMethodInfo.GetMethodDefToken());
+        return 0;
+    }
 
-    DebugDump(xNewILMethodBody, _T("New IL Body:"));
+    // Each call to a callee of the method filter gets a gate of its own, in place of the prologue
+    // of the callee, so only the calls made in the caller scopes are faulted:
+    //      count; gate (to CALL_SITE); pop arguments; throw or take return value; br JOIN
+    //      CALL_SITE: prefixes; call; JOIN: nop
+    CAtlMap<mdToken, CALL_SITE_TRAP> mapCallSiteTraps;
+    mdMemberRef tkTrapMethodRef = mdMemberRefNil;
+    mdMemberRef tkTakeExceptionMethodRef = mdMemberRefNil;
+    mdMemberRef tkIncrementMethodRef = mdMemberRefNil;
+    BOOL bAtomic = CSettings::IsCallCountingAtomic();
+    ULONG nCallSiteCount = 0;
+    POSITION posFirstPrefix = NULL;
+    BOOL bTailCall = FALSE;
+    for(POSITION pos = xInstructions.GetHeadPosition(); NULL != pos; pos = xInstructions.GetNext(pos))
+    {
+        // The gate goes before the prefixes of the call.
+        IL_OPCODE_ID nOpcode = xInstructions.GetAt(pos).nOpcode;
+        if(IL_FLOW_PREFIX == CILOpcodes::GetInfo(nOpcode).nFlow)
+        {
+            if(NULL == posFirstPrefix)
+                posFirstPrefix = pos;
+            bTailCall |= (IL_OP_TAILCALL == nOpcode);
+            continue;
+        }
+        POSITION posCallSite = (NULL != posFirstPrefix) ? posFirstPrefix : pos;
+        BOOL bTailCallSite = bTailCall;
+        posFirstPrefix = NULL;
+        bTailCall = FALSE;
 
-    // set method body
-    HRESULT hr = this->m_pCorProfilerInfo->SetILFunctionBody(this->m_moduleId, rMethodInfo.GetMethodDefToken(),
+        // A tail call must be followed by ret, there is no room for the join.
+        if(((IL_OP_CALL != nOpcode) && (IL_OP_CALLVIRT != nOpcode)) || bTailCallSite)
+        {
+            continue;
+        }
+        mdToken tkCallee = (mdToken)(xInstructions.GetAt(pos).nOperand);
+        CALL_SITE_TRAP xTrap;
+        if(!mapCallSiteTraps.Lookup(tkCallee, xTrap))
+        {
+            this->PrepareCallSiteTrap(tkCallee, rvszCallees, xTrap);
+            mapCallSiteTraps.SetAt(tkCallee, xTrap);
+        }
+        if(!xTrap.bTrapped)
+        {
+            continue;
+        }
+
+        if(mdMemberRefNil == tkTrapMethodRef)
+        {
+            tkTrapMethodRef = this->EmitMethodRefToken(
+                CSettings::GetDispatcherAssemblyName(),
+                CSettings::GetDispatcherFullQualifiedClassName(),
+                CSettings::GetDispatcherNonQualifiedMethodName(),
+                SIG_PREFIX__TRAP_COMPACT, sizeof(SIG_PREFIX__TRAP_COMPACT));
+            tkTakeExceptionMethodRef = this->EmitMethodRefToken(
+                CSettings::GetDispatcherAssemblyName(),
+                CSettings::GetDispatcherFullQualifiedClassName(),
+                _T("TakeFaultedException"),
+                SIG_PREFIX__TAKE_FAULTED_EXCEPTION, sizeof(SIG_PREFIX__TAKE_FAULTED_EXCEPTION));
+            if(bAtomic)
+            {
+                tkIncrementMethodRef = this->EmitMethodRefToken(
+                    CSettings::GetCLISystemAssemblyName(), _T("System.Threading.Interlocked"), _T("Increment"),
+                    SIG__INTERLOCKED_INCREMENT, sizeof(SIG__INTERLOCKED_INCREMENT));
+            }
+        }
+        CTrapTable::TRAP_GATE *pGate = CTrapTable::GetGate(xTrap.nTrapId);
+        ULONGLONG nCallCounterAddress = (ULONGLONG)(UINT_PTR)&pGate->nCalls;
+        ULONGLONG nThresholdAddress = (ULONGLONG)(UINT_PTR)&pGate->nThreshold;
+        ULONGLONG nArmedFlagAddress = (ULONGLONG)(UINT_PTR)&pGate->bArmed;
+
+        // armed flag, where the branches and the exception clauses to the call site go now;
+        // calls are neither counted nor trapped while the gate is disarmed
+        POSITION posArmed = xInstructions.InsertBefore(posCallSite, IL_OP_LDC_I8, nArmedFlagAddress);
+        xInstructions.RetargetBranches(posCallSite, posArmed);
+        xInstructions.InsertBefore(posCallSite, IL_OP_CONV_U);
+        xInstructions.InsertBefore(posCallSite, IL_OP_LDIND_U1);
+        xInstructions.InsertBranchBefore(posCallSite, IL_OP_BRFALSE, posCallSite);
+
+        // call counting
+        xInstructions.InsertBefore(posCallSite, IL_OP_LDC_I8, nCallCounterAddress);
+        xInstructions.InsertBefore(posCallSite, IL_OP_CONV_U);
+        if(bAtomic)
+        {
+            xInstructions.InsertBefore(posCallSite, IL_OP_CALL, tkIncrementMethodRef);
+        }
+        else
+        {
+            xInstructions.InsertBefore(posCallSite, IL_OP_DUP);
+            xInstructions.InsertBefore(posCallSite, IL_OP_LDIND_I4);
+            xInstructions.InsertBefore(posCallSite, IL_OP_LDC_I4_1);
+            xInstructions.InsertBefore(posCallSite, IL_OP_ADD);
+            xInstructions.InsertBefore(posCallSite, IL_OP_STIND_I4);
+            xInstructions.InsertBefore(posCallSite, IL_OP_LDC_I8, nCallCounterAddress);
+            xInstructions.InsertBefore(posCallSite, IL_OP_CONV_U);
+            xInstructions.InsertBefore(posCallSite, IL_OP_LDIND_I4);
+        }
+
+        // gate, whose branches go to the call site
+        xInstructions.InsertBefore(posCallSite, IL_OP_LDC_I8, nThresholdAddress);
+        xInstructions.InsertBefore(posCallSite, IL_OP_CONV_U);
+        xInstructions.InsertBefore(posCallSite, IL_OP_LDIND_I4);
+        xInstructions.InsertBranchBefore(posCallSite, IL_OP_BLT, posCallSite);
+        xInstructions.InsertBefore(posCallSite, IL_OP_LDC_I4, xTrap.nTrapId);
+        xInstructions.InsertBefore(posCallSite, IL_OP_CALL, tkTrapMethodRef);
+        xInstructions.InsertBranchBefore(posCallSite, IL_OP_BRFALSE, posCallSite);
+
+        // fault: the arguments of the call are dropped, then the exception is thrown, or the
+        // return value stands for the one of the callee
+        for(ULONG i = 0; i < xTrap.nArgumentCount; i++)
+        {
+            xInstructions.InsertBefore(posCallSite, IL_OP_POP);
+        }
+        xInstructions.InsertBefore(posCallSite, IL_OP_CALL, tkTakeExceptionMethodRef);
+        xInstructions.InsertBefore(posCallSite, IL_OP_DUP);
+        POSITION posNoException = xInstructions.InsertBefore(posCallSite, IL_OP_POP);
+        xInstructions.InsertBranchBefore(posNoException, IL_OP_BRFALSE, posNoException);
+        xInstructions.InsertBefore(posNoException, IL_OP_THROW);
+        if(mdMethodSpecNil != xTrap.tkTakeReturnValue)
+        {
+            xInstructions.InsertBefore(posCallSite, IL_OP_CALL, xTrap.tkTakeReturnValue);
+        }
+        POSITION posJoin = xInstructions.InsertBefore(xInstructions.GetNext(pos), IL_OP_NOP);
+        xInstructions.InsertBranchBefore(posCallSite, IL_OP_BR, posJoin);
+        nCallSiteCount++;
+    }
+    if(0 == nCallSiteCount)
+    {
+        return 0;
+    }
+
+    // The body is fat, with the exception clauses in a single fat section.
+    CILMethodHeader xNewILMethodHeader;
+    if(xOldILMethodHeader.IsTiny())
+    {
+        xNewILMethodHeader.Attach((LPVOID)(&imageDefaultILMethodFatHeaderWithoutLocals),
+            sizeof(imageDefaultILMethodFatHeaderWithoutLocals));
+    }
+    else
+    {
+        xNewILMethodHeader = xOldILMethodHeader;
+    }
+    ULONG nNewILMethodHeaderSize = (ULONG)xNewILMethodHeader.GetSize();
+    ULONG nNewILMethodCodeSize = xInstructions.Layout();
+    ULONG nClauseCount = xInstructions.GetExceptionClauseCount();
+    ULONG nNewILMethodSectSize = (0 < nClauseCount)
+        ? sizeof(IMAGE_COR_ILMETHOD_SECT_FAT) + nClauseCount * sizeof(IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT) : 0;
+    ULONG nPaddingSize = 0;
+    if(0 < nNewILMethodSectSize)
+        nPaddingSize = ((nNewILMethodCodeSize + (sizeof(DWORD)-1)) & ~(sizeof(DWORD)-1)) - nNewILMethodCodeSize;
+    ULONG nNewILMethodBodySize = nNewILMethodHeaderSize + nNewILMethodCodeSize + nPaddingSize + nNewILMethodSectSize;
+
+    CAtlArray<BYTE> vReJitILMethodBody;
+    LPBYTE pMethodILBody = this->AllocateILMethodBody(nNewILMethodBodySize, vReJitILMethodBody);
+    LPBYTE pTarget = pMethodILBody;
+    ::memcpy(pTarget, xNewILMethodHeader.GetBaseAddress(), nNewILMethodHeaderSize);
+    xNewILMethodHeader.Attach(pTarget, nNewILMethodHeaderSize);
+    pTarget += nNewILMethodHeaderSize;
+
+    CMemoryRef xNewILMethodCode(pTarget, nNewILMethodCodeSize);
+    xInstructions.Encode(pTarget);
+    pTarget += nNewILMethodCodeSize;
+    ::memset(pTarget, 0, nPaddingSize);
+    pTarget += nPaddingSize;
+
+    CILMethodSect xNewILMethodSect;
+    if(0 < nNewILMethodSectSize)
+    {
+        xNewILMethodSect = CILMethodSect(pTarget, nNewILMethodSectSize);
+        xNewILMethodSect.MemoryCopy(
+            CMemoryRef((&imageDefaultILMethodFatSection), sizeof(imageDefaultILMethodFatSection)));
+        xNewILMethodSect.SetAsHasMoreSections(FALSE);
+        xNewILMethodSect.SetSectionDataSize(nNewILMethodSectSize);
+        xInstructions.EncodeExceptionClauses(
+            (IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT*)(pTarget + sizeof(IMAGE_COR_ILMETHOD_SECT_FAT)));
+        pTarget += nNewILMethodSectSize;
+    }
+    ASSERT(pTarget == pMethodILBody + nNewILMethodBodySize);
+
+    // The gates need at most 3 slots above the arguments of the call, which the original code
+    // has already counted.
+    CILStackAnalyzer xStackAnalyzer(this->m_pMetaDataImport);
+    ULONG nMaxStack;
+    if(!xStackAnalyzer.ComputeMaxStack(xNewILMethodCode, xNewILMethodSect, nMaxStack))
+    {
+        DebugTrace(_T("IL code of method 0x%X not analyzed, max stack is estimated"), rMethodInfo.GetMethodDefToken());
+        nMaxStack = xOldILMethodHeader.GetMaxStack() + 3;
+    }
+    xNewILMethodHeader.SetCodeSize(nNewILMethodCodeSize);
+    xNewILMethodHeader.SetMaxStack(nMaxStack);
+    DebugDump(CILMethodBody(pMethodILBody, nNewILMethodBodySize), _T("New IL Body:"));
+
+    LARGE_INTEGER xEndTime;
+    ::QueryPerformanceCounter(&xEndTime);
+    CRewriteCache::CountRewrittenBody(rMethodInfo.GetILMethodBody().GetSize(), nNewILMethodBodySize,
+        FALSE, xEndTime.QuadPart - xStartTime.QuadPart);
+
+    this->SetILMethodBody(rMethodInfo, pMethodILBody, nNewILMethodBodySize);
+    return nCallSiteCount;
+}
+
+void CMetadataModule::PrepareCallSiteTrap(mdToken tkCallee, const CAtlArray<CString> &rvszCallees,
+                                          CALL_SITE_TRAP &rTrap)
+{
+    rTrap.bTrapped = FALSE;
+    rTrap.nTrapId = 0;
+    rTrap.nArgumentCount = 0;
+    rTrap.tkTakeReturnValue = mdMethodSpecNil;
+
+    PCCOR_SIGNATURE pvSignature;
+    ULONG nSignatureSize;
+    CString szCalleeName = this->RetrieveFullQualifiedMemberName(tkCallee, pvSignature, nSignatureSize);
+    size_t nIndex = 0;
+    while((nIndex < rvszCallees.GetCount()) && (rvszCallees[nIndex] != szCalleeName))
+    {
+        nIndex++;
+    }
+    if(szCalleeName.IsEmpty() || (nIndex == rvszCallees.GetCount()))
+    {
+        return;
+    }
+
+    //  MethodRefSig ::= [HASTHIS [EXPLICITTHIS]] (DEFAULT | VARARG | GENERIC GenParamCount)
+    //      ParamCount RetType Param* [SENTINEL Param+]
+    // where ParamCount counts the parameters after the sentinel as well.
+    CMethodDefSigBlob xMethodSigBlob(pvSignature, nSignatureSize);
+    PCCOR_SIGNATURE pTempSignature = pvSignature;
+    ULONG nCallingConvention = ::CorSigUncompressCallingConv(pTempSignature);
+    if(nCallingConvention & IMAGE_CEE_CS_CALLCONV_GENERIC)
+    {
+        ::CorSigUncompressData(pTempSignature);
+    }
+    rTrap.nArgumentCount = ::CorSigUncompressData(pTempSignature);
+    xMethodSigBlob.EnsureWithin(pTempSignature);
+    if((nCallingConvention & IMAGE_CEE_CS_CALLCONV_HASTHIS) && !(nCallingConvention & IMAGE_CEE_CS_CALLCONV_EXPLICITTHIS))
+    {
+        rTrap.nArgumentCount++;  // this
+    }
+
+    PCCOR_SIGNATURE pvReturnType = pTempSignature;
+    CorElementType nElementType = ::CorSigUncompressElementType(pTempSignature);
+    xMethodSigBlob.EnsureWithin(pTempSignature);
+    switch(nElementType)
+    {
+    case ELEMENT_TYPE_VOID           :
+        break;
+
+    case ELEMENT_TYPE_CMOD_REQD      :
+    case ELEMENT_TYPE_CMOD_OPT       :
+    case ELEMENT_TYPE_BYREF          :
+    case ELEMENT_TYPE_TYPEDBYREF     :
+    case ELEMENT_TYPE_PTR            :
+    case ELEMENT_TYPE_FNPTR          :
+        // The return type is passed to TakeFaultedReturnValue<T> as its generic argument, which
+        // can be none of these.
+        DebugTrace(_T("Return type 0x%X of %s is not supported at call sites"), nElementType, (LPCTSTR)szCalleeName);
+        return;
+
+    default:
+        {
+            pTempSignature = pvReturnType;
+            BOOL bTypeParameters;
+            if(!xMethodSigBlob.ParseRetTypeSig(pTempSignature, bTypeParameters))
+            {
+                return;
+            }
+            ULONG nReturnTypeSize = (ULONG)((LPCBYTE)pTempSignature - (LPCBYTE)pvReturnType);
+
+            // Type parameters are those of the callee, not of the caller.
+            if(bTypeParameters)
+            {
+                DebugTrace(_T("Return type of %s is generic, not supported at call sites"), (LPCTSTR)szCalleeName);
+                return;
+            }
+            mdMemberRef tkGenericTakeReturnValueMethodRef = this->EmitMethodRefToken(
+                CSettings::GetDispatcherAssemblyName(),
+                CSettings::GetDispatcherFullQualifiedClassName(),
+                _T("TakeFaultedReturnValue"),
+                SIG__TAKE_FAULTED_RETURN_VALUE, sizeof(SIG__TAKE_FAULTED_RETURN_VALUE));
+            rTrap.tkTakeReturnValue = this->EmitMethodSpecToken(tkGenericTakeReturnValueMethodRef, pvReturnType,
+                nReturnTypeSize);
+        }
+        break;
+    }
+
+    // The trap is identified by the token of the call, which the dispatcher resolves in the
+    // module of the caller.
+    rTrap.nTrapId = CTrapTable::RegisterCallSite(this->m_moduleId, this->GetModuleVersionId(), tkCallee, szCalleeName);
+    rTrap.bTrapped = TRUE;
+}
+
+void CMetadataModule::RewriteILMethodBody(CMetadataMethod &rMethodInfo, const CMemoryRef &rxPrologue,
+                                          mdSignature tkNewLocalVar)
+{
+    // The body is built in two passes: the size of every part is computed first, then all parts
+    // are encoded right into the single buffer allocated for the body, without intermediate copies.
+    LARGE_INTEGER xStartTime;
+    ::QueryPerformanceCounter(&xStartTime);
+    ULONG nPrologueSize = (ULONG)rxPrologue.GetSize();
+    CILMethodHeader xOldILMethodHeader = rMethodInfo.GetILMethodBody().GetHeader();
+    CILMethodSect xOldILMethodSect;
+    if(xOldILMethodHeader.IsFat())
+        xOldILMethodSect = rMethodInfo.GetILMethodBody().GetSect();
+
+    // The prologue goes on with the original code only with an empty stack, so the max stack is
+    // the larger of both. The original code keeps its declared max stack if it can't be analyzed.
+    CILStackAnalyzer xStackAnalyzer(this->m_pMetaDataImport);
+    ULONG nPrologueMaxStack, nMaxStack;
+    if(!xStackAnalyzer.ComputeMaxStack(rxPrologue, CILMethodSect(), nPrologueMaxStack))
+    {
+        EventReportError(IDS_REPORT_INVALID_PROLOGUE, this->m_moduleId, rMethodInfo.GetMethodDefToken(),
+            rxPrologue.GetSize());
+        CExceptionAsBreak::Throw();
+    }
+    if(!xStackAnalyzer.ComputeMaxStack(rMethodInfo.GetILMethodBody().GetCode(), xOldILMethodSect, nMaxStack))
+    {
+        DebugTrace(_T("IL code of method 0x%X not analyzed, keeps max stack %u"), rMethodInfo.GetMethodDefToken(),
+            xOldILMethodHeader.GetMaxStack());
+        nMaxStack = xOldILMethodHeader.GetMaxStack();
+    }
+    if(nMaxStack < nPrologueMaxStack)
+        nMaxStack = nPrologueMaxStack;
+
+    CILMethodHeader xNewILMethodHeader;
+    if(xOldILMethodHeader.IsTiny())
+    {
+        DebugDump(xOldILMethodHeader, _T("Original TINY IL Method Header"));
+        if(mdSignatureNil != tkNewLocalVar)
+        {
+            xNewILMethodHeader.Attach((LPVOID)(&imageDefaultILMethodFatHeader), sizeof(imageDefaultILMethodFatHeader));
+        }
+        else if((nMaxStack <= IL_NUMBER__MAX_TINY_STACK) &&
+            (xOldILMethodHeader.GetCodeSize() + nPrologueSize <= IL_SIZE__MAX_TINY_CODE))
+        {
+            // Small getters and setters stay tiny, so the JIT still sees them as small methods.
+            xNewILMethodHeader = xOldILMethodHeader;
+        }
+        else
+        {
+            xNewILMethodHeader.Attach((LPVOID)(&imageDefaultILMethodFatHeaderWithoutLocals),
+                sizeof(imageDefaultILMethodFatHeaderWithoutLocals));
+        }
+    }
+    else
+    {
+        ASSERT(xOldILMethodHeader.IsFat());
+        DebugDump(xOldILMethodHeader, _T("Original FAT IL Method Header"));
+        xNewILMethodHeader = xOldILMethodHeader;
+        DebugDump(xOldILMethodSect, _T("Original IL Method Sect"));
+    }
+
+    // Pass 1: size of header, code, padding and sections. Only sections need to be dword aligned,
+    // and the fat header is a whole number of dwords.
+    ULONG nNewILMethodHeaderSize = (ULONG)xNewILMethodHeader.GetSize();
+    ULONG nNewILMethodCodeSize = nPrologueSize + xOldILMethodHeader.GetCodeSize();
+    ULONG nNewILMethodSectSize = (ULONG)this->MeasureILMethodSect(xOldILMethodSect);
+    ULONG nPaddingSize = 0;
+    if(0 < nNewILMethodSectSize)
+        nPaddingSize = ((nNewILMethodCodeSize + (sizeof(DWORD)-1)) & ~(sizeof(DWORD)-1)) - nNewILMethodCodeSize;
+    ULONG nNewILMethodBodySize = nNewILMethodHeaderSize + nNewILMethodCodeSize + nPaddingSize + nNewILMethodSectSize;
+
+    // Allocate new ILMethodBody memory.
+    CAtlArray<BYTE> vReJitILMethodBody;
+    LPBYTE pMethodILBody = this->AllocateILMethodBody(nNewILMethodBodySize, vReJitILMethodBody);
+
+    // Pass 2: every byte of the body is written once. Copy and adjust new header
+    LPBYTE pTarget = pMethodILBody;
+    ::memcpy(pTarget, xNewILMethodHeader.GetBaseAddress(), nNewILMethodHeaderSize);
+    xNewILMethodHeader.Attach(pTarget, nNewILMethodHeaderSize);
+    pTarget += nNewILMethodHeaderSize;
+
+    xNewILMethodHeader.SetCodeSize(nNewILMethodCodeSize);
+    xNewILMethodHeader.SetMaxStack(nMaxStack);
+    if(mdSignatureNil != tkNewLocalVar)
+        xNewILMethodHeader.SetLocalVarToken(tkNewLocalVar);  // otherwise keep the local-vars of the method
+    DebugDump(xNewILMethodHeader, _T("New IL Method Header"));
+
+    // Write Prologue, then the original code
+    ::memcpy(pTarget, rxPrologue.GetBaseAddress(), nPrologueSize);
+    pTarget += nPrologueSize;
+    CMemoryRef xOldILMethodCode = rMethodInfo.GetILMethodBody().GetCode();
+    ::memcpy(pTarget, xOldILMethodCode.GetBaseAddress(), xOldILMethodCode.GetSize());
+    pTarget += xOldILMethodCode.GetSize();
+
+    // Pad the code, and encode the sections with their offsets shifted by the prologue
+    ::memset(pTarget, 0, nPaddingSize);
+    pTarget += nPaddingSize;
+    this->EncodeILMethodSect(xOldILMethodSect, nPrologueSize, pTarget);
+    ASSERT(pTarget + nNewILMethodSectSize == pMethodILBody + nNewILMethodBodySize);
+
+    DebugDump(CILMethodBody(pMethodILBody, nNewILMethodBodySize), _T("New IL Body:"));
+    LARGE_INTEGER xEndTime;
+    ::QueryPerformanceCounter(&xEndTime);
+    CRewriteCache::CountRewrittenBody(rMethodInfo.GetILMethodBody().GetSize(), nNewILMethodBodySize,
+        xNewILMethodHeader.IsTiny(), xEndTime.QuadPart - xStartTime.QuadPart);
+
+    this->SetILMethodBody(rMethodInfo, pMethodILBody, nNewILMethodBodySize);
+}
+
+LPBYTE CMetadataModule::AllocateILMethodBody(ULONG nILMethodBodySize, CAtlArray<BYTE> &rvReJitILMethodBody)
+{
+    // The function control of ReJIT copies the body, so it needs no memory from the allocator
+    // of the module. The body is then held by the given array.
+    LPBYTE pMethodILBody = NULL;
+    if(NULL != this->m_pFunctionControl)
+    {
+        if(rvReJitILMethodBody.SetCount(nILMethodBodySize))
+        {
+            pMethodILBody = rvReJitILMethodBody.GetData();
+        }
+    }
+    else
+    {
+        pMethodILBody = (LPBYTE)(this->m_pMethodMalloc->Alloc(nILMethodBodySize));
+    }
+    if(NULL == pMethodILBody)
+    {
+        EventReportError(IDS_REPORT_FAILED_ALLOC, E_OUTOFMEMORY, nILMethodBodySize);
+        CExceptionAsBreak::Throw();
+    }
+    return pMethodILBody;
+}
+
+void CMetadataModule::SetILMethodBody(CMetadataMethod &rMethodInfo, LPBYTE pMethodILBody, ULONG nILMethodBodySize)
+{
+    HRESULT hr;
+    if(NULL != this->m_pFunctionControl)
+    {
+        hr = this->m_pFunctionControl->SetILFunctionBody(nILMethodBodySize, pMethodILBody);
+        if(FAILED(hr))
+        {
+            EventReportError(IDS_REPORT_FAILED_SET_REJIT_FUNCTION_BODY, hr, this->m_moduleId,
+                rMethodInfo.GetMethodDefToken(), nILMethodBodySize);
+            CExceptionAsBreak::Throw();
+        }
+        DebugTrace(_T("Function Modified for ReJIT!\n"));
+        return;
+    }
+    hr = this->m_pCorProfilerInfo->SetILFunctionBody(this->m_moduleId, rMethodInfo.GetMethodDefToken(),
         pMethodILBody);
     if(FAILED(hr))
     {
@@ -700,95 +2056,39 @@ void CMetadataModule::InsertPrologueIntoMethod(CMetadataMethod &rMethodInfo)
         CExceptionAsBreak::Throw();
     }
     DebugTrace(_T("Function Modified!!!!!!!!!!!!!!\n"));
-
-    return;
 }
 
-CorElementType CMetadataModule::ParseReturnType(CMetadataMethod &rMethodInfo, mdToken &tkReturnType)
+CorElementType CMetadataModule::ParseReturnType(CMetadataMethod &rMethodInfo, PCCOR_SIGNATURE &pvReturnType, ULONG &nReturnTypeSize)
 {
     CMethodDefSigBlob xMethodSigBlob = rMethodInfo.GetMethodSignature();
-    PCCOR_SIGNATURE pRetTypeSignature = xMethodSigBlob.LocateReturnType();
+    pvReturnType = xMethodSigBlob.LocateReturnType();
+    nReturnTypeSize = 0;
 
-    PCCOR_SIGNATURE pTempSignature = pRetTypeSignature;
+    PCCOR_SIGNATURE pTempSignature = pvReturnType;
     CorElementType nElementType = ::CorSigUncompressElementType(pTempSignature);
     xMethodSigBlob.EnsureWithin(pTempSignature);
 
     switch(nElementType)
     {
     case ELEMENT_TYPE_VOID           :
-    case ELEMENT_TYPE_OBJECT         :
         break;
 
-    case ELEMENT_TYPE_BOOLEAN        :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.Boolean"));
-        break;
-    case ELEMENT_TYPE_CHAR           :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.Char"));
-        break;
-    case ELEMENT_TYPE_I1             :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.SByte"));
-        break;
-    case ELEMENT_TYPE_U1             :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.Byte"));
-        break;
-    case ELEMENT_TYPE_I2             :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.Int16"));
-        break;
-    case ELEMENT_TYPE_U2             :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.UInt16"));
-        break;
-    case ELEMENT_TYPE_I4             :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.Int32"));
-        break;
-    case ELEMENT_TYPE_U4             :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.UInt32"));
-        break;
-    case ELEMENT_TYPE_I8             :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.Int64"));
-        break;
-    case ELEMENT_TYPE_U8             :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.UInt64"));
-        break;
-    case ELEMENT_TYPE_R4             :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.Single"));
-        break;
-    case ELEMENT_TYPE_R8             :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.Double"));
-        break;
-    case ELEMENT_TYPE_STRING         :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.String"));
-        break;
+    case ELEMENT_TYPE_CMOD_REQD      :
+    case ELEMENT_TYPE_CMOD_OPT       :
+    case ELEMENT_TYPE_BYREF          :
     case ELEMENT_TYPE_TYPEDBYREF     :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.TypedReference"));
-        break;
-    case ELEMENT_TYPE_I              :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.IntPtr"));
-        break;
-    case ELEMENT_TYPE_U              :
-        tkReturnType = this->EmitTypeRefToken(NULL, _T("System.UIntPtr"));
-        break;
-
-    case ELEMENT_TYPE_VALUETYPE      :
-    case ELEMENT_TYPE_CLASS          :
-        tkReturnType = ::CorSigUncompressToken(pTempSignature);
-        xMethodSigBlob.EnsureWithin(pTempSignature);
+    case ELEMENT_TYPE_PTR            :
+    case ELEMENT_TYPE_FNPTR          :
+        // The return type is passed to Trap<T> as its generic argument, which can be none of these
+        EventReportError(IDS_REPORT_UNSUPPORTED_RETURN_TYPE, rMethodInfo.GetMethodDefToken(), nElementType);
+        CExceptionAsBreak::Throw();
         break;
 
     default:
-        pTempSignature = pRetTypeSignature;
+        // The return type blob is used as is, its tokens are of the current scope already.
+        pTempSignature = pvReturnType;
         xMethodSigBlob.ParseRetTypeSig(pTempSignature);
-        {
-            HRESULT hr = this->m_pMetaDataEmit->GetTokenFromTypeSpec(pRetTypeSignature,
-                (ULONG)((LPCBYTE)pTempSignature - (LPCBYTE)pRetTypeSignature), &tkReturnType);
-            if(FAILED(hr))
-            {
-                EventReportError(IDS_REPORT_FAILED_GET_TOKEN_FROM_TYPESPEC, hr, pRetTypeSignature,
-                    (ULONG)((LPCBYTE)pTempSignature - (LPCBYTE)pRetTypeSignature));
-                DebugDump(xMethodSigBlob, _T("The method signature blob"));
-                CExceptionAsBreak::Throw();
-            }
-            DebugTrace(_T("Successfully emit type-spec token for return-type of current method."));
-        }
+        nReturnTypeSize = (ULONG)((LPCBYTE)pTempSignature - (LPCBYTE)pvReturnType);
         break;
     }
     return nElementType;
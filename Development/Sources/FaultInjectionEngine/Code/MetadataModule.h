@@ -5,6 +5,7 @@
 
 #pragma once
 #include "MetadataMethod.h"
+#include "StaticFault.h"
 
 BEGIN_DEFAULT_NAMESPACE
 
@@ -19,9 +20,14 @@ public:
 
 public:
     void AttachMetadata(CComQIPtr<ICorProfilerInfo> pCorProfilerInfo, ModuleID moduleId);
+    void SetFunctionControl(ICorProfilerFunctionControl *pFunctionControl);
     void LoadILMethodBody(CMetadataMethod &rMethodInfo);
     void LoadMethodProperties(CMetadataMethod &rMethodInfo);
-    void InsertPrologueIntoMethod(CMetadataMethod &rMethodInfo);
+    ULONG InsertPrologueIntoMethod(CMetadataMethod &rMethodInfo);
+    void InsertOfflinePrologueIntoMethod(CMetadataMethod &rMethodInfo);
+    BOOL InsertStaticFaultIntoMethod(CMetadataMethod &rMethodInfo, const CStaticFault &rxStaticFault);
+    ULONG InsertCallSiteTrapsIntoMethod(CMetadataMethod &rMethodInfo, const CAtlArray<CString> &rvszCallees);
+    GUID GetModuleVersionId(void);
     ULONG FindAllAssembliesByName(LPCTSTR pstrAssemblyName,
         CAtlArray<CComQIPtr<IMetaDataImport, &IID_IMetaDataImport> > &rvpAssembliesMetaDataImport);
     ULONG FindAllTypesByAssemblyAndName(LPCTSTR pstrAssemblyName, LPCTSTR pstrTypeName,
@@ -29,15 +35,49 @@ public:
         CAtlArray<mdTypeDef> &rvTypeDefTokens);
     ULONG FindAllMethodsByAssemblyAndName(LPCTSTR pstrAssemblyName, LPCTSTR pstrTypeName, LPCTSTR pstrMethodName,
         CAtlArray<CComQIPtr<IMetaDataImport, &IID_IMetaDataImport> > &rvpAssembliesMetaDataImport,
-        CAtlArray<mdTypeDef> &rvTypeDefTokens, CAtlArray<mdMethodDef> &rvMethodDefTokens);
+        CAtlArray<mdTypeDef> &rvTypeDefTokens, CAtlArray<mdMethodDef> &rvMethodDefTokens,
+        PCCOR_SIGNATURE pvSignaturePrefix = NULL, ULONG nSignaturePrefixSize = 0);
+    ULONG FindMethodsByFullQualifiedName(const CAtlArray<CString> &rvszMethodNames,
+        const CAtlArray<ULONGLONG> &rvnSignatureHashes, CAtlArray<mdMethodDef> &rvMethodDefTokens,
+        CAtlArray<size_t> &rvNameIndexes);
+    ULONG FindMethodsByCustomAttribute(LPCTSTR pstrAttributeName, CAtlArray<mdMethodDef> &rvMethodDefTokens);
 
 protected:
+    struct CALL_SITE_TRAP
+    {
+        BOOL bTrapped;              // FALSE if the callee is not of the method filter, or not supported
+        ULONG nTrapId;
+        ULONG nArgumentCount;       // popped when the call is faulted, this included
+        mdToken tkTakeReturnValue;  // TakeFaultedReturnValue<T>, or mdMethodSpecNil if the callee returns void
+    };
+
     mdTypeRef EmitTypeRefToken(LPCTSTR pstrAssemblyName, LPCTSTR pstrTypeName);
-    mdMemberRef EmitMethodRefToken(LPCTSTR pstrAssemblyName, LPCTSTR pstrTypeName, LPCTSTR pstrMethodName);
+    mdMemberRef EmitMethodRefToken(LPCTSTR pstrAssemblyName, LPCTSTR pstrTypeName, LPCTSTR pstrMethodName,
+        PCCOR_SIGNATURE pvSignaturePrefix = NULL, ULONG nSignaturePrefixSize = 0);
+    static HRESULT FindMethodBySignaturePrefix(IMetaDataImport *pMetaDataImport, mdTypeDef tkTypeDef,
+        LPCTSTR pstrMethodName, PCCOR_SIGNATURE pvSignaturePrefix, ULONG nSignaturePrefixSize,
+        mdMethodDef &rtkMethodDef);
     CString RetrieveFullQualifiedTypeName(mdTypeDef tkTypeDef);
-    CILMethodSect PrepareILMethodSect(CMetadataMethod &rMethodInfo, ULONG nShiftOffset, CAtlArray<BYTE> &rvAllocator);
-    WORD EmitNewLocalVarToken(mdSignature tkOldLocalVarToken, mdSignature &tkNewLocalVarToken);
-    CorElementType ParseReturnType(CMetadataMethod &rMethodInfo, mdToken &tkReturnType);
+    CString RetrieveFullQualifiedTypeRefName(mdTypeRef tkTypeRef);
+    CString RetrieveFullQualifiedMemberName(mdToken tkMember, PCCOR_SIGNATURE &rpvSignature, ULONG &rnSignatureSize);
+    ULONGLONG HashCanonicalParameters(const CMethodDefSigBlob &rxSignature);
+    BOOL HashCanonicalType(const CSignatureBlob &rxSignature, CorElementType nElementType,
+        PCCOR_SIGNATURE &rpSignature, CCanonicalSigHash &rxHash);
+    CString RetrieveCanonicalTypeName(const CSignatureBlob &rxSignature, PCCOR_SIGNATURE &rpSignature);
+    static size_t MeasureILMethodSect(const CILMethodSect &rxOldILMethodSect);
+    static void EncodeILMethodSect(const CILMethodSect &rxOldILMethodSect, ULONG nShiftOffset, LPBYTE pTarget);
+    ULONG InsertCompactPrologueIntoMethod(CMetadataMethod &rMethodInfo, PCCOR_SIGNATURE pvReturnType,
+        ULONG nReturnTypeSize);
+    void RewriteILMethodBody(CMetadataMethod &rMethodInfo, const CMemoryRef &rxPrologue,
+        mdSignature tkNewLocalVar);
+    void PrepareCallSiteTrap(mdToken tkCallee, const CAtlArray<CString> &rvszCallees, CALL_SITE_TRAP &rTrap);
+    LPBYTE AllocateILMethodBody(ULONG nILMethodBodySize, CAtlArray<BYTE> &rvReJitILMethodBody);
+    void SetILMethodBody(CMetadataMethod &rMethodInfo, LPBYTE pMethodILBody, ULONG nILMethodBodySize);
+    mdTypeSpec EmitTypeSpecToken(PCCOR_SIGNATURE pvType, ULONG nTypeSize);
+    mdMethodSpec EmitMethodSpecToken(mdMemberRef tkGenericMethodRef, PCCOR_SIGNATURE pvTypeArgument, ULONG nTypeArgumentSize);
+    WORD EmitNewLocalVarToken(mdSignature tkOldLocalVarToken, PCCOR_SIGNATURE pvReturnType, ULONG nReturnTypeSize,
+        mdSignature &tkNewLocalVarToken);
+    CorElementType ParseReturnType(CMetadataMethod &rMethodInfo, PCCOR_SIGNATURE &pvReturnType, ULONG &nReturnTypeSize);
 
 private:
     ModuleID m_moduleId;
@@ -47,6 +87,7 @@ private:
     CComPtr<IMetaDataAssemblyEmit> m_pMetaDataAssemblyEmit;
     CComPtr<IMetaDataAssemblyImport> m_pMetaDataAssemblyImport;
     CComQIPtr<ICorProfilerInfo> m_pCorProfilerInfo;
+    CComPtr<ICorProfilerFunctionControl> m_pFunctionControl;  // set while the method is compiled for ReJIT
 };
 
 END_DEFAULT_NAMESPACE
\ No newline at end of file
@@ -0,0 +1,1818 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include <atlfile.h>
+#include "InstantiationCache.h"
+#include "MetadataModule.h"
+#include "MetadataSnapshot.h"
+#include "OfflineProfilerInfo.h"
+#include "OfflineRewriter.h"
+#include "SignatureBlob.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Helper Functions
+
+// Asked by DefineImportType and DefineImportMember, to tell the scopes of snapshots from others
+// {3822AC6A-5FFE-4B94-8B31-BFFB04F7948F}
+static const IID IID_IMetadataSnapshot =
+    {0x3822ac6a, 0x5ffe, 0x4b94, {0x8b, 0x31, 0xbf, 0xfb, 0x04, 0xf7, 0x94, 0x8f}};
+
+enum
+{
+    TABLE_MODULE = 0x00, TABLE_TYPEREF = 0x01, TABLE_TYPEDEF = 0x02, TABLE_FIELD = 0x04, TABLE_METHODDEF = 0x06,
+    TABLE_PARAM = 0x08, TABLE_INTERFACEIMPL = 0x09, TABLE_MEMBERREF = 0x0A, TABLE_DECLSECURITY = 0x0E,
+    TABLE_STANDALONESIG = 0x11, TABLE_EVENT = 0x14, TABLE_PROPERTY = 0x17, TABLE_MODULEREF = 0x1A,
+    TABLE_TYPESPEC = 0x1B, TABLE_ASSEMBLY = 0x20, TABLE_ASSEMBLYREF = 0x23, TABLE_FILE = 0x26,
+    TABLE_EXPORTEDTYPE = 0x27, TABLE_MANIFESTRESOURCE = 0x28, TABLE_NESTEDCLASS = 0x29,
+    TABLE_GENERICPARAM = 0x2A, TABLE_METHODSPEC = 0x2B, TABLE_GENERICPARAMCONSTRAINT = 0x2C,
+    NO_TABLE = 0xFF
+};
+
+// Types of columns. Below 0x40, the index of a row of that table.
+enum
+{
+    COLUMN_UINT16 = 0x80, COLUMN_UINT32, COLUMN_STRING, COLUMN_GUID, COLUMN_BLOB,
+    CODED_TYPEDEFORREF = 0x90, CODED_HASCONSTANT, CODED_HASCUSTOMATTRIBUTE, CODED_HASFIELDMARSHAL,
+    CODED_HASDECLSECURITY, CODED_MEMBERREFPARENT, CODED_HASSEMANTICS, CODED_METHODDEFORREF,
+    CODED_MEMBERFORWARDED, CODED_IMPLEMENTATION, CODED_CUSTOMATTRIBUTETYPE, CODED_RESOLUTIONSCOPE,
+    CODED_TYPEORMETHODDEF,
+    NO_COLUMN = 0xFF
+};
+
+// Coded indexes of ECMA-335 II.24.2.6: the tag in the low bits selects the table.
+struct CODED_INDEX
+{
+    BYTE nTagBits;
+    BYTE nTableCount;
+    BYTE vTables[22];
+};
+
+static const CODED_INDEX s_vCodedIndexes[] =
+{
+    {2, 3, {TABLE_TYPEDEF, TABLE_TYPEREF, TABLE_TYPESPEC}},
+    {2, 3, {TABLE_FIELD, TABLE_PARAM, TABLE_PROPERTY}},
+    {5, 22, {TABLE_METHODDEF, TABLE_FIELD, TABLE_TYPEREF, TABLE_TYPEDEF, TABLE_PARAM, TABLE_INTERFACEIMPL,
+        TABLE_MEMBERREF, TABLE_MODULE, TABLE_DECLSECURITY, TABLE_PROPERTY, TABLE_EVENT, TABLE_STANDALONESIG,
+        TABLE_MODULEREF, TABLE_TYPESPEC, TABLE_ASSEMBLY, TABLE_ASSEMBLYREF, TABLE_FILE, TABLE_EXPORTEDTYPE,
+        TABLE_MANIFESTRESOURCE, TABLE_GENERICPARAM, TABLE_GENERICPARAMCONSTRAINT, TABLE_METHODSPEC}},
+    {1, 2, {TABLE_FIELD, TABLE_PARAM}},
+    {2, 3, {TABLE_TYPEDEF, TABLE_METHODDEF, TABLE_ASSEMBLY}},
+    {3, 5, {TABLE_TYPEDEF, TABLE_TYPEREF, TABLE_MODULEREF, TABLE_METHODDEF, TABLE_TYPESPEC}},
+    {1, 2, {TABLE_EVENT, TABLE_PROPERTY}},
+    {1, 2, {TABLE_METHODDEF, TABLE_MEMBERREF}},
+    {1, 2, {TABLE_FIELD, TABLE_METHODDEF}},
+    {2, 3, {TABLE_FILE, TABLE_ASSEMBLYREF, TABLE_EXPORTEDTYPE}},
+    {3, 5, {NO_TABLE, NO_TABLE, TABLE_METHODDEF, TABLE_MEMBERREF, NO_TABLE}},
+    {2, 4, {TABLE_MODULE, TABLE_MODULEREF, TABLE_ASSEMBLYREF, TABLE_TYPEREF}},
+    {1, 2, {TABLE_TYPEDEF, TABLE_METHODDEF}},
+};
+
+// Columns of the tables of ECMA-335 II.22, and which of them hold the parent, the name, the
+// namespace (or culture) and the blob of a row
+struct TABLE_SCHEMA
+{
+    BYTE nColumnCount;
+    BYTE vColumns[9];
+    BYTE nParentColumn;
+    BYTE nNameColumn;
+    BYTE nNamespaceColumn;
+    BYTE nBlobColumn;
+};
+
+static const TABLE_SCHEMA s_vSchemas[] =
+{
+    // 0x00 Module
+    {5, {COLUMN_UINT16, COLUMN_STRING, COLUMN_GUID, COLUMN_GUID, COLUMN_GUID}, NO_COLUMN, 1, NO_COLUMN, NO_COLUMN},
+    // 0x01 TypeRef
+    {3, {CODED_RESOLUTIONSCOPE, COLUMN_STRING, COLUMN_STRING}, 0, 1, 2, NO_COLUMN},
+    // 0x02 TypeDef
+    {6, {COLUMN_UINT32, COLUMN_STRING, COLUMN_STRING, CODED_TYPEDEFORREF, TABLE_FIELD, TABLE_METHODDEF},
+        NO_COLUMN, 1, 2, NO_COLUMN},
+    // 0x03 FieldPtr
+    {1, {TABLE_FIELD}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x04 Field
+    {3, {COLUMN_UINT16, COLUMN_STRING, COLUMN_BLOB}, NO_COLUMN, 1, NO_COLUMN, 2},
+    // 0x05 MethodPtr
+    {1, {TABLE_METHODDEF}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x06 MethodDef
+    {6, {COLUMN_UINT32, COLUMN_UINT16, COLUMN_UINT16, COLUMN_STRING, COLUMN_BLOB, TABLE_PARAM},
+        NO_COLUMN, 3, NO_COLUMN, 4},
+    // 0x07 ParamPtr
+    {1, {TABLE_PARAM}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x08 Param
+    {3, {COLUMN_UINT16, COLUMN_UINT16, COLUMN_STRING}, NO_COLUMN, 2, NO_COLUMN, NO_COLUMN},
+    // 0x09 InterfaceImpl
+    {2, {TABLE_TYPEDEF, CODED_TYPEDEFORREF}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x0A MemberRef
+    {3, {CODED_MEMBERREFPARENT, COLUMN_STRING, COLUMN_BLOB}, 0, 1, NO_COLUMN, 2},
+    // 0x0B Constant
+    {3, {COLUMN_UINT16, CODED_HASCONSTANT, COLUMN_BLOB}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x0C CustomAttribute
+    {3, {CODED_HASCUSTOMATTRIBUTE, CODED_CUSTOMATTRIBUTETYPE, COLUMN_BLOB}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x0D FieldMarshal
+    {2, {CODED_HASFIELDMARSHAL, COLUMN_BLOB}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x0E DeclSecurity
+    {3, {COLUMN_UINT16, CODED_HASDECLSECURITY, COLUMN_BLOB}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x0F ClassLayout
+    {3, {COLUMN_UINT16, COLUMN_UINT32, TABLE_TYPEDEF}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x10 FieldLayout
+    {2, {COLUMN_UINT32, TABLE_FIELD}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x11 StandAloneSig
+    {1, {COLUMN_BLOB}, NO_COLUMN, NO_COLUMN, NO_COLUMN, 0},
+    // 0x12 EventMap
+    {2, {TABLE_TYPEDEF, TABLE_EVENT}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x13 EventPtr
+    {1, {TABLE_EVENT}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x14 Event
+    {3, {COLUMN_UINT16, COLUMN_STRING, CODED_TYPEDEFORREF}, NO_COLUMN, 1, NO_COLUMN, NO_COLUMN},
+    // 0x15 PropertyMap
+    {2, {TABLE_TYPEDEF, TABLE_PROPERTY}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x16 PropertyPtr
+    {1, {TABLE_PROPERTY}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x17 Property
+    {3, {COLUMN_UINT16, COLUMN_STRING, COLUMN_BLOB}, NO_COLUMN, 1, NO_COLUMN, 2},
+    // 0x18 MethodSemantics
+    {3, {COLUMN_UINT16, TABLE_METHODDEF, CODED_HASSEMANTICS}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x19 MethodImpl
+    {3, {TABLE_TYPEDEF, CODED_METHODDEFORREF, CODED_METHODDEFORREF}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x1A ModuleRef
+    {1, {COLUMN_STRING}, NO_COLUMN, 0, NO_COLUMN, NO_COLUMN},
+    // 0x1B TypeSpec
+    {1, {COLUMN_BLOB}, NO_COLUMN, NO_COLUMN, NO_COLUMN, 0},
+    // 0x1C ImplMap
+    {4, {COLUMN_UINT16, CODED_MEMBERFORWARDED, COLUMN_STRING, TABLE_MODULEREF}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x1D FieldRVA
+    {2, {COLUMN_UINT32, TABLE_FIELD}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x1E EncLog
+    {2, {COLUMN_UINT32, COLUMN_UINT32}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x1F EncMap
+    {1, {COLUMN_UINT32}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x20 Assembly
+    {9, {COLUMN_UINT32, COLUMN_UINT16, COLUMN_UINT16, COLUMN_UINT16, COLUMN_UINT16, COLUMN_UINT32, COLUMN_BLOB,
+        COLUMN_STRING, COLUMN_STRING}, NO_COLUMN, 7, 8, 6},
+    // 0x21 AssemblyProcessor
+    {1, {COLUMN_UINT32}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x22 AssemblyOS
+    {3, {COLUMN_UINT32, COLUMN_UINT32, COLUMN_UINT32}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x23 AssemblyRef
+    {9, {COLUMN_UINT16, COLUMN_UINT16, COLUMN_UINT16, COLUMN_UINT16, COLUMN_UINT32, COLUMN_BLOB, COLUMN_STRING,
+        COLUMN_STRING, COLUMN_BLOB}, NO_COLUMN, 6, 7, 5},
+    // 0x24 AssemblyRefProcessor
+    {2, {COLUMN_UINT32, TABLE_ASSEMBLYREF}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x25 AssemblyRefOS
+    {4, {COLUMN_UINT32, COLUMN_UINT32, COLUMN_UINT32, TABLE_ASSEMBLYREF}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x26 File
+    {3, {COLUMN_UINT32, COLUMN_STRING, COLUMN_BLOB}, NO_COLUMN, 1, NO_COLUMN, NO_COLUMN},
+    // 0x27 ExportedType
+    {5, {COLUMN_UINT32, COLUMN_UINT32, COLUMN_STRING, COLUMN_STRING, CODED_IMPLEMENTATION}, NO_COLUMN, 2, 3, NO_COLUMN},
+    // 0x28 ManifestResource
+    {4, {COLUMN_UINT32, COLUMN_UINT32, COLUMN_STRING, CODED_IMPLEMENTATION}, NO_COLUMN, 2, NO_COLUMN, NO_COLUMN},
+    // 0x29 NestedClass
+    {2, {TABLE_TYPEDEF, TABLE_TYPEDEF}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+    // 0x2A GenericParam
+    {4, {COLUMN_UINT16, COLUMN_UINT16, CODED_TYPEORMETHODDEF, COLUMN_STRING}, 2, 3, NO_COLUMN, NO_COLUMN},
+    // 0x2B MethodSpec
+    {2, {CODED_METHODDEFORREF, COLUMN_BLOB}, 0, NO_COLUMN, NO_COLUMN, 1},
+    // 0x2C GenericParamConstraint
+    {2, {TABLE_GENERICPARAM, CODED_TYPEDEFORREF}, NO_COLUMN, NO_COLUMN, NO_COLUMN, NO_COLUMN},
+};
+
+// Copy a compressed integer of a signature, which may be signed: the encoding tells its size.
+static HRESULT CopyCompressedData(PCCOR_SIGNATURE &rpvSig, PCCOR_SIGNATURE pvSigEnd, CAtlArray<BYTE> &rvTarget,
+                                  ULONG *pnValue = NULL)
+{
+    if((rpvSig >= pvSigEnd) || (rpvSig + CorSigUncompressedDataSize(rpvSig) > pvSigEnd))
+    {
+        return META_E_BAD_SIGNATURE;
+    }
+    ULONG nValue;
+    ULONG nSize = CorSigUncompressData(rpvSig, &nValue);
+    for(ULONG i = 0; i < nSize; i++)
+    {
+        rvTarget.Add(rpvSig[i]);
+    }
+    rpvSig += nSize;
+    if(NULL != pnValue)
+    {
+        *pnValue = nValue;
+    }
+    return S_OK;
+}
+
+#pragma endregion
+
+#pragma region Implementation of CMetadataSnapshot
+
+CMetadataSnapshot::CMetadataSnapshot(void)
+{
+    this->m_pImage = NULL;
+    this->m_nImageSize = 0;
+    this->m_pSections = NULL;
+    this->m_nSectionCount = 0;
+    this->m_pStrings = NULL;
+    this->m_nStringsSize = 0;
+    this->m_pGuids = NULL;
+    this->m_nGuidsSize = 0;
+    this->m_pBlobs = NULL;
+    this->m_nBlobsSize = 0;
+    this->m_nHeapSizes = 0;
+    ::memset(this->m_vTables, 0, sizeof(this->m_vTables));
+}
+
+CMetadataSnapshot::~CMetadataSnapshot(void)
+{
+    for(size_t i = 0; i < this->m_vpEmittedBlobs.GetCount(); i++)
+    {
+        delete[] this->m_vpEmittedBlobs[i];
+    }
+}
+
+HRESULT CMetadataSnapshot::Open(LPCTSTR pstrAssemblyPath)
+{
+    ASSERT(NULL == this->m_pImage);
+
+    // Map the file.
+    HRESULT hr = this->m_xFile.Create(pstrAssemblyPath, GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING);
+    if(SUCCEEDED(hr))
+    {
+        hr = this->m_xFile.GetSize(this->m_nImageSize);
+    }
+    if(SUCCEEDED(hr))
+    {
+        hr = (0 == this->m_nImageSize) ? HRESULT_FROM_WIN32(ERROR_BAD_EXE_FORMAT) : this->m_xMapping.MapFile(this->m_xFile);
+    }
+    if(FAILED(hr))
+    {
+        return hr;
+    }
+    this->m_pImage = this->m_xMapping;
+
+    // Locate the headers, then the metadata.
+    const IMAGE_DOS_HEADER *pDosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(this->m_pImage);
+    if((this->m_nImageSize < sizeof(IMAGE_DOS_HEADER)) || (IMAGE_DOS_SIGNATURE != pDosHeader->e_magic)
+        || ((ULONGLONG)(DWORD)pDosHeader->e_lfanew + sizeof(IMAGE_NT_HEADERS64) > this->m_nImageSize))
+    {
+        return HRESULT_FROM_WIN32(ERROR_BAD_EXE_FORMAT);
+    }
+    const IMAGE_NT_HEADERS32 *pNtHeaders = reinterpret_cast<const IMAGE_NT_HEADERS32*>(this->m_pImage + pDosHeader->e_lfanew);
+    this->m_pSections = reinterpret_cast<const IMAGE_SECTION_HEADER*>(
+        reinterpret_cast<LPCBYTE>(&pNtHeaders->OptionalHeader) + pNtHeaders->FileHeader.SizeOfOptionalHeader);
+    this->m_nSectionCount = pNtHeaders->FileHeader.NumberOfSections;
+    const IMAGE_DATA_DIRECTORY *pComDirectory = COfflineRewriter::LocateDataDirectory(pNtHeaders,
+        IMAGE_DIRECTORY_ENTRY_COM_DESCRIPTOR);
+    if((IMAGE_NT_SIGNATURE != pNtHeaders->Signature) || (NULL == pComDirectory) || (0 == pComDirectory->VirtualAddress)
+        || ((ULONGLONG)(reinterpret_cast<LPCBYTE>(this->m_pSections + this->m_nSectionCount) - this->m_pImage)
+            > this->m_nImageSize))
+    {
+        return HRESULT_FROM_WIN32(ERROR_BAD_EXE_FORMAT);
+    }
+
+    ULONG nCorHeaderSize = 0;
+    const IMAGE_COR20_HEADER *pCorHeader = reinterpret_cast<const IMAGE_COR20_HEADER*>(
+        this->GetImageData(pComDirectory->VirtualAddress, nCorHeaderSize));
+    if((NULL == pCorHeader) || (nCorHeaderSize < sizeof(IMAGE_COR20_HEADER)))
+    {
+        return COR_E_BADIMAGEFORMAT;
+    }
+    ULONG nMetadataSize = 0;
+    LPCBYTE pMetadata = this->GetImageData(pCorHeader->MetaData.VirtualAddress, nMetadataSize);
+    if((NULL == pMetadata) || (nMetadataSize < pCorHeader->MetaData.Size))
+    {
+        return COR_E_BADIMAGEFORMAT;
+    }
+    return this->ReadTables(pMetadata, pCorHeader->MetaData.Size);
+}
+
+void CMetadataSnapshot::AddReference(CMetadataSnapshot *pReference)
+{
+    ASSERT(NULL != pReference);
+    this->m_vpReferences.Add(pReference);
+}
+
+HRESULT CMetadataSnapshot::ReadTables(LPCBYTE pMetadata, ULONG nMetadataSize)
+{
+    // Metadata root and stream headers, ECMA-335 II.24.2.1-2
+    if((nMetadataSize < 16) || (0x424A5342 != *(UNALIGNED DWORD*)pMetadata))   // "BSJB"
+    {
+        return COR_E_BADIMAGEFORMAT;
+    }
+    ULONG nOffset = 16 + *(UNALIGNED DWORD*)(pMetadata + 12);
+    if((nOffset < 16) || (nOffset + 4 > nMetadataSize))
+    {
+        return COR_E_BADIMAGEFORMAT;
+    }
+    WORD nStreamCount = *(UNALIGNED WORD*)(pMetadata + nOffset + 2);
+    nOffset += 4;
+
+    LPCBYTE pTableStream = NULL;
+    ULONG nTableStreamSize = 0;
+    for(WORD i = 0; i < nStreamCount; i++)
+    {
+        if(nOffset + 8 > nMetadataSize)
+        {
+            return COR_E_BADIMAGEFORMAT;
+        }
+        ULONG nStreamOffset = *(UNALIGNED DWORD*)(pMetadata + nOffset);
+        ULONG nStreamSize = *(UNALIGNED DWORD*)(pMetadata + nOffset + 4);
+        LPCSTR pstrStreamName = reinterpret_cast<LPCSTR>(pMetadata + nOffset + 8);
+        size_t nNameLength = ::strnlen(pstrStreamName, min((ULONG)32, nMetadataSize - nOffset - 8));
+        if((32 == nNameLength) || (nNameLength == nMetadataSize - nOffset - 8)
+            || (nStreamOffset > nMetadataSize) || (nStreamSize > nMetadataSize - nStreamOffset))
+        {
+            return COR_E_BADIMAGEFORMAT;
+        }
+        nOffset += 8 + (((ULONG)nNameLength + 4) & ~3);
+
+        LPCBYTE pStream = pMetadata + nStreamOffset;
+        if(0 == ::strcmp(pstrStreamName, "#~"))
+        {
+            pTableStream = pStream;
+            nTableStreamSize = nStreamSize;
+        }
+        else if(0 == ::strcmp(pstrStreamName, "#-"))
+        {
+            return COR_E_BADIMAGEFORMAT;    // uncompressed tables are only written by edit and continue
+        }
+        else if(0 == ::strcmp(pstrStreamName, "#Strings"))
+        {
+            this->m_pStrings = pStream;
+            this->m_nStringsSize = nStreamSize;
+        }
+        else if(0 == ::strcmp(pstrStreamName, "#GUID"))
+        {
+            this->m_pGuids = pStream;
+            this->m_nGuidsSize = nStreamSize;
+        }
+        else if(0 == ::strcmp(pstrStreamName, "#Blob"))
+        {
+            this->m_pBlobs = pStream;
+            this->m_nBlobsSize = nStreamSize;
+        }
+    }
+    if((NULL == pTableStream) || (nTableStreamSize < 24))
+    {
+        return COR_E_BADIMAGEFORMAT;
+    }
+
+    // Header of the table stream, II.24.2.6: the row counts of the tables present follow.
+    this->m_nHeapSizes = pTableStream[6];
+    ULONGLONG nValid = *(UNALIGNED ULONGLONG*)(pTableStream + 8);
+    nOffset = 24;
+    for(ULONG i = 0; i < 64; i++)
+    {
+        if(0 == (nValid & (1ULL << i)))
+        {
+            continue;
+        }
+        if((TABLE_COUNT <= i) || (nOffset + 4 > nTableStreamSize))
+        {
+            return COR_E_BADIMAGEFORMAT;
+        }
+        this->m_vTables[i].nRowCount = *(UNALIGNED DWORD*)(pTableStream + nOffset);
+        nOffset += 4;
+    }
+    if(0 != (this->m_nHeapSizes & 0x40))
+    {
+        nOffset += 4;   // extra data
+    }
+
+    // Lay out the rows, now that the sizes of the indexes are known.
+    for(ULONG i = 0; i < TABLE_COUNT; i++)
+    {
+        TABLE &rxTable = this->m_vTables[i];
+        const TABLE_SCHEMA &rxSchema = s_vSchemas[i];
+        rxTable.nRowSize = 0;
+        for(BYTE j = 0; j < rxSchema.nColumnCount; j++)
+        {
+            rxTable.vColumnOffsets[j] = (BYTE)rxTable.nRowSize;
+            rxTable.vColumnSizes[j] = (BYTE)this->GetColumnSize(rxSchema.vColumns[j]);
+            rxTable.nRowSize += rxTable.vColumnSizes[j];
+        }
+        ULONGLONG nTableSize = (ULONGLONG)rxTable.nRowSize * rxTable.nRowCount;
+        if(nOffset + nTableSize > nTableStreamSize)
+        {
+            return COR_E_BADIMAGEFORMAT;
+        }
+        rxTable.pRows = pTableStream + nOffset;
+        nOffset += (ULONG)nTableSize;
+    }
+    return S_OK;
+}
+
+LPCBYTE CMetadataSnapshot::GetImageData(DWORD nRva, ULONG &rnSize) const
+{
+    for(WORD i = 0; i < this->m_nSectionCount; i++)
+    {
+        const IMAGE_SECTION_HEADER &rxSection = this->m_pSections[i];
+        if((nRva < rxSection.VirtualAddress) || (nRva - rxSection.VirtualAddress >= rxSection.SizeOfRawData))
+        {
+            continue;
+        }
+        ULONGLONG nOffset = (ULONGLONG)rxSection.PointerToRawData + (nRva - rxSection.VirtualAddress);
+        ULONGLONG nEnd = (ULONGLONG)rxSection.PointerToRawData + rxSection.SizeOfRawData;
+        if(nEnd > this->m_nImageSize)
+        {
+            return NULL;    // truncated file
+        }
+        rnSize = (ULONG)(nEnd - nOffset);
+        return this->m_pImage + nOffset;
+    }
+    return NULL;
+}
+
+ULONG CMetadataSnapshot::GetColumnSize(BYTE nColumnType) const
+{
+    switch(nColumnType)
+    {
+    case COLUMN_UINT16:
+        return 2;
+    case COLUMN_UINT32:
+        return 4;
+    case COLUMN_STRING:
+        return (0 != (this->m_nHeapSizes & 0x01)) ? 4 : 2;
+    case COLUMN_GUID:
+        return (0 != (this->m_nHeapSizes & 0x02)) ? 4 : 2;
+    case COLUMN_BLOB:
+        return (0 != (this->m_nHeapSizes & 0x04)) ? 4 : 2;
+    }
+    if(nColumnType < TABLE_COUNT)
+    {
+        return (this->m_vTables[nColumnType].nRowCount < 0x10000) ? 2 : 4;
+    }
+
+    // A coded index is wider once the largest of its tables needs the bits of the tag.
+    const CODED_INDEX &rxCodedIndex = s_vCodedIndexes[nColumnType - CODED_TYPEDEFORREF];
+    ULONG nMaxRowCount = 0;
+    for(BYTE i = 0; i < rxCodedIndex.nTableCount; i++)
+    {
+        if(NO_TABLE != rxCodedIndex.vTables[i])
+        {
+            nMaxRowCount = max(nMaxRowCount, this->m_vTables[rxCodedIndex.vTables[i]].nRowCount);
+        }
+    }
+    return (nMaxRowCount < (1UL << (16 - rxCodedIndex.nTagBits))) ? 2 : 4;
+}
+
+ULONG CMetadataSnapshot::ReadColumn(ULONG nTable, ULONG nRow, ULONG nColumn) const
+{
+    const TABLE &rxTable = this->m_vTables[nTable];
+    ASSERT((0 < nRow) && (nRow <= rxTable.nRowCount));
+    ASSERT(nColumn < s_vSchemas[nTable].nColumnCount);
+
+    LPCBYTE pValue = rxTable.pRows + (nRow - 1) * rxTable.nRowSize + rxTable.vColumnOffsets[nColumn];
+    return (2 == rxTable.vColumnSizes[nColumn]) ? *(UNALIGNED WORD*)pValue : *(UNALIGNED DWORD*)pValue;
+}
+
+mdToken CMetadataSnapshot::ReadToken(ULONG nTable, ULONG nRow, ULONG nColumn) const
+{
+    BYTE nColumnType = s_vSchemas[nTable].vColumns[nColumn];
+    ULONG nValue = this->ReadColumn(nTable, nRow, nColumn);
+    if(nColumnType < TABLE_COUNT)
+    {
+        return TokenFromRid(nValue, nColumnType << 24);
+    }
+
+    const CODED_INDEX &rxCodedIndex = s_vCodedIndexes[nColumnType - CODED_TYPEDEFORREF];
+    ULONG nTag = nValue & ((1UL << rxCodedIndex.nTagBits) - 1);
+    if((nTag >= rxCodedIndex.nTableCount) || (NO_TABLE == rxCodedIndex.vTables[nTag]))
+    {
+        return mdTokenNil;
+    }
+    return TokenFromRid(nValue >> rxCodedIndex.nTagBits, rxCodedIndex.vTables[nTag] << 24);
+}
+
+ULONG CMetadataSnapshot::GetRowCount(ULONG nTable) const
+{
+    return this->m_vTables[nTable].nRowCount + (ULONG)this->m_vEmittedRows[nTable].GetCount();
+}
+
+const CMetadataSnapshot::EMITTED_ROW* CMetadataSnapshot::GetEmittedRow(mdToken tk) const
+{
+    ULONG nTable = TypeFromToken(tk) >> 24;
+    ULONG nRow = RidFromToken(tk);
+    if((TABLE_COUNT <= nTable) || (nRow <= this->m_vTables[nTable].nRowCount) || (nRow > this->GetRowCount(nTable)))
+    {
+        return NULL;
+    }
+    return &this->m_vEmittedRows[nTable][nRow - this->m_vTables[nTable].nRowCount - 1];
+}
+
+mdToken CMetadataSnapshot::GetParent(mdToken tk) const
+{
+    ASSERT(this->IsValidRow(tk));
+    const EMITTED_ROW *pRow = this->GetEmittedRow(tk);
+    if(NULL != pRow)
+    {
+        return pRow->tkParent;
+    }
+    ULONG nTable = TypeFromToken(tk) >> 24;
+    BYTE nColumn = s_vSchemas[nTable].nParentColumn;
+    return (NO_COLUMN == nColumn) ? mdTokenNil : this->ReadToken(nTable, RidFromToken(tk), nColumn);
+}
+
+LPCSTR CMetadataSnapshot::GetName(mdToken tk) const
+{
+    ASSERT(this->IsValidRow(tk));
+    const EMITTED_ROW *pRow = this->GetEmittedRow(tk);
+    if(NULL != pRow)
+    {
+        return pRow->szName;
+    }
+    ULONG nTable = TypeFromToken(tk) >> 24;
+    BYTE nColumn = s_vSchemas[nTable].nNameColumn;
+    ULONG nOffset = (NO_COLUMN == nColumn) ? 0 : this->ReadColumn(nTable, RidFromToken(tk), nColumn);
+    return (nOffset < this->m_nStringsSize) ? reinterpret_cast<LPCSTR>(this->m_pStrings + nOffset) : "";
+}
+
+LPCSTR CMetadataSnapshot::GetNamespace(mdToken tk) const
+{
+    ASSERT(this->IsValidRow(tk));
+    const EMITTED_ROW *pRow = this->GetEmittedRow(tk);
+    if(NULL != pRow)
+    {
+        return pRow->szNamespace;
+    }
+    ULONG nTable = TypeFromToken(tk) >> 24;
+    BYTE nColumn = s_vSchemas[nTable].nNamespaceColumn;
+    ULONG nOffset = (NO_COLUMN == nColumn) ? 0 : this->ReadColumn(nTable, RidFromToken(tk), nColumn);
+    return (nOffset < this->m_nStringsSize) ? reinterpret_cast<LPCSTR>(this->m_pStrings + nOffset) : "";
+}
+
+PCCOR_SIGNATURE CMetadataSnapshot::GetBlob(mdToken tk, ULONG &rnSize) const
+{
+    ASSERT(this->IsValidRow(tk));
+    const EMITTED_ROW *pRow = this->GetEmittedRow(tk);
+    if(NULL != pRow)
+    {
+        rnSize = pRow->nBlobSize;
+        return pRow->pBlob;
+    }
+    rnSize = 0;
+    ULONG nTable = TypeFromToken(tk) >> 24;
+    BYTE nColumn = s_vSchemas[nTable].nBlobColumn;
+    ULONG nOffset = (NO_COLUMN == nColumn) ? 0 : this->ReadColumn(nTable, RidFromToken(tk), nColumn);
+    if(nOffset >= this->m_nBlobsSize)
+    {
+        return NULL;
+    }
+
+    // The blob is prefixed with its size, compressed as the integers of signatures.
+    PCCOR_SIGNATURE pvBlob = this->m_pBlobs + nOffset;
+    ULONG nPrefixSize = CorSigUncompressedDataSize(pvBlob);
+    if(nPrefixSize > this->m_nBlobsSize - nOffset)
+    {
+        return NULL;
+    }
+    ULONG nSize;
+    pvBlob += CorSigUncompressData(pvBlob, &nSize);
+    if(nSize > this->m_nBlobsSize - nOffset - nPrefixSize)
+    {
+        return NULL;
+    }
+    rnSize = nSize;
+    return pvBlob;
+}
+
+mdToken CMetadataSnapshot::FindRow(ULONG nTable, mdToken tkParent, LPCSTR pstrName, LPCSTR pstrNamespace,
+                                   PCCOR_SIGNATURE pvBlob, ULONG nBlobSize) const
+{
+    // Fields the table has no column for, or passed as NULL, match any row. Assembly names are
+    // compared without case, as the loader does.
+    const TABLE_SCHEMA &rxSchema = s_vSchemas[nTable];
+    ULONG nRowCount = this->GetRowCount(nTable);
+    for(ULONG i = 1; i <= nRowCount; i++)
+    {
+        mdToken tk = TokenFromRid(i, nTable << 24);
+        if((NO_COLUMN != rxSchema.nParentColumn) && (this->GetParent(tk) != tkParent))
+        {
+            continue;
+        }
+        if((NO_COLUMN != rxSchema.nNameColumn) && (NULL != pstrName)
+            && (0 != ((TABLE_ASSEMBLYREF == nTable) ? ::_stricmp : ::strcmp)(this->GetName(tk), pstrName)))
+        {
+            continue;
+        }
+        if((NO_COLUMN != rxSchema.nNamespaceColumn) && (NULL != pstrNamespace)
+            && (0 != ::strcmp(this->GetNamespace(tk), pstrNamespace)))
+        {
+            continue;
+        }
+        if((NO_COLUMN != rxSchema.nBlobColumn) && (NULL != pvBlob))
+        {
+            ULONG nSize;
+            PCCOR_SIGNATURE pvRowBlob = this->GetBlob(tk, nSize);
+            if((nSize != nBlobSize) || (0 != ::memcmp(pvRowBlob, pvBlob, nSize)))
+            {
+                continue;
+            }
+        }
+        return tk;
+    }
+    return mdTokenNil;
+}
+
+mdToken CMetadataSnapshot::EmitRow(ULONG nTable, const EMITTED_ROW &rxRow, PCCOR_SIGNATURE pvBlob, ULONG nBlobSize)
+{
+    EMITTED_ROW xRow = rxRow;
+    xRow.pBlob = NULL;
+    xRow.nBlobSize = nBlobSize;
+    if(0 < nBlobSize)
+    {
+        LPBYTE pBlob = new BYTE[nBlobSize];
+        ::memcpy(pBlob, pvBlob, nBlobSize);
+        this->m_vpEmittedBlobs.Add(pBlob);
+        xRow.pBlob = pBlob;
+    }
+    this->m_vEmittedRows[nTable].Add(xRow);
+    return TokenFromRid(this->GetRowCount(nTable), nTable << 24);
+}
+
+mdToken CMetadataSnapshot::DefineRow(ULONG nTable, const EMITTED_ROW &rxRow, PCCOR_SIGNATURE pvBlob, ULONG nBlobSize)
+{
+    // Rows are shared, as in the metadata of the runtime.
+    mdToken tk = this->FindRow(nTable, rxRow.tkParent, rxRow.szName, rxRow.szNamespace, pvBlob, nBlobSize);
+    return IsNilToken(tk) ? this->EmitRow(nTable, rxRow, pvBlob, nBlobSize) : tk;
+}
+
+LPCSTR CMetadataSnapshot::GetAssemblyName(void) const
+{
+    return (0 < this->m_vTables[TABLE_ASSEMBLY].nRowCount) ? this->GetName(TokenFromRid(1, mdtAssembly)) : NULL;
+}
+
+mdTypeDef CMetadataSnapshot::GetEnclosingClass(mdTypeDef td) const
+{
+    // The table of nested classes is sorted by nested class.
+    const ULONG nTable = TABLE_NESTEDCLASS;
+    ULONG nLow = 1, nHigh = this->m_vTables[nTable].nRowCount;
+    while(nLow <= nHigh)
+    {
+        ULONG nMiddle = nLow + (nHigh - nLow) / 2;
+        mdTypeDef tdNested = this->ReadToken(nTable, nMiddle, 0);
+        if(tdNested == td)
+        {
+            return this->ReadToken(nTable, nMiddle, 1);
+        }
+        if(tdNested < td)
+        {
+            nLow = nMiddle + 1;
+        }
+        else
+        {
+            nHigh = nMiddle - 1;
+        }
+    }
+    return mdTypeDefNil;
+}
+
+mdTypeDef CMetadataSnapshot::GetMethodClass(mdMethodDef md) const
+{
+    // The method lists of the types are in order: the class is the last one starting at or before
+    // the method, as types without methods start at the same row as the next one.
+    ULONG nRow = RidFromToken(md);
+    ULONG nClassRow = 0;
+    ULONG nLow = 1, nHigh = this->m_vTables[TABLE_TYPEDEF].nRowCount;
+    while(nLow <= nHigh)
+    {
+        ULONG nMiddle = nLow + (nHigh - nLow) / 2;
+        if(this->ReadColumn(TABLE_TYPEDEF, nMiddle, 5) <= nRow)
+        {
+            nClassRow = nMiddle;
+            nLow = nMiddle + 1;
+        }
+        else
+        {
+            nHigh = nMiddle - 1;
+        }
+    }
+    return TokenFromRid(nClassRow, mdtTypeDef);
+}
+
+void CMetadataSnapshot::GetMethodRange(mdTypeDef td, ULONG &rnFirst, ULONG &rnEnd) const
+{
+    ULONG nRow = RidFromToken(td);
+    ULONG nMethodRowCount = this->m_vTables[TABLE_METHODDEF].nRowCount;
+    rnEnd = (nRow < this->m_vTables[TABLE_TYPEDEF].nRowCount)
+        ? this->ReadColumn(TABLE_TYPEDEF, nRow + 1, 5) : nMethodRowCount + 1;
+    rnEnd = min(rnEnd, nMethodRowCount + 1);
+    rnFirst = min(this->ReadColumn(TABLE_TYPEDEF, nRow, 5), rnEnd);
+}
+
+HRESULT CMetadataSnapshot::ImportAssemblyRef(const CMetadataSnapshot &rxSource, mdToken tkScope, mdToken &rtkScope)
+{
+    // The scope is an assembly ref of the source, or else the assembly of the source itself.
+    mdToken tkAssembly = (mdtAssemblyRef == TypeFromToken(tkScope)) ? tkScope : TokenFromRid(1, mdtAssembly);
+    if(!rxSource.IsValidRow(tkAssembly))
+    {
+        return CLDB_E_RECORD_NOTFOUND;
+    }
+    LPCSTR pstrName = rxSource.GetName(tkAssembly);
+    LPCSTR pstrAssemblyName = this->GetAssemblyName();
+    if((NULL != pstrAssemblyName) && (0 == ::_stricmp(pstrName, pstrAssemblyName)))
+    {
+        rtkScope = TokenFromRid(1, mdtModule);  // a type of this module
+        return S_OK;
+    }
+    rtkScope = this->FindRow(TABLE_ASSEMBLYREF, mdTokenNil, pstrName, NULL, NULL, 0);
+    if(!IsNilToken(rtkScope))
+    {
+        return S_OK;
+    }
+
+    // Version and flags precede the blob in both tables; the public key of an assembly is kept
+    // whole, as the runtime does.
+    EMITTED_ROW xRow;
+    xRow.szName = pstrName;
+    xRow.szNamespace = rxSource.GetNamespace(tkAssembly);
+    const EMITTED_ROW *pSourceRow = rxSource.GetEmittedRow(tkAssembly);
+    if(NULL != pSourceRow)
+    {
+        ::memcpy(xRow.vVersion, pSourceRow->vVersion, sizeof(xRow.vVersion));
+        xRow.dwFlags = pSourceRow->dwFlags;
+    }
+    else
+    {
+        ULONG nTable = TypeFromToken(tkAssembly) >> 24;
+        ULONG nFirstColumn = (TABLE_ASSEMBLY == nTable) ? 1 : 0;
+        for(ULONG i = 0; i < _countof(xRow.vVersion); i++)
+        {
+            xRow.vVersion[i] = (WORD)rxSource.ReadColumn(nTable, RidFromToken(tkAssembly), nFirstColumn + i);
+        }
+        xRow.dwFlags = rxSource.ReadColumn(nTable, RidFromToken(tkAssembly), nFirstColumn + 4);
+        if(TABLE_ASSEMBLY == nTable)
+        {
+            xRow.dwFlags &= afPublicKey;
+        }
+    }
+    ULONG nPublicKeySize;
+    PCCOR_SIGNATURE pvPublicKey = rxSource.GetBlob(tkAssembly, nPublicKeySize);
+    rtkScope = this->EmitRow(TABLE_ASSEMBLYREF, xRow, pvPublicKey, nPublicKeySize);
+    return S_OK;
+}
+
+HRESULT CMetadataSnapshot::ImportTypeRef(const CMetadataSnapshot &rxSource, mdToken tkType, mdToken &rtkType)
+{
+    if(&rxSource == this)
+    {
+        rtkType = tkType;
+        return S_OK;
+    }
+    if(!rxSource.IsValidRow(tkType))
+    {
+        return E_INVALIDARG;
+    }
+
+    // Import the scope first: the enclosing type of a nested type, or the assembly.
+    mdToken tkScope;
+    HRESULT hr;
+    switch(TypeFromToken(tkType))
+    {
+    case mdtTypeDef:
+        {
+            mdTypeDef tdEnclosingClass = rxSource.GetEnclosingClass(tkType);
+            hr = IsNilToken(tdEnclosingClass) ? this->ImportAssemblyRef(rxSource, mdAssemblyNil, tkScope)
+                : this->ImportTypeRef(rxSource, tdEnclosingClass, tkScope);
+        }
+        break;
+    case mdtTypeRef:
+        {
+            mdToken tkSourceScope = rxSource.GetParent(tkType);
+            switch(TypeFromToken(tkSourceScope))
+            {
+            case mdtTypeRef:
+                hr = this->ImportTypeRef(rxSource, tkSourceScope, tkScope);
+                break;
+            case mdtAssemblyRef:
+            case mdtModule:
+                hr = this->ImportAssemblyRef(rxSource, tkSourceScope, tkScope);
+                break;
+            default:
+                hr = E_NOTIMPL;     // types of other modules
+                break;
+            }
+        }
+        break;
+    default:
+        hr = E_NOTIMPL;     // type specs
+        break;
+    }
+    if(FAILED(hr))
+    {
+        return hr;
+    }
+
+    EMITTED_ROW xRow;
+    xRow.tkParent = tkScope;
+    xRow.szName = rxSource.GetName(tkType);
+    xRow.szNamespace = rxSource.GetNamespace(tkType);
+    rtkType = this->DefineRow(TABLE_TYPEREF, xRow, NULL, 0);
+    return S_OK;
+}
+
+HRESULT CMetadataSnapshot::ImportTypeToken(const CMetadataSnapshot &rxSource, PCCOR_SIGNATURE &rpvSig,
+                                           PCCOR_SIGNATURE pvSigEnd, CAtlArray<BYTE> &rvTarget)
+{
+    if((rpvSig >= pvSigEnd) || (rpvSig + CorSigUncompressedDataSize(rpvSig) > pvSigEnd))
+    {
+        return META_E_BAD_SIGNATURE;
+    }
+    mdToken tkType;
+    rpvSig += CorSigUncompressToken(rpvSig, &tkType);
+    HRESULT hr = this->ImportTypeRef(rxSource, tkType, tkType);
+    if(FAILED(hr))
+    {
+        return hr;
+    }
+    BYTE vToken[4];
+    ULONG nSize = CorSigCompressToken(tkType, vToken);
+    for(ULONG i = 0; i < nSize; i++)
+    {
+        rvTarget.Add(vToken[i]);
+    }
+    return S_OK;
+}
+
+HRESULT CMetadataSnapshot::ImportType(const CMetadataSnapshot &rxSource, PCCOR_SIGNATURE &rpvSig,
+                                      PCCOR_SIGNATURE pvSigEnd, CAtlArray<BYTE> &rvTarget)
+{
+    if(rpvSig >= pvSigEnd)
+    {
+        return META_E_BAD_SIGNATURE;
+    }
+    BYTE nElementType = *rpvSig++;
+    rvTarget.Add(nElementType);
+
+    HRESULT hr;
+    ULONG nCount = 0;
+    switch(nElementType)
+    {
+    case ELEMENT_TYPE_VOID:
+    case ELEMENT_TYPE_BOOLEAN:
+    case ELEMENT_TYPE_CHAR:
+    case ELEMENT_TYPE_I1:
+    case ELEMENT_TYPE_U1:
+    case ELEMENT_TYPE_I2:
+    case ELEMENT_TYPE_U2:
+    case ELEMENT_TYPE_I4:
+    case ELEMENT_TYPE_U4:
+    case ELEMENT_TYPE_I8:
+    case ELEMENT_TYPE_U8:
+    case ELEMENT_TYPE_R4:
+    case ELEMENT_TYPE_R8:
+    case ELEMENT_TYPE_STRING:
+    case ELEMENT_TYPE_TYPEDBYREF:
+    case ELEMENT_TYPE_I:
+    case ELEMENT_TYPE_U:
+    case ELEMENT_TYPE_OBJECT:
+        return S_OK;
+
+    case ELEMENT_TYPE_PTR:
+    case ELEMENT_TYPE_BYREF:
+    case ELEMENT_TYPE_SZARRAY:
+    case ELEMENT_TYPE_PINNED:
+    case ELEMENT_TYPE_SENTINEL:     // precedes the first vararg parameter
+        return this->ImportType(rxSource, rpvSig, pvSigEnd, rvTarget);
+
+    case ELEMENT_TYPE_CMOD_REQD:
+    case ELEMENT_TYPE_CMOD_OPT:
+        hr = this->ImportTypeToken(rxSource, rpvSig, pvSigEnd, rvTarget);
+        return FAILED(hr) ? hr : this->ImportType(rxSource, rpvSig, pvSigEnd, rvTarget);
+
+    case ELEMENT_TYPE_CLASS:
+    case ELEMENT_TYPE_VALUETYPE:
+        return this->ImportTypeToken(rxSource, rpvSig, pvSigEnd, rvTarget);
+
+    case ELEMENT_TYPE_VAR:
+    case ELEMENT_TYPE_MVAR:
+        return CopyCompressedData(rpvSig, pvSigEnd, rvTarget);
+
+    case ELEMENT_TYPE_GENERICINST:
+        hr = this->ImportType(rxSource, rpvSig, pvSigEnd, rvTarget);
+        if(SUCCEEDED(hr))
+        {
+            hr = CopyCompressedData(rpvSig, pvSigEnd, rvTarget, &nCount);
+        }
+        for(ULONG i = 0; SUCCEEDED(hr) && (i < nCount); i++)
+        {
+            hr = this->ImportType(rxSource, rpvSig, pvSigEnd, rvTarget);
+        }
+        return hr;
+
+    case ELEMENT_TYPE_ARRAY:
+        // element type, rank, then the sizes and the lower bounds, each with their count first
+        hr = this->ImportType(rxSource, rpvSig, pvSigEnd, rvTarget);
+        if(SUCCEEDED(hr))
+        {
+            hr = CopyCompressedData(rpvSig, pvSigEnd, rvTarget);
+        }
+        for(int nList = 0; SUCCEEDED(hr) && (nList < 2); nList++)
+        {
+            hr = CopyCompressedData(rpvSig, pvSigEnd, rvTarget, &nCount);
+            for(ULONG i = 0; SUCCEEDED(hr) && (i < nCount); i++)
+            {
+                hr = CopyCompressedData(rpvSig, pvSigEnd, rvTarget);
+            }
+        }
+        return hr;
+
+    case ELEMENT_TYPE_FNPTR:
+        return this->ImportMemberSignature(rxSource, rpvSig, pvSigEnd, rvTarget);
+    }
+    return META_E_BAD_SIGNATURE;
+}
+
+HRESULT CMetadataSnapshot::ImportMemberSignature(const CMetadataSnapshot &rxSource, PCCOR_SIGNATURE &rpvSig,
+                                                 PCCOR_SIGNATURE pvSigEnd, CAtlArray<BYTE> &rvTarget)
+{
+    if(rpvSig >= pvSigEnd)
+    {
+        return META_E_BAD_SIGNATURE;
+    }
+    BYTE nCallingConvention = *rpvSig++;
+    rvTarget.Add(nCallingConvention);
+    if(IMAGE_CEE_CS_CALLCONV_FIELD == (nCallingConvention & IMAGE_CEE_CS_CALLCONV_MASK))
+    {
+        return this->ImportType(rxSource, rpvSig, pvSigEnd, rvTarget);
+    }
+
+    // generic parameter count, parameter count, then the return type and the parameters
+    HRESULT hr = S_OK;
+    if(0 != (nCallingConvention & IMAGE_CEE_CS_CALLCONV_GENERIC))
+    {
+        hr = CopyCompressedData(rpvSig, pvSigEnd, rvTarget);
+    }
+    ULONG nParameterCount = 0;
+    if(SUCCEEDED(hr))
+    {
+        hr = CopyCompressedData(rpvSig, pvSigEnd, rvTarget, &nParameterCount);
+    }
+    for(ULONG i = 0; SUCCEEDED(hr) && (i <= nParameterCount); i++)
+    {
+        hr = this->ImportType(rxSource, rpvSig, pvSigEnd, rvTarget);
+    }
+    return hr;
+}
+
+CMetadataSnapshot* CMetadataSnapshot::FromUnknown(IUnknown *pUnknown)
+{
+    void *pvSnapshot = NULL;
+    if((NULL == pUnknown) || FAILED(pUnknown->QueryInterface(IID_IMetadataSnapshot, &pvSnapshot)))
+    {
+        return NULL;
+    }
+    return static_cast<CMetadataSnapshot*>(pvSnapshot);
+}
+
+HRESULT CMetadataSnapshot::EnumTokens(HCORENUM *phEnum, mdToken rTokens[], ULONG cMax, ULONG *pcTokens)
+{
+    if((NULL == phEnum) || (NULL == *phEnum))
+    {
+        return E_INVALIDARG;
+    }
+    ENUM_STATE *pState = static_cast<ENUM_STATE*>(*phEnum);
+    ULONG nCount = 0;
+    while((nCount < cMax) && (pState->nNext < pState->vTokens.GetCount()))
+    {
+        rTokens[nCount++] = pState->vTokens[pState->nNext++];
+    }
+    if(NULL != pcTokens)
+    {
+        *pcTokens = nCount;
+    }
+    return (0 < nCount) ? S_OK : S_FALSE;
+}
+
+HRESULT CMetadataSnapshot::CopyName(LPCSTR pstrUtf8Name, LPWSTR szName, ULONG cchName, ULONG *pchName)
+{
+    // Lengths count the terminating null, and names which do not fit are truncated.
+    CStringW szWideName = CA2W(pstrUtf8Name, CP_UTF8);
+    ULONG nLength = (ULONG)szWideName.GetLength() + 1;
+    if(NULL != pchName)
+    {
+        *pchName = nLength;
+    }
+    if((NULL == szName) || (0 == cchName))
+    {
+        return S_OK;
+    }
+    ::wcsncpy_s(szName, cchName, szWideName, _TRUNCATE);
+    return (cchName < nLength) ? CLDB_S_TRUNCATION : S_OK;
+}
+
+STDMETHODIMP CMetadataSnapshot::QueryInterface(REFIID riid, void **ppvObject)
+{
+    if(NULL == ppvObject)
+    {
+        return E_POINTER;
+    }
+    if(::InlineIsEqualGUID(riid, IID_IUnknown) || ::InlineIsEqualGUID(riid, IID_IMetaDataImport)
+        || ::InlineIsEqualGUID(riid, IID_IMetaDataImport2))
+    {
+        *ppvObject = static_cast<IMetaDataImport2*>(this);
+        return S_OK;
+    }
+    if(::InlineIsEqualGUID(riid, IID_IMetaDataEmit) || ::InlineIsEqualGUID(riid, IID_IMetaDataEmit2))
+    {
+        *ppvObject = static_cast<IMetaDataEmit2*>(this);
+        return S_OK;
+    }
+    if(::InlineIsEqualGUID(riid, IID_IMetaDataAssemblyImport))
+    {
+        *ppvObject = static_cast<IMetaDataAssemblyImport*>(this);
+        return S_OK;
+    }
+    if(::InlineIsEqualGUID(riid, IID_IMetaDataAssemblyEmit))
+    {
+        *ppvObject = static_cast<IMetaDataAssemblyEmit*>(this);
+        return S_OK;
+    }
+    if(::InlineIsEqualGUID(riid, IID_IMetadataSnapshot))
+    {
+        *ppvObject = this;
+        return S_OK;
+    }
+    *ppvObject = NULL;
+    return E_NOINTERFACE;
+}
+
+STDMETHODIMP_(void) CMetadataSnapshot::CloseEnum(HCORENUM hEnum)
+{
+    delete static_cast<ENUM_STATE*>(hEnum);
+}
+
+STDMETHODIMP CMetadataSnapshot::CountEnum(HCORENUM hEnum, ULONG *pulCount)
+{
+    if(NULL == pulCount)
+    {
+        return E_POINTER;
+    }
+    *pulCount = (NULL == hEnum) ? 0 : (ULONG)static_cast<ENUM_STATE*>(hEnum)->vTokens.GetCount();
+    return S_OK;
+}
+
+STDMETHODIMP CMetadataSnapshot::EnumTypeDefs(HCORENUM *phEnum, mdTypeDef rTypeDefs[], ULONG cMax, ULONG *pcTypeDefs)
+{
+    if(NULL == phEnum)
+    {
+        return E_POINTER;
+    }
+    if(NULL == *phEnum)
+    {
+        // All the types but the global one, <Module>
+        ENUM_STATE *pState = new ENUM_STATE;
+        pState->nNext = 0;
+        for(ULONG i = 2; i <= this->m_vTables[TABLE_TYPEDEF].nRowCount; i++)
+        {
+            pState->vTokens.Add(TokenFromRid(i, mdtTypeDef));
+        }
+        *phEnum = pState;
+    }
+    return EnumTokens(phEnum, rTypeDefs, cMax, pcTypeDefs);
+}
+
+STDMETHODIMP CMetadataSnapshot::FindTypeDefByName(LPCWSTR szTypeDef, mdToken tkEnclosingClass, mdTypeDef *ptd)
+{
+    if((NULL == szTypeDef) || (NULL == ptd))
+    {
+        return E_INVALIDARG;
+    }
+
+    // Nested types have no namespace; the others have all before the last dot.
+    CStringA szName = CW2A(szTypeDef, CP_UTF8);
+    CStringA szNamespace;
+    if(IsNilToken(tkEnclosingClass))
+    {
+        tkEnclosingClass = mdTypeDefNil;
+        int nLastDot = szName.ReverseFind('.');
+        if(0 <= nLastDot)
+        {
+            szNamespace = szName.Left(nLastDot);
+            szName = szName.Mid(nLastDot + 1);
+        }
+    }
+    for(ULONG i = 1; i <= this->m_vTables[TABLE_TYPEDEF].nRowCount; i++)
+    {
+        mdTypeDef td = TokenFromRid(i, mdtTypeDef);
+        if((0 == ::strcmp(this->GetName(td), szName)) && (0 == ::strcmp(this->GetNamespace(td), szNamespace))
+            && (this->GetEnclosingClass(td) == tkEnclosingClass))
+        {
+            *ptd = td;
+            return S_OK;
+        }
+    }
+    *ptd = mdTypeDefNil;
+    return CLDB_E_RECORD_NOTFOUND;
+}
+
+STDMETHODIMP CMetadataSnapshot::GetScopeProps(LPWSTR szName, ULONG cchName, ULONG *pchName, GUID *pmvid)
+{
+    if(0 == this->m_vTables[TABLE_MODULE].nRowCount)
+    {
+        return CLDB_E_RECORD_NOTFOUND;
+    }
+    if(NULL != pmvid)
+    {
+        ULONG nIndex = this->ReadColumn(TABLE_MODULE, 1, 2);
+        if((0 == nIndex) || (nIndex * sizeof(GUID) > this->m_nGuidsSize))
+        {
+            return COR_E_BADIMAGEFORMAT;
+        }
+        ::memcpy(pmvid, this->m_pGuids + (nIndex - 1) * sizeof(GUID), sizeof(GUID));
+    }
+    return CopyName(this->GetName(TokenFromRid(1, mdtModule)), szName, cchName, pchName);
+}
+
+STDMETHODIMP CMetadataSnapshot::GetTypeDefProps(mdTypeDef td, LPWSTR szTypeDef, ULONG cchTypeDef, ULONG *pchTypeDef,
+                                                DWORD *pdwTypeDefFlags, mdToken *ptkExtends)
+{
+    if((mdtTypeDef != TypeFromToken(td)) || !this->IsValidToken(td))
+    {
+        return E_INVALIDARG;
+    }
+    if(NULL != pdwTypeDefFlags)
+    {
+        *pdwTypeDefFlags = this->ReadColumn(TABLE_TYPEDEF, RidFromToken(td), 0);
+    }
+    if(NULL != ptkExtends)
+    {
+        *ptkExtends = this->ReadToken(TABLE_TYPEDEF, RidFromToken(td), 3);
+    }
+    CStringA szFullName = this->GetNamespace(td);
+    if(!szFullName.IsEmpty())
+    {
+        szFullName += '.';
+    }
+    szFullName += this->GetName(td);
+    return CopyName(szFullName, szTypeDef, cchTypeDef, pchTypeDef);
+}
+
+STDMETHODIMP CMetadataSnapshot::EnumMethodsWithName(HCORENUM *phEnum, mdTypeDef cl, LPCWSTR szName,
+                                                    mdMethodDef rMethods[], ULONG cMax, ULONG *pcTokens)
+{
+    if(NULL == phEnum)
+    {
+        return E_POINTER;
+    }
+    if(NULL == *phEnum)
+    {
+        if((mdtTypeDef != TypeFromToken(cl)) || !this->IsValidToken(cl))
+        {
+            return E_INVALIDARG;
+        }
+        CStringA szUtf8Name;
+        if(NULL != szName)
+        {
+            szUtf8Name = CW2A(szName, CP_UTF8);
+        }
+        ENUM_STATE *pState = new ENUM_STATE;
+        pState->nNext = 0;
+        ULONG nFirst, nEnd;
+        this->GetMethodRange(cl, nFirst, nEnd);
+        for(ULONG i = nFirst; i < nEnd; i++)
+        {
+            mdMethodDef md = TokenFromRid(i, mdtMethodDef);
+            if((NULL == szName) || (0 == ::strcmp(this->GetName(md), szUtf8Name)))
+            {
+                pState->vTokens.Add(md);
+            }
+        }
+        *phEnum = pState;
+    }
+    return EnumTokens(phEnum, rMethods, cMax, pcTokens);
+}
+
+STDMETHODIMP CMetadataSnapshot::FindMethod(mdTypeDef td, LPCWSTR szName, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob,
+                                           mdMethodDef *pmb)
+{
+    if((NULL == szName) || (NULL == pmb) || (mdtTypeDef != TypeFromToken(td)) || !this->IsValidToken(td))
+    {
+        return E_INVALIDARG;
+    }
+    CStringA szUtf8Name = CW2A(szName, CP_UTF8);
+    ULONG nFirst, nEnd;
+    this->GetMethodRange(td, nFirst, nEnd);
+    for(ULONG i = nFirst; i < nEnd; i++)
+    {
+        mdMethodDef md = TokenFromRid(i, mdtMethodDef);
+        if(0 != ::strcmp(this->GetName(md), szUtf8Name))
+        {
+            continue;
+        }
+        ULONG nSigSize;
+        PCCOR_SIGNATURE pvSig = this->GetBlob(md, nSigSize);
+        if((NULL == pvSigBlob) || ((nSigSize == cbSigBlob) && (0 == ::memcmp(pvSig, pvSigBlob, nSigSize))))
+        {
+            *pmb = md;
+            return S_OK;
+        }
+    }
+    *pmb = mdMethodDefNil;
+    return CLDB_E_RECORD_NOTFOUND;
+}
+
+STDMETHODIMP CMetadataSnapshot::GetMethodProps(mdMethodDef mb, mdTypeDef *pClass, LPWSTR szMethod, ULONG cchMethod,
+                                               ULONG *pchMethod, DWORD *pdwAttr, PCCOR_SIGNATURE *ppvSigBlob,
+                                               ULONG *pcbSigBlob, ULONG *pulCodeRVA, DWORD *pdwImplFlags)
+{
+    if((mdtMethodDef != TypeFromToken(mb)) || !this->IsValidToken(mb))
+    {
+        return E_INVALIDARG;
+    }
+    ULONG nRow = RidFromToken(mb);
+    if(NULL != pClass)
+    {
+        *pClass = this->GetMethodClass(mb);
+    }
+    if(NULL != pdwAttr)
+    {
+        *pdwAttr = this->ReadColumn(TABLE_METHODDEF, nRow, 2);
+    }
+    if(NULL != pdwImplFlags)
+    {
+        *pdwImplFlags = this->ReadColumn(TABLE_METHODDEF, nRow, 1);
+    }
+    if(NULL != pulCodeRVA)
+    {
+        if(!this->m_mapCodeRvas.Lookup(mb, *pulCodeRVA))
+        {
+            *pulCodeRVA = this->ReadColumn(TABLE_METHODDEF, nRow, 0);
+        }
+    }
+    ULONG nSigSize;
+    PCCOR_SIGNATURE pvSig = this->GetBlob(mb, nSigSize);
+    if(NULL != ppvSigBlob)
+    {
+        *ppvSigBlob = pvSig;
+    }
+    if(NULL != pcbSigBlob)
+    {
+        *pcbSigBlob = nSigSize;
+    }
+    return CopyName(this->GetName(mb), szMethod, cchMethod, pchMethod);
+}
+
+STDMETHODIMP CMetadataSnapshot::GetMemberRefProps(mdMemberRef mr, mdToken *ptk, LPWSTR szMember, ULONG cchMember,
+                                                  ULONG *pchMember, PCCOR_SIGNATURE *ppvSigBlob, ULONG *pbSig)
+{
+    if((mdtMemberRef != TypeFromToken(mr)) || !this->IsValidToken(mr))
+    {
+        return E_INVALIDARG;
+    }
+    if(NULL != ptk)
+    {
+        *ptk = this->GetParent(mr);
+    }
+    ULONG nSigSize;
+    PCCOR_SIGNATURE pvSig = this->GetBlob(mr, nSigSize);
+    if(NULL != ppvSigBlob)
+    {
+        *ppvSigBlob = pvSig;
+    }
+    if(NULL != pbSig)
+    {
+        *pbSig = nSigSize;
+    }
+    return CopyName(this->GetName(mr), szMember, cchMember, pchMember);
+}
+
+STDMETHODIMP CMetadataSnapshot::GetSigFromToken(mdSignature mdSig, PCCOR_SIGNATURE *ppvSig, ULONG *pcbSig)
+{
+    if((mdtSignature != TypeFromToken(mdSig)) || !this->IsValidToken(mdSig) || (NULL == ppvSig) || (NULL == pcbSig))
+    {
+        return E_INVALIDARG;
+    }
+    *ppvSig = this->GetBlob(mdSig, *pcbSig);
+    return S_OK;
+}
+
+STDMETHODIMP CMetadataSnapshot::GetTypeSpecFromToken(mdTypeSpec typespec, PCCOR_SIGNATURE *ppvSig, ULONG *pcbSig)
+{
+    if((mdtTypeSpec != TypeFromToken(typespec)) || !this->IsValidToken(typespec) || (NULL == ppvSig) || (NULL == pcbSig))
+    {
+        return E_INVALIDARG;
+    }
+    *ppvSig = this->GetBlob(typespec, *pcbSig);
+    return S_OK;
+}
+
+STDMETHODIMP_(BOOL) CMetadataSnapshot::IsValidToken(mdToken tk)
+{
+    return this->IsValidRow(tk);
+}
+
+BOOL CMetadataSnapshot::IsValidRow(mdToken tk) const
+{
+    ULONG nTable = TypeFromToken(tk) >> 24;
+    ULONG nRow = RidFromToken(tk);
+    return (nTable < TABLE_COUNT) && (0 < nRow) && (nRow <= this->GetRowCount(nTable));
+}
+
+STDMETHODIMP CMetadataSnapshot::GetNestedClassProps(mdTypeDef tdNestedClass, mdTypeDef *ptdEnclosingClass)
+{
+    if(NULL == ptdEnclosingClass)
+    {
+        return E_POINTER;
+    }
+    *ptdEnclosingClass = this->GetEnclosingClass(tdNestedClass);
+    return IsNilToken(*ptdEnclosingClass) ? CLDB_E_RECORD_NOTFOUND : S_OK;
+}
+
+STDMETHODIMP CMetadataSnapshot::GetMethodSpecProps(mdMethodSpec mi, mdToken *tkParent, PCCOR_SIGNATURE *ppvSigBlob,
+                                                   ULONG *pcbSigBlob)
+{
+    if((mdtMethodSpec != TypeFromToken(mi)) || !this->IsValidToken(mi))
+    {
+        return E_INVALIDARG;
+    }
+    if(NULL != tkParent)
+    {
+        *tkParent = this->GetParent(mi);
+    }
+    ULONG nSigSize;
+    PCCOR_SIGNATURE pvSig = this->GetBlob(mi, nSigSize);
+    if(NULL != ppvSigBlob)
+    {
+        *ppvSigBlob = pvSig;
+    }
+    if(NULL != pcbSigBlob)
+    {
+        *pcbSigBlob = nSigSize;
+    }
+    return S_OK;
+}
+
+STDMETHODIMP CMetadataSnapshot::SetHandler(IUnknown* /*pUnk*/)
+{
+    return S_OK;    // nothing is saved, so no token ever moves
+}
+
+STDMETHODIMP CMetadataSnapshot::DefineImportType(IMetaDataAssemblyImport* /*pAssemImport*/, const void* /*pbHashValue*/,
+                                                 ULONG /*cbHashValue*/, IMetaDataImport *pImport, mdTypeDef tdImport,
+                                                 IMetaDataAssemblyEmit* /*pAssemEmit*/, mdTypeRef *ptr)
+{
+    CMetadataSnapshot *pSource = FromUnknown(pImport);
+    if((NULL == pSource) || (NULL == ptr))
+    {
+        return E_NOTIMPL;   // only types of other snapshots are imported
+    }
+    return this->ImportTypeRef(*pSource, tdImport, *ptr);
+}
+
+STDMETHODIMP CMetadataSnapshot::DefineMemberRef(mdToken tkImport, LPCWSTR szName, PCCOR_SIGNATURE pvSigBlob,
+                                                ULONG cbSigBlob, mdMemberRef *pmr)
+{
+    if((NULL == szName) || (NULL == pmr))
+    {
+        return E_INVALIDARG;
+    }
+    EMITTED_ROW xRow;
+    xRow.tkParent = tkImport;
+    xRow.szName = CW2A(szName, CP_UTF8);
+    *pmr = this->DefineRow(TABLE_MEMBERREF, xRow, pvSigBlob, cbSigBlob);
+    return S_OK;
+}
+
+STDMETHODIMP CMetadataSnapshot::DefineImportMember(IMetaDataAssemblyImport* /*pAssemImport*/,
+                                                   const void* /*pbHashValue*/, ULONG /*cbHashValue*/,
+                                                   IMetaDataImport *pImport, mdToken mbMember,
+                                                   IMetaDataAssemblyEmit* /*pAssemEmit*/, mdToken tkParent,
+                                                   mdMemberRef *pmr)
+{
+    CMetadataSnapshot *pSource = FromUnknown(pImport);
+    if((NULL == pSource) || (NULL == pmr))
+    {
+        return E_NOTIMPL;   // only members of other snapshots are imported
+    }
+    if(((mdtMethodDef != TypeFromToken(mbMember)) && (mdtMemberRef != TypeFromToken(mbMember)))
+        || !pSource->IsValidRow(mbMember))
+    {
+        return E_INVALIDARG;
+    }
+
+    // The signature refers to types by tokens of the source, which are imported as well.
+    ULONG nSigSize;
+    PCCOR_SIGNATURE pvSig = pSource->GetBlob(mbMember, nSigSize);
+    PCCOR_SIGNATURE pvSigEnd = pvSig + nSigSize;
+    CAtlArray<BYTE> vSig;
+    HRESULT hr = this->ImportMemberSignature(*pSource, pvSig, pvSigEnd, vSig);
+    if(FAILED(hr))
+    {
+        return hr;
+    }
+    EMITTED_ROW xRow;
+    xRow.tkParent = tkParent;
+    xRow.szName = pSource->GetName(mbMember);
+    *pmr = this->DefineRow(TABLE_MEMBERREF, xRow, vSig.GetData(), (ULONG)vSig.GetCount());
+    return S_OK;
+}
+
+STDMETHODIMP CMetadataSnapshot::GetTokenFromSig(PCCOR_SIGNATURE pvSig, ULONG cbSig, mdSignature *pmsig)
+{
+    if((NULL == pvSig) || (NULL == pmsig))
+    {
+        return E_INVALIDARG;
+    }
+    *pmsig = this->DefineRow(TABLE_STANDALONESIG, EMITTED_ROW(), pvSig, cbSig);
+    return S_OK;
+}
+
+STDMETHODIMP CMetadataSnapshot::GetTokenFromTypeSpec(PCCOR_SIGNATURE pvSig, ULONG cbSig, mdTypeSpec *ptypespec)
+{
+    if((NULL == pvSig) || (NULL == ptypespec))
+    {
+        return E_INVALIDARG;
+    }
+    *ptypespec = this->DefineRow(TABLE_TYPESPEC, EMITTED_ROW(), pvSig, cbSig);
+    return S_OK;
+}
+
+STDMETHODIMP CMetadataSnapshot::SetMethodProps(mdMethodDef md, DWORD /*dwMethodFlags*/, ULONG ulCodeRVA,
+                                               DWORD /*dwImplFlags*/)
+{
+    if((mdtMethodDef != TypeFromToken(md)) || !this->IsValidToken(md))
+    {
+        return E_INVALIDARG;
+    }
+    if(ULONG_MAX != ulCodeRVA)
+    {
+        this->m_mapCodeRvas.SetAt(md, ulCodeRVA);
+    }
+    return S_OK;
+}
+
+STDMETHODIMP CMetadataSnapshot::DefineMethodSpec(mdToken tkParent, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob,
+                                                 mdMethodSpec *pmi)
+{
+    if((NULL == pvSigBlob) || (NULL == pmi))
+    {
+        return E_INVALIDARG;
+    }
+    EMITTED_ROW xRow;
+    xRow.tkParent = tkParent;
+    *pmi = this->DefineRow(TABLE_METHODSPEC, xRow, pvSigBlob, cbSigBlob);
+    return S_OK;
+}
+
+STDMETHODIMP CMetadataSnapshot::GetAssemblyFromScope(mdAssembly *ptkAssembly)
+{
+    if(NULL == ptkAssembly)
+    {
+        return E_POINTER;
+    }
+    *ptkAssembly = (0 < this->m_vTables[TABLE_ASSEMBLY].nRowCount) ? TokenFromRid(1, mdtAssembly) : mdAssemblyNil;
+    return IsNilToken(*ptkAssembly) ? CLDB_E_RECORD_NOTFOUND : S_OK;
+}
+
+STDMETHODIMP CMetadataSnapshot::FindAssembliesByName(LPCWSTR /*szAppBase*/, LPCWSTR /*szPrivateBin*/,
+                                                     LPCWSTR szAssemblyName, IUnknown *ppIUnk[], ULONG cMax,
+                                                     ULONG *pcAssemblies)
+{
+    if((NULL == szAssemblyName) || (NULL == pcAssemblies))
+    {
+        return E_INVALIDARG;
+    }
+
+    // Match the simple name, without version, culture or key, against this snapshot and its
+    // references. Callers release the scopes found, which costs nothing here.
+    CStringA szName = CW2A(szAssemblyName, CP_UTF8);
+    int nComma = szName.Find(',');
+    if(0 <= nComma)
+    {
+        szName = szName.Left(nComma);
+    }
+    szName.Trim();
+
+    ULONG nCount = 0;
+    for(size_t i = 0; i <= this->m_vpReferences.GetCount(); i++)
+    {
+        CMetadataSnapshot *pCandidate = (0 == i) ? this : this->m_vpReferences[i - 1];
+        LPCSTR pstrCandidateName = pCandidate->GetAssemblyName();
+        if((NULL == pstrCandidateName) || (0 != ::_stricmp(pstrCandidateName, szName)))
+        {
+            continue;
+        }
+        if(nCount < cMax)
+        {
+            ppIUnk[nCount] = static_cast<IMetaDataImport2*>(pCandidate);
+        }
+        nCount++;
+    }
+    *pcAssemblies = nCount;
+    return (0 < nCount) ? S_OK : S_FALSE;
+}
+
+#pragma endregion
+
+#if defined(FAULT_ENGINE_TEST_EXPORTS)
+
+#pragma region Reference Signature Walker
+
+// The recursive walk which CSignatureBlob replaced, a bounds check per field, kept to measure the
+// parser against and to check where it stops. Lenient: valid signatures are all it is given.
+static BOOL ReadSignatureData(PCCOR_SIGNATURE &rpSignature, PCCOR_SIGNATURE pTail, ULONG &rnData)
+{
+    if(rpSignature >= pTail)
+    {
+        return FALSE;
+    }
+    rpSignature += ::CorSigUncompressData(rpSignature, &rnData);
+    return rpSignature <= pTail;
+}
+
+static BOOL ReadSignatureToken(PCCOR_SIGNATURE &rpSignature, PCCOR_SIGNATURE pTail)
+{
+    mdToken tkToken;
+    if(rpSignature >= pTail)
+    {
+        return FALSE;
+    }
+    rpSignature += ::CorSigUncompressToken(rpSignature, &tkToken);
+    return rpSignature <= pTail;
+}
+
+static BOOL WalkMethodSigRecursively(PCCOR_SIGNATURE &rpSignature, PCCOR_SIGNATURE pTail);
+
+static BOOL WalkTypeSigRecursively(PCCOR_SIGNATURE &rpSignature, PCCOR_SIGNATURE pTail)
+{
+    ULONG nData, nCount;
+    if(rpSignature >= pTail)
+    {
+        return FALSE;
+    }
+    CorElementType nElementType = ::CorSigUncompressElementType(rpSignature);
+    switch(nElementType)
+    {
+    case ELEMENT_TYPE_CMOD_REQD:
+    case ELEMENT_TYPE_CMOD_OPT:
+        return ReadSignatureToken(rpSignature, pTail) && WalkTypeSigRecursively(rpSignature, pTail);
+
+    case ELEMENT_TYPE_SENTINEL:
+    case ELEMENT_TYPE_BYREF:
+    case ELEMENT_TYPE_PTR:
+    case ELEMENT_TYPE_SZARRAY:
+        return WalkTypeSigRecursively(rpSignature, pTail);
+
+    case ELEMENT_TYPE_VALUETYPE:
+    case ELEMENT_TYPE_CLASS:
+        return ReadSignatureToken(rpSignature, pTail);
+
+    case ELEMENT_TYPE_VAR:
+    case ELEMENT_TYPE_MVAR:
+        return ReadSignatureData(rpSignature, pTail, nData);
+
+    case ELEMENT_TYPE_ARRAY:
+        if(!WalkTypeSigRecursively(rpSignature, pTail) || !ReadSignatureData(rpSignature, pTail, nData))
+        {
+            return FALSE;
+        }
+        for(int nList = 0; nList < 2; nList++)  // Sizes, then LoBounds
+        {
+            if(!ReadSignatureData(rpSignature, pTail, nCount))
+            {
+                return FALSE;
+            }
+            for(ULONG i = 0; i < nCount; i++)
+            {
+                if(!ReadSignatureData(rpSignature, pTail, nData))
+                {
+                    return FALSE;
+                }
+            }
+        }
+        return TRUE;
+
+    case ELEMENT_TYPE_GENERICINST:
+        if(!WalkTypeSigRecursively(rpSignature, pTail) || !ReadSignatureData(rpSignature, pTail, nCount))
+        {
+            return FALSE;
+        }
+        for(ULONG i = 0; i < nCount; i++)
+        {
+            if(!WalkTypeSigRecursively(rpSignature, pTail))
+            {
+                return FALSE;
+            }
+        }
+        return TRUE;
+
+    case ELEMENT_TYPE_FNPTR:
+        return WalkMethodSigRecursively(rpSignature, pTail);
+
+    default:
+        return (ELEMENT_TYPE_END < nElementType) && (nElementType < ELEMENT_TYPE_MAX);
+    }
+}
+
+static BOOL WalkMethodSigRecursively(PCCOR_SIGNATURE &rpSignature, PCCOR_SIGNATURE pTail)
+{
+    ULONG nData, nParamCount;
+    if(rpSignature >= pTail)
+    {
+        return FALSE;
+    }
+    if(IMAGE_CEE_CS_CALLCONV_GENERIC & *rpSignature++)
+    {
+        if(!ReadSignatureData(rpSignature, pTail, nData))
+        {
+            return FALSE;
+        }
+    }
+    if(!ReadSignatureData(rpSignature, pTail, nParamCount))
+    {
+        return FALSE;
+    }
+    for(ULONG i = 0; i <= nParamCount; i++)     // the return type first
+    {
+        if(!WalkTypeSigRecursively(rpSignature, pTail))
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+#pragma endregion
+
+#pragma region Exported Functions (Called by Tests)
+
+extern "C" BOOL WINAPI FaultEngineBenchmarkSnapshot(LPCWSTR pstrAssemblyPath, LPCWSTR *ppstrReferencePaths,
+                                                    ULONG nReferenceCount, LPCWSTR pstrMethodFilterFile,
+                                                    ULONG nIterations, LONGLONG *pnTicks, ULONG *pnMethodCount)
+{
+    if((NULL == pstrAssemblyPath) || ((NULL == ppstrReferencePaths) && (0 < nReferenceCount))
+        || (NULL == pstrMethodFilterFile) || (NULL == pnTicks) || (NULL == pnMethodCount) || (0 == nIterations))
+    {
+        return FALSE;
+    }
+    CEventLog::Initialize();
+
+    CAtlArray<CString> vszMethodNames;
+    CAtlArray<ULONGLONG> vnSignatureHashes;
+    if(!COfflineRewriter::LoadMethodFilter(CW2CT(pstrMethodFilterFile), vszMethodNames, vnSignatureHashes))
+    {
+        return FALSE;
+    }
+
+    // References, such as the dispatcher and the system assembly, are only read, so they are
+    // opened once for all the iterations.
+    CAutoPtrArray<CMetadataSnapshot> vpReferences;
+    for(ULONG i = 0; i < nReferenceCount; i++)
+    {
+        CAutoPtr<CMetadataSnapshot> pReference(new CMetadataSnapshot());
+        HRESULT hr = pReference->Open(CW2CT(ppstrReferencePaths[i]));
+        if(FAILED(hr))
+        {
+            EventReportError(IDS_REPORT_FAILED_OPEN_ASSEMBLY, hr, ppstrReferencePaths[i]);
+            return FALSE;
+        }
+        vpReferences.Add(pReference);
+    }
+
+    // Run the JIT hook on the methods of the filter, on a fresh snapshot each time so that the
+    // tokens are emitted again.
+    const ModuleID moduleId = 1;
+    BOOL bSucceeded = TRUE;
+    ULONG nMethodCount = 0;
+    LARGE_INTEGER xStartTime, xEndTime;
+    ::QueryPerformanceCounter(&xStartTime);
+    for(ULONG i = 0; bSucceeded && (i < nIterations); i++)
+    {
+        CMetadataSnapshot xSnapshot;
+        HRESULT hr = xSnapshot.Open(CW2CT(pstrAssemblyPath));
+        if(FAILED(hr))
+        {
+            EventReportError(IDS_REPORT_FAILED_OPEN_ASSEMBLY, hr, pstrAssemblyPath);
+            return FALSE;
+        }
+        for(size_t j = 0; j < vpReferences.GetCount(); j++)
+        {
+            xSnapshot.AddReference(vpReferences[j]);
+        }
+        COfflineProfilerInfo xProfilerInfo(static_cast<IMetaDataImport2*>(&xSnapshot), xSnapshot.GetImage(),
+            xSnapshot.GetImageSize(), xSnapshot.GetSections(), xSnapshot.GetSectionCount());
+        try
+        {
+            CMetadataModule xModule(CComQIPtr<ICorProfilerInfo>(static_cast<ICorProfilerInfo*>(&xProfilerInfo)), moduleId);
+            CAtlArray<mdMethodDef> vMethodDefTokens;
+            CAtlArray<size_t> vNameIndexes;
+            xModule.FindMethodsByFullQualifiedName(vszMethodNames, vnSignatureHashes, vMethodDefTokens, vNameIndexes);
+            for(size_t j = 0; j < vMethodDefTokens.GetCount(); j++)
+            {
+                CMetadataMethod xMethodInfo(vMethodDefTokens[j]);
+                xModule.LoadMethodProperties(xMethodInfo);
+                xModule.InsertPrologueIntoMethod(xMethodInfo);
+            }
+        }
+        catch(CExceptionAsBreak* /*&sharedExceptionAsBreak*/)
+        {
+            bSucceeded = FALSE;     // error is reported by callee
+        }
+        nMethodCount = (ULONG)xProfilerInfo.GetNewBodyCount();
+
+        // The instantiations belong to the tokens of this snapshot.
+        CInstantiationCache::RemoveModule(moduleId);
+    }
+    ::QueryPerformanceCounter(&xEndTime);
+
+    *pnTicks = xEndTime.QuadPart - xStartTime.QuadPart;
+    *pnMethodCount = nMethodCount;
+    return bSucceeded;
+}
+
+extern "C" BOOL WINAPI FaultEngineBenchmarkSignatures(LPCWSTR pstrAssemblyPath, ULONG nIterations,
+                                                      LONGLONG *pnTicks, LONGLONG *pnReferenceTicks,
+                                                      ULONG *pnSignatureCount)
+{
+    if((NULL == pstrAssemblyPath) || (NULL == pnTicks) || (NULL == pnReferenceTicks)
+        || (NULL == pnSignatureCount) || (0 == nIterations))
+    {
+        return FALSE;
+    }
+    CEventLog::Initialize();
+
+    CMetadataSnapshot xSnapshot;
+    HRESULT hr = xSnapshot.Open(CW2CT(pstrAssemblyPath));
+    if(FAILED(hr))
+    {
+        EventReportError(IDS_REPORT_FAILED_OPEN_ASSEMBLY, hr, pstrAssemblyPath);
+        return FALSE;
+    }
+
+    // Every method signature of the assembly: those of the methods it defines, then those of
+    // the methods it references. Rows are taken until the first token out of the table.
+    CAtlArray<CSignatureBlob> vSignatures;
+    PCCOR_SIGNATURE pvSignature;
+    ULONG nSignatureSize;
+    for(ULONG nRow = 1; SUCCEEDED(xSnapshot.GetMethodProps(TokenFromRid(nRow, mdtMethodDef),
+        NULL, NULL, 0, NULL, NULL, &pvSignature, &nSignatureSize, NULL, NULL)); nRow++)
+    {
+        if(0 < nSignatureSize)
+        {
+            vSignatures.Add(CSignatureBlob(pvSignature, nSignatureSize));
+        }
+    }
+    for(ULONG nRow = 1; SUCCEEDED(xSnapshot.GetMemberRefProps(TokenFromRid(nRow, mdtMemberRef),
+        NULL, NULL, 0, NULL, &pvSignature, &nSignatureSize)); nRow++)
+    {
+        if((0 < nSignatureSize)
+            && (IMAGE_CEE_CS_CALLCONV_FIELD != (pvSignature[0] & IMAGE_CEE_CS_CALLCONV_MASK)))
+        {
+            vSignatures.Add(CSignatureBlob(pvSignature, nSignatureSize));
+        }
+    }
+
+    // Both walks must accept the same signatures, and stop at the same byte: the bytes each one
+    // consumed are summed, which also keeps the timed loops from being optimized away.
+    ULONGLONG nParsedSize = 0, nWalkedSize = 0;
+    LARGE_INTEGER xStartTime, xEndTime;
+    try
+    {
+        ::QueryPerformanceCounter(&xStartTime);
+        for(ULONG i = 0; i < nIterations; i++)
+        {
+            for(size_t j = 0; j < vSignatures.GetCount(); j++)
+            {
+                PCCOR_SIGNATURE pBase = (PCCOR_SIGNATURE)vSignatures[j].GetBaseAddress();
+                PCCOR_SIGNATURE pSignature = pBase;
+                if(!vSignatures[j].ParseMethodSig(pSignature))
+                {
+                    return FALSE;
+                }
+                nParsedSize += pSignature - pBase;
+            }
+        }
+        ::QueryPerformanceCounter(&xEndTime);
+    }
+    catch(CExceptionAsBreak* /*&sharedExceptionAsBreak*/)
+    {
+        return FALSE;   // error is reported by callee
+    }
+    *pnTicks = xEndTime.QuadPart - xStartTime.QuadPart;
+
+    ::QueryPerformanceCounter(&xStartTime);
+    for(ULONG i = 0; i < nIterations; i++)
+    {
+        for(size_t j = 0; j < vSignatures.GetCount(); j++)
+        {
+            PCCOR_SIGNATURE pBase = (PCCOR_SIGNATURE)vSignatures[j].GetBaseAddress();
+            PCCOR_SIGNATURE pSignature = pBase;
+            if(!WalkMethodSigRecursively(pSignature, (PCCOR_SIGNATURE)vSignatures[j].GetTailAddress()))
+            {
+                return FALSE;
+            }
+            nWalkedSize += pSignature - pBase;
+        }
+    }
+    ::QueryPerformanceCounter(&xEndTime);
+    *pnReferenceTicks = xEndTime.QuadPart - xStartTime.QuadPart;
+
+    *pnSignatureCount = (ULONG)vSignatures.GetCount();
+    return nParsedSize == nWalkedSize;
+}
+
+#pragma endregion
+
+#endif // FAULT_ENGINE_TEST_EXPORTS
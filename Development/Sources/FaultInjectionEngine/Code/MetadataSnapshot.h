@@ -0,0 +1,351 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  Declaration of class CMetadataSnapshot.
+//  A stand-in for the metadata interfaces of the runtime, read straight from the tables of an
+//  assembly file mapped into memory. It implements the calls CMetadataModule and
+//  CILStackAnalyzer make; tokens it emits are kept in memory, after the rows of the file, and
+//  are never saved. With COfflineProfilerInfo it runs the rewriting of the JIT hook without a
+//  runtime, for tests and benchmarks. Other calls return E_NOTIMPL.
+//
+
+#pragma once
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Declaration of CMetadataSnapshot
+
+class CMetadataSnapshot : public IMetaDataImport2, public IMetaDataEmit2, public IMetaDataAssemblyImport,
+    public IMetaDataAssemblyEmit
+{
+public:
+    CMetadataSnapshot(void);
+    ~CMetadataSnapshot(void);
+
+    /// <summary>
+    /// Map the assembly file and read its metadata tables.
+    /// </summary>
+    HRESULT Open(LPCTSTR pstrAssemblyPath);
+
+    /// <summary>
+    /// Make the assembly of another snapshot visible to FindAssembliesByName, e.g. the one of
+    /// the dispatcher. The reference must outlive this snapshot.
+    /// </summary>
+    void AddReference(CMetadataSnapshot *pReference);
+
+    /// <summary>
+    /// Get the mapped image and its section headers, for COfflineProfilerInfo.
+    /// </summary>
+    LPCBYTE GetImage(void) const { return this->m_pImage; }
+    ULONGLONG GetImageSize(void) const { return this->m_nImageSize; }
+    const IMAGE_SECTION_HEADER* GetSections(void) const { return this->m_pSections; }
+    WORD GetSectionCount(void) const { return this->m_nSectionCount; }
+
+public:
+    // IUnknown. Snapshots live on the stack of their users, so references are not counted.
+    STDMETHOD(QueryInterface)(REFIID riid, void **ppvObject);
+    STDMETHOD_(ULONG, AddRef)(void) { return 1; }
+    STDMETHOD_(ULONG, Release)(void) { return 1; }
+
+    // IMetaDataImport (Implemented Ones)
+    STDMETHOD_(void, CloseEnum)(HCORENUM hEnum);
+    STDMETHOD(CountEnum)(HCORENUM hEnum, ULONG *pulCount);
+    STDMETHOD(EnumTypeDefs)(HCORENUM *phEnum, mdTypeDef rTypeDefs[], ULONG cMax, ULONG *pcTypeDefs);
+    STDMETHOD(FindTypeDefByName)(LPCWSTR szTypeDef, mdToken tkEnclosingClass, mdTypeDef *ptd);
+    STDMETHOD(GetScopeProps)(LPWSTR szName, ULONG cchName, ULONG *pchName, GUID *pmvid);
+    STDMETHOD(GetTypeDefProps)(mdTypeDef td, LPWSTR szTypeDef, ULONG cchTypeDef, ULONG *pchTypeDef,
+        DWORD *pdwTypeDefFlags, mdToken *ptkExtends);
+    STDMETHOD(EnumMethodsWithName)(HCORENUM *phEnum, mdTypeDef cl, LPCWSTR szName, mdMethodDef rMethods[],
+        ULONG cMax, ULONG *pcTokens);
+    STDMETHOD(FindMethod)(mdTypeDef td, LPCWSTR szName, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob,
+        mdMethodDef *pmb);
+    STDMETHOD(GetMethodProps)(mdMethodDef mb, mdTypeDef *pClass, LPWSTR szMethod, ULONG cchMethod,
+        ULONG *pchMethod, DWORD *pdwAttr, PCCOR_SIGNATURE *ppvSigBlob, ULONG *pcbSigBlob, ULONG *pulCodeRVA,
+        DWORD *pdwImplFlags);
+    STDMETHOD(GetMemberRefProps)(mdMemberRef mr, mdToken *ptk, LPWSTR szMember, ULONG cchMember,
+        ULONG *pchMember, PCCOR_SIGNATURE *ppvSigBlob, ULONG *pbSig);
+    STDMETHOD(GetSigFromToken)(mdSignature mdSig, PCCOR_SIGNATURE *ppvSig, ULONG *pcbSig);
+    STDMETHOD(GetTypeSpecFromToken)(mdTypeSpec typespec, PCCOR_SIGNATURE *ppvSig, ULONG *pcbSig);
+    STDMETHOD_(BOOL, IsValidToken)(mdToken tk);
+    STDMETHOD(GetNestedClassProps)(mdTypeDef tdNestedClass, mdTypeDef *ptdEnclosingClass);
+
+    // IMetaDataImport (Not Implemented Ones)
+    STDMETHOD(ResetEnum)(HCORENUM, ULONG) { return E_NOTIMPL; }
+    STDMETHOD(EnumInterfaceImpls)(HCORENUM*, mdTypeDef, mdInterfaceImpl[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumTypeRefs)(HCORENUM*, mdTypeRef[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetModuleFromScope)(mdModule*) { return E_NOTIMPL; }
+    STDMETHOD(GetInterfaceImplProps)(mdInterfaceImpl, mdTypeDef*, mdToken*) { return E_NOTIMPL; }
+    STDMETHOD(GetTypeRefProps)(mdTypeRef, mdToken*, LPWSTR, ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(ResolveTypeRef)(mdTypeRef, REFIID, IUnknown**, mdTypeDef*) { return E_NOTIMPL; }
+    STDMETHOD(EnumMembers)(HCORENUM*, mdTypeDef, mdToken[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumMembersWithName)(HCORENUM*, mdTypeDef, LPCWSTR, mdToken[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumMethods)(HCORENUM*, mdTypeDef, mdMethodDef[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumFields)(HCORENUM*, mdTypeDef, mdFieldDef[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumFieldsWithName)(HCORENUM*, mdTypeDef, LPCWSTR, mdFieldDef[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumParams)(HCORENUM*, mdMethodDef, mdParamDef[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumMemberRefs)(HCORENUM*, mdToken, mdMemberRef[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumMethodImpls)(HCORENUM*, mdTypeDef, mdToken[], mdToken[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumPermissionSets)(HCORENUM*, mdToken, DWORD, mdPermission[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(FindMember)(mdTypeDef, LPCWSTR, PCCOR_SIGNATURE, ULONG, mdToken*) { return E_NOTIMPL; }
+    STDMETHOD(FindField)(mdTypeDef, LPCWSTR, PCCOR_SIGNATURE, ULONG, mdFieldDef*) { return E_NOTIMPL; }
+    STDMETHOD(FindMemberRef)(mdTypeRef, LPCWSTR, PCCOR_SIGNATURE, ULONG, mdMemberRef*) { return E_NOTIMPL; }
+    STDMETHOD(EnumProperties)(HCORENUM*, mdTypeDef, mdProperty[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumEvents)(HCORENUM*, mdTypeDef, mdEvent[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetEventProps)(mdEvent, mdTypeDef*, LPWSTR, ULONG, ULONG*, DWORD*, mdToken*, mdMethodDef*,
+        mdMethodDef*, mdMethodDef*, mdMethodDef[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumMethodSemantics)(HCORENUM*, mdMethodDef, mdToken[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetMethodSemantics)(mdMethodDef, mdToken, DWORD*) { return E_NOTIMPL; }
+    STDMETHOD(GetClassLayout)(mdTypeDef, DWORD*, COR_FIELD_OFFSET[], ULONG, ULONG*, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetFieldMarshal)(mdToken, PCCOR_SIGNATURE*, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetRVA)(mdToken, ULONG*, DWORD*) { return E_NOTIMPL; }
+    STDMETHOD(GetPermissionSetProps)(mdPermission, DWORD*, void const**, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetModuleRefProps)(mdModuleRef, LPWSTR, ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumModuleRefs)(HCORENUM*, mdModuleRef[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetNameFromToken)(mdToken, MDUTF8CSTR*) { return E_NOTIMPL; }
+    STDMETHOD(EnumUnresolvedMethods)(HCORENUM*, mdToken[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetUserString)(mdString, LPWSTR, ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetPinvokeMap)(mdToken, DWORD*, LPWSTR, ULONG, ULONG*, mdModuleRef*) { return E_NOTIMPL; }
+    STDMETHOD(EnumSignatures)(HCORENUM*, mdSignature[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumTypeSpecs)(HCORENUM*, mdTypeSpec[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumUserStrings)(HCORENUM*, mdString[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetParamForMethodIndex)(mdMethodDef, ULONG, mdParamDef*) { return E_NOTIMPL; }
+    STDMETHOD(EnumCustomAttributes)(HCORENUM*, mdToken, mdToken, mdCustomAttribute[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetCustomAttributeProps)(mdCustomAttribute, mdToken*, mdToken*, void const**, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(FindTypeRef)(mdToken, LPCWSTR, mdTypeRef*) { return E_NOTIMPL; }
+    STDMETHOD(GetMemberProps)(mdToken, mdTypeDef*, LPWSTR, ULONG, ULONG*, DWORD*, PCCOR_SIGNATURE*, ULONG*,
+        ULONG*, DWORD*, DWORD*, UVCP_CONSTANT*, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetFieldProps)(mdFieldDef, mdTypeDef*, LPWSTR, ULONG, ULONG*, DWORD*, PCCOR_SIGNATURE*, ULONG*,
+        DWORD*, UVCP_CONSTANT*, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetPropertyProps)(mdProperty, mdTypeDef*, LPCWSTR, ULONG, ULONG*, DWORD*, PCCOR_SIGNATURE*,
+        ULONG*, DWORD*, UVCP_CONSTANT*, ULONG*, mdMethodDef*, mdMethodDef*, mdMethodDef[], ULONG,
+        ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetParamProps)(mdParamDef, mdMethodDef*, ULONG*, LPWSTR, ULONG, ULONG*, DWORD*, DWORD*,
+        UVCP_CONSTANT*, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetCustomAttributeByName)(mdToken, LPCWSTR, const void**, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetNativeCallConvFromSig)(void const*, ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(IsGlobal)(mdToken, int*) { return E_NOTIMPL; }
+
+    // IMetaDataImport2
+    STDMETHOD(GetMethodSpecProps)(mdMethodSpec mi, mdToken *tkParent, PCCOR_SIGNATURE *ppvSigBlob,
+        ULONG *pcbSigBlob);
+    STDMETHOD(EnumGenericParams)(HCORENUM*, mdToken, mdGenericParam[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetGenericParamProps)(mdGenericParam, ULONG*, DWORD*, mdToken*, DWORD*, LPWSTR, ULONG,
+        ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumGenericParamConstraints)(HCORENUM*, mdGenericParam, mdGenericParamConstraint[], ULONG,
+        ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetGenericParamConstraintProps)(mdGenericParamConstraint, mdGenericParam*, mdToken*) { return E_NOTIMPL; }
+    STDMETHOD(GetPEKind)(DWORD*, DWORD*) { return E_NOTIMPL; }
+    STDMETHOD(GetVersionString)(LPWSTR, DWORD, DWORD*) { return E_NOTIMPL; }
+    STDMETHOD(EnumMethodSpecs)(HCORENUM*, mdToken, mdMethodSpec[], ULONG, ULONG*) { return E_NOTIMPL; }
+
+    // IMetaDataEmit (Implemented Ones)
+    STDMETHOD(SetHandler)(IUnknown *pUnk);
+    STDMETHOD(DefineImportType)(IMetaDataAssemblyImport *pAssemImport, const void *pbHashValue, ULONG cbHashValue,
+        IMetaDataImport *pImport, mdTypeDef tdImport, IMetaDataAssemblyEmit *pAssemEmit, mdTypeRef *ptr);
+    STDMETHOD(DefineMemberRef)(mdToken tkImport, LPCWSTR szName, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob,
+        mdMemberRef *pmr);
+    STDMETHOD(DefineImportMember)(IMetaDataAssemblyImport *pAssemImport, const void *pbHashValue,
+        ULONG cbHashValue, IMetaDataImport *pImport, mdToken mbMember, IMetaDataAssemblyEmit *pAssemEmit,
+        mdToken tkParent, mdMemberRef *pmr);
+    STDMETHOD(GetTokenFromSig)(PCCOR_SIGNATURE pvSig, ULONG cbSig, mdSignature *pmsig);
+    STDMETHOD(GetTokenFromTypeSpec)(PCCOR_SIGNATURE pvSig, ULONG cbSig, mdTypeSpec *ptypespec);
+    STDMETHOD(SetMethodProps)(mdMethodDef md, DWORD dwMethodFlags, ULONG ulCodeRVA, DWORD dwImplFlags);
+
+    // IMetaDataEmit (Not Implemented Ones). Nothing is saved.
+    STDMETHOD(SetModuleProps)(LPCWSTR) { return E_NOTIMPL; }
+    STDMETHOD(Save)(LPCWSTR, DWORD) { return E_NOTIMPL; }
+    STDMETHOD(SaveToStream)(IStream*, DWORD) { return E_NOTIMPL; }
+    STDMETHOD(GetSaveSize)(CorSaveSize, DWORD*) { return E_NOTIMPL; }
+    STDMETHOD(DefineTypeDef)(LPCWSTR, DWORD, mdToken, mdToken[], mdTypeDef*) { return E_NOTIMPL; }
+    STDMETHOD(DefineNestedType)(LPCWSTR, DWORD, mdToken, mdToken[], mdTypeDef, mdTypeDef*) { return E_NOTIMPL; }
+    STDMETHOD(DefineMethod)(mdTypeDef, LPCWSTR, DWORD, PCCOR_SIGNATURE, ULONG, ULONG, DWORD, mdMethodDef*) { return E_NOTIMPL; }
+    STDMETHOD(DefineMethodImpl)(mdTypeDef, mdToken, mdToken) { return E_NOTIMPL; }
+    STDMETHOD(DefineTypeRefByName)(mdToken, LPCWSTR, mdTypeRef*) { return E_NOTIMPL; }
+    STDMETHOD(DefineEvent)(mdTypeDef, LPCWSTR, DWORD, mdToken, mdMethodDef, mdMethodDef, mdMethodDef,
+        mdMethodDef[], mdEvent*) { return E_NOTIMPL; }
+    STDMETHOD(SetClassLayout)(mdTypeDef, DWORD, COR_FIELD_OFFSET[], ULONG) { return E_NOTIMPL; }
+    STDMETHOD(DeleteClassLayout)(mdTypeDef) { return E_NOTIMPL; }
+    STDMETHOD(SetFieldMarshal)(mdToken, PCCOR_SIGNATURE, ULONG) { return E_NOTIMPL; }
+    STDMETHOD(DeleteFieldMarshal)(mdToken) { return E_NOTIMPL; }
+    STDMETHOD(DefinePermissionSet)(mdToken, DWORD, void const*, ULONG, mdPermission*) { return E_NOTIMPL; }
+    STDMETHOD(SetRVA)(mdMethodDef, ULONG) { return E_NOTIMPL; }
+    STDMETHOD(DefineModuleRef)(LPCWSTR, mdModuleRef*) { return E_NOTIMPL; }
+    STDMETHOD(SetParent)(mdMemberRef, mdToken) { return E_NOTIMPL; }
+    STDMETHOD(SaveToMemory)(void*, ULONG) { return E_NOTIMPL; }
+    STDMETHOD(DefineUserString)(LPCWSTR, ULONG, mdString*) { return E_NOTIMPL; }
+    STDMETHOD(DeleteToken)(mdToken) { return E_NOTIMPL; }
+    STDMETHOD(SetTypeDefProps)(mdTypeDef, DWORD, mdToken, mdToken[]) { return E_NOTIMPL; }
+    STDMETHOD(SetEventProps)(mdEvent, DWORD, mdToken, mdMethodDef, mdMethodDef, mdMethodDef, mdMethodDef[]) { return E_NOTIMPL; }
+    STDMETHOD(SetPermissionSetProps)(mdToken, DWORD, void const*, ULONG, mdPermission*) { return E_NOTIMPL; }
+    STDMETHOD(DefinePinvokeMap)(mdToken, DWORD, LPCWSTR, mdModuleRef) { return E_NOTIMPL; }
+    STDMETHOD(SetPinvokeMap)(mdToken, DWORD, LPCWSTR, mdModuleRef) { return E_NOTIMPL; }
+    STDMETHOD(DeletePinvokeMap)(mdToken) { return E_NOTIMPL; }
+    STDMETHOD(DefineCustomAttribute)(mdToken, mdToken, void const*, ULONG, mdCustomAttribute*) { return E_NOTIMPL; }
+    STDMETHOD(SetCustomAttributeValue)(mdCustomAttribute, void const*, ULONG) { return E_NOTIMPL; }
+    STDMETHOD(DefineField)(mdTypeDef, LPCWSTR, DWORD, PCCOR_SIGNATURE, ULONG, DWORD, void const*, ULONG,
+        mdFieldDef*) { return E_NOTIMPL; }
+    STDMETHOD(DefineProperty)(mdTypeDef, LPCWSTR, DWORD, PCCOR_SIGNATURE, ULONG, DWORD, void const*, ULONG,
+        mdMethodDef, mdMethodDef, mdMethodDef[], mdProperty*) { return E_NOTIMPL; }
+    STDMETHOD(DefineParam)(mdMethodDef, ULONG, LPCWSTR, DWORD, DWORD, void const*, ULONG, mdParamDef*) { return E_NOTIMPL; }
+    STDMETHOD(SetFieldProps)(mdFieldDef, DWORD, DWORD, void const*, ULONG) { return E_NOTIMPL; }
+    STDMETHOD(SetPropertyProps)(mdProperty, DWORD, DWORD, void const*, ULONG, mdMethodDef, mdMethodDef,
+        mdMethodDef[]) { return E_NOTIMPL; }
+    STDMETHOD(SetParamProps)(mdParamDef, LPCWSTR, DWORD, DWORD, void const*, ULONG) { return E_NOTIMPL; }
+    STDMETHOD(DefineSecurityAttributeSet)(mdToken, COR_SECATTR[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(ApplyEditAndContinue)(IUnknown*) { return E_NOTIMPL; }
+    STDMETHOD(TranslateSigWithScope)(IMetaDataAssemblyImport*, const void*, ULONG, IMetaDataImport*,
+        PCCOR_SIGNATURE, ULONG, IMetaDataAssemblyEmit*, IMetaDataEmit*, PCOR_SIGNATURE, ULONG,
+        ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(SetMethodImplFlags)(mdMethodDef, DWORD) { return E_NOTIMPL; }
+    STDMETHOD(SetFieldRVA)(mdFieldDef, ULONG) { return E_NOTIMPL; }
+    STDMETHOD(Merge)(IMetaDataImport*, IMapToken*, IUnknown*) { return E_NOTIMPL; }
+    STDMETHOD(MergeEnd)(void) { return E_NOTIMPL; }
+
+    // IMetaDataEmit2
+    STDMETHOD(DefineMethodSpec)(mdToken tkParent, PCCOR_SIGNATURE pvSigBlob, ULONG cbSigBlob, mdMethodSpec *pmi);
+    STDMETHOD(GetDeltaSaveSize)(CorSaveSize, DWORD*) { return E_NOTIMPL; }
+    STDMETHOD(SaveDelta)(LPCWSTR, DWORD) { return E_NOTIMPL; }
+    STDMETHOD(SaveDeltaToStream)(IStream*, DWORD) { return E_NOTIMPL; }
+    STDMETHOD(SaveDeltaToMemory)(void*, ULONG) { return E_NOTIMPL; }
+    STDMETHOD(DefineGenericParam)(mdToken, ULONG, DWORD, LPCWSTR, DWORD, mdToken[], mdGenericParam*) { return E_NOTIMPL; }
+    STDMETHOD(SetGenericParamProps)(mdGenericParam, DWORD, LPCWSTR, DWORD, mdToken[]) { return E_NOTIMPL; }
+    STDMETHOD(ResetENCLog)(void) { return E_NOTIMPL; }
+
+    // IMetaDataAssemblyImport (Implemented Ones). CloseEnum is shared with IMetaDataImport.
+    STDMETHOD(GetAssemblyFromScope)(mdAssembly *ptkAssembly);
+    STDMETHOD(FindAssembliesByName)(LPCWSTR szAppBase, LPCWSTR szPrivateBin, LPCWSTR szAssemblyName,
+        IUnknown *ppIUnk[], ULONG cMax, ULONG *pcAssemblies);
+
+    // IMetaDataAssemblyImport (Not Implemented Ones)
+    STDMETHOD(GetAssemblyProps)(mdAssembly, const void**, ULONG*, ULONG*, LPWSTR, ULONG, ULONG*,
+        ASSEMBLYMETADATA*, DWORD*) { return E_NOTIMPL; }
+    STDMETHOD(GetAssemblyRefProps)(mdAssemblyRef, const void**, ULONG*, LPWSTR, ULONG, ULONG*,
+        ASSEMBLYMETADATA*, const void**, ULONG*, DWORD*) { return E_NOTIMPL; }
+    STDMETHOD(GetFileProps)(mdFile, LPWSTR, ULONG, ULONG*, const void**, ULONG*, DWORD*) { return E_NOTIMPL; }
+    STDMETHOD(GetExportedTypeProps)(mdExportedType, LPWSTR, ULONG, ULONG*, mdToken*, mdTypeDef*, DWORD*) { return E_NOTIMPL; }
+    STDMETHOD(GetManifestResourceProps)(mdManifestResource, LPWSTR, ULONG, ULONG*, mdToken*, DWORD*, DWORD*) { return E_NOTIMPL; }
+    STDMETHOD(EnumAssemblyRefs)(HCORENUM*, mdAssemblyRef[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumFiles)(HCORENUM*, mdFile[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumExportedTypes)(HCORENUM*, mdExportedType[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(EnumManifestResources)(HCORENUM*, mdManifestResource[], ULONG, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(FindExportedTypeByName)(LPCWSTR, mdToken, mdExportedType*) { return E_NOTIMPL; }
+    STDMETHOD(FindManifestResourceByName)(LPCWSTR, mdManifestResource*) { return E_NOTIMPL; }
+
+    // IMetaDataAssemblyEmit. The engine only passes it to DefineImportType and DefineImportMember.
+    STDMETHOD(DefineAssembly)(const void*, ULONG, ULONG, LPCWSTR, const ASSEMBLYMETADATA*, DWORD, mdAssembly*) { return E_NOTIMPL; }
+    STDMETHOD(DefineAssemblyRef)(const void*, ULONG, LPCWSTR, const ASSEMBLYMETADATA*, const void*, ULONG,
+        DWORD, mdAssemblyRef*) { return E_NOTIMPL; }
+    STDMETHOD(DefineFile)(LPCWSTR, const void*, ULONG, DWORD, mdFile*) { return E_NOTIMPL; }
+    STDMETHOD(DefineExportedType)(LPCWSTR, mdToken, mdTypeDef, DWORD, mdExportedType*) { return E_NOTIMPL; }
+    STDMETHOD(DefineManifestResource)(LPCWSTR, mdToken, DWORD, DWORD, mdManifestResource*) { return E_NOTIMPL; }
+    STDMETHOD(SetAssemblyProps)(mdAssembly, const void*, ULONG, ULONG, LPCWSTR, const ASSEMBLYMETADATA*, DWORD) { return E_NOTIMPL; }
+    STDMETHOD(SetAssemblyRefProps)(mdAssemblyRef, const void*, ULONG, LPCWSTR, const ASSEMBLYMETADATA*,
+        const void*, ULONG, DWORD) { return E_NOTIMPL; }
+    STDMETHOD(SetFileProps)(mdFile, const void*, ULONG, DWORD) { return E_NOTIMPL; }
+    STDMETHOD(SetExportedTypeProps)(mdExportedType, mdToken, mdTypeDef, DWORD) { return E_NOTIMPL; }
+    STDMETHOD(SetManifestResourceProps)(mdManifestResource, mdToken, DWORD, DWORD) { return E_NOTIMPL; }
+
+private:
+    // Metadata tables of ECMA-335 II.22, numbered as the token types
+    static const ULONG TABLE_COUNT = 0x2D;
+    static const ULONG MAX_COLUMN_COUNT = 9;
+
+    struct TABLE
+    {
+        ULONG nRowCount;    // in the file
+        ULONG nRowSize;
+        LPCBYTE pRows;
+        BYTE vColumnOffsets[MAX_COLUMN_COUNT];
+        BYTE vColumnSizes[MAX_COLUMN_COUNT];
+    };
+
+    // A row emitted in memory. The fields used depend on the table, as for the rows of the file.
+    struct EMITTED_ROW
+    {
+        EMITTED_ROW(void) : tkParent(mdTokenNil), pBlob(NULL), nBlobSize(0), dwFlags(0)
+        {
+            ::memset(vVersion, 0, sizeof(vVersion));
+        }
+
+        mdToken tkParent;           // resolution scope, class or method
+        CStringA szName;            // UTF-8, as in the string heap
+        CStringA szNamespace;       // or culture of an assembly ref
+        LPCBYTE pBlob;              // signature, or public key of an assembly ref
+        ULONG nBlobSize;
+        WORD vVersion[4];
+        DWORD dwFlags;
+    };
+
+    struct ENUM_STATE
+    {
+        CAtlArray<mdToken> vTokens;
+        size_t nNext;
+    };
+
+    HRESULT ReadTables(LPCBYTE pMetadata, ULONG nMetadataSize);
+    LPCBYTE GetImageData(DWORD nRva, ULONG &rnSize) const;
+    ULONG GetColumnSize(BYTE nColumnType) const;
+    ULONG ReadColumn(ULONG nTable, ULONG nRow, ULONG nColumn) const;
+    mdToken ReadToken(ULONG nTable, ULONG nRow, ULONG nColumn) const;
+    ULONG GetRowCount(ULONG nTable) const;
+    BOOL IsValidRow(mdToken tk) const;
+    const EMITTED_ROW* GetEmittedRow(mdToken tk) const;
+
+    // Fields of a row of the file or emitted, by their role in the table
+    mdToken GetParent(mdToken tk) const;
+    LPCSTR GetName(mdToken tk) const;
+    LPCSTR GetNamespace(mdToken tk) const;
+    PCCOR_SIGNATURE GetBlob(mdToken tk, ULONG &rnSize) const;
+
+    mdToken FindRow(ULONG nTable, mdToken tkParent, LPCSTR pstrName, LPCSTR pstrNamespace,
+        PCCOR_SIGNATURE pvBlob, ULONG nBlobSize) const;
+    mdToken EmitRow(ULONG nTable, const EMITTED_ROW &rxRow, PCCOR_SIGNATURE pvBlob, ULONG nBlobSize);
+    mdToken DefineRow(ULONG nTable, const EMITTED_ROW &rxRow, PCCOR_SIGNATURE pvBlob, ULONG nBlobSize);
+    LPCSTR GetAssemblyName(void) const;
+    mdTypeDef GetEnclosingClass(mdTypeDef td) const;
+    mdTypeDef GetMethodClass(mdMethodDef md) const;
+    void GetMethodRange(mdTypeDef td, ULONG &rnFirst, ULONG &rnEnd) const;
+
+    // Copy of tokens and signatures of another snapshot into this one
+    HRESULT ImportAssemblyRef(const CMetadataSnapshot &rxSource, mdToken tkScope, mdToken &rtkScope);
+    HRESULT ImportTypeRef(const CMetadataSnapshot &rxSource, mdToken tkType, mdToken &rtkType);
+    HRESULT ImportTypeToken(const CMetadataSnapshot &rxSource, PCCOR_SIGNATURE &rpvSig, PCCOR_SIGNATURE pvSigEnd,
+        CAtlArray<BYTE> &rvTarget);
+    HRESULT ImportType(const CMetadataSnapshot &rxSource, PCCOR_SIGNATURE &rpvSig, PCCOR_SIGNATURE pvSigEnd,
+        CAtlArray<BYTE> &rvTarget);
+    HRESULT ImportMemberSignature(const CMetadataSnapshot &rxSource, PCCOR_SIGNATURE &rpvSig,
+        PCCOR_SIGNATURE pvSigEnd, CAtlArray<BYTE> &rvTarget);
+
+    static CMetadataSnapshot* FromUnknown(IUnknown *pUnknown);
+    static HRESULT EnumTokens(HCORENUM *phEnum, mdToken rTokens[], ULONG cMax, ULONG *pcTokens);
+    static HRESULT CopyName(LPCSTR pstrUtf8Name, LPWSTR szName, ULONG cchName, ULONG *pchName);
+
+private:
+    CAtlFile m_xFile;
+    CAtlFileMapping<BYTE> m_xMapping;
+    LPCBYTE m_pImage;
+    ULONGLONG m_nImageSize;
+    const IMAGE_SECTION_HEADER *m_pSections;
+    WORD m_nSectionCount;
+
+    LPCBYTE m_pStrings;
+    ULONG m_nStringsSize;
+    LPCBYTE m_pGuids;
+    ULONG m_nGuidsSize;
+    LPCBYTE m_pBlobs;
+    ULONG m_nBlobsSize;
+    BYTE m_nHeapSizes;
+    TABLE m_vTables[TABLE_COUNT];
+
+    CAtlArray<EMITTED_ROW> m_vEmittedRows[TABLE_COUNT];
+    CAtlArray<LPBYTE> m_vpEmittedBlobs;            // owned, so that blobs handed out stay put
+    CAtlMap<mdMethodDef, ULONG> m_mapCodeRvas;     // set by SetMethodProps
+    CAtlArray<CMetadataSnapshot*> m_vpReferences;
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
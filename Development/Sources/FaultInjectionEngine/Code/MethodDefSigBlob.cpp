@@ -14,3 +14,14 @@ PCCOR_SIGNATURE CMethodDefSigBlob::LocateReturnType() const
     GetParamCountFromMethodSig(pSignature);
     return pSignature;
 }
+
+PCCOR_SIGNATURE CMethodDefSigBlob::LocateParameters(ULONG &rnParamCount) const
+{
+    PCCOR_SIGNATURE pSignature = RefSignature();
+    rnParamCount = GetParamCountFromMethodSig(pSignature);
+    if(!ParseRetTypeSig(pSignature))
+    {
+        return NULL;
+    }
+    return pSignature;
+}
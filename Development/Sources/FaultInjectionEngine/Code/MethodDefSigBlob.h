@@ -17,6 +17,7 @@ public:
 
 public:
     PCCOR_SIGNATURE LocateReturnType() const;
+    PCCOR_SIGNATURE LocateParameters(ULONG &rnParamCount) const;
 };
 
 END_DEFAULT_NAMESPACE
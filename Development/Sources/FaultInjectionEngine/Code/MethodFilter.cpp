@@ -0,0 +1,264 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include "MethodFilter.h"
+#include "TraceAndLog.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Implementation of CMethodFilter
+
+ULONGLONG CMethodFilter::SplitParameterList(CString &rszMethodName)
+{
+    int nParenthesis = rszMethodName.Find(_T('('));
+    if(0 > nParenthesis)
+    {
+        return 0;
+    }
+
+    CString szParameters = rszMethodName.Mid(nParenthesis + 1);
+    szParameters.TrimRight();
+    if(!szParameters.IsEmpty() && (_T(')') == szParameters[szParameters.GetLength() - 1]))
+    {
+        szParameters.Truncate(szParameters.GetLength() - 1);
+    }
+    rszMethodName.Truncate(nParenthesis);
+    rszMethodName.TrimRight();
+
+    ULONGLONG nSignatureHash = HashCanonicalParameters(szParameters);
+    if((0 == nSignatureHash) && !rszMethodName.IsEmpty())
+    {
+        EventReportWarning(IDS_REPORT_UNHASHABLE_PARAMETER_LIST, rszMethodName, szParameters);
+    }
+    return nSignatureHash;
+}
+
+ULONGLONG CMethodFilter::HashCanonicalParameters(LPCTSTR pstrParameters)
+{
+    ASSERT(NULL != pstrParameters);
+
+    CString szParameters;
+    for(LPCTSTR pChar = pstrParameters; _T('\0') != *pChar; pChar++)
+    {
+        if(!_istspace(*pChar))
+        {
+            szParameters += *pChar;
+        }
+    }
+
+    // Same canonical form as CMetadataModule::HashCanonicalParameters. An empty list is a method
+    // without parameters.
+    CCanonicalSigHash xHash;
+    LPCTSTR pstrNext = szParameters;
+    while(_T('\0') != *pstrNext)
+    {
+        if(!HashCanonicalType(pstrNext, xHash))
+        {
+            return 0;
+        }
+        if(_T('&') == *pstrNext)
+        {
+            xHash.AddElementType(ELEMENT_TYPE_BYREF);
+            pstrNext++;
+        }
+        xHash.AddElementType(ELEMENT_TYPE_SENTINEL);
+
+        if(_T(',') == *pstrNext)
+        {
+            pstrNext++;
+            if(_T('\0') == *pstrNext)
+            {
+                return 0;
+            }
+        }
+        else if(_T('\0') != *pstrNext)
+        {
+            return 0;
+        }
+    }
+    return xHash.GetHash();
+}
+
+BOOL CMethodFilter::HashCanonicalType(LPCTSTR &rpstrParameters, CCanonicalSigHash &rxHash)
+{
+    // The type name, up to its generic arguments, its array suffixes or the next parameter. Names
+    // without namespace are type parameters, which a method signature does not name.
+    int nLength = (int)_tcscspn(rpstrParameters, _T("<>,[]&"));
+    CString szTypeName(rpstrParameters, nLength);
+    rpstrParameters += nLength;
+    if((0 > szTypeName.Find(_T('.'))) || (0 <= szTypeName.FindOneOf(_T("*!`"))))
+    {
+        return FALSE;
+    }
+
+    if(_T('<') == *rpstrParameters)
+    {
+        rxHash.AddElementType(ELEMENT_TYPE_GENERICINST);
+        rxHash.AddTypeName(szTypeName, szTypeName.GetLength());
+        do
+        {
+            rpstrParameters++;
+            if(!HashCanonicalType(rpstrParameters, rxHash))
+            {
+                return FALSE;
+            }
+        }
+        while(_T(',') == *rpstrParameters);
+        if(_T('>') != *rpstrParameters)
+        {
+            return FALSE;
+        }
+        rpstrParameters++;
+        rxHash.AddElementType(ELEMENT_TYPE_END);
+    }
+    else
+    {
+        CorElementType nPrimitiveType = CSignatureBlob::FindPrimitiveType(szTypeName);
+        if(ELEMENT_TYPE_END != nPrimitiveType)
+        {
+            rxHash.AddElementType(nPrimitiveType);
+        }
+        else
+        {
+            rxHash.AddElementType(ELEMENT_TYPE_CLASS);
+            rxHash.AddTypeName(szTypeName, szTypeName.GetLength());
+        }
+    }
+
+    // Array suffixes name the outer array first, as in C#: "System.Int32[][,]" is a vector of
+    // arrays of rank 2. The signature names it first as well, so the suffixes are added last.
+    CAtlArray<BYTE> vnRanks;
+    while(_T('[') == *rpstrParameters)
+    {
+        BYTE nRank = 1;
+        for(rpstrParameters++; _T(',') == *rpstrParameters; rpstrParameters++)
+        {
+            if(MAXBYTE == nRank)
+            {
+                return FALSE;
+            }
+            nRank++;
+        }
+        if(_T(']') != *rpstrParameters)
+        {
+            return FALSE;
+        }
+        rpstrParameters++;
+        vnRanks.Add(nRank);
+    }
+    for(size_t i = vnRanks.GetCount(); 0 < i; i--)
+    {
+        if(1 == vnRanks[i - 1])
+        {
+            rxHash.AddElementType(ELEMENT_TYPE_SZARRAY);
+        }
+        else
+        {
+            rxHash.AddElementType(ELEMENT_TYPE_ARRAY);
+            rxHash.AddByte(vnRanks[i - 1]);
+        }
+    }
+    return TRUE;
+}
+
+BOOL CMethodFilter::Selects(ULONGLONG nLineHash, ULONGLONG nMethodHash)
+{
+    return (0 == nLineHash) || ((0 != nMethodHash) && (nLineHash == nMethodHash));
+}
+
+size_t CMethodFilter::Add(const CString &rszMethodName, ULONGLONG nSignatureHash)
+{
+    size_t nIndex = this->m_vszMethodNames.Add(rszMethodName);
+    this->m_vnSignatureHashes.Add(nSignatureHash);
+    this->m_vnNextLines.Add(NO_LINE);
+
+    // Chain the line after the last one with the same name, so lines are found in file order.
+    const CAtlMap<CString, size_t, CStringElementTraits<CString> >::CPair *pxPair =
+        this->m_mapFirstLines.Lookup(rszMethodName);
+    if(NULL == pxPair)
+    {
+        this->m_mapFirstLines.SetAt(rszMethodName, nIndex);
+        return nIndex;
+    }
+    size_t nLine = pxPair->m_value;
+    while(NO_LINE != this->m_vnNextLines[nLine])
+    {
+        nLine = this->m_vnNextLines[nLine];
+    }
+    this->m_vnNextLines[nLine] = nIndex;
+    return nIndex;
+}
+
+void CMethodFilter::Copy(const CMethodFilter &rxMethodFilter)
+{
+    this->RemoveAll();
+    for(size_t i = 0; i < rxMethodFilter.GetCount(); i++)
+    {
+        this->Add(rxMethodFilter.m_vszMethodNames[i], rxMethodFilter.m_vnSignatureHashes[i]);
+    }
+}
+
+void CMethodFilter::RemoveAll(void)
+{
+    this->m_vszMethodNames.RemoveAll();
+    this->m_vnSignatureHashes.RemoveAll();
+    this->m_vnNextLines.RemoveAll();
+    this->m_mapFirstLines.RemoveAll();
+}
+
+size_t CMethodFilter::GetCount(void) const
+{
+    return this->m_vszMethodNames.GetCount();
+}
+
+const CAtlArray<CString>& CMethodFilter::GetMethodNames(void) const
+{
+    return this->m_vszMethodNames;
+}
+
+const CAtlArray<ULONGLONG>& CMethodFilter::GetSignatureHashes(void) const
+{
+    return this->m_vnSignatureHashes;
+}
+
+int CMethodFilter::Find(const CString &rszFullQualifiedMethodName, ULONGLONG nSignatureHash,
+                        ULONG *pnComparisonCount) const
+{
+    const CAtlMap<CString, size_t, CStringElementTraits<CString> >::CPair *pxPair =
+        this->m_mapFirstLines.Lookup(rszFullQualifiedMethodName);
+    for(size_t nLine = (NULL == pxPair) ? NO_LINE : pxPair->m_value; NO_LINE != nLine;
+        nLine = this->m_vnNextLines[nLine])
+    {
+        if(NULL != pnComparisonCount)
+        {
+            (*pnComparisonCount)++;
+        }
+        if(Selects(this->m_vnSignatureHashes[nLine], nSignatureHash))
+        {
+            return (int)nLine;
+        }
+    }
+    return -1;
+}
+
+#pragma endregion
+
+#if defined(FAULT_ENGINE_TEST_EXPORTS)
+
+#pragma region Exported Functions (Called by Tests)
+
+extern "C" ULONGLONG WINAPI FaultEngineHashCanonicalParameters(LPCWSTR pstrParameters)
+{
+    if(NULL == pstrParameters)
+    {
+        return 0;
+    }
+    return CMethodFilter::HashCanonicalParameters(CW2CT(pstrParameters));
+}
+
+#pragma endregion
+
+#endif // FAULT_ENGINE_TEST_EXPORTS
@@ -0,0 +1,84 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  Declaration of class CMethodFilter.
+//  The lines of the method filter which trap methods: the full-qualified name of a method and
+//  the hash of its parameter types, or 0 for all overloads of the name. Lines are kept in file
+//  order, and chained per name behind a map, so a method compiled is looked up by its name
+//  once, then by comparing the hash of its parameter types with the lines of that name only.
+//  Both hashes are taken over the same canonical form (see CCanonicalSigHash): the parameter
+//  list of a line when the filter is loaded, and the signature of a method when it is named.
+//
+
+#pragma once
+
+#include "SignatureBlob.h"
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Declaration of CMethodFilter
+
+class CMethodFilter
+{
+public:
+    CMethodFilter(void) {};
+    ~CMethodFilter(void) {};
+
+public:
+    /// <summary>
+    /// Remove the parameter list from a name of the method filter, e.g. "Type.Method(System.Int32)",
+    /// and return its hash, which selects one overload. Return 0 if there is none: all overloads.
+    /// A list which can not be hashed is reported, and selects all overloads as well.
+    /// </summary>
+    static ULONGLONG SplitParameterList(CString &rszMethodName);
+
+    /// <summary>
+    /// Hash the parameter types of a line, named as in the formal signature of a fault rule, e.g.
+    /// "System.Int32, System.String&, System.Int32[]". White space is ignored. Return 0 if a type
+    /// can not be named by a method signature (e.g. a generic parameter or a pointer).
+    /// </summary>
+    static ULONGLONG HashCanonicalParameters(LPCTSTR pstrParameters);
+
+    /// <summary>
+    /// See if a line whose parameter types hash as nLineHash selects a method of the same name
+    /// whose parameter types hash as nMethodHash. A line without parameter list selects every
+    /// overload, and a method which can not be hashed is only selected by such lines.
+    /// </summary>
+    static BOOL Selects(ULONGLONG nLineHash, ULONGLONG nMethodHash);
+
+    /// <summary>
+    /// Add a line after the others, and return its index.
+    /// </summary>
+    size_t Add(const CString &rszMethodName, ULONGLONG nSignatureHash);
+    void Copy(const CMethodFilter &rxMethodFilter);
+    void RemoveAll(void);
+    size_t GetCount(void) const;
+    const CAtlArray<CString>& GetMethodNames(void) const;
+    const CAtlArray<ULONGLONG>& GetSignatureHashes(void) const;
+
+    /// <summary>
+    /// Find the first line which selects a method, by its full qualified name and the hash of its
+    /// parameter types. Return its index, or -1 if there is none. Also count the lines whose
+    /// hashes were compared, all of them with the name of the method.
+    /// </summary>
+    int Find(const CString &rszFullQualifiedMethodName, ULONGLONG nSignatureHash,
+        ULONG *pnComparisonCount = NULL) const;
+
+private:
+    static BOOL HashCanonicalType(LPCTSTR &rpstrParameters, CCanonicalSigHash &rxHash);
+
+private:
+    CAtlArray<CString> m_vszMethodNames;  // name of each line, in file order
+    CAtlArray<ULONGLONG> m_vnSignatureHashes;  // parameter types of each line, 0 for all overloads
+    CAtlArray<size_t> m_vnNextLines;  // next line with the same name, NO_LINE for the last one
+    CAtlMap<CString, size_t, CStringElementTraits<CString> > m_mapFirstLines;  // first line of each name
+
+    static const size_t NO_LINE = (size_t)-1;
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
@@ -0,0 +1,153 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include "OfflineProfilerInfo.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Implementation of COfflineProfilerInfo
+
+COfflineProfilerInfo::COfflineProfilerInfo(IUnknown *pMetaDataScope, LPCBYTE pImage, ULONGLONG nImageSize,
+                                           const IMAGE_SECTION_HEADER *pSections, WORD nSectionCount)
+{
+    ASSERT(NULL != pMetaDataScope);
+    ASSERT(NULL != pImage);
+    ASSERT(NULL != pSections);
+
+    this->m_pMetaDataScope = pMetaDataScope;
+    this->m_pImage = pImage;
+    this->m_nImageSize = nImageSize;
+    this->m_pSections = pSections;
+    this->m_nSectionCount = nSectionCount;
+}
+
+COfflineProfilerInfo::~COfflineProfilerInfo(void)
+{
+    POSITION pos = this->m_mapAllocations.GetStartPosition();
+    while(NULL != pos)
+    {
+        delete[] const_cast<LPBYTE>(this->m_mapAllocations.GetNextKey(pos));
+    }
+}
+
+LPCBYTE COfflineProfilerInfo::GetImageData(DWORD nRva, ULONG *pnSize) const
+{
+    for(WORD i = 0; i < this->m_nSectionCount; i++)
+    {
+        const IMAGE_SECTION_HEADER &rxSection = this->m_pSections[i];
+        if((nRva < rxSection.VirtualAddress) || (nRva - rxSection.VirtualAddress >= rxSection.SizeOfRawData))
+        {
+            continue;
+        }
+        ULONGLONG nOffset = (ULONGLONG)rxSection.PointerToRawData + (nRva - rxSection.VirtualAddress);
+        ULONGLONG nEnd = (ULONGLONG)rxSection.PointerToRawData + rxSection.SizeOfRawData;
+        if(nEnd > this->m_nImageSize)
+        {
+            return NULL;    // truncated file
+        }
+        if(NULL != pnSize)
+        {
+            *pnSize = (ULONG)(nEnd - nOffset);
+        }
+        return this->m_pImage + nOffset;
+    }
+    return NULL;
+}
+
+const CMemoryRef COfflineProfilerInfo::GetNewBody(size_t i) const
+{
+    LPCBYTE pBody = this->m_vNewBodies[i].pBody;
+    ULONG nSize = 0;
+    this->m_mapAllocations.Lookup(pBody, nSize);
+    return CMemoryRef(pBody, nSize);
+}
+
+STDMETHODIMP COfflineProfilerInfo::QueryInterface(REFIID riid, void **ppvObject)
+{
+    if(NULL == ppvObject)
+    {
+        return E_POINTER;
+    }
+    if(::InlineIsEqualGUID(riid, IID_IUnknown) || ::InlineIsEqualGUID(riid, IID_ICorProfilerInfo))
+    {
+        *ppvObject = static_cast<ICorProfilerInfo*>(this);
+        return S_OK;
+    }
+    if(::InlineIsEqualGUID(riid, IID_IMethodMalloc))
+    {
+        *ppvObject = static_cast<IMethodMalloc*>(this);
+        return S_OK;
+    }
+    *ppvObject = NULL;
+    return E_NOINTERFACE;
+}
+
+STDMETHODIMP_(PVOID) COfflineProfilerInfo::Alloc(ULONG cb)
+{
+    // Bodies get their RVA when the rewriter lays out the new section, so any memory will do.
+    LPBYTE pBlock = new(std::nothrow) BYTE[cb];
+    if(NULL != pBlock)
+    {
+        this->m_mapAllocations.SetAt(pBlock, cb);
+    }
+    return pBlock;
+}
+
+STDMETHODIMP COfflineProfilerInfo::GetModuleMetaData(ModuleID /*moduleId*/, DWORD /*dwOpenFlags*/, REFIID riid,
+                                                     IUnknown **ppOut)
+{
+    // The scope is opened for writing, so it serves all the interfaces asked for.
+    return this->m_pMetaDataScope->QueryInterface(riid, reinterpret_cast<void**>(ppOut));
+}
+
+STDMETHODIMP COfflineProfilerInfo::GetILFunctionBody(ModuleID /*moduleId*/, mdMethodDef methodId,
+                                                     LPCBYTE *ppMethodHeader, ULONG *pcbMethodSize)
+{
+    if((NULL == ppMethodHeader) || (NULL == pcbMethodSize))
+    {
+        return E_POINTER;
+    }
+    CComQIPtr<IMetaDataImport> pMetaDataImport = this->m_pMetaDataScope;
+    ULONG nCodeRva = 0;
+    HRESULT hr = pMetaDataImport->GetMethodProps(methodId, NULL, NULL, 0, NULL, NULL, NULL, NULL, &nCodeRva, NULL);
+    if(FAILED(hr))
+    {
+        return hr;
+    }
+    if(0 == nCodeRva)
+    {
+        return CORPROF_E_FUNCTION_NOT_IL;   // abstract, P/Invoke or runtime-implemented method
+    }
+
+    // The header tells the size of the body; the runtime reports the rest of the image as well.
+    *ppMethodHeader = this->GetImageData(nCodeRva, pcbMethodSize);
+    return (NULL == *ppMethodHeader) ? COR_E_BADIMAGEFORMAT : S_OK;
+}
+
+STDMETHODIMP COfflineProfilerInfo::GetILFunctionBodyAllocator(ModuleID /*moduleId*/, IMethodMalloc **ppMalloc)
+{
+    if(NULL == ppMalloc)
+    {
+        return E_POINTER;
+    }
+    *ppMalloc = static_cast<IMethodMalloc*>(this);
+    return S_OK;
+}
+
+STDMETHODIMP COfflineProfilerInfo::SetILFunctionBody(ModuleID /*moduleId*/, mdMethodDef methodid,
+                                                     LPCBYTE pbNewILMethodHeader)
+{
+    ULONG nSize;
+    if(!this->m_mapAllocations.Lookup(pbNewILMethodHeader, nSize))
+    {
+        return E_INVALIDARG;    // not from the allocator
+    }
+    NEW_BODY xNewBody = {methodid, pbNewILMethodHeader};
+    this->m_vNewBodies.Add(xNewBody);
+    return S_OK;
+}
+
+#pragma endregion
@@ -0,0 +1,111 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  Declaration of class COfflineProfilerInfo.
+//  CMetadataModule reads and writes a module through ICorProfilerInfo. When an assembly is
+//  rewritten on disk there is no runtime, so this class answers the few calls it makes for one
+//  assembly mapped into memory: the metadata comes from a scope opened by the metadata
+//  dispenser, method bodies are read from the image by their RVA, and new bodies are kept in
+//  memory until the rewriter lays them out in the output file.
+//
+
+#pragma once
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Declaration of COfflineProfilerInfo
+
+class COfflineProfilerInfo : public ICorProfilerInfo, public IMethodMalloc
+{
+public:
+    /// <summary>
+    /// Serve the assembly mapped at pImage, with its section headers, and the metadata scope
+    /// opened on the same file. All must outlive this object.
+    /// </summary>
+    COfflineProfilerInfo(IUnknown *pMetaDataScope, LPCBYTE pImage, ULONGLONG nImageSize,
+        const IMAGE_SECTION_HEADER *pSections, WORD nSectionCount);
+    ~COfflineProfilerInfo(void);
+
+    /// <summary>
+    /// Get the data at a relative virtual address of the image, and how many bytes of its
+    /// section follow it. Return NULL if the address is not backed by the file.
+    /// </summary>
+    LPCBYTE GetImageData(DWORD nRva, ULONG *pnSize = NULL) const;
+
+    /// <summary>
+    /// Get the number of method bodies set, and each method with its body.
+    /// </summary>
+    size_t GetNewBodyCount(void) const { return this->m_vNewBodies.GetCount(); }
+    mdMethodDef GetNewBodyMethod(size_t i) const { return this->m_vNewBodies[i].tkMethodDef; }
+    const CMemoryRef GetNewBody(size_t i) const;
+
+public:
+    // IUnknown. The object lives on the stack of the rewriter, so references are not counted.
+    STDMETHOD(QueryInterface)(REFIID riid, void **ppvObject);
+    STDMETHOD_(ULONG, AddRef)(void) { return 1; }
+    STDMETHOD_(ULONG, Release)(void) { return 1; }
+
+    // IMethodMalloc
+    STDMETHOD_(PVOID, Alloc)(ULONG cb);
+
+    // ICorProfilerInfo (Implemented Ones)
+    STDMETHOD(GetModuleMetaData)(ModuleID moduleId, DWORD dwOpenFlags, REFIID riid, IUnknown **ppOut);
+    STDMETHOD(GetILFunctionBody)(ModuleID moduleId, mdMethodDef methodId, LPCBYTE *ppMethodHeader,
+        ULONG *pcbMethodSize);
+    STDMETHOD(GetILFunctionBodyAllocator)(ModuleID moduleId, IMethodMalloc **ppMalloc);
+    STDMETHOD(SetILFunctionBody)(ModuleID moduleId, mdMethodDef methodid, LPCBYTE pbNewILMethodHeader);
+
+    // ICorProfilerInfo (Not Implemented Ones). Nothing runs, so there are no objects, classes
+    // or functions to ask about.
+    STDMETHOD(GetClassFromObject)(ObjectID, ClassID*) { return E_NOTIMPL; }
+    STDMETHOD(GetClassFromToken)(ModuleID, mdTypeDef, ClassID*) { return E_NOTIMPL; }
+    STDMETHOD(GetCodeInfo)(FunctionID, LPCBYTE*, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetEventMask)(DWORD*) { return E_NOTIMPL; }
+    STDMETHOD(GetFunctionFromIP)(LPCBYTE, FunctionID*) { return E_NOTIMPL; }
+    STDMETHOD(GetFunctionFromToken)(ModuleID, mdToken, FunctionID*) { return E_NOTIMPL; }
+    STDMETHOD(GetHandleFromThread)(ThreadID, HANDLE*) { return E_NOTIMPL; }
+    STDMETHOD(GetObjectSize)(ObjectID, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(IsArrayClass)(ClassID, CorElementType*, ClassID*, ULONG*) { return E_NOTIMPL; }
+    STDMETHOD(GetThreadInfo)(ThreadID, DWORD*) { return E_NOTIMPL; }
+    STDMETHOD(GetCurrentThreadID)(ThreadID*) { return E_NOTIMPL; }
+    STDMETHOD(GetClassIDInfo)(ClassID, ModuleID*, mdTypeDef*) { return E_NOTIMPL; }
+    STDMETHOD(GetFunctionInfo)(FunctionID, ClassID*, ModuleID*, mdToken*) { return E_NOTIMPL; }
+    STDMETHOD(SetEventMask)(DWORD) { return E_NOTIMPL; }
+    STDMETHOD(SetEnterLeaveFunctionHooks)(FunctionEnter*, FunctionLeave*, FunctionTailcall*) { return E_NOTIMPL; }
+    STDMETHOD(SetFunctionIDMapper)(FunctionIDMapper*) { return E_NOTIMPL; }
+    STDMETHOD(GetTokenAndMetaDataFromFunction)(FunctionID, REFIID, IUnknown**, mdToken*) { return E_NOTIMPL; }
+    STDMETHOD(GetModuleInfo)(ModuleID, LPCBYTE*, ULONG, ULONG*, WCHAR[], AssemblyID*) { return E_NOTIMPL; }
+    STDMETHOD(GetAppDomainInfo)(AppDomainID, ULONG, ULONG*, WCHAR[], ProcessID*) { return E_NOTIMPL; }
+    STDMETHOD(GetAssemblyInfo)(AssemblyID, ULONG, ULONG*, WCHAR[], AppDomainID*, ModuleID*) { return E_NOTIMPL; }
+    STDMETHOD(SetFunctionReJIT)(FunctionID) { return E_NOTIMPL; }
+    STDMETHOD(ForceGC)(void) { return E_NOTIMPL; }
+    STDMETHOD(SetILInstrumentedCodeMap)(FunctionID, BOOL, ULONG, COR_IL_MAP[]) { return E_NOTIMPL; }
+    STDMETHOD(GetInprocInspectionInterface)(IUnknown**) { return E_NOTIMPL; }
+    STDMETHOD(GetInprocInspectionIThisThread)(IUnknown**) { return E_NOTIMPL; }
+    STDMETHOD(GetThreadContext)(ThreadID, ContextID*) { return E_NOTIMPL; }
+    STDMETHOD(BeginInprocDebugging)(BOOL, DWORD*) { return E_NOTIMPL; }
+    STDMETHOD(EndInprocDebugging)(DWORD) { return E_NOTIMPL; }
+    STDMETHOD(GetILToNativeMapping)(FunctionID, ULONG32, ULONG32*, COR_DEBUG_IL_TO_NATIVE_MAP[]) { return E_NOTIMPL; }
+
+private:
+    struct NEW_BODY
+    {
+        mdMethodDef tkMethodDef;
+        LPCBYTE pBody;
+    };
+
+    CComPtr<IUnknown> m_pMetaDataScope;
+    LPCBYTE m_pImage;
+    ULONGLONG m_nImageSize;
+    const IMAGE_SECTION_HEADER *m_pSections;
+    WORD m_nSectionCount;
+    CAtlMap<LPCBYTE, ULONG> m_mapAllocations;   // every block from Alloc, with its size
+    CAtlArray<NEW_BODY> m_vNewBodies;           // in the order they are set
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
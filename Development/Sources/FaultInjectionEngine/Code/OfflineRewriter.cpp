@@ -0,0 +1,552 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include <atlfile.h>
+#include "MetadataModule.h"
+#include "MethodFilter.h"
+#include "OfflineProfilerInfo.h"
+#include "OfflineRewriter.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Helper Functions
+
+// Same name, as the rewritten assemblies replace the original ones in the output folder
+static CString CombineOutputPath(LPCTSTR pstrOutputFolder, const CString &rszAssemblyPath)
+{
+    int nOffset = max(rszAssemblyPath.ReverseFind(_T('\\')), rszAssemblyPath.ReverseFind(_T('/'))) + 1;
+    return CString(pstrOutputFolder) + _T("\\") + rszAssemblyPath.Mid(nOffset);
+}
+
+// The address of a header in the output image, which starts as a copy of the input image
+template<class T> static T* Relocate(const T *pInputHeader, LPCBYTE pInputImage, LPBYTE pOutputImage)
+{
+    return reinterpret_cast<T*>(pOutputImage + (reinterpret_cast<LPCBYTE>(pInputHeader) - pInputImage));
+}
+
+#pragma endregion
+
+#pragma region Implementation of COfflineRewriter
+
+BOOL COfflineRewriter::LoadMethodFilter(LPCTSTR pstrMethodFilterFile, CAtlArray<CString> &rvszMethodNames,
+                                         CAtlArray<ULONGLONG> &rvnSignatureHashes,
+                                         CAtlArray<CString> *pvszProtectedNames)
+{
+    CReadTextFile xMethodFilterFile;
+    xMethodFilterFile.Open(pstrMethodFilterFile);
+    if(!xMethodFilterFile.IsOpened())
+    {
+        EventReportError(IDS_REPORT_OPEN_METHOD_FILTER_FAILED, pstrMethodFilterFile);
+        return FALSE;
+    }
+
+    // Same format as read by the engine. The prologue calls the dispatcher, which applies the
+    // conditions and faults of the rules, so static faults and disarming do not apply here.
+    // Call sites are gated by the engine at JIT compilation only, their lines are skipped.
+    // Each line is kept once, a name with different parameter lists once per list.
+    rvszMethodNames.RemoveAll();
+    rvnSignatureHashes.RemoveAll();
+    if(NULL != pvszProtectedNames)
+    {
+        pvszProtectedNames->RemoveAll();
+    }
+    while(!xMethodFilterFile.IsEndOfFile())
+    {
+        CString szMethodName = xMethodFilterFile.ReadLine(PREFERRED_QUALIFIED_METHOD_NAME_LENGTH);
+        int nTab = szMethodName.Find(_T('\t'));
+        if(0 <= nTab)
+        {
+            if(nTab + 1 == szMethodName.Find(CSettings::GetCallerScopesPrefix(), nTab + 1))
+            {
+                continue;
+            }
+            szMethodName = szMethodName.Left(nTab);
+        }
+        szMethodName.Trim();
+        if(0 == szMethodName.Find(_T('#')))
+        {
+            szMethodName = szMethodName.Mid(1);
+        }
+        ULONGLONG nSignatureHash = CMethodFilter::SplitParameterList(szMethodName);
+        if(szMethodName.IsEmpty())
+        {
+            continue;
+        }
+        BOOL bListed = FALSE;
+        for(size_t i = 0; !bListed && (i < rvszMethodNames.GetCount()); i++)
+        {
+            bListed = (rvszMethodNames[i] == szMethodName) && (rvnSignatureHashes[i] == nSignatureHash);
+        }
+        if(bListed)
+        {
+            continue;
+        }
+
+        // Check if the method is in protected namespaces.
+        LPCTSTR pstrProtectedNamespace = CSettings::FindProtectedNamespace(szMethodName);
+        if(NULL != pstrProtectedNamespace)
+        {
+            EventReportWarning(IDS_REPORT_METHOD_INSIDE_PROTECTED_NAMESPACE, szMethodName, pstrProtectedNamespace);
+            if(NULL != pvszProtectedNames)
+            {
+                pvszProtectedNames->Add(szMethodName);
+            }
+        }
+        else
+        {
+            rvszMethodNames.Add(szMethodName);
+            rvnSignatureHashes.Add(nSignatureHash);
+        }
+    }
+    return TRUE;
+}
+
+ULONG COfflineRewriter::RewriteAssemblies(const CAtlArray<CString> &rvszAssemblyPaths, LPCTSTR pstrOutputFolder,
+                                          const CAtlArray<CString> &rvszMethodNames,
+                                          const CAtlArray<ULONGLONG> &rvnSignatureHashes)
+{
+    ASSERT(NULL != pstrOutputFolder);
+
+    REWRITE_JOB xJob = {&rvszAssemblyPaths, pstrOutputFolder, &rvszMethodNames, &rvnSignatureHashes, 0, 0};
+
+    // Assemblies are independent, so the threads only share the index of the next one.
+    SYSTEM_INFO xSystemInfo;
+    ::GetSystemInfo(&xSystemInfo);
+    size_t nThreadCount = min(min((size_t)xSystemInfo.dwNumberOfProcessors, (size_t)MAXIMUM_WAIT_OBJECTS),
+        rvszAssemblyPaths.GetCount());
+    CAtlArray<HANDLE> vhThreads;
+    for(size_t i = 0; i < nThreadCount; i++)
+    {
+        HANDLE hThread = ::CreateThread(NULL, 0, RewriteThreadProc, &xJob, 0, NULL);
+        if(NULL == hThread)
+        {
+            EventReportError(IDS_REPORT_FAILED_START_REWRITE_THREAD, HRESULT_FROM_WIN32(::GetLastError()));
+            break;
+        }
+        vhThreads.Add(hThread);
+    }
+
+    if(0 == vhThreads.GetCount())
+    {
+        RewriteThreadProc(&xJob);
+    }
+    else
+    {
+        ::WaitForMultipleObjects((DWORD)vhThreads.GetCount(), vhThreads.GetData(), TRUE, INFINITE);
+        for(size_t i = 0; i < vhThreads.GetCount(); i++)
+        {
+            ::CloseHandle(vhThreads[i]);
+        }
+    }
+    return (ULONG)xJob.nMethodCount;
+}
+
+DWORD WINAPI COfflineRewriter::RewriteThreadProc(LPVOID pvJob)
+{
+    REWRITE_JOB *pJob = static_cast<REWRITE_JOB*>(pvJob);
+    HRESULT hr = ::CoInitializeEx(NULL, COINIT_MULTITHREADED);
+    BOOL bUninitialize = SUCCEEDED(hr);
+    {
+        // One dispenser per thread, and one scope per assembly
+        CComPtr<IMetaDataDispenserEx> pDispenser;
+        hr = pDispenser.CoCreateInstance(CLSID_CorMetaDataDispenser);
+        if(FAILED(hr))
+        {
+            EventReportError(IDS_REPORT_FAILED_CREATE_DISPENSER, hr);
+        }
+        else
+        {
+            // Do not turn member refs into defs, and report the tokens moved on save.
+            CComVariant vValue((ULONG)MDRefToDefNone);
+            pDispenser->SetOption(MetaDataRefToDefCheck, &vValue);
+            vValue = (ULONG)MDNotifyAll;
+            pDispenser->SetOption(MetaDataNotificationForTokenMovement, &vValue);
+        }
+
+        const CAtlArray<CString> &rvszAssemblyPaths = *pJob->pvszAssemblyPaths;
+        LONG nIndex;
+        while((nIndex = ::InterlockedIncrement(&pJob->nNextAssembly) - 1) < (LONG)rvszAssemblyPaths.GetCount())
+        {
+            CString szOutputPath = CombineOutputPath(pJob->pstrOutputFolder, rvszAssemblyPaths[nIndex]);
+
+            // Module ids only tell the assemblies apart, so the index will do.
+            ULONG nMethodCount = (NULL == pDispenser) ? 0 : RewriteAssembly(pDispenser, rvszAssemblyPaths[nIndex],
+                szOutputPath, (ModuleID)(nIndex + 1), *pJob->pvszMethodNames, *pJob->pvnSignatureHashes);
+            if(0 < nMethodCount)
+            {
+                ::InterlockedExchangeAdd(&pJob->nMethodCount, (LONG)nMethodCount);
+            }
+            else if(!::CopyFile(rvszAssemblyPaths[nIndex], szOutputPath, FALSE))
+            {
+                EventReportError(IDS_REPORT_FAILED_SAVE_ASSEMBLY, HRESULT_FROM_WIN32(::GetLastError()), szOutputPath);
+            }
+        }
+    }
+    if(bUninitialize)
+    {
+        ::CoUninitialize();
+    }
+    return 0;
+}
+
+ULONG COfflineRewriter::RewriteAssembly(IMetaDataDispenserEx *pDispenser, LPCTSTR pstrAssemblyPath,
+                                        LPCTSTR pstrOutputPath, ModuleID moduleId,
+                                        const CAtlArray<CString> &rvszMethodNames,
+                                        const CAtlArray<ULONGLONG> &rvnSignatureHashes)
+{
+    ASSERT(NULL != pDispenser);
+
+    // Map the file.
+    CAtlFile xFile;
+    HRESULT hr = xFile.Create(pstrAssemblyPath, GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING);
+    ULONGLONG nImageSize = 0;
+    if(SUCCEEDED(hr))
+    {
+        hr = xFile.GetSize(nImageSize);
+    }
+    CAtlFileMapping<BYTE> xMapping;
+    if(SUCCEEDED(hr))
+    {
+        hr = (0 == nImageSize) ? HRESULT_FROM_WIN32(ERROR_BAD_EXE_FORMAT) : xMapping.MapFile(xFile);
+    }
+    if(FAILED(hr))
+    {
+        EventReportError(IDS_REPORT_FAILED_OPEN_ASSEMBLY, hr, pstrAssemblyPath);
+        return 0;
+    }
+    LPCBYTE pImage = xMapping;
+
+    // Locate the headers. Files which are not managed images are copied unchanged.
+    const IMAGE_DOS_HEADER *pDosHeader = reinterpret_cast<const IMAGE_DOS_HEADER*>(pImage);
+    if((nImageSize < sizeof(IMAGE_DOS_HEADER)) || (IMAGE_DOS_SIGNATURE != pDosHeader->e_magic)
+        || ((ULONGLONG)(DWORD)pDosHeader->e_lfanew + sizeof(IMAGE_NT_HEADERS64) > nImageSize))
+    {
+        return 0;
+    }
+    const IMAGE_NT_HEADERS32 *pNtHeaders = reinterpret_cast<const IMAGE_NT_HEADERS32*>(pImage + pDosHeader->e_lfanew);
+    const IMAGE_SECTION_HEADER *pSections = reinterpret_cast<const IMAGE_SECTION_HEADER*>(
+        reinterpret_cast<LPCBYTE>(&pNtHeaders->OptionalHeader) + pNtHeaders->FileHeader.SizeOfOptionalHeader);
+    WORD nSectionCount = pNtHeaders->FileHeader.NumberOfSections;
+    const IMAGE_DATA_DIRECTORY *pComDirectory = LocateDataDirectory(pNtHeaders, IMAGE_DIRECTORY_ENTRY_COM_DESCRIPTOR);
+    if((IMAGE_NT_SIGNATURE != pNtHeaders->Signature) || (NULL == pComDirectory) || (0 == pComDirectory->VirtualAddress))
+    {
+        return 0;
+    }
+    if((ULONGLONG)(reinterpret_cast<LPCBYTE>(pSections + nSectionCount) - pImage) > nImageSize)
+    {
+        EventReportError(IDS_REPORT_INVALID_ASSEMBLY_IMAGE, pstrAssemblyPath);
+        return 0;
+    }
+
+    // Open the metadata for writing.
+    CComPtr<IUnknown> pMetaDataScope;
+    hr = pDispenser->OpenScope(CT2CW(pstrAssemblyPath), ofWrite, IID_IMetaDataEmit, &pMetaDataScope);
+    if(FAILED(hr))
+    {
+        EventReportError(IDS_REPORT_FAILED_OPEN_ASSEMBLY, hr, pstrAssemblyPath);
+        return 0;
+    }
+    CComQIPtr<IMetaDataEmit> pMetaDataEmit = pMetaDataScope;
+    CTokenMoveCounter xTokenMoveCounter;
+    pMetaDataEmit->SetHandler(&xTokenMoveCounter);
+
+    COfflineProfilerInfo xProfilerInfo(pMetaDataScope, pImage, nImageSize, pSections, nSectionCount);
+    ULONG nCorHeaderSize = 0;
+    const IMAGE_COR20_HEADER *pCorHeader = reinterpret_cast<const IMAGE_COR20_HEADER*>(
+        xProfilerInfo.GetImageData(pComDirectory->VirtualAddress, &nCorHeaderSize));
+    if((NULL == pCorHeader) || (nCorHeaderSize < sizeof(IMAGE_COR20_HEADER)))
+    {
+        EventReportError(IDS_REPORT_INVALID_ASSEMBLY_IMAGE, pstrAssemblyPath);
+        return 0;
+    }
+
+    // Insert the prologue into the methods of the filter, like at JIT compilation.
+    try
+    {
+        CMetadataModule xModule(CComQIPtr<ICorProfilerInfo>(static_cast<ICorProfilerInfo*>(&xProfilerInfo)), moduleId);
+        CAtlArray<mdMethodDef> vMethodDefTokens;
+        CAtlArray<size_t> vNameIndexes;
+        xModule.FindMethodsByFullQualifiedName(rvszMethodNames, rvnSignatureHashes, vMethodDefTokens, vNameIndexes);
+
+        CAtlMap<mdMethodDef, BOOL> mapRewritten;   // a method may be listed more than once
+        for(size_t i = 0; i < vMethodDefTokens.GetCount(); i++)
+        {
+            if(NULL != mapRewritten.Lookup(vMethodDefTokens[i]))
+            {
+                continue;
+            }
+            mapRewritten.SetAt(vMethodDefTokens[i], TRUE);
+            try
+            {
+                CMetadataMethod xMethodInfo(vMethodDefTokens[i]);
+                xModule.LoadMethodProperties(xMethodInfo);
+                xModule.InsertOfflinePrologueIntoMethod(xMethodInfo);
+            }
+            catch(CExceptionAsBreak* /*&sharedExceptionAsBreak*/)
+            {
+                // Error is reported by callee. The method keeps its original code.
+            }
+        }
+    }
+    catch(CExceptionAsBreak* /*&sharedExceptionAsBreak*/)
+    {
+        return 0;
+    }
+    ULONG nMethodCount = (ULONG)xProfilerInfo.GetNewBodyCount();
+    if(0 == nMethodCount)
+    {
+        return 0;
+    }
+
+    // The new section header follows the last one, if the headers have room for it.
+    DWORD nNewSectionHeaderOffset = (DWORD)(reinterpret_cast<LPCBYTE>(pSections + nSectionCount) - pImage);
+    DWORD nFirstRawData = pNtHeaders->OptionalHeader.SizeOfHeaders;
+    DWORD nVirtualEnd = 0;
+    DWORD nRawEnd = (DWORD)nImageSize;
+    for(WORD i = 0; i < nSectionCount; i++)
+    {
+        if((0 < pSections[i].SizeOfRawData) && (pSections[i].PointerToRawData < nFirstRawData))
+        {
+            nFirstRawData = pSections[i].PointerToRawData;
+        }
+        nVirtualEnd = max(nVirtualEnd, pSections[i].VirtualAddress + max(pSections[i].Misc.VirtualSize, pSections[i].SizeOfRawData));
+        nRawEnd = max(nRawEnd, pSections[i].PointerToRawData + pSections[i].SizeOfRawData);
+    }
+    if(nNewSectionHeaderOffset + sizeof(IMAGE_SECTION_HEADER) > nFirstRawData)
+    {
+        EventReportError(IDS_REPORT_NO_ROOM_FOR_SECTION, pstrAssemblyPath);
+        return 0;
+    }
+
+    // Lay out the section: the method bodies, dword aligned for their fat headers and sections,
+    // then the metadata. The fields from SectionAlignment on are at the same offsets in the
+    // headers of PE32 and PE32+ images.
+    DWORD nFileAlignment = pNtHeaders->OptionalHeader.FileAlignment;
+    DWORD nSectionAlignment = pNtHeaders->OptionalHeader.SectionAlignment;
+    IMAGE_SECTION_HEADER xNewSection;
+    ::memset(&xNewSection, 0, sizeof(xNewSection));
+    ::memcpy(xNewSection.Name, ".trap", sizeof(".trap") - 1);
+    xNewSection.VirtualAddress = Align(nVirtualEnd, nSectionAlignment);
+    xNewSection.PointerToRawData = Align(nRawEnd, nFileAlignment);
+    xNewSection.Characteristics = IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ;
+
+    CAtlArray<DWORD> vBodyOffsets;
+    DWORD nContentSize = 0;
+    for(size_t i = 0; i < nMethodCount; i++)
+    {
+        nContentSize = Align(nContentSize, sizeof(DWORD));
+        vBodyOffsets.Add(nContentSize);
+        hr = pMetaDataEmit->SetMethodProps(xProfilerInfo.GetNewBodyMethod(i), ULONG_MAX,
+            xNewSection.VirtualAddress + nContentSize, ULONG_MAX);
+        if(FAILED(hr))
+        {
+            EventReportError(IDS_REPORT_FAILED_SAVE_ASSEMBLY, hr, pstrAssemblyPath);
+            return 0;
+        }
+        nContentSize += (DWORD)xProfilerInfo.GetNewBody(i).GetSize();
+    }
+    DWORD nMetadataOffset = Align(nContentSize, sizeof(DWORD));
+    DWORD nMetadataSize = 0;
+    hr = pMetaDataEmit->GetSaveSize(cssAccurate, &nMetadataSize);
+    if(FAILED(hr))
+    {
+        EventReportError(IDS_REPORT_FAILED_SAVE_ASSEMBLY, hr, pstrAssemblyPath);
+        return 0;
+    }
+    xNewSection.Misc.VirtualSize = nMetadataOffset + nMetadataSize;
+    xNewSection.SizeOfRawData = Align(xNewSection.Misc.VirtualSize, nFileAlignment);
+
+    // Write the image: a copy of the input, then the section.
+    CAtlArray<BYTE> vOutputImage;
+    size_t nOutputImageSize = (size_t)xNewSection.PointerToRawData + xNewSection.SizeOfRawData;
+    if(!vOutputImage.SetCount(nOutputImageSize))
+    {
+        EventReportError(IDS_REPORT_FAILED_ALLOC, E_OUTOFMEMORY, nOutputImageSize);
+        return 0;
+    }
+    LPBYTE pOutputImage = vOutputImage.GetData();
+    ::memcpy(pOutputImage, pImage, (size_t)nImageSize);
+    ::memset(pOutputImage + nImageSize, 0, nOutputImageSize - (size_t)nImageSize);
+
+    LPBYTE pSectionData = pOutputImage + xNewSection.PointerToRawData;
+    for(size_t i = 0; i < nMethodCount; i++)
+    {
+        CMemoryRef xBody = xProfilerInfo.GetNewBody(i);
+        ::memcpy(pSectionData + vBodyOffsets[i], xBody.GetBaseAddress(), xBody.GetSize());
+    }
+    hr = pMetaDataEmit->SaveToMemory(pSectionData + nMetadataOffset, nMetadataSize);
+    if(FAILED(hr))
+    {
+        EventReportError(IDS_REPORT_FAILED_SAVE_ASSEMBLY, hr, pstrAssemblyPath);
+        return 0;
+    }
+    if(0 < xTokenMoveCounter.GetMovedTokenCount())
+    {
+        EventReportError(IDS_REPORT_TOKENS_MOVED, pstrAssemblyPath, xTokenMoveCounter.GetMovedTokenCount());
+        return 0;
+    }
+
+    // Point the headers to the section and the new metadata. The checksum and the signatures
+    // do not match the image any more.
+    ::memcpy(pOutputImage + nNewSectionHeaderOffset, &xNewSection, sizeof(xNewSection));
+    IMAGE_NT_HEADERS32 *pNewNtHeaders = Relocate(pNtHeaders, pImage, pOutputImage);
+    pNewNtHeaders->FileHeader.NumberOfSections++;
+    pNewNtHeaders->OptionalHeader.SizeOfImage = Align(xNewSection.VirtualAddress + xNewSection.Misc.VirtualSize,
+        nSectionAlignment);
+    pNewNtHeaders->OptionalHeader.SizeOfInitializedData += xNewSection.SizeOfRawData;
+    pNewNtHeaders->OptionalHeader.CheckSum = 0;
+    const IMAGE_DATA_DIRECTORY *pSecurityDirectory = LocateDataDirectory(pNtHeaders, IMAGE_DIRECTORY_ENTRY_SECURITY);
+    if(NULL != pSecurityDirectory)
+    {
+        ::memset(Relocate(pSecurityDirectory, pImage, pOutputImage), 0, sizeof(IMAGE_DATA_DIRECTORY));
+    }
+    IMAGE_COR20_HEADER *pNewCorHeader = Relocate(pCorHeader, pImage, pOutputImage);
+    pNewCorHeader->MetaData.VirtualAddress = xNewSection.VirtualAddress + nMetadataOffset;
+    pNewCorHeader->MetaData.Size = nMetadataSize;
+    pNewCorHeader->Flags &= ~COMIMAGE_FLAGS_STRONGNAMESIGNED;
+
+    CAtlFile xOutputFile;
+    hr = xOutputFile.Create(pstrOutputPath, GENERIC_WRITE, 0, CREATE_ALWAYS);
+    if(SUCCEEDED(hr))
+    {
+        hr = xOutputFile.Write(pOutputImage, (DWORD)nOutputImageSize);
+    }
+    if(FAILED(hr))
+    {
+        EventReportError(IDS_REPORT_FAILED_SAVE_ASSEMBLY, hr, pstrOutputPath);
+        return 0;
+    }
+
+    EventReportInfo(IDS_REPORT_ASSEMBLY_REWRITTEN, pstrAssemblyPath, nMethodCount, pstrOutputPath);
+    return nMethodCount;
+}
+
+void COfflineRewriter::AddAssemblyPaths(LPCWSTR pstrPath, CAtlArray<CString> &rvszAssemblyPaths)
+{
+    DWORD dwAttributes = ::GetFileAttributesW(pstrPath);
+    if((INVALID_FILE_ATTRIBUTES == dwAttributes) || (0 == (dwAttributes & FILE_ATTRIBUTE_DIRECTORY)))
+    {
+        rvszAssemblyPaths.Add(CString(pstrPath));
+        return;
+    }
+
+    const LPCTSTR vpstrPatterns[] = {_T("\\*.dll"), _T("\\*.exe")};
+    for(int i = 0; i < _countof(vpstrPatterns); i++)
+    {
+        WIN32_FIND_DATA xFindData;
+        HANDLE hFind = ::FindFirstFile(CString(pstrPath) + vpstrPatterns[i], &xFindData);
+        if(INVALID_HANDLE_VALUE == hFind)
+        {
+            continue;
+        }
+        do
+        {
+            rvszAssemblyPaths.Add(CString(pstrPath) + _T("\\") + xFindData.cFileName);
+        } while(::FindNextFile(hFind, &xFindData));
+        ::FindClose(hFind);
+    }
+}
+
+const IMAGE_DATA_DIRECTORY* COfflineRewriter::LocateDataDirectory(const IMAGE_NT_HEADERS32 *pNtHeaders, DWORD nEntry)
+{
+    if(IMAGE_NT_OPTIONAL_HDR64_MAGIC == pNtHeaders->OptionalHeader.Magic)
+    {
+        const IMAGE_NT_HEADERS64 *pNtHeaders64 = reinterpret_cast<const IMAGE_NT_HEADERS64*>(pNtHeaders);
+        return (nEntry < pNtHeaders64->OptionalHeader.NumberOfRvaAndSizes)
+            ? &pNtHeaders64->OptionalHeader.DataDirectory[nEntry] : NULL;
+    }
+    return (nEntry < pNtHeaders->OptionalHeader.NumberOfRvaAndSizes)
+        ? &pNtHeaders->OptionalHeader.DataDirectory[nEntry] : NULL;
+}
+
+STDMETHODIMP COfflineRewriter::CTokenMoveCounter::QueryInterface(REFIID riid, void **ppvObject)
+{
+    if(NULL == ppvObject)
+    {
+        return E_POINTER;
+    }
+    if(::InlineIsEqualGUID(riid, IID_IUnknown) || ::InlineIsEqualGUID(riid, IID_IMapToken))
+    {
+        *ppvObject = static_cast<IMapToken*>(this);
+        return S_OK;
+    }
+    *ppvObject = NULL;
+    return E_NOINTERFACE;
+}
+
+STDMETHODIMP COfflineRewriter::CTokenMoveCounter::Map(mdToken tkImp, mdToken tkEmit)
+{
+    if(tkImp != tkEmit)
+    {
+        this->m_nMovedTokenCount++;
+    }
+    return S_OK;
+}
+
+#pragma endregion
+
+#pragma region Exported Functions (Called by Tests)
+
+extern "C" BOOL WINAPI FaultEngineRewriteAssemblies(LPCWSTR *ppstrAssemblyPaths, ULONG nAssemblyCount,
+                                                    LPCWSTR pstrOutputFolder, LPCWSTR pstrMethodFilterFile,
+                                                    ULONG *pnMethodCount)
+{
+    if((NULL == ppstrAssemblyPaths) || (NULL == pstrOutputFolder) || (NULL == pstrMethodFilterFile)
+        || (NULL == pnMethodCount))
+    {
+        return FALSE;
+    }
+    CEventLog::Initialize();
+
+    CAtlArray<CString> vszMethodNames;
+    CAtlArray<ULONGLONG> vnSignatureHashes;
+    if(!COfflineRewriter::LoadMethodFilter(CW2CT(pstrMethodFilterFile), vszMethodNames, vnSignatureHashes))
+    {
+        return FALSE;
+    }
+    CAtlArray<CString> vszAssemblyPaths;
+    for(ULONG i = 0; i < nAssemblyCount; i++)
+    {
+        vszAssemblyPaths.Add(CString(ppstrAssemblyPaths[i]));
+    }
+    *pnMethodCount = COfflineRewriter::RewriteAssemblies(vszAssemblyPaths, CW2CT(pstrOutputFolder), vszMethodNames,
+        vnSignatureHashes);
+    return TRUE;
+}
+
+// Command line: rundll32 FaultInjectionEngine.dll,FaultEngineRewriteW <output folder> <method filter>
+// <assembly or folder>... The results are reported in the event log of the engine.
+extern "C" void CALLBACK FaultEngineRewriteW(HWND /*hWnd*/, HINSTANCE /*hInstance*/, LPWSTR pstrCmdLine,
+                                             int /*nCmdShow*/)
+{
+    int nArgumentCount = 0;
+    LPWSTR *ppstrArguments = ::CommandLineToArgvW(pstrCmdLine, &nArgumentCount);
+    if(NULL == ppstrArguments)
+    {
+        return;
+    }
+    if(3 <= nArgumentCount)
+    {
+        CEventLog::Initialize();
+
+        CAtlArray<CString> vszMethodNames;
+        CAtlArray<ULONGLONG> vnSignatureHashes;
+        if(COfflineRewriter::LoadMethodFilter(CW2CT(ppstrArguments[1]), vszMethodNames, vnSignatureHashes))
+        {
+            CAtlArray<CString> vszAssemblyPaths;
+            for(int i = 2; i < nArgumentCount; i++)
+            {
+                COfflineRewriter::AddAssemblyPaths(ppstrArguments[i], vszAssemblyPaths);
+            }
+            ::CreateDirectoryW(ppstrArguments[0], NULL);
+            COfflineRewriter::RewriteAssemblies(vszAssemblyPaths, CW2CT(ppstrArguments[0]), vszMethodNames,
+                vnSignatureHashes);
+        }
+    }
+    ::LocalFree(ppstrArguments);
+}
+
+#pragma endregion
@@ -0,0 +1,92 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  Declaration of class COfflineRewriter.
+//  Traps the methods of the method filter in assemblies on disk, ahead of time, so that tests
+//  run them without loading the engine as a profiler. Each assembly is mapped into memory and
+//  rewritten by CMetadataModule through COfflineProfilerInfo; the new method bodies and the
+//  saved metadata are appended to the image in a new section, and the headers point to them.
+//  Assemblies are rewritten in parallel, one thread and one metadata dispenser per processor.
+//
+
+#pragma once
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Declaration of COfflineRewriter
+
+class COfflineRewriter
+{
+public:
+    /// <summary>
+    /// Read the method filter file, with the hashes of the parameter lists (0 for all overloads).
+    /// Static faults and call sites are ignored, and disarmed methods are trapped as well: the
+    /// dispatcher decides whether they fault. Methods in protected namespaces are skipped, and
+    /// added to pvszProtectedNames if it is given.
+    /// </summary>
+    static BOOL LoadMethodFilter(LPCTSTR pstrMethodFilterFile, CAtlArray<CString> &rvszMethodNames,
+        CAtlArray<ULONGLONG> &rvnSignatureHashes, CAtlArray<CString> *pvszProtectedNames = NULL);
+
+    /// <summary>
+    /// Rewrite the assemblies into the output folder, with the same file names. Files which
+    /// are not assemblies, or have no method of the filter, are copied unchanged. Return the
+    /// number of methods trapped.
+    /// </summary>
+    static ULONG RewriteAssemblies(const CAtlArray<CString> &rvszAssemblyPaths, LPCTSTR pstrOutputFolder,
+        const CAtlArray<CString> &rvszMethodNames, const CAtlArray<ULONGLONG> &rvnSignatureHashes);
+
+    /// <summary>
+    /// Add a file, or the executables and libraries of a folder, to the paths of assemblies.
+    /// </summary>
+    static void AddAssemblyPaths(LPCWSTR pstrPath, CAtlArray<CString> &rvszAssemblyPaths);
+
+    /// <summary>
+    /// Get an entry of the data directory of a PE32 or PE32+ image, or NULL if it has none.
+    /// </summary>
+    static const IMAGE_DATA_DIRECTORY* LocateDataDirectory(const IMAGE_NT_HEADERS32 *pNtHeaders, DWORD nEntry);
+
+private:
+    struct REWRITE_JOB
+    {
+        const CAtlArray<CString> *pvszAssemblyPaths;
+        LPCTSTR pstrOutputFolder;
+        const CAtlArray<CString> *pvszMethodNames;
+        const CAtlArray<ULONGLONG> *pvnSignatureHashes;
+        volatile LONG nNextAssembly;
+        volatile LONG nMethodCount;
+    };
+
+    // Counts the tokens moved when the metadata is saved. The code of the methods refers to the
+    // old tokens, so an assembly whose tokens move can not be rewritten.
+    class CTokenMoveCounter : public IMapToken
+    {
+    public:
+        CTokenMoveCounter(void) : m_nMovedTokenCount(0) {};
+
+        STDMETHOD(QueryInterface)(REFIID riid, void **ppvObject);
+        STDMETHOD_(ULONG, AddRef)(void) { return 1; }
+        STDMETHOD_(ULONG, Release)(void) { return 1; }
+        STDMETHOD(Map)(mdToken tkImp, mdToken tkEmit);
+
+        ULONG GetMovedTokenCount(void) const { return this->m_nMovedTokenCount; }
+
+    private:
+        ULONG m_nMovedTokenCount;
+    };
+
+    static DWORD WINAPI RewriteThreadProc(LPVOID pvJob);
+    static ULONG RewriteAssembly(IMetaDataDispenserEx *pDispenser, LPCTSTR pstrAssemblyPath,
+        LPCTSTR pstrOutputPath, ModuleID moduleId, const CAtlArray<CString> &rvszMethodNames,
+        const CAtlArray<ULONGLONG> &rvnSignatureHashes);
+    static DWORD Align(DWORD nValue, DWORD nAlignment)
+    {
+        return (nValue + nAlignment - 1) & ~(nAlignment - 1);
+    }
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
@@ -0,0 +1,339 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include "ReJitController.h"
+#include "MetadataModule.h"
+#include "FaultPointTable.h"
+#include "Exceptions.h"
+#include "TraceAndLog.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Implementation of CReJitController
+
+CReJitController::CReJitController(void)
+{
+    this->m_nArmedMethodCount = 0;
+    this->m_nMethodFilterVersion = 0;
+    this->m_bMethodFilterChanged = FALSE;
+}
+
+void CReJitController::Attach(ICorProfilerInfo4 *pCorProfilerInfo)
+{
+    ASSERT(NULL != pCorProfilerInfo);
+    this->m_pCorProfilerInfo = pCorProfilerInfo;
+}
+
+BOOL CReJitController::IsAttached(void) const
+{
+    return (NULL != this->m_pCorProfilerInfo);
+}
+
+void CReJitController::AddModule(ModuleID moduleId)
+{
+    if(!this->IsAttached())
+    {
+        return;
+    }
+
+    // Resolve the methods right away, so they are not inlined before the control thread gets to
+    // the module. Requesting ReJIT is left to the control thread, it must not be done from here.
+    CAtlArray<CString> vszMethodNames;
+    CAtlArray<ULONGLONG> vnSignatureHashes;
+    size_t nArmedMethodCount;
+    ULONG nMethodFilterVersion;
+    {
+        CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csState);
+        this->m_vModules.Add(moduleId);
+        vszMethodNames.Copy(this->m_vszMethodNames);
+        vnSignatureHashes.Copy(this->m_vnSignatureHashes);
+        nArmedMethodCount = this->m_nArmedMethodCount;
+        nMethodFilterVersion = this->m_nMethodFilterVersion;
+    }
+
+    CAtlArray<mdMethodDef> vMethodDefTokens;
+    CAtlArray<BOOL> vArmed;
+    if(!this->ResolveModule(moduleId, vszMethodNames, vnSignatureHashes, nArmedMethodCount, vMethodDefTokens, vArmed))
+    {
+        return;
+    }
+
+    CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csState);
+    if(nMethodFilterVersion == this->m_nMethodFilterVersion)  // otherwise resolved again on refresh
+    {
+        this->UpdateModule(moduleId, vMethodDefTokens, vArmed);
+    }
+}
+
+void CReJitController::RemoveModule(ModuleID moduleId)
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csState);
+
+    // Module ids may be reused by modules loaded later, so nothing of the module may be kept.
+    for(size_t i = this->m_vModules.GetCount(); 0 < i--; )
+    {
+        if(this->m_vModules[i] == moduleId)
+        {
+            this->m_vModules.RemoveAt(i);
+        }
+    }
+    for(size_t i = this->m_vMethods.GetCount(); 0 < i--; )
+    {
+        if(this->m_vMethods[i].moduleId == moduleId)
+        {
+            this->m_vMethods.RemoveAt(i);
+        }
+    }
+}
+
+void CReJitController::SetMethodFilter(const CAtlArray<CString> &rvszArmedMethods,
+                                       const CAtlArray<ULONGLONG> &rvnArmedSignatureHashes,
+                                       const CAtlArray<CString> &rvszDisarmedMethods,
+                                       const CAtlArray<ULONGLONG> &rvnDisarmedSignatureHashes)
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csState);
+    this->m_vszMethodNames.Copy(rvszArmedMethods);
+    this->m_vszMethodNames.Append(rvszDisarmedMethods);
+    this->m_vnSignatureHashes.Copy(rvnArmedSignatureHashes);
+    this->m_vnSignatureHashes.Append(rvnDisarmedSignatureHashes);
+    this->m_nArmedMethodCount = rvszArmedMethods.GetCount();
+    this->m_nMethodFilterVersion++;
+    this->m_bMethodFilterChanged = TRUE;
+}
+
+void CReJitController::Refresh(void)
+{
+    if(!this->IsAttached())
+    {
+        return;
+    }
+
+    // Take the work under lock, but read the metadata without it. Resolving a method filter in
+    // all modules takes a while, and callbacks on other threads must not wait for it.
+    CAtlArray<ModuleID> vModulesToResolve;
+    CAtlArray<CString> vszMethodNames;
+    CAtlArray<ULONGLONG> vnSignatureHashes;
+    size_t nArmedMethodCount;
+    ULONG nMethodFilterVersion;
+    {
+        CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csState);
+        if(this->m_bMethodFilterChanged)
+        {
+            vModulesToResolve.Copy(this->m_vModules);
+        }
+        this->m_bMethodFilterChanged = FALSE;
+        vszMethodNames.Copy(this->m_vszMethodNames);
+        vnSignatureHashes.Copy(this->m_vnSignatureHashes);
+        nArmedMethodCount = this->m_nArmedMethodCount;
+        nMethodFilterVersion = this->m_nMethodFilterVersion;
+    }
+
+    for(size_t i = 0; i < vModulesToResolve.GetCount(); i++)
+    {
+        CAtlArray<mdMethodDef> vMethodDefTokens;
+        CAtlArray<BOOL> vArmed;
+        if(this->ResolveModule(vModulesToResolve[i], vszMethodNames, vnSignatureHashes, nArmedMethodCount,
+            vMethodDefTokens, vArmed))
+        {
+            CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csState);
+            if(nMethodFilterVersion != this->m_nMethodFilterVersion)
+            {
+                break;  // changed again, next refresh resolves all modules anyway
+            }
+            this->UpdateModule(vModulesToResolve[i], vMethodDefTokens, vArmed);
+        }
+    }
+
+    CAtlArray<ModuleID> vReJitModuleIds, vRevertModuleIds;
+    CAtlArray<mdMethodDef> vReJitMethodDefTokens, vRevertMethodDefTokens;
+    {
+        CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csState);
+        for(size_t i = this->m_vMethods.GetCount(); 0 < i--; )
+        {
+            METHOD_ENTRY &rMethod = this->m_vMethods[i];
+            if(rMethod.bArmed && !rMethod.bRewritten)
+            {
+                vReJitModuleIds.Add(rMethod.moduleId);
+                vReJitMethodDefTokens.Add(rMethod.tkMethodDef);
+                rMethod.bRewritten = TRUE;
+            }
+            else if(!rMethod.bArmed && rMethod.bRewritten)
+            {
+                vRevertModuleIds.Add(rMethod.moduleId);
+                vRevertMethodDefTokens.Add(rMethod.tkMethodDef);
+                rMethod.bRewritten = FALSE;
+            }
+            else if(!rMethod.bFiltered && !rMethod.bRewritten)
+            {
+                // A method being reverted is kept until the revert succeeds, see RequestRevert.
+                this->m_vMethods.RemoveAt(i);
+            }
+        }
+    }
+
+    // The runtime suspends all managed threads to install the new code, so it must be requested
+    // without holding the lock taken by callbacks.
+    if(0 < vReJitModuleIds.GetCount() || 0 < vRevertModuleIds.GetCount())
+    {
+        EventReportInfo(IDS_REPORT_REJIT_REQUESTED, vReJitModuleIds.GetCount(), vRevertModuleIds.GetCount());
+    }
+    this->RequestReJit(vReJitModuleIds, vReJitMethodDefTokens);
+    this->RequestRevert(vRevertModuleIds, vRevertMethodDefTokens);
+}
+
+BOOL CReJitController::IsFilteredMethod(ModuleID moduleId, mdMethodDef tkMethodDef) const
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csState);
+
+    // Only methods of the method filter are resolved, so the table is small.
+    for(size_t i = 0; i < this->m_vMethods.GetCount(); i++)
+    {
+        if((this->m_vMethods[i].moduleId == moduleId) && (this->m_vMethods[i].tkMethodDef == tkMethodDef))
+        {
+            return this->m_vMethods[i].bFiltered;
+        }
+    }
+    return FALSE;
+}
+
+CReJitController::METHOD_ENTRY* CReJitController::FindMethod(ModuleID moduleId, mdMethodDef tkMethodDef)
+{
+    for(size_t i = 0; i < this->m_vMethods.GetCount(); i++)
+    {
+        if((this->m_vMethods[i].moduleId == moduleId) && (this->m_vMethods[i].tkMethodDef == tkMethodDef))
+        {
+            return &this->m_vMethods[i];
+        }
+    }
+    return NULL;
+}
+
+BOOL CReJitController::ResolveModule(ModuleID moduleId, const CAtlArray<CString> &rvszMethodNames,
+                                     const CAtlArray<ULONGLONG> &rvnSignatureHashes, size_t nArmedMethodCount,
+                                     CAtlArray<mdMethodDef> &rvMethodDefTokens, CAtlArray<BOOL> &rvArmed)
+{
+    try
+    {
+        CMetadataModule xModule(CComQIPtr<ICorProfilerInfo>(this->m_pCorProfilerInfo), moduleId);
+        CAtlArray<size_t> vNameIndexes;
+        xModule.FindMethodsByFullQualifiedName(rvszMethodNames, rvnSignatureHashes, rvMethodDefTokens, vNameIndexes);
+        for(size_t i = 0; i < vNameIndexes.GetCount(); i++)
+        {
+            rvArmed.Add(vNameIndexes[i] < nArmedMethodCount);
+        }
+
+        // Fault points are found when the module is loaded, and always armed, like at JIT.
+        size_t nNamedMethodCount = rvMethodDefTokens.GetCount();
+        CFaultPointTable::GetMethods(moduleId, rvMethodDefTokens);
+        for(size_t i = nNamedMethodCount; i < rvMethodDefTokens.GetCount(); i++)
+        {
+            rvArmed.Add(TRUE);
+        }
+    }
+    catch(CExceptionAsBreak* /*&sharedExceptionAsBreak*/)
+    {
+        // Error is reported by callee (e.g. the module is being unloaded). Skip the module.
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void CReJitController::UpdateModule(ModuleID moduleId, const CAtlArray<mdMethodDef> &rvMethodDefTokens,
+                                    const CAtlArray<BOOL> &rvArmed)
+{
+    // A method which is not found again in the method filter is reverted, then forgotten.
+    for(size_t i = 0; i < this->m_vMethods.GetCount(); i++)
+    {
+        if(this->m_vMethods[i].moduleId == moduleId)
+        {
+            this->m_vMethods[i].bArmed = FALSE;
+            this->m_vMethods[i].bFiltered = FALSE;
+        }
+    }
+    for(size_t i = 0; i < rvMethodDefTokens.GetCount(); i++)
+    {
+        METHOD_ENTRY *pMethod = this->FindMethod(moduleId, rvMethodDefTokens[i]);
+        if(NULL == pMethod)
+        {
+            METHOD_ENTRY xMethod = {moduleId, rvMethodDefTokens[i], FALSE, FALSE, FALSE};
+            pMethod = &this->m_vMethods[this->m_vMethods.Add(xMethod)];
+        }
+        pMethod->bArmed |= rvArmed[i];  // overloads may be listed both armed and disarmed
+        pMethod->bFiltered = TRUE;
+    }
+}
+
+void CReJitController::RequestReJit(CAtlArray<ModuleID> &rvModuleIds, CAtlArray<mdMethodDef> &rvMethodDefTokens)
+{
+    ASSERT(rvModuleIds.GetCount() == rvMethodDefTokens.GetCount());
+    if(0 == rvModuleIds.GetCount())
+    {
+        return;
+    }
+
+    HRESULT hr = this->m_pCorProfilerInfo->RequestReJIT((ULONG)rvModuleIds.GetCount(),
+        rvModuleIds.GetData(), rvMethodDefTokens.GetData());
+    if(FAILED(hr))
+    {
+        EventReportError(IDS_REPORT_FAILED_REQUEST_REJIT, hr, rvModuleIds.GetCount());
+
+        // Try again on the next refresh
+        CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csState);
+        for(size_t i = 0; i < rvModuleIds.GetCount(); i++)
+        {
+            METHOD_ENTRY *pMethod = this->FindMethod(rvModuleIds[i], rvMethodDefTokens[i]);
+            if(NULL != pMethod)
+            {
+                pMethod->bRewritten = FALSE;
+            }
+        }
+    }
+}
+
+void CReJitController::RequestRevert(CAtlArray<ModuleID> &rvModuleIds, CAtlArray<mdMethodDef> &rvMethodDefTokens)
+{
+    ASSERT(rvModuleIds.GetCount() == rvMethodDefTokens.GetCount());
+    if(0 == rvModuleIds.GetCount())
+    {
+        return;
+    }
+
+    CAtlArray<HRESULT> vStatus;
+    vStatus.SetCount(rvModuleIds.GetCount());
+    HRESULT hr = this->m_pCorProfilerInfo->RequestRevert((ULONG)rvModuleIds.GetCount(),
+        rvModuleIds.GetData(), rvMethodDefTokens.GetData(), vStatus.GetData());
+    if(FAILED(hr))
+    {
+        EventReportError(IDS_REPORT_FAILED_REQUEST_REVERT, hr, rvModuleIds.GetCount());
+    }
+
+    // A method which is not reverted keeps its prologue, and would still be faulted. Try again
+    // on the next refresh.
+    CComCritSecLock<CComAutoCriticalSection> xLock(this->m_csState);
+    for(size_t i = 0; i < rvModuleIds.GetCount(); i++)
+    {
+        HRESULT hrStatus = FAILED(hr) ? hr : vStatus[i];
+        METHOD_ENTRY *pMethod = this->FindMethod(rvModuleIds[i], rvMethodDefTokens[i]);
+        if(FAILED(hrStatus))
+        {
+            if(SUCCEEDED(hr))
+            {
+                EventReportWarning(IDS_REPORT_REJIT_FAILED, hrStatus, rvModuleIds[i], rvMethodDefTokens[i]);
+            }
+            if(NULL != pMethod)
+            {
+                pMethod->bRewritten = TRUE;
+            }
+        }
+        else if((NULL != pMethod) && !pMethod->bFiltered && !pMethod->bRewritten)
+        {
+            // Reverted, and no longer in the method filter
+            this->m_vMethods.RemoveAt(pMethod - this->m_vMethods.GetData());
+        }
+    }
+}
+
+#pragma endregion
@@ -0,0 +1,104 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  Declaration of class CReJitController.
+//  Without ReJIT, a trapped method gets its prologue at first JIT compilation and keeps it
+//  for the lifetime of the process. With ReJIT (CLR 4.5 and later) the engine asks the runtime
+//  to compile an armed method again with the prologue, and to revert it to its original code
+//  once it is disarmed, so methods run at full speed outside of fault injection windows.
+//  The controller resolves the names of the method filter to methods of the loaded modules,
+//  and requests ReJIT or revert of the methods whose state in the method filter changed.
+//  The new code itself is supplied by CEngine::GetReJITParameters.
+//
+
+#pragma once
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Declaration of CReJitController
+
+class CReJitController
+{
+public:
+    CReJitController(void);
+    ~CReJitController(void) {};
+
+public:
+    /// <summary>
+    /// Start rewriting methods on demand. Until then, all other methods do nothing.
+    /// </summary>
+    void Attach(ICorProfilerInfo4 *pCorProfilerInfo);
+
+    /// <summary>
+    /// See if methods are rewritten on demand.
+    /// </summary>
+    BOOL IsAttached(void) const;
+
+    /// <summary>
+    /// Resolve the method filter in a module loaded into the process. Armed methods of the
+    /// module are requested for ReJIT on the next Refresh.
+    /// </summary>
+    void AddModule(ModuleID moduleId);
+
+    /// <summary>
+    /// Forget a module being unloaded, and its methods.
+    /// </summary>
+    void RemoveModule(ModuleID moduleId);
+
+    /// <summary>
+    /// Set the methods which should run with a prologue (armed), and those which run their
+    /// original code but may be armed later (disarmed), with the hashes of their parameter lists
+    /// (0 for all overloads). Takes effect on the next Refresh.
+    /// </summary>
+    void SetMethodFilter(const CAtlArray<CString> &rvszArmedMethods,
+        const CAtlArray<ULONGLONG> &rvnArmedSignatureHashes, const CAtlArray<CString> &rvszDisarmedMethods,
+        const CAtlArray<ULONGLONG> &rvnDisarmedSignatureHashes);
+
+    /// <summary>
+    /// Resolve the method filter in all modules if it changed, then request ReJIT of armed methods
+    /// and revert of disarmed ones.
+    /// Must be called by one thread at a time, and never from a profiler callback.
+    /// </summary>
+    void Refresh(void);
+
+    /// <summary>
+    /// See if the method is in the method filter, armed or not. Such a method must not be inlined
+    /// into its callers, otherwise the callers would not run its new code.
+    /// </summary>
+    BOOL IsFilteredMethod(ModuleID moduleId, mdMethodDef tkMethodDef) const;
+
+private:
+    struct METHOD_ENTRY
+    {
+        ModuleID moduleId;
+        mdMethodDef tkMethodDef;
+        BOOL bArmed;        // state asked for by the method filter
+        BOOL bRewritten;    // state requested from the runtime
+        BOOL bFiltered;     // still in the method filter, otherwise dropped once reverted
+    };
+
+    METHOD_ENTRY* FindMethod(ModuleID moduleId, mdMethodDef tkMethodDef);
+    BOOL ResolveModule(ModuleID moduleId, const CAtlArray<CString> &rvszMethodNames,
+        const CAtlArray<ULONGLONG> &rvnSignatureHashes, size_t nArmedMethodCount,
+        CAtlArray<mdMethodDef> &rvMethodDefTokens, CAtlArray<BOOL> &rvArmed);
+    void UpdateModule(ModuleID moduleId, const CAtlArray<mdMethodDef> &rvMethodDefTokens, const CAtlArray<BOOL> &rvArmed);
+    void RequestReJit(CAtlArray<ModuleID> &rvModuleIds, CAtlArray<mdMethodDef> &rvMethodDefTokens);
+    void RequestRevert(CAtlArray<ModuleID> &rvModuleIds, CAtlArray<mdMethodDef> &rvMethodDefTokens);
+
+    CComQIPtr<ICorProfilerInfo4> m_pCorProfilerInfo;
+    mutable CComAutoCriticalSection m_csState;  // modules are loaded and methods inlined on many threads
+    CAtlArray<ModuleID> m_vModules;  // loaded modules
+    CAtlArray<CString> m_vszMethodNames;  // method filter, armed methods first
+    CAtlArray<ULONGLONG> m_vnSignatureHashes;  // parameter types of each method in name list, 0 for all overloads
+    size_t m_nArmedMethodCount;
+    ULONG m_nMethodFilterVersion;  // tells whether a resolution used the current method filter
+    BOOL m_bMethodFilterChanged;
+    CAtlArray<METHOD_ENTRY> m_vMethods;  // resolved methods of the method filter
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
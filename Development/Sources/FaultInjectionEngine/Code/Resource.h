@@ -37,6 +37,43 @@
 #define IDS_REPORT_FAILED_GET_TOKEN_FROM_TYPESPEC 2020
 #define IDS_REPORT_INVALID_SIGNATURE    2021
 #define IDS_REPORT_SUCCESSFULLY_MODIFY_METHOD 2022
+#define IDS_REPORT_FAILED_SET_EVENT_MASK 2023
+#define IDS_REPORT_EVENT_MASK_SELECTED  2024
+#define IDS_REPORT_EVENT_MASK_OVERRIDDEN 2025
+#define IDS_REPORT_FAILED_GET_SCOPE_PROPS 2026
+#define IDS_REPORT_FAILED_DEFINE_METHOD_SPEC 2027
+#define IDS_REPORT_UNSUPPORTED_RETURN_TYPE 2028
+#define IDS_REPORT_SUCCESSFULLY_COMPILE_FAULT 2029
+#define IDS_REPORT_STATIC_FAULT_NOT_COMPILED 2030
+#define IDS_REPORT_INVALID_STATIC_FAULT 2031
+#define IDS_REPORT_FAILED_SET_REJIT_FUNCTION_BODY 2032
+#define IDS_REPORT_REJIT_NOT_AVAILABLE  2033
+#define IDS_REPORT_FAILED_REQUEST_REJIT 2034
+#define IDS_REPORT_FAILED_REQUEST_REVERT 2035
+#define IDS_REPORT_REJIT_FAILED         2036
+#define IDS_REPORT_REJIT_REQUESTED      2037
+#define IDS_REPORT_FAILED_START_CONTROL_THREAD 2038
+#define IDS_REPORT_ENGINE_ATTACHED      2039
+#define IDS_REPORT_INVALID_CLIENT_DATA  2040
+#define IDS_REPORT_REJIT_NOT_AVAILABLE_ON_ATTACH 2041
+#define IDS_REPORT_DETACH_REQUESTED     2042
+#define IDS_REPORT_DETACH_REFUSED       2043
+#define IDS_REPORT_ENGINE_DETACHED      2044
+#define IDS_REPORT_JIT_COUNTERS         2045
+#define IDS_REPORT_INVALID_PROLOGUE     2046
+#define IDS_REPORT_FAILED_OPEN_ASSEMBLY 2047
+#define IDS_REPORT_INVALID_ASSEMBLY_IMAGE 2048
+#define IDS_REPORT_NO_ROOM_FOR_SECTION  2049
+#define IDS_REPORT_TOKENS_MOVED         2050
+#define IDS_REPORT_FAILED_SAVE_ASSEMBLY 2051
+#define IDS_REPORT_ASSEMBLY_REWRITTEN   2052
+#define IDS_REPORT_FAILED_START_REWRITE_THREAD 2053
+#define IDS_REPORT_FAILED_CREATE_DISPENSER 2054
+#define IDS_REPORT_FAILED_CREATE_REPORT 2055
+#define IDS_REPORT_FILTER_ANALYZED      2056
+#define IDS_REPORT_CALL_SITES_TRAPPED   2057
+#define IDS_REPORT_FAULT_POINTS_FOUND   2058
+#define IDS_REPORT_UNHASHABLE_PARAMETER_LIST 2059
 #define IDS_EVENT_LEVEL_ERROR           10000
 #define IDS_END_OF_LINE                 10001
 #define IDS_EVENT_LEVEL_WARNING         10001
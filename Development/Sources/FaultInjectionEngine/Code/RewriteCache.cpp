@@ -0,0 +1,151 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include "RewriteCache.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Implementation of CRewriteCache
+
+CComAutoCriticalSection CRewriteCache::m_csOutcomes;
+CAtlMap<CRewriteCache::METHOD_KEY, CRewriteCache::OUTCOME, CRewriteCache::CMethodKeyTraits> CRewriteCache::m_mapOutcomes;
+volatile LONG CRewriteCache::m_nCompilations = 0;
+volatile LONG CRewriteCache::m_nSkipped = 0;
+volatile LONG CRewriteCache::m_nRewrittenBodies = 0;
+volatile LONG CRewriteCache::m_nOriginalBytes = 0;
+volatile LONG CRewriteCache::m_nRewrittenBytes = 0;
+volatile LONG CRewriteCache::m_nTinyBodies = 0;
+volatile LONGLONG CRewriteCache::m_nRewriteTicks = 0;
+
+CRewriteCache::OUTCOME CRewriteCache::Lookup(ModuleID moduleId, mdMethodDef tkMethodDef)
+{
+    ::InterlockedIncrement(&m_nCompilations);
+
+    OUTCOME nOutcome = Peek(moduleId, tkMethodDef);
+    if(OUTCOME_UNKNOWN != nOutcome)
+    {
+        ::InterlockedIncrement(&m_nSkipped);
+    }
+    return nOutcome;
+}
+
+CRewriteCache::OUTCOME CRewriteCache::Peek(ModuleID moduleId, mdMethodDef tkMethodDef)
+{
+    METHOD_KEY xKey = { moduleId, tkMethodDef };
+    OUTCOME nOutcome = OUTCOME_UNKNOWN;
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csOutcomes);
+    m_mapOutcomes.Lookup(xKey, nOutcome);
+    return nOutcome;
+}
+
+void CRewriteCache::Record(ModuleID moduleId, mdMethodDef tkMethodDef, OUTCOME nOutcome)
+{
+    METHOD_KEY xKey = { moduleId, tkMethodDef };
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csOutcomes);
+    m_mapOutcomes.SetAt(xKey, nOutcome);
+}
+
+void CRewriteCache::RemoveModule(ModuleID moduleId)
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csOutcomes);
+    POSITION pos = m_mapOutcomes.GetStartPosition();
+    while(NULL != pos)
+    {
+        POSITION posCurrent = pos;
+        if(m_mapOutcomes.GetNext(pos)->m_key.moduleId == moduleId)
+        {
+            m_mapOutcomes.RemoveAtPos(posCurrent);
+        }
+    }
+}
+
+void CRewriteCache::ForgetBypassed(void)
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csOutcomes);
+    POSITION pos = m_mapOutcomes.GetStartPosition();
+    while(NULL != pos)
+    {
+        POSITION posCurrent = pos;
+        if(OUTCOME_BYPASSED == m_mapOutcomes.GetNext(pos)->m_value)
+        {
+            m_mapOutcomes.RemoveAtPos(posCurrent);
+        }
+    }
+}
+
+void CRewriteCache::GetCounters(ULONG &rnCompilations, ULONG &rnSkipped)
+{
+    rnCompilations = static_cast<ULONG>(m_nCompilations);
+    rnSkipped = static_cast<ULONG>(m_nSkipped);
+}
+
+void CRewriteCache::CountRewrittenBody(size_t nOriginalSize, size_t nRewrittenSize, BOOL bTiny, LONGLONG nTicks)
+{
+    ::InterlockedExchangeAdd64(&m_nRewriteTicks, nTicks);
+    ::InterlockedIncrement(&m_nRewrittenBodies);
+    ::InterlockedExchangeAdd(&m_nOriginalBytes, (LONG)nOriginalSize);
+    ::InterlockedExchangeAdd(&m_nRewrittenBytes, (LONG)nRewrittenSize);
+    if(bTiny)
+    {
+        ::InterlockedIncrement(&m_nTinyBodies);
+    }
+}
+
+void CRewriteCache::GetCodeSizeCounters(ULONG &rnBodies, ULONG &rnOriginalBytes, ULONG &rnRewrittenBytes, ULONG &rnTinyBodies)
+{
+    rnBodies = static_cast<ULONG>(m_nRewrittenBodies);
+    rnOriginalBytes = static_cast<ULONG>(m_nOriginalBytes);
+    rnRewrittenBytes = static_cast<ULONG>(m_nRewrittenBytes);
+    rnTinyBodies = static_cast<ULONG>(m_nTinyBodies);
+}
+
+LONGLONG CRewriteCache::GetRewriteTicks(void)
+{
+    return ::InterlockedCompareExchange64(&m_nRewriteTicks, 0, 0);
+}
+
+#pragma endregion
+
+#if defined(FAULT_ENGINE_TEST_EXPORTS)
+
+#pragma region Exported Functions (Called by Tests)
+
+extern "C" BOOL WINAPI FaultEngineGetJitCounters(ULONG *pnCompilations, ULONG *pnSkipped)
+{
+    if((NULL == pnCompilations) || (NULL == pnSkipped))
+    {
+        return FALSE;
+    }
+    CRewriteCache::GetCounters(*pnCompilations, *pnSkipped);
+    return TRUE;
+}
+
+extern "C" BOOL WINAPI FaultEngineGetCodeSizeCounters(ULONG *pnBodies, ULONG *pnOriginalBytes, ULONG *pnRewrittenBytes,
+                                                     ULONG *pnTinyBodies)
+{
+    if((NULL == pnBodies) || (NULL == pnOriginalBytes) || (NULL == pnRewrittenBytes) || (NULL == pnTinyBodies))
+    {
+        return FALSE;
+    }
+    CRewriteCache::GetCodeSizeCounters(*pnBodies, *pnOriginalBytes, *pnRewrittenBytes, *pnTinyBodies);
+    return TRUE;
+}
+
+extern "C" BOOL WINAPI FaultEngineGetRewriteTime(LONGLONG *pnTicks, LONGLONG *pnFrequency)
+{
+    LARGE_INTEGER xFrequency;
+    if((NULL == pnTicks) || (NULL == pnFrequency) || !::QueryPerformanceFrequency(&xFrequency))
+    {
+        return FALSE;
+    }
+    *pnTicks = CRewriteCache::GetRewriteTicks();
+    *pnFrequency = xFrequency.QuadPart;
+    return TRUE;
+}
+
+#pragma endregion
+
+#endif // FAULT_ENGINE_TEST_EXPORTS
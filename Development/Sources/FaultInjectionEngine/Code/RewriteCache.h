@@ -0,0 +1,117 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  Declaration of class CRewriteCache.
+//  The runtime raises JITCompilationStarted more than once for the same method-def: once per
+//  value-type instantiation of a generic method or of a method of a generic type, once per
+//  app-domain for modules which are not shared, and whenever two threads compile it at the
+//  same time. The IL body set at the first event is used by all later compilations, so the
+//  decision taken then (rewritten or bypassed) is remembered, and later events skip reading
+//  the metadata, matching the method filter and rewriting the body again.
+//  It also counts the size of the rewritten bodies and the time to build them, to measure what
+//  the prologues cost.
+//
+
+#pragma once
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Declaration of CRewriteCache
+
+class CRewriteCache
+{
+public:
+    enum OUTCOME
+    {
+        OUTCOME_UNKNOWN,    // not compiled yet, or forgotten
+        OUTCOME_BYPASSED,   // compiled with its original code
+        OUTCOME_REWRITTEN,  // compiled with a prologue or a compiled fault
+    };
+
+    /// <summary>
+    /// Get the outcome of the first compilation of the method, and count the event.
+    /// </summary>
+    static OUTCOME Lookup(ModuleID moduleId, mdMethodDef tkMethodDef);
+
+    /// <summary>
+    /// Get the outcome of the first compilation of the method, without counting an event. Used
+    /// when the question comes from anything else than a compilation (e.g. inlining).
+    /// </summary>
+    static OUTCOME Peek(ModuleID moduleId, mdMethodDef tkMethodDef);
+
+    /// <summary>
+    /// Remember the outcome of the compilation of the method.
+    /// </summary>
+    static void Record(ModuleID moduleId, mdMethodDef tkMethodDef, OUTCOME nOutcome);
+
+    /// <summary>
+    /// Forget the methods of a module being unloaded. Its module id may be reused by the runtime.
+    /// </summary>
+    static void RemoveModule(ModuleID moduleId);
+
+    /// <summary>
+    /// Forget the bypassed methods, since a new method filter may trap them. Rewritten methods
+    /// keep their body anyway.
+    /// </summary>
+    static void ForgetBypassed(void);
+
+    /// <summary>
+    /// Get the number of compilations looked up so far, and how many of them were skipped.
+    /// </summary>
+    static void GetCounters(ULONG &rnCompilations, ULONG &rnSkipped);
+
+    /// <summary>
+    /// Count a rewritten IL body, sizes in bytes including header and sections, and the
+    /// performance-counter ticks taken to build it.
+    /// </summary>
+    static void CountRewrittenBody(size_t nOriginalSize, size_t nRewrittenSize, BOOL bTiny, LONGLONG nTicks);
+
+    /// <summary>
+    /// Get the number of rewritten bodies, their total size before and after, and how many are tiny.
+    /// </summary>
+    static void GetCodeSizeCounters(ULONG &rnBodies, ULONG &rnOriginalBytes, ULONG &rnRewrittenBytes, ULONG &rnTinyBodies);
+
+    /// <summary>
+    /// Get the performance-counter ticks taken to build all rewritten bodies so far.
+    /// </summary>
+    static LONGLONG GetRewriteTicks(void);
+
+private:
+    struct METHOD_KEY
+    {
+        ModuleID moduleId;
+        mdMethodDef tkMethodDef;
+    };
+
+    class CMethodKeyTraits : public CElementTraitsBase<METHOD_KEY>
+    {
+    public:
+        static ULONG Hash(const METHOD_KEY &rxKey)
+        {
+            // Method-def tokens of a module are dense, module ids are aligned pointers.
+            return (static_cast<ULONG>(rxKey.moduleId >> 4) * 31) ^ rxKey.tkMethodDef;
+        }
+
+        static bool CompareElements(const METHOD_KEY &rxKey1, const METHOD_KEY &rxKey2)
+        {
+            return (rxKey1.moduleId == rxKey2.moduleId) && (rxKey1.tkMethodDef == rxKey2.tkMethodDef);
+        }
+    };
+
+    static CComAutoCriticalSection m_csOutcomes;  // JIT compilation happens on many threads
+    static CAtlMap<METHOD_KEY, OUTCOME, CMethodKeyTraits> m_mapOutcomes;
+    static volatile LONG m_nCompilations;
+    static volatile LONG m_nSkipped;
+    static volatile LONG m_nRewrittenBodies;
+    static volatile LONG m_nOriginalBytes;
+    static volatile LONG m_nRewrittenBytes;
+    static volatile LONG m_nTinyBodies;
+    static volatile LONGLONG m_nRewriteTicks;
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
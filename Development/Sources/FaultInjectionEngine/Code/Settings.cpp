@@ -26,6 +26,7 @@ BEGIN_DEFAULT_NAMESPACE
 #define DISPATCHER_CLASS_NAME       _T("Microsoft.Test.FaultInjection.FaultDispatcher")
 #define DISPATCHER_METHOD_NAME      _T("Trap")
 #define QUALIFIED_NAME_SEPARATOR    _T(".")
+#define CALLER_SCOPES_PREFIX        _T("callers=")
 const LPCTSTR PROTECTED_NAMESPACE_LIST[] = {
     _T("Microsoft.Test.FaultInjection."),
     NULL    // Must be NULL terminated!
@@ -38,11 +39,20 @@ const LPCTSTR PROTECTED_NAMESPACE_LIST[] = {
 #define ENV_VAR_METHOD_FILTER_FILE  _T("FAULT_INJECTION_METHOD_FILTER")
 #define ENV_VAR_EVENT_LOG_FOLDER    _T("FAULT_INJECTION_LOG_DIR")
 #define ENV_VAR_EVENT_LOG_LEVEL     _T("FAULT_INJECTION_LOG_LEVEL")
+#define ENV_VAR_EVENT_MASK          _T("FAULT_INJECTION_EVENT_MASK")
+#define ENV_VAR_CALL_COUNTING       _T("FAULT_INJECTION_CALL_COUNTING")
+#define ENV_VAR_REJIT               _T("FAULT_INJECTION_REJIT")
+#define ENV_VAR_PROLOGUE            _T("FAULT_INJECTION_PROLOGUE")
+#define ENV_VAR_FAULT_POINT_ATTRIBUTE   _T("FAULT_INJECTION_FAULT_POINT_ATTRIBUTE")
 
 #define ENV_VAL_EVENT_LOG_LEVEL_ERROR   _T("ERROR")
 #define ENV_VAL_EVENT_LOG_LEVEL_WARNING _T("WARNING")
 #define ENV_VAL_EVENT_LOG_LEVEL_INFO    _T("INFO")
 
+#define ENV_VAL_CALL_COUNTING_FAST      _T("FAST")
+#define ENV_VAL_REJIT_ON                _T("ON")
+#define ENV_VAL_PROLOGUE_COMPACT        _T("COMPACT")
+
 #pragma endregion
 
 #pragma region Helper Functions
@@ -104,10 +114,65 @@ CString _szEventLogFolder = GetEnvironment(
 CString _szMethodFilterFile = GetEnvironment(
     ENV_VAR_METHOD_FILTER_FILE, PREFERRED_FILE_PATH_NAME_LENGTH);
 
+CString _szEventMask = GetEnvironment(ENV_VAR_EVENT_MASK, 16);
+
+CString _szCallCounting = GetEnvironment(ENV_VAR_CALL_COUNTING, 8);
+
+CString _szReJit = GetEnvironment(ENV_VAR_REJIT, 8);
+
+CString _szPrologue = GetEnvironment(ENV_VAR_PROLOGUE, 8);
+
+CString _szFaultPointAttribute = GetEnvironment(
+    ENV_VAR_FAULT_POINT_ATTRIBUTE, PREFERRED_QUALIFIED_TYPE_NAME_LENGTH);
+
+// Settings above are loaded when the engine is loaded. A profiler attached to a running process
+// loads them again, once the client data is copied to the environment.
+static void ReloadSettings(void)
+{
+    _nEventLogLevel = GetEventLogLevel();
+    _szEventLogFolder = GetEnvironment(ENV_VAR_EVENT_LOG_FOLDER, PREFERRED_FILE_PATH_NAME_LENGTH);
+    _szMethodFilterFile = GetEnvironment(ENV_VAR_METHOD_FILTER_FILE, PREFERRED_FILE_PATH_NAME_LENGTH);
+    _szEventMask = GetEnvironment(ENV_VAR_EVENT_MASK, 16);
+    _szCallCounting = GetEnvironment(ENV_VAR_CALL_COUNTING, 8);
+    _szReJit = GetEnvironment(ENV_VAR_REJIT, 8);
+    _szPrologue = GetEnvironment(ENV_VAR_PROLOGUE, 8);
+    _szFaultPointAttribute = GetEnvironment(ENV_VAR_FAULT_POINT_ATTRIBUTE, PREFERRED_QUALIFIED_TYPE_NAME_LENGTH);
+}
+
 #pragma endregion
 
 #pragma region Implementation of CSettings
 
+BOOL CSettings::LoadFromClientData(const void *pvClientData, UINT cbClientData)
+{
+    // A profiler attached to a running process gets no environment variables of its own. The
+    // API passes them as client data instead, in the layout of an environment block:
+    // "NAME=VALUE\0NAME=VALUE\0\0" in UTF-16.
+    LPCWSTR pszBlock = static_cast<LPCWSTR>(pvClientData);
+    size_t cchBlock = cbClientData / sizeof(WCHAR);
+    if((NULL == pszBlock) || (0 != cbClientData % sizeof(WCHAR)) || (0 == cchBlock) || (L'\0' != pszBlock[cchBlock - 1]))
+    {
+        DebugTrace(_T("Invalid client data of %u bytes"), cbClientData);
+        return FALSE;
+    }
+
+    // The variables are set in the process, so the dispatcher finds them as well.
+    for(LPCWSTR pszVariable = pszBlock; (pszVariable < pszBlock + cchBlock) && (L'\0' != *pszVariable);
+        pszVariable += wcslen(pszVariable) + 1)
+    {
+        CStringW szVariable = pszVariable;
+        int nEqual = szVariable.Find(L'=');
+        if(0 < nEqual)
+        {
+            DebugTrace(_T("ClientData[%s]"), (LPCTSTR)CW2T(szVariable));
+            ::SetEnvironmentVariableW(szVariable.Left(nEqual), szVariable.Mid(nEqual + 1));
+        }
+    }
+
+    ReloadSettings();
+    return TRUE;
+}
+
 UINT CSettings::GetEventLogLevel(void)
 {
     return _nEventLogLevel;
@@ -123,6 +188,50 @@ LPCTSTR CSettings::GetMethodFilterFile(void)
     return _szMethodFilterFile;
 }
 
+BOOL CSettings::GetEventMaskOverride(DWORD* pdwEventMask)
+{
+    ASSERT(NULL != pdwEventMask);
+
+    if(_szEventMask.IsEmpty())
+    {
+        return FALSE;
+    }
+
+    // Both decimal and hexadecimal ("0x" prefixed) values are accepted.
+    *pdwEventMask = _tcstoul(_szEventMask, NULL, 0);
+    return TRUE;
+}
+
+BOOL CSettings::IsCallCountingAtomic(void)
+{
+    // Calls are counted with Interlocked.Increment unless FAST is asked for, which counts them
+    // with a plain increment. Concurrent calls may then be lost and a call-count condition
+    // triggers later than expected.
+    return (_szCallCounting != ENV_VAL_CALL_COUNTING_FAST);
+}
+
+BOOL CSettings::IsPrologueCompact(void)
+{
+    // The compact prologue adds no local-var and keeps the outcome of a fault on the current thread
+    // instead, so small methods stay small (and tiny) at the cost of a slower faulted call.
+    return (_szPrologue == ENV_VAL_PROLOGUE_COMPACT);
+}
+
+BOOL CSettings::IsReJitRequested(void)
+{
+    // Trapped methods are rewritten on demand, while they are armed in the method filter, instead
+    // of once at first JIT compilation.
+    return (_szReJit == ENV_VAL_REJIT_ON);
+}
+
+LPCTSTR CSettings::GetFaultPointAttributeName(void)
+{
+    // Methods carrying the attribute are trapped as well as those of the method filter. The name
+    // is the full name of the attribute type, or its name alone to match it in any namespace.
+    // Empty if there are no fault points.
+    return _szFaultPointAttribute;
+}
+
 LPCTSTR CSettings::GetCLISystemAssemblyName(void)
 {
     return CLI_SYSTEM_ASSEMBLY_NAME;
@@ -153,11 +262,29 @@ LPCTSTR CSettings::GetQualifiedNameSeparatorBeforeNestedType(void)
     return QUALIFIED_NAME_SEPARATOR;
 }
 
+LPCTSTR CSettings::GetCallerScopesPrefix(void)
+{
+    return CALLER_SCOPES_PREFIX;
+}
+
 const LPCTSTR* CSettings::GetProtectedNamespaceList(void)
 {
     return PROTECTED_NAMESPACE_LIST;
 }
 
+LPCTSTR CSettings::FindProtectedNamespace(LPCTSTR pstrMethodName)
+{
+    ASSERT(NULL != pstrMethodName);
+    for(int i = 0; NULL != PROTECTED_NAMESPACE_LIST[i]; i++)
+    {
+        if(0 == _tcsncmp(pstrMethodName, PROTECTED_NAMESPACE_LIST[i], _tcslen(PROTECTED_NAMESPACE_LIST[i])))
+        {
+            return PROTECTED_NAMESPACE_LIST[i];
+        }
+    }
+    return NULL;
+}
+
 #pragma endregion
 
 END_DEFAULT_NAMESPACE
\ No newline at end of file
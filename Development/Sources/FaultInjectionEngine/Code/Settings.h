@@ -20,6 +20,10 @@ BEGIN_DEFAULT_NAMESPACE
 #define PREFERRED_QUALIFIED_TYPE_NAME_LENGTH        1024
 #define PREFERRED_QUALIFIED_METHOD_NAME_LENGTH      1024
 #define PREFERRED_NONQUALIFIED_METHOD_NAME_LENGTH   256
+#define PREFERRED_OVERLOADED_METHOD_COUNT           8
+#define PREFERRED_MAX_TRAP_GATE_COUNT               65536
+#define PREFERRED_MAX_LATENCY_FAULT_COUNT           1024
+#define PREFERRED_DETACH_TIME_IN_MILLISECONDS       1000
 
 #pragma endregion
 
@@ -31,13 +35,21 @@ public:
     static UINT GetEventLogLevel(void);
     static LPCTSTR GetEventLogFolder(void);
     static LPCTSTR GetMethodFilterFile(void);
+    static BOOL GetEventMaskOverride(DWORD* pdwEventMask);
+    static BOOL IsCallCountingAtomic(void);
+    static BOOL IsPrologueCompact(void);
+    static BOOL IsReJitRequested(void);
+    static LPCTSTR GetFaultPointAttributeName(void);
+    static BOOL LoadFromClientData(const void *pvClientData, UINT cbClientData);
     static LPCTSTR GetCLISystemAssemblyName(void);
     static LPCTSTR GetDispatcherAssemblyName(void);
     static LPCTSTR GetDispatcherFullQualifiedClassName(void);
     static LPCTSTR GetDispatcherNonQualifiedMethodName(void);
     static LPCTSTR GetQualifiedNameSeparatorBeforeMethod(void);
     static LPCTSTR GetQualifiedNameSeparatorBeforeNestedType(void);
+    static LPCTSTR GetCallerScopesPrefix(void);
     static const LPCTSTR* GetProtectedNamespaceList(void);
+    static LPCTSTR FindProtectedNamespace(LPCTSTR pstrMethodName);
 };
 
 #pragma endregion
@@ -10,6 +10,137 @@
 
 USING_DEFAULT_NAMESPACE
 
+#pragma region Signature Decoding
+
+// Kind of each element type: what follows it in the signature. Indexed by the element type,
+// up to ELEMENT_TYPE_PINNED. Anything else is invalid in the signatures parsed here.
+enum
+{
+    CATEGORY_INVALID = 0,
+    CATEGORY_PRIMITIVE,     // nothing follows
+    CATEGORY_VOID,          // return types and pointers only
+    CATEGORY_TYPEDBYREF,    // return types and parameters only
+    CATEGORY_BYREF,         // return types and parameters only, followed by a type
+    CATEGORY_MODIFIER,      // followed by a token, then by what the modifier applies to
+    CATEGORY_SENTINEL,      // parameters only, followed by the first vararg parameter
+    CATEGORY_TOKEN,         // followed by a TypeDefOrRefEncoded
+    CATEGORY_NUMBER,        // followed by a compressed integer
+    CATEGORY_PTR,           // followed by a type, or VOID
+    CATEGORY_SZARRAY,       // followed by a type
+    CATEGORY_ARRAY,         // followed by a type and an array shape
+    CATEGORY_GENERICINST,   // followed by (CLASS | VALUETYPE) TypeDefOrRefEncoded GenArgCount Type*
+    CATEGORY_FNPTR          // followed by a method signature
+};
+
+static const BYTE ELEMENT_TYPE_CATEGORIES[ELEMENT_TYPE_PINNED + 1] =
+{
+    CATEGORY_INVALID,       // 0x00 END
+    CATEGORY_VOID,          // 0x01 VOID
+    CATEGORY_PRIMITIVE,     // 0x02 BOOLEAN
+    CATEGORY_PRIMITIVE,     // 0x03 CHAR
+    CATEGORY_PRIMITIVE,     // 0x04 I1
+    CATEGORY_PRIMITIVE,     // 0x05 U1
+    CATEGORY_PRIMITIVE,     // 0x06 I2
+    CATEGORY_PRIMITIVE,     // 0x07 U2
+    CATEGORY_PRIMITIVE,     // 0x08 I4
+    CATEGORY_PRIMITIVE,     // 0x09 U4
+    CATEGORY_PRIMITIVE,     // 0x0A I8
+    CATEGORY_PRIMITIVE,     // 0x0B U8
+    CATEGORY_PRIMITIVE,     // 0x0C R4
+    CATEGORY_PRIMITIVE,     // 0x0D R8
+    CATEGORY_PRIMITIVE,     // 0x0E STRING
+    CATEGORY_PTR,           // 0x0F PTR
+    CATEGORY_BYREF,         // 0x10 BYREF
+    CATEGORY_TOKEN,         // 0x11 VALUETYPE
+    CATEGORY_TOKEN,         // 0x12 CLASS
+    CATEGORY_NUMBER,        // 0x13 VAR
+    CATEGORY_ARRAY,         // 0x14 ARRAY
+    CATEGORY_GENERICINST,   // 0x15 GENERICINST
+    CATEGORY_TYPEDBYREF,    // 0x16 TYPEDBYREF
+    CATEGORY_INVALID,       // 0x17
+    CATEGORY_PRIMITIVE,     // 0x18 I
+    CATEGORY_PRIMITIVE,     // 0x19 U
+    CATEGORY_INVALID,       // 0x1A
+    CATEGORY_FNPTR,         // 0x1B FNPTR
+    CATEGORY_PRIMITIVE,     // 0x1C OBJECT
+    CATEGORY_SZARRAY,       // 0x1D SZARRAY
+    CATEGORY_NUMBER,        // 0x1E MVAR
+    CATEGORY_MODIFIER,      // 0x1F CMOD_REQD
+    CATEGORY_MODIFIER,      // 0x20 CMOD_OPT
+    CATEGORY_INVALID,       // 0x21 INTERNAL
+    CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID,    // 0x22 - 0x26
+    CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID,    // 0x27 - 0x2B
+    CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID,    // 0x2C - 0x30
+    CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID,    // 0x31 - 0x35
+    CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID,    // 0x36 - 0x3A
+    CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID, CATEGORY_INVALID,    // 0x3B - 0x3F
+    CATEGORY_INVALID,       // 0x40 MODIFIER
+    CATEGORY_SENTINEL,      // 0x41 SENTINEL
+    CATEGORY_INVALID,       // 0x42
+    CATEGORY_INVALID,       // 0x43
+    CATEGORY_INVALID,       // 0x44
+    CATEGORY_INVALID        // 0x45 PINNED, local variables only
+};
+
+// What an item of the signature may be, by the place it takes in the grammar.
+enum
+{
+    SLOT_TYPE = 0,          // Type
+    SLOT_RET_TYPE,          // RetTypeSig: VOID, TYPEDBYREF, [BYREF] Type
+    SLOT_PARAM,             // Param: [SENTINEL] (TYPEDBYREF, [BYREF] Type)
+    SLOT_PTR_TARGET         // after PTR: VOID or Type
+};
+
+// Categories which may take each slot, one bit per category.
+#define CATEGORY_BIT(category)  (1 << (category))
+#define CATEGORIES_OF_TYPE      (CATEGORY_BIT(CATEGORY_PRIMITIVE) | CATEGORY_BIT(CATEGORY_MODIFIER) \
+    | CATEGORY_BIT(CATEGORY_TOKEN) | CATEGORY_BIT(CATEGORY_NUMBER) | CATEGORY_BIT(CATEGORY_PTR) \
+    | CATEGORY_BIT(CATEGORY_SZARRAY) | CATEGORY_BIT(CATEGORY_ARRAY) | CATEGORY_BIT(CATEGORY_GENERICINST) \
+    | CATEGORY_BIT(CATEGORY_FNPTR))
+
+static const ULONG SLOT_CATEGORIES[] =
+{
+    CATEGORIES_OF_TYPE,
+    CATEGORIES_OF_TYPE | CATEGORY_BIT(CATEGORY_VOID) | CATEGORY_BIT(CATEGORY_TYPEDBYREF) | CATEGORY_BIT(CATEGORY_BYREF),
+    CATEGORIES_OF_TYPE | CATEGORY_BIT(CATEGORY_SENTINEL) | CATEGORY_BIT(CATEGORY_TYPEDBYREF) | CATEGORY_BIT(CATEGORY_BYREF),
+    CATEGORIES_OF_TYPE | CATEGORY_BIT(CATEGORY_VOID)
+};
+
+// Deepest nesting of generic instantiations, arrays and function pointers. Deeper signatures
+// are rejected rather than parsed on an unbounded stack.
+#define MAX_SIGNATURE_NESTING   64
+
+// ECMA-335 II.23.2: an unsigned integer of 1, 2 or 4 bytes, told by the high bits of the first
+// byte. Like CorSigUncompressData, only the bytes of the integer are read, but their bounds are
+// not checked: callers check them once per item, when the whole item is read.
+static __forceinline ULONG UncompressData(PCCOR_SIGNATURE &rpSignature)
+{
+    ULONG nData = rpSignature[0];
+    if(0 == (nData & 0x80))
+    {
+        rpSignature += 1;
+        return nData;
+    }
+    if(0 == (nData & 0x40))
+    {
+        nData = ((nData & 0x3F) << 8) | rpSignature[1];
+        rpSignature += 2;
+        return nData;
+    }
+    nData = ((nData & 0x1F) << 24) | (rpSignature[1] << 16) | (rpSignature[2] << 8) | rpSignature[3];
+    rpSignature += 4;
+    return nData;
+}
+
+static __forceinline BYTE GetCategory(ULONG nElementType)
+{
+    return (nElementType < _countof(ELEMENT_TYPE_CATEGORIES)) ? ELEMENT_TYPE_CATEGORIES[nElementType] : CATEGORY_INVALID;
+}
+
+#pragma endregion
+
+#pragma region Implementation of CSignatureBlob
+
 PCCOR_SIGNATURE CSignatureBlob::RefSignature(void) const
 {
     return (PCCOR_SIGNATURE)(this->m_pBase);
@@ -28,42 +159,25 @@ BOOL CSignatureBlob::ParseRetTypeSig(PCCOR_SIGNATURE &pSignature) const
 {
     //-----------------------------------------------------------------------------------
     //  RetTypeSig ::= CustomMod* ( VOID | TYPEDBYREF | [BYREF] Type )
-    
-    CorElementType nElementType = this->BypassOptCustomMod(pSignature);
-    return this->ParseRetTypeSig(nElementType, pSignature);
+    PARSE_FRAME xFrame = { 1, SLOT_RET_TYPE, FALSE };
+    return this->ParseItems(pSignature, &xFrame, ELEMENT_TYPE_END);
 }
 
 BOOL CSignatureBlob::ParseRetTypeSig(CorElementType nElementType, PCCOR_SIGNATURE &pSignature) const
 {
-    //-----------------------------------------------------------------------------------
-    //  RetTypeSig ::= CustomMod* ( VOID | TYPEDBYREF | [BYREF] Type )
-    switch(nElementType)
-    {
-    case ELEMENT_TYPE_CMOD_REQD      :
-    case ELEMENT_TYPE_CMOD_OPT       :
-        return this->ParseRetTypeSig(pSignature);
-
-    case ELEMENT_TYPE_VOID           :
-    case ELEMENT_TYPE_TYPEDBYREF     :
-        return TRUE;
-
-    case ELEMENT_TYPE_BYREF          :
-        return this->ParseTypeSig(pSignature);
-
-    default:
-        break;
-    }
-    return this->ParseTypeSig(nElementType, pSignature);
+    PARSE_FRAME xFrame = { 1, SLOT_RET_TYPE, FALSE };
+    return this->ParseItems(pSignature, &xFrame, nElementType);
 }
 
-BOOL CSignatureBlob::ParseTypeSig(PCCOR_SIGNATURE& pSignature) const
+BOOL CSignatureBlob::ParseRetTypeSig(PCCOR_SIGNATURE &pSignature, BOOL &rbTypeParameters) const
 {
-    CorElementType nElementType = ::CorSigUncompressElementType(pSignature);
-    EnsureWithin(pSignature);
-    return this->ParseTypeSig(nElementType, pSignature);
+    // Also tells whether the type refers to type parameters (VAR or MVAR) anywhere in it.
+    rbTypeParameters = FALSE;
+    PARSE_FRAME xFrame = { 1, SLOT_RET_TYPE, FALSE };
+    return this->ParseItems(pSignature, &xFrame, ELEMENT_TYPE_END, 1, &rbTypeParameters);
 }
 
-BOOL CSignatureBlob::ParseTypeSig(CorElementType nElementType, PCCOR_SIGNATURE& pSignature) const
+BOOL CSignatureBlob::ParseTypeSig(PCCOR_SIGNATURE& pSignature) const
 {
     //-----------------------------------------------------------------------------------
     //  Type ::= ( BOOLEAN | CHAR | I1 | U1 | U2 | U2 | I4 | U4 | I8 | U8 | R4 | R8 | I | U |
@@ -80,118 +194,45 @@ BOOL CSignatureBlob::ParseTypeSig(CorElementType nElementType, PCCOR_SIGNATURE&
     //      | GENERICINST (CLASS | VALUETYPE) TypeDefOrRefEncoded GenArgCount Type*
     //      | VAR Number
     //      | MVAR Number
-    switch(nElementType)
-    {
-    case ELEMENT_TYPE_BOOLEAN        :
-    case ELEMENT_TYPE_CHAR           :
-    case ELEMENT_TYPE_I1             :
-    case ELEMENT_TYPE_U1             :
-    case ELEMENT_TYPE_I2             :
-    case ELEMENT_TYPE_U2             :
-    case ELEMENT_TYPE_I4             :
-    case ELEMENT_TYPE_U4             :
-    case ELEMENT_TYPE_I8             :
-    case ELEMENT_TYPE_U8             :
-    case ELEMENT_TYPE_R4             :
-    case ELEMENT_TYPE_R8             :
-    case ELEMENT_TYPE_I              :
-    case ELEMENT_TYPE_U              :
-    case ELEMENT_TYPE_STRING         :
-    case ELEMENT_TYPE_OBJECT         :
-        return TRUE;
-
-    case ELEMENT_TYPE_VALUETYPE      :
-    case ELEMENT_TYPE_CLASS          :
-        /* TypeDef_or_TypeRef = */ ::CorSigUncompressToken(pSignature);
-        EnsureWithin(pSignature);
-        return TRUE;
-
-    case ELEMENT_TYPE_PTR            :
-        nElementType = this->BypassOptCustomMod(pSignature);
-        if(ELEMENT_TYPE_VOID == nElementType)
-            return TRUE;
-        return this->ParseTypeSig(nElementType, pSignature);
-
-    case ELEMENT_TYPE_FNPTR          :
-        return this->ParseMethodSig(pSignature);
-
-    case ELEMENT_TYPE_ARRAY          :
-        return this->ParseTypeSig(pSignature) && this->ParseArrayShapeSig(pSignature);
-
-    case ELEMENT_TYPE_SZARRAY        :
-        nElementType = this->BypassOptCustomMod(pSignature);
-        return this->ParseTypeSig(nElementType, pSignature);
-
-    case ELEMENT_TYPE_GENERICINST    :
-        nElementType = ::CorSigUncompressElementType(pSignature);
-        this->EnsureWithin(pSignature);
-        if((ELEMENT_TYPE_CLASS != nElementType) && (ELEMENT_TYPE_VALUETYPE != nElementType))
-            return FALSE;
-        /* TypeDef_or_TypeRef = */ ::CorSigUncompressToken(pSignature);
-        this->EnsureWithin(pSignature);
-        {
-            ULONG nGenericArgumentsCount = ::CorSigUncompressData(pSignature);
-            this->EnsureWithin(pSignature);
+    PARSE_FRAME xFrame = { 1, SLOT_TYPE, FALSE };
+    return this->ParseItems(pSignature, &xFrame, ELEMENT_TYPE_END);
+}
 
-            for(ULONG i = 0; i < nGenericArgumentsCount; i++)
-            {
-                if(!this->ParseTypeSig(pSignature))
-                    return FALSE;
-            }
-        }
-        return TRUE;
-
-    case ELEMENT_TYPE_VAR            :
-    case ELEMENT_TYPE_MVAR           :
-        /* index = */ ::CorSigUncompressData(pSignature);
-        this->EnsureWithin(pSignature);
-        return TRUE;
-
-    case ELEMENT_TYPE_END            :
-    case ELEMENT_TYPE_VOID           :
-    case ELEMENT_TYPE_CMOD_REQD      :
-    case ELEMENT_TYPE_CMOD_OPT       :
-    case ELEMENT_TYPE_INTERNAL       :
-    case ELEMENT_TYPE_MAX            :
-    case ELEMENT_TYPE_MODIFIER       :
-    case ELEMENT_TYPE_SENTINEL       :
-    case ELEMENT_TYPE_PINNED         :
-    //case ELEMENT_TYPE_R4_HFA         :
-    //case ELEMENT_TYPE_R8_HFA         :
-    default:
-        ASSERT(FALSE);
-        return FALSE;
-    }
+BOOL CSignatureBlob::ParseTypeSig(CorElementType nElementType, PCCOR_SIGNATURE& pSignature) const
+{
+    PARSE_FRAME xFrame = { 1, SLOT_TYPE, FALSE };
+    return this->ParseItems(pSignature, &xFrame, nElementType);
 }
 
 BOOL CSignatureBlob::ParseArrayShapeSig(PCCOR_SIGNATURE &pSignature) const
 {
     //-----------------------------------------------------------------------------------
     //  ArrayShape ::= Rank NumSizes Size* NumLoBounds LoBound*
-    ULONG nRank = ::CorSigUncompressData(pSignature);
-    DBG_UNREFERENCED_LOCAL_VARIABLE(nRank);
+    //  Each count is checked against the bytes left, one byte per integer at least, so the
+    //  integers themselves are checked once per list.
+    /* Rank = */ UncompressData(pSignature);
+    ULONG nNumberOfSizes = UncompressData(pSignature);
     this->EnsureWithin(pSignature);
-    
-    ULONG nNumberOfSize = ::CorSigUncompressData(pSignature);
-    this->EnsureWithin(pSignature);
-    
-    for(ULONG i = 0; i < nNumberOfSize; i++)
+    if(nNumberOfSizes > (ULONG)((PCCOR_SIGNATURE)this->GetTailAddress() - pSignature))
     {
-        ULONG nSize = ::CorSigUncompressData(pSignature);
-        DBG_UNREFERENCED_LOCAL_VARIABLE(nSize);
-        this->EnsureWithin(pSignature);
+        return FALSE;
+    }
+    for(ULONG i = 0; i < nNumberOfSizes; i++)
+    {
+        /* Size = */ UncompressData(pSignature);
     }
 
-    ULONG nNumberOfLowerbound = ::CorSigUncompressData(pSignature);
+    ULONG nNumberOfLowerbounds = UncompressData(pSignature);
     this->EnsureWithin(pSignature);
-
-    for(ULONG i = 0; i < nNumberOfLowerbound; i++)
+    if(nNumberOfLowerbounds > (ULONG)((PCCOR_SIGNATURE)this->GetTailAddress() - pSignature))
     {
-        ULONG nLowerbound = ::CorSigUncompressData(pSignature);
-        DBG_UNREFERENCED_LOCAL_VARIABLE(nLowerbound);
-        this->EnsureWithin(pSignature);
+        return FALSE;
     }
-
+    for(ULONG i = 0; i < nNumberOfLowerbounds; i++)
+    {
+        /* LoBound = */ UncompressData(pSignature);
+    }
+    this->EnsureWithin(pSignature);
     return TRUE;
 }
 
@@ -200,30 +241,14 @@ BOOL CSignatureBlob::ParseParameterSig(PCCOR_SIGNATURE &pSignature) const
     ASSERT(HitTest(pSignature));
     //-----------------------------------------------------------------------------------
     //  Param ::= CustomMod* ( TYPEDBYREF | [BYREF] Type )
-    CorElementType nElementType = this->BypassOptCustomMod(pSignature);
-    EnsureWithin(pSignature);
-    return this->ParseParameterSig(nElementType, pSignature);
+    PARSE_FRAME xFrame = { 1, SLOT_PARAM, FALSE };
+    return this->ParseItems(pSignature, &xFrame, ELEMENT_TYPE_END);
 }
 
 BOOL CSignatureBlob::ParseParameterSig(CorElementType nElementType, PCCOR_SIGNATURE &pSignature) const
 {
-    //-----------------------------------------------------------------------------------
-    //  Param ::= CustomMod* ( TYPEDBYREF | [BYREF] Type )
-    switch(nElementType)
-    {
-    case ELEMENT_TYPE_CMOD_REQD      :
-    case ELEMENT_TYPE_CMOD_OPT       :
-        return this->ParseParameterSig(pSignature);
-
-    case ELEMENT_TYPE_TYPEDBYREF     :
-        return TRUE;
-
-    case ELEMENT_TYPE_BYREF          :
-        return this->ParseTypeSig(pSignature);
-
-    default:
-        return FALSE;
-    }
+    PARSE_FRAME xFrame = { 1, SLOT_PARAM, FALSE };
+    return this->ParseItems(pSignature, &xFrame, nElementType);
 }
 
 BOOL CSignatureBlob::ParseMethodSig(PCCOR_SIGNATURE &pSignature) const
@@ -237,24 +262,155 @@ BOOL CSignatureBlob::ParseMethodSig(PCCOR_SIGNATURE &pSignature) const
     //      [HASTHIS [EXPLICITTHIS]] VARARG ParamCount
     //      RetTypeSig ([SENTINEL] ParamSig)*
 
-    ULONG nParamCount = GetParamCountFromMethodSig(pSignature);
-
-    if(!this->ParseRetTypeSig(pSignature))
-        return FALSE;
+    // The return type is parsed first, so it is on top of the parameters.
+    PARSE_FRAME vFrames[2] = { { 0, SLOT_PARAM, FALSE }, { 1, SLOT_RET_TYPE, FALSE } };
+    vFrames[0].nRemaining = this->GetParamCountFromMethodSig(pSignature);
+    return this->ParseItems(pSignature, vFrames, ELEMENT_TYPE_END, _countof(vFrames));
+}
 
-    for(ULONG i = 0; i < nParamCount; i++)
+BOOL CSignatureBlob::ParseItems(PCCOR_SIGNATURE &pSignature, const PARSE_FRAME *pInitialFrames,
+                                CorElementType nFirstElementType, ULONG nInitialDepth,
+                                BOOL *pbTypeParameters) const
+{
+    //-----------------------------------------------------------------------------------
+    //  The items of a signature are parsed in a loop, the nested ones on an explicit stack of
+    //  frames, each counting the items left at its level. An item is an element type with the
+    //  modifiers before it and the fixed fields after it (tokens, numbers, counts), so its
+    //  bounds are checked once it is read. Prefixes with a single type after them (PTR,
+    //  BYREF, SZARRAY) only change the slot of the next item, and take no frame.
+
+    PARSE_FRAME vFrames[MAX_SIGNATURE_NESTING];
+    ::memcpy(vFrames, pInitialFrames, nInitialDepth * sizeof(PARSE_FRAME));
+    ULONG nDepth = nInitialDepth;
+    ULONG nElementType = nFirstElementType;  // ELEMENT_TYPE_END if not read yet
+
+    for(;;)
     {
-        CorElementType nElementType = ::CorSigUncompressElementType(pSignature);
-        this->EnsureWithin(pSignature);
+        // Close the levels whose items are all read, then take the next item.
+        while(0 == vFrames[nDepth - 1].nRemaining)
+        {
+            BOOL bArrayShape = vFrames[nDepth - 1].bArrayShape;
+            if(bArrayShape && !this->ParseArrayShapeSig(pSignature))
+            {
+                return FALSE;
+            }
+            if(0 == --nDepth)
+            {
+                return TRUE;
+            }
+        }
+        vFrames[nDepth - 1].nRemaining--;
+        ULONG nSlot = vFrames[nDepth - 1].nSlot;
 
-        if( (ELEMENT_TYPE_SENTINEL == nElementType)
-            ? this->ParseParameterSig(pSignature) : this->ParseParameterSig(nElementType, pSignature) )
+        for(;;)
         {
-            return FALSE;
+            if(ELEMENT_TYPE_END == nElementType)
+            {
+                nElementType = *pSignature++;
+            }
+            BYTE nCategory = GetCategory(nElementType);
+            while((CATEGORY_MODIFIER == nCategory) || (CATEGORY_SENTINEL == nCategory))
+            {
+                if(0 == (SLOT_CATEGORIES[nSlot] & CATEGORY_BIT(nCategory)))
+                {
+                    return FALSE;
+                }
+                if(CATEGORY_MODIFIER == nCategory)
+                {
+                    /* TypeDef_or_TypeRef = */ UncompressData(pSignature);
+                }
+                this->EnsureWithin(pSignature);
+                nElementType = *pSignature++;
+                nCategory = GetCategory(nElementType);
+            }
+            if(0 == (SLOT_CATEGORIES[nSlot] & CATEGORY_BIT(nCategory)))
+            {
+                return FALSE;
+            }
+            nElementType = ELEMENT_TYPE_END;
+
+            // Read the fields of the item, and decide where the next item goes.
+            ULONG nNestedCount = 0;
+            BYTE nNestedSlot = SLOT_TYPE;
+            BOOL bArrayShape = FALSE;
+            switch(nCategory)
+            {
+            case CATEGORY_NUMBER:
+                if(NULL != pbTypeParameters)
+                {
+                    *pbTypeParameters = TRUE;
+                }
+                UncompressData(pSignature);
+                break;
+
+            case CATEGORY_TOKEN:
+                UncompressData(pSignature);
+                break;
+
+            case CATEGORY_PTR:
+                nSlot = SLOT_PTR_TARGET;
+                this->EnsureWithin(pSignature);
+                continue;
+
+            case CATEGORY_BYREF:
+            case CATEGORY_SZARRAY:
+                nSlot = SLOT_TYPE;
+                this->EnsureWithin(pSignature);
+                continue;
+
+            case CATEGORY_ARRAY:
+                nNestedCount = 1;
+                bArrayShape = TRUE;
+                break;
+
+            case CATEGORY_GENERICINST:
+                nElementType = *pSignature++;
+                if((ELEMENT_TYPE_CLASS != nElementType) && (ELEMENT_TYPE_VALUETYPE != nElementType))
+                {
+                    return FALSE;
+                }
+                nElementType = ELEMENT_TYPE_END;
+                /* TypeDef_or_TypeRef = */ UncompressData(pSignature);
+                nNestedCount = UncompressData(pSignature);
+                break;
+
+            case CATEGORY_FNPTR:
+                {
+                    // Parameters below, the return type on top of them.
+                    ULONG nCallingConvention = *pSignature++;
+                    if(IMAGE_CEE_CS_CALLCONV_GENERIC & nCallingConvention)
+                    {
+                        /* GenParamCount = */ UncompressData(pSignature);
+                    }
+                    ULONG nParamCount = UncompressData(pSignature);
+                    if(MAX_SIGNATURE_NESTING == nDepth)
+                    {
+                        return FALSE;
+                    }
+                    PARSE_FRAME xParams = { nParamCount, SLOT_PARAM, FALSE };
+                    vFrames[nDepth++] = xParams;
+                    nNestedCount = 1;
+                    nNestedSlot = SLOT_RET_TYPE;
+                }
+                break;
+
+            default:
+                break;  // PRIMITIVE, VOID, TYPEDBYREF
+            }
+            this->EnsureWithin(pSignature);
+
+            if((0 < nNestedCount) || bArrayShape)
+            {
+                if(MAX_SIGNATURE_NESTING == nDepth)
+                {
+                    return FALSE;
+                }
+                PARSE_FRAME xNested = { nNestedCount, nNestedSlot, (BYTE)bArrayShape };
+                vFrames[nDepth++] = xNested;
+            }
+            break;
         }
     }
-
-    return TRUE;
 }
 
 ULONG CSignatureBlob::GetParamCountFromMethodSig(PCCOR_SIGNATURE &pSignature) const
@@ -267,36 +423,106 @@ ULONG CSignatureBlob::GetParamCountFromMethodSig(PCCOR_SIGNATURE &pSignature) co
     //      [SENTINEL Param+]
 
     // HASTHIS, EXPLICTTHIS, DEFAULT, VARARG, GENERIC are composited in CorCallingConvention
-    ULONG nCallingConvention = ::CorSigUncompressCallingConv(pSignature);
-    EnsureWithin(pSignature);
-
+    ULONG nCallingConvention = *pSignature++;
     if(IMAGE_CEE_CS_CALLCONV_GENERIC & nCallingConvention) // GENERIC
     {
         // GenParamCount (that following GENERIC)
-        ULONG nGenParamCount = ::CorSigUncompressData(pSignature);
-        DBG_UNREFERENCED_LOCAL_VARIABLE(nGenParamCount);
-        EnsureWithin(pSignature);
+        /* GenParamCount = */ UncompressData(pSignature);
     }
 
     // ParamCount
-    ULONG nParamCount = ::CorSigUncompressData(pSignature);
+    ULONG nParamCount = UncompressData(pSignature);
     EnsureWithin(pSignature);
     return nParamCount;
 }
 
+CorElementType CSignatureBlob::FindPrimitiveType(LPCTSTR pstrTypeName)
+{
+    ASSERT(NULL != pstrTypeName);
+
+    static const struct
+    {
+        LPCTSTR pstrTypeName;
+        CorElementType nElementType;
+    } vPrimitiveTypes[] =
+    {
+        {_T("System.Boolean"),        ELEMENT_TYPE_BOOLEAN},
+        {_T("System.Char"),           ELEMENT_TYPE_CHAR},
+        {_T("System.SByte"),          ELEMENT_TYPE_I1},
+        {_T("System.Byte"),           ELEMENT_TYPE_U1},
+        {_T("System.Int16"),          ELEMENT_TYPE_I2},
+        {_T("System.UInt16"),         ELEMENT_TYPE_U2},
+        {_T("System.Int32"),          ELEMENT_TYPE_I4},
+        {_T("System.UInt32"),         ELEMENT_TYPE_U4},
+        {_T("System.Int64"),          ELEMENT_TYPE_I8},
+        {_T("System.UInt64"),         ELEMENT_TYPE_U8},
+        {_T("System.Single"),         ELEMENT_TYPE_R4},
+        {_T("System.Double"),         ELEMENT_TYPE_R8},
+        {_T("System.IntPtr"),         ELEMENT_TYPE_I},
+        {_T("System.UIntPtr"),        ELEMENT_TYPE_U},
+        {_T("System.String"),         ELEMENT_TYPE_STRING},
+        {_T("System.Object"),         ELEMENT_TYPE_OBJECT},
+        {_T("System.TypedReference"), ELEMENT_TYPE_TYPEDBYREF},
+    };
+    for(size_t i = 0; i < _countof(vPrimitiveTypes); i++)
+    {
+        if(0 == _tcscmp(vPrimitiveTypes[i].pstrTypeName, pstrTypeName))
+        {
+            return vPrimitiveTypes[i].nElementType;
+        }
+    }
+    return ELEMENT_TYPE_END;
+}
+
 CorElementType CSignatureBlob::BypassOptCustomMod(PCCOR_SIGNATURE& pSignature) const
 {
     ASSERT(HitTest(pSignature));
     //-----------------------------------------------------------------------------------
-    //  CustMod* ::= (CMOD_REQD | CMOD_OPT)*
+    //  CustMod* ::= ((CMOD_REQD | CMOD_OPT) TypeDefOrRefEncoded)*
 
-    CorElementType nElementType;
-    do
+    ULONG nElementType = *pSignature++;
+    while(CATEGORY_MODIFIER == GetCategory(nElementType))
     {
-        nElementType = ::CorSigUncompressElementType(pSignature);
-        this->EnsureWithin(pSignature);
+        /* TypeDef_or_TypeRef = */ UncompressData(pSignature);
+        nElementType = *pSignature++;
     }
-    while((ELEMENT_TYPE_CMOD_REQD == nElementType) || (ELEMENT_TYPE_CMOD_OPT == nElementType));
+    this->EnsureWithin(pSignature);
+    return (CorElementType)nElementType;
+}
+
+#pragma endregion
+
+#pragma region Implementation of CCanonicalSigHash
 
-    return nElementType;
+void CCanonicalSigHash::AddByte(BYTE nByte)
+{
+    this->m_nHash ^= nByte;
+    this->m_nHash *= 1099511628211ULL;
+}
+
+void CCanonicalSigHash::AddElementType(CorElementType nElementType)
+{
+    this->AddByte((BYTE)nElementType);
+}
+
+void CCanonicalSigHash::AddTypeName(LPCTSTR pstrTypeName, int nLength)
+{
+    ASSERT(NULL != pstrTypeName);
+
+    for(int i = 0; i < nLength; i++)
+    {
+        WCHAR wChar = (WCHAR)(_TUCHAR)pstrTypeName[i];
+        this->AddByte(LOBYTE(wChar));
+        this->AddByte(HIBYTE(wChar));
+    }
+    this->AddByte(0);
+    this->AddByte(0);
 }
+
+ULONGLONG CCanonicalSigHash::GetHash(void) const
+{
+    // 0 stands for all overloads in the method filter, and for methods which can not be hashed.
+    return (0 == this->m_nHash) ? 1 : this->m_nHash;
+}
+
+#pragma endregion
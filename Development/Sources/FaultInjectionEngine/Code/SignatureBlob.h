@@ -19,17 +19,57 @@ public:
     void EnsureWithin(PCCOR_SIGNATURE pTailOfSignature) const;
     BOOL ParseRetTypeSig(PCCOR_SIGNATURE &pSignature) const;
     BOOL ParseRetTypeSig(CorElementType nElementType, PCCOR_SIGNATURE &pSignature) const;
+    BOOL ParseRetTypeSig(PCCOR_SIGNATURE &pSignature, BOOL &rbTypeParameters) const;
     BOOL ParseTypeSig(PCCOR_SIGNATURE &pSignature) const;
     BOOL ParseTypeSig(CorElementType nElementType, PCCOR_SIGNATURE &pSignature) const;
     BOOL ParseMethodSig(PCCOR_SIGNATURE &pSignature) const;
     BOOL ParseParameterSig(PCCOR_SIGNATURE &pSignature) const;
     BOOL ParseParameterSig(CorElementType nElementType, PCCOR_SIGNATURE &pSignature) const;
     BOOL ParseArrayShapeSig(PCCOR_SIGNATURE &pSignature) const;
+    CorElementType BypassOptCustomMod(PCCOR_SIGNATURE& pSignature) const;
+    static CorElementType FindPrimitiveType(LPCTSTR pstrTypeName);
 
 protected:
     PCCOR_SIGNATURE RefSignature(void) const;
-    CorElementType BypassOptCustomMod(PCCOR_SIGNATURE& pSignature) const;
     ULONG GetParamCountFromMethodSig(PCCOR_SIGNATURE &pSignature) const;
+
+private:
+    /// <summary>
+    /// A level of nesting while the signature is parsed: the items left at the level, what they
+    /// may be, and whether an array shape follows them
+    /// </summary>
+    struct PARSE_FRAME
+    {
+        ULONG nRemaining;
+        BYTE nSlot;
+        BYTE bArrayShape;
+    };
+
+    BOOL ParseItems(PCCOR_SIGNATURE &pSignature, const PARSE_FRAME *pInitialFrames,
+        CorElementType nFirstElementType, ULONG nInitialDepth = 1, BOOL *pbTypeParameters = NULL) const;
+};
+
+//-----------------------------------------------------------------------------------
+//  FNV-1a of the canonical form of parameter types, which both a method signature and the
+//  parameter list of a method filter line are reduced to, so their hashes can be compared:
+//      Param ::= Type [BYREF] SENTINEL
+//      Type  ::= primitive | CLASS Name | GENERICINST Name Type* END | Type SZARRAY | Type ARRAY Rank
+//  Name is the full-qualified type name in UTF-16 followed by 0 (without the arity of generic
+//  types). Value types and classes are both CLASS, as a line can not tell them apart, and a type
+//  named like a primitive is the primitive.
+struct CCanonicalSigHash
+{
+public:
+    CCanonicalSigHash(void) : m_nHash(14695981039346656037ULL) {};
+
+public:
+    void AddByte(BYTE nByte);
+    void AddElementType(CorElementType nElementType);
+    void AddTypeName(LPCTSTR pstrTypeName, int nLength);
+    ULONGLONG GetHash(void) const;
+
+private:
+    ULONGLONG m_nHash;
 };
 
 END_DEFAULT_NAMESPACE
@@ -0,0 +1,96 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include <limits>
+#include "StaticFault.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Implementation of CStaticFault
+
+BOOL CStaticFault::Parse(LPCTSTR pstrDescriptor)
+{
+    ASSERT(NULL != pstrDescriptor);
+
+    this->m_nKind = FAULT_NONE;
+    this->m_szDescriptor = pstrDescriptor;
+    this->m_szDescriptor.Trim();
+
+    int nSeparator = this->m_szDescriptor.Find(_T('='));
+    if(nSeparator <= 0)
+    {
+        return FALSE;
+    }
+    CString szKey = this->m_szDescriptor.Left(nSeparator);
+    CString szArgument = this->m_szDescriptor.Mid(nSeparator + 1);
+
+    if(szKey == _T("throw"))
+    {
+        // [Assembly]Namespace.Type
+        int nClose = szArgument.Find(_T(']'));
+        if((0 != szArgument.Find(_T('['))) || (nClose <= 1) || (nClose + 1 == szArgument.GetLength()))
+        {
+            return FALSE;
+        }
+        this->m_szAssemblyName = szArgument.Mid(1, nClose - 1);
+        this->m_szTypeName = szArgument.Mid(nClose + 1);
+        this->m_nKind = FAULT_THROW;
+        return TRUE;
+    }
+
+    if(szKey == _T("return"))
+    {
+        if(szArgument == _T("null"))
+        {
+            this->m_nKind = FAULT_RETURN_NULL;
+            return TRUE;
+        }
+
+        // Namespace.Type:Value
+        int nColon = szArgument.Find(_T(':'));
+        if((nColon <= 0) || (nColon + 1 == szArgument.GetLength()))
+        {
+            return FALSE;
+        }
+        this->m_szTypeName = szArgument.Left(nColon);
+        this->m_szValue = szArgument.Mid(nColon + 1);
+        this->m_nKind = FAULT_RETURN_VALUE;
+        return TRUE;
+    }
+
+    if(szKey == _T("delay"))
+    {
+        if(!CLatencyFault::Parse(szArgument, this->m_xLatency))
+        {
+            return FALSE;
+        }
+        this->m_nKind = FAULT_DELAY;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+double CStaticFault::GetRealValue(void) const
+{
+    // Reals are written with the round-trip format of the invariant culture, whose symbols
+    // for the special values are not read by the C runtime.
+    if(this->m_szValue == _T("NaN"))
+    {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    if(this->m_szValue == _T("Infinity"))
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+    if(this->m_szValue == _T("-Infinity"))
+    {
+        return -std::numeric_limits<double>::infinity();
+    }
+    return _tcstod(this->m_szValue, NULL);
+}
+
+#pragma endregion
@@ -0,0 +1,86 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  Declaration of class CStaticFault.
+//  A static fault occurs on every call and is known when the process starts, so it is
+//  compiled into the prologue of the method instead of a call to FaultDispatcher.Trap.
+//  It is given in the method filter after the method name, separated by a tab:
+//      throw=[Assembly]Namespace.ExceptionType     throw a new exception (default constructor)
+//      return=null                                 return null, or just return if void
+//      return=System.Int32:5                       return a constant of a primitive type
+//      delay=spin:fixed:50000:0                    delay the call, then run the original code
+//                                                  (see LatencyFault.h)
+//
+
+#pragma once
+
+#include "LatencyFault.h"
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Declaration of CStaticFault
+
+class CStaticFault
+{
+public:
+    enum FAULT_KIND
+    {
+        FAULT_NONE,
+        FAULT_THROW,
+        FAULT_RETURN_NULL,
+        FAULT_RETURN_VALUE,
+        FAULT_DELAY,
+    };
+
+public:
+    CStaticFault(void) : m_nKind(FAULT_NONE) {};
+    ~CStaticFault(void) {};
+
+public:
+    /// <summary>
+    /// Parse the fault descriptor. Return FALSE (and leave the fault undefined) if it is malformed.
+    /// </summary>
+    BOOL Parse(LPCTSTR pstrDescriptor);
+
+    BOOL IsDefined(void) const { return (FAULT_NONE != this->m_nKind); };
+    FAULT_KIND GetKind(void) const { return this->m_nKind; };
+    LPCTSTR GetDescriptor(void) const { return this->m_szDescriptor; };
+
+    /// <summary>
+    /// Assembly of the exception type, for FAULT_THROW.
+    /// </summary>
+    LPCTSTR GetAssemblyName(void) const { return this->m_szAssemblyName; };
+
+    /// <summary>
+    /// Full qualified name of the exception type (FAULT_THROW) or of the returned value's
+    /// type (FAULT_RETURN_VALUE).
+    /// </summary>
+    LPCTSTR GetTypeName(void) const { return this->m_szTypeName; };
+
+    /// <summary>
+    /// Returned value, for FAULT_RETURN_VALUE.
+    /// </summary>
+    LONGLONG GetIntegerValue(void) const { return _tcstoi64(this->m_szValue, NULL, 10); };
+    ULONGLONG GetUnsignedIntegerValue(void) const { return _tcstoui64(this->m_szValue, NULL, 10); };
+    double GetRealValue(void) const;
+
+    /// <summary>
+    /// Delay of the call, for FAULT_DELAY.
+    /// </summary>
+    const CLatencyFault::LATENCY_SPEC& GetLatency(void) const { return this->m_xLatency; };
+
+private:
+    FAULT_KIND m_nKind;
+    CString m_szDescriptor;
+    CString m_szAssemblyName;
+    CString m_szTypeName;
+    CString m_szValue;
+    CLatencyFault::LATENCY_SPEC m_xLatency;
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
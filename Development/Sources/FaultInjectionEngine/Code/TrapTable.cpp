@@ -0,0 +1,241 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+#include "stdafx.h"
+#include "TrapTable.h"
+#include "TraceAndLog.h"
+
+USING_DEFAULT_NAMESPACE
+
+#pragma region Implementation of CTrapTable
+
+CComAutoCriticalSection CTrapTable::m_csEntries;
+CAtlArray<CTrapTable::TRAP_ENTRY> CTrapTable::m_vEntries;
+CTrapTable::CTrapIdMap CTrapTable::m_mapTrapIds;
+CTrapTable::CTrapIdMap CTrapTable::m_mapCallSiteTrapIds;
+CTrapTable::TRAP_GATE CTrapTable::m_vGates[PREFERRED_MAX_TRAP_GATE_COUNT];
+CTrapTable::TRAP_GATE CTrapTable::m_xSharedGate = {0, LONG_MIN, 1};  // open whatever the counter is
+
+C_ASSERT(64 == sizeof(CTrapTable::TRAP_GATE));
+
+ULONG CTrapTable::Register(ModuleID moduleId, REFGUID rxModuleVersionId, mdMethodDef tkMethodDef,
+                           LPCTSTR pstrFullQualifiedMethodName)
+{
+    return AssignTrapId(m_mapTrapIds, moduleId, rxModuleVersionId, tkMethodDef, pstrFullQualifiedMethodName);
+}
+
+ULONG CTrapTable::RegisterCallSite(ModuleID moduleId, REFGUID rxModuleVersionId, mdToken tkCallee,
+                                   LPCTSTR pstrFullQualifiedCalleeName)
+{
+    // A callee in the same module has the method-def token it would be registered with when
+    // trapped itself, so the call sites are kept in a map of their own.
+    return AssignTrapId(m_mapCallSiteTrapIds, moduleId, rxModuleVersionId, tkCallee, pstrFullQualifiedCalleeName);
+}
+
+ULONG CTrapTable::AssignTrapId(CTrapIdMap &rmapTrapIds, ModuleID moduleId, REFGUID rxModuleVersionId,
+                               mdToken tkMethodDef, LPCTSTR pstrFullQualifiedMethodName)
+{
+    ASSERT(NULL != pstrFullQualifiedMethodName);
+
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csEntries);
+
+    // A method may be JIT-compiled more than once (e.g. in different app-domains, or by ReJIT),
+    // it keeps the id assigned at first time.
+    METHOD_KEY xKey = {moduleId, tkMethodDef};
+    ULONG nTrapId;
+    if(rmapTrapIds.Lookup(xKey, nTrapId))
+    {
+        return nTrapId;
+    }
+
+    TRAP_ENTRY xEntry;
+    xEntry.moduleId = moduleId;
+    xEntry.xModuleVersionId = rxModuleVersionId;
+    xEntry.tkMethodDef = tkMethodDef;
+    xEntry.szFullQualifiedMethodName = pstrFullQualifiedMethodName;
+    nTrapId = (ULONG)m_vEntries.Add(xEntry);
+    rmapTrapIds.SetAt(xKey, nTrapId);
+    if(nTrapId < PREFERRED_MAX_TRAP_GATE_COUNT)
+    {
+        // armed and open until the dispatcher sets a threshold for it
+        m_vGates[nTrapId].nCalls = 0;
+        m_vGates[nTrapId].nThreshold = 0;
+        m_vGates[nTrapId].bArmed = 1;
+    }
+
+    DebugTrace(_T("Trap #%d is assigned to %s (token 0x%08X)"), nTrapId, pstrFullQualifiedMethodName, tkMethodDef);
+    return nTrapId;
+}
+
+ULONG CTrapTable::GetCount(void)
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csEntries);
+    return (ULONG)m_vEntries.GetCount();
+}
+
+BOOL CTrapTable::Lookup(ULONG nTrapId, GUID &rxModuleVersionId, mdMethodDef &rtkMethodDef)
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csEntries);
+    if(nTrapId >= m_vEntries.GetCount())
+    {
+        return FALSE;
+    }
+
+    rxModuleVersionId = m_vEntries[nTrapId].xModuleVersionId;
+    rtkMethodDef = m_vEntries[nTrapId].tkMethodDef;
+    return TRUE;
+}
+
+void CTrapTable::RemoveModule(ModuleID moduleId)
+{
+    CComCritSecLock<CComAutoCriticalSection> xLock(m_csEntries);
+
+    // The dispatcher may still hold the trap ids, so the entries are kept. Their methods are
+    // registered again under new ids if the module id comes back.
+    RemoveModule(m_mapTrapIds, moduleId);
+    RemoveModule(m_mapCallSiteTrapIds, moduleId);
+}
+
+void CTrapTable::RemoveModule(CTrapIdMap &rmapTrapIds, ModuleID moduleId)
+{
+    POSITION pos = rmapTrapIds.GetStartPosition();
+    while(NULL != pos)
+    {
+        POSITION posCurrent = pos;
+        if(rmapTrapIds.GetNext(pos)->m_key.moduleId == moduleId)
+        {
+            rmapTrapIds.RemoveAtPos(posCurrent);
+        }
+    }
+}
+
+CTrapTable::TRAP_GATE* CTrapTable::GetGate(ULONG nTrapId)
+{
+    if(nTrapId >= PREFERRED_MAX_TRAP_GATE_COUNT)
+    {
+        DebugTrace(_T("Trap #%d has no gate of its own and calls Trap every time"), nTrapId);
+        return &m_xSharedGate;
+    }
+    return &m_vGates[nTrapId];
+}
+
+LONG CTrapTable::TakeCalls(ULONG nTrapId)
+{
+    if(nTrapId >= PREFERRED_MAX_TRAP_GATE_COUNT)
+    {
+        return 1;
+    }
+    return ::InterlockedExchange(&m_vGates[nTrapId].nCalls, 0);
+}
+
+BOOL CTrapTable::SetThreshold(ULONG nTrapId, LONG nThreshold)
+{
+    if((nTrapId >= PREFERRED_MAX_TRAP_GATE_COUNT) || (nTrapId >= GetCount()))
+    {
+        return FALSE;
+    }
+    TRAP_GATE &rxGate = m_vGates[nTrapId];
+    if(LONG_MAX == nThreshold)
+    {
+        rxGate.bArmed = 0;
+        rxGate.nThreshold = nThreshold;
+    }
+    else
+    {
+        // The threshold is written first, so a prologue which finds the gate armed compares
+        // the counter with it.
+        rxGate.nThreshold = nThreshold;
+        rxGate.bArmed = 1;
+    }
+    return TRUE;
+}
+
+void CTrapTable::ResetAll(BOOL bDiscardCalls)
+{
+    ULONG nCount = min(GetCount(), (ULONG)PREFERRED_MAX_TRAP_GATE_COUNT);
+    for(ULONG i = 0; i < nCount; i++)
+    {
+        m_vGates[i].nThreshold = 0;
+        if(bDiscardCalls)
+        {
+            m_vGates[i].nCalls = 0;
+        }
+        m_vGates[i].bArmed = 1;
+    }
+}
+
+#pragma endregion
+
+#pragma region Exported Functions (Called by FaultDispatcher)
+
+extern "C" ULONG WINAPI FaultEngineGetTrapCount(void)
+{
+    return CTrapTable::GetCount();
+}
+
+extern "C" BOOL WINAPI FaultEngineGetTrapInfo(ULONG nTrapId, GUID *pxModuleVersionId, mdMethodDef *ptkMethodDef)
+{
+    if((NULL == pxModuleVersionId) || (NULL == ptkMethodDef))
+    {
+        return FALSE;
+    }
+    return CTrapTable::Lookup(nTrapId, *pxModuleVersionId, *ptkMethodDef);
+}
+
+extern "C" LONG WINAPI FaultEngineTakeTrapCalls(ULONG nTrapId)
+{
+    return CTrapTable::TakeCalls(nTrapId);
+}
+
+extern "C" BOOL WINAPI FaultEngineSetTrapThreshold(ULONG nTrapId, LONG nThreshold)
+{
+    return CTrapTable::SetThreshold(nTrapId, nThreshold);
+}
+
+extern "C" void WINAPI FaultEngineResetTraps(BOOL bDiscardCalls)
+{
+    CTrapTable::ResetAll(bDiscardCalls);
+}
+
+#pragma endregion
+
+#if defined(FAULT_ENGINE_TEST_EXPORTS)
+
+#pragma region Exported Functions (Called by Tests)
+
+extern "C" ULONG WINAPI FaultEngineRegisterTrap(ModuleID moduleId, const GUID *pxModuleVersionId, mdMethodDef tkMethodDef)
+{
+    if(NULL == pxModuleVersionId)
+    {
+        return ULONG_MAX;
+    }
+    return CTrapTable::Register(moduleId, *pxModuleVersionId, tkMethodDef, _T("(registered by test)"));
+}
+
+extern "C" ULONG WINAPI FaultEngineRegisterCallSiteTrap(ModuleID moduleId, const GUID *pxModuleVersionId, mdToken tkCallee)
+{
+    if(NULL == pxModuleVersionId)
+    {
+        return ULONG_MAX;
+    }
+    return CTrapTable::RegisterCallSite(moduleId, *pxModuleVersionId, tkCallee, _T("(registered by test)"));
+}
+
+extern "C" BOOL WINAPI FaultEngineGetTrapGate(ULONG nTrapId, UINT_PTR *pnAddress, BOOL *pbArmed, LONG *pnThreshold)
+{
+    if((NULL == pnAddress) || (NULL == pbArmed) || (NULL == pnThreshold) || (nTrapId >= CTrapTable::GetCount()))
+    {
+        return FALSE;
+    }
+    CTrapTable::TRAP_GATE *pGate = CTrapTable::GetGate(nTrapId);
+    *pnAddress = (UINT_PTR)pGate;
+    *pbArmed = (0 != pGate->bArmed);
+    *pnThreshold = pGate->nThreshold;
+    return TRUE;
+}
+
+#pragma endregion
+
+#endif // FAULT_ENGINE_TEST_EXPORTS
@@ -0,0 +1,147 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+//
+//  Declaration of class CTrapTable.
+//  Every trapped method gets a dense integer id (trap id), which is loaded by the
+//  prologue and passed to FaultDispatcher.Trap. The dispatcher gets the identity of
+//  a trap id (module version id and method-def token) from the exported functions,
+//  so it needs no stack walk to know which method is trapped. The calls to a callee
+//  trapped at its call sites get a trap id of their own, identified by the token of
+//  the call, so they never share the gate of the callee when it is trapped as well.
+//  Each trap id also has a gate in engine-owned memory: an armed flag, a call counter and
+//  a threshold. The prologue reads the armed flag first and skips the rest when it is
+//  cleared, so methods without an active rule cost a load and a branch. Otherwise it
+//  increments the counter and calls Trap only when it reaches the threshold. The
+//  dispatcher takes the counted calls and sets the threshold to the number of calls until
+//  the fault condition can trigger again, so call-count conditions cost a few instructions
+//  instead of a call to Trap.
+//
+
+#pragma once
+
+#include "Settings.h"
+
+BEGIN_DEFAULT_NAMESPACE
+
+#pragma region Declaration of CTrapTable
+
+class CTrapTable
+{
+public:
+    /// <summary>
+    /// Get the trap id of the method, assigning a new one if the method is not registered yet.
+    /// </summary>
+    static ULONG Register(ModuleID moduleId, REFGUID rxModuleVersionId, mdMethodDef tkMethodDef,
+        LPCTSTR pstrFullQualifiedMethodName);
+
+    /// <summary>
+    /// Get the trap id of the call sites of the callee in the module, assigning a new one if they
+    /// are not registered yet. tkCallee is the method-def or member-ref token of the calls.
+    /// </summary>
+    static ULONG RegisterCallSite(ModuleID moduleId, REFGUID rxModuleVersionId, mdToken tkCallee,
+        LPCTSTR pstrFullQualifiedCalleeName);
+
+    /// <summary>
+    /// Number of trap ids assigned so far. Valid ids are [0, GetCount()).
+    /// </summary>
+    static ULONG GetCount(void);
+
+    /// <summary>
+    /// Get the identity of the trapped method by its trap id. Return FALSE if the id is unknown.
+    /// </summary>
+    static BOOL Lookup(ULONG nTrapId, GUID &rxModuleVersionId, mdMethodDef &rtkMethodDef);
+
+    /// <summary>
+    /// Forget the methods of a module being unloaded, since its module id may be reused by a
+    /// module loaded later. Their trap ids stay assigned, and are never given to another method.
+    /// </summary>
+    static void RemoveModule(ModuleID moduleId);
+
+    // Every gate has a cache line of its own: the prologues of different methods write their
+    // counters from different threads, and must not invalidate each other's gates.
+    struct __declspec(align(64)) TRAP_GATE
+    {
+        volatile LONG nCalls;       // calls counted by the prologue since the dispatcher took them
+        volatile LONG nThreshold;   // the prologue calls Trap once nCalls reaches it
+        volatile BYTE bArmed;       // the prologue neither counts calls nor calls Trap when cleared
+    };
+
+    /// <summary>
+    /// Get the gate of the trap id, whose address is embedded into the prologue.
+    /// The address stays valid as long as the engine is loaded.
+    /// </summary>
+    static TRAP_GATE* GetGate(ULONG nTrapId);
+
+    /// <summary>
+    /// Take the calls counted since last time, resetting the counter. Trap ids which have
+    /// no gate of their own always report a single call.
+    /// </summary>
+    static LONG TakeCalls(ULONG nTrapId);
+
+    /// <summary>
+    /// Set the number of calls after which the prologue calls Trap again. LONG_MAX means never,
+    /// and disarms the gate: calls are no longer counted. Any other threshold arms it.
+    /// Return FALSE if the id is unknown or has no gate of its own.
+    /// </summary>
+    static BOOL SetThreshold(ULONG nTrapId, LONG nThreshold);
+
+    /// <summary>
+    /// Arm and reset all gates, so the next call of every trapped method calls Trap. The calls counted
+    /// so far are discarded on demand, when they do not count for the new fault rules.
+    /// </summary>
+    static void ResetAll(BOOL bDiscardCalls);
+
+private:
+    struct TRAP_ENTRY
+    {
+        ModuleID moduleId;
+        GUID xModuleVersionId;
+        mdMethodDef tkMethodDef;
+        CString szFullQualifiedMethodName;
+    };
+
+    struct METHOD_KEY
+    {
+        ModuleID moduleId;
+        mdToken tkMethodDef;  // or the token of the calls, for call sites
+    };
+
+    class CMethodKeyTraits : public CElementTraitsBase<METHOD_KEY>
+    {
+    public:
+        static ULONG Hash(const METHOD_KEY &rxKey)
+        {
+            // Method-def tokens of a module are dense, module ids are aligned pointers.
+            return (static_cast<ULONG>(rxKey.moduleId >> 4) * 31) ^ rxKey.tkMethodDef;
+        }
+
+        static bool CompareElements(const METHOD_KEY &rxKey1, const METHOD_KEY &rxKey2)
+        {
+            return (rxKey1.moduleId == rxKey2.moduleId) && (rxKey1.tkMethodDef == rxKey2.tkMethodDef);
+        }
+    };
+
+    typedef CAtlMap<METHOD_KEY, ULONG, CMethodKeyTraits> CTrapIdMap;
+
+    static ULONG AssignTrapId(CTrapIdMap &rmapTrapIds, ModuleID moduleId, REFGUID rxModuleVersionId,
+        mdToken tkMethodDef, LPCTSTR pstrFullQualifiedMethodName);
+    static void RemoveModule(CTrapIdMap &rmapTrapIds, ModuleID moduleId);
+
+    static CComAutoCriticalSection m_csEntries;  // JIT compilation happens on many threads
+    static CAtlArray<TRAP_ENTRY> m_vEntries;  // indexed by trap id
+    static CTrapIdMap m_mapTrapIds;  // methods of the loaded modules
+    static CTrapIdMap m_mapCallSiteTrapIds;  // call sites of the loaded modules, by callee
+
+    // Accessed by the prologues and the dispatcher without lock, an aligned LONG or a byte is
+    // read and written atomically. Trap ids beyond the capacity share a gate which is always open.
+    // Untouched gates cost address space only, the table is zero-initialized.
+    static TRAP_GATE m_vGates[PREFERRED_MAX_TRAP_GATE_COUNT];
+    static TRAP_GATE m_xSharedGate;
+};
+
+#pragma endregion
+
+END_DEFAULT_NAMESPACE
@@ -0,0 +1,200 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Diagnostics;
+using System.Threading;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Tests which attach the engine to a test application already running.
+    /// </summary>
+    public class AttachTests
+    {
+        #region Private Data
+
+        // Runs Warm before the engine is attached, then prints the results of Cold and Warm for
+        // each "call" line read from the standard input.
+        private const string WorkloadSource = @"
+using System;
+using System.Runtime.CompilerServices;
+
+namespace Workload
+{
+    static class Program
+    {
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        static int Cold() { return 0; }
+
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        static int Warm() { return 0; }
+
+        static int Main()
+        {
+            Warm();
+            Console.WriteLine(""ready"");
+            while (Console.ReadLine() == ""call"")
+            {
+                Console.WriteLine(""{0} {1}"", Cold(), Warm());
+            }
+            return 0;
+        }
+    }
+}";
+
+        // Prints, for each "call" line read from the standard input, the result of Trapped and the
+        // name of the method Where runs in. Both may be inlined into Caller, compiled after the
+        // engine is attached.
+        private const string InliningWorkloadSource = @"
+using System;
+using System.Diagnostics;
+using System.Runtime.CompilerServices;
+
+namespace Workload
+{
+    static class Program
+    {
+        [MethodImpl(MethodImplOptions.AggressiveInlining)]
+        static int Trapped() { return 0; }
+
+        [MethodImpl(MethodImplOptions.AggressiveInlining)]
+        static string Where() { return new StackTrace().GetFrame(0).GetMethod().Name; }
+
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        static string Caller() { return Trapped() + "" "" + Where(); }
+
+        static int Main()
+        {
+            Console.WriteLine(""ready"");
+            while (Console.ReadLine() == ""call"")
+            {
+                Console.WriteLine(Caller());
+            }
+            return 0;
+        }
+    }
+}";
+
+        #endregion
+
+        #region AttachTest
+
+        /// <summary>
+        /// Verifies that a method compiled after the engine is attached is faulted, and that a method
+        /// compiled before keeps its code.
+        /// </summary>
+        [Fact]
+        public void AttachTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("AttachWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Program.Cold()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(1)),
+                new FaultRule("static Workload.Program.Warm()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(1)));
+
+            using (Process process = workload.Start())
+            {
+                Assert.Equal("ready", process.StandardOutput.ReadLine());
+                session.AttachTo(process);
+
+                process.StandardInput.WriteLine("call");
+                Assert.Equal("1 0", process.StandardOutput.ReadLine());
+
+                process.StandardInput.WriteLine("exit");
+                process.WaitForExit();
+                Assert.Equal(0, process.ExitCode);
+            }
+        }
+
+        #endregion
+
+        #region InliningTest
+
+        /// <summary>
+        /// Verifies that an attached engine keeps trapped methods from being inlined, and lets
+        /// other methods be inlined.
+        /// </summary>
+        [Fact]
+        public void InliningTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("InliningWorkload", InliningWorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Program.Trapped()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(1)));
+
+            using (Process process = workload.Start())
+            {
+                Assert.Equal("ready", process.StandardOutput.ReadLine());
+                session.AttachTo(process);
+
+                process.StandardInput.WriteLine("call");
+                Assert.Equal("1 Caller", process.StandardOutput.ReadLine());
+
+                process.StandardInput.WriteLine("exit");
+                process.WaitForExit();
+                Assert.Equal(0, process.ExitCode);
+            }
+        }
+
+        #endregion
+
+        #region DetachTest
+
+        /// <summary>
+        /// Verifies that an attached engine which has not faulted any method yet is unloaded once
+        /// all rules are disarmed.
+        /// </summary>
+        [Fact]
+        public void DetachTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("DetachWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Program.Cold()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(1)));
+
+            using (Process process = workload.Start())
+            {
+                Assert.Equal("ready", process.StandardOutput.ReadLine());
+                session.AttachTo(process);
+                Assert.True(IsEngineLoaded(process));
+
+                session.Disarm();
+                Stopwatch timeout = Stopwatch.StartNew();
+                while (IsEngineLoaded(process))
+                {
+                    Assert.True(timeout.Elapsed < TimeSpan.FromSeconds(30), "Engine was not detached.");
+                    Thread.Sleep(100);
+                }
+
+                // The application goes on without the engine.
+                process.StandardInput.WriteLine("call");
+                Assert.Equal("0 0", process.StandardOutput.ReadLine());
+
+                process.StandardInput.WriteLine("exit");
+                process.WaitForExit();
+                Assert.Equal(0, process.ExitCode);
+            }
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private static bool IsEngineLoaded(Process process)
+        {
+            process.Refresh();
+            foreach (ProcessModule module in process.Modules)
+            {
+                if (string.Equals(module.ModuleName, "FaultInjectionEngine.dll", StringComparison.OrdinalIgnoreCase))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        #endregion
+    }
+}
@@ -0,0 +1,208 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Collections.Generic;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Tests which verify call-count, sampling and rate-limiting conditions, evaluated by the
+    /// prologue of the faulted methods without calling the dispatcher on every call
+    /// </summary>
+    public class CallCountGateTests
+    {
+        #region Private Data
+
+        private const string CallCountingVariable = "FAULT_INJECTION_CALL_COUNTING";
+
+        // Exits with 0 only if the faults occur exactly on the expected calls.
+        private const string WorkloadSource = @"
+using System;
+using System.Diagnostics;
+
+namespace Workload
+{
+    static class Program
+    {
+        static int Nth() { return 0; }
+        static int EveryNth() { return 0; }
+        static int Never() { return 0; }
+
+        static int Main()
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            int nthFaultedOn = 0;
+            int everyNthFaults = 0;
+            int neverFaults = 0;
+            for (int i = 1; i <= 100000; i++)
+            {
+                if (Nth() != 0) { nthFaultedOn = (nthFaultedOn == 0) ? i : -1; }
+                if (EveryNth() != 0) { everyNthFaults += (i % 100 == 0) ? 1 : 1000000; }
+                neverFaults += Never();
+            }
+            stopwatch.Stop();
+
+            bool passed = nthFaultedOn == 1000 && everyNthFaults == 1000 && neverFaults == 0;
+            Console.WriteLine(passed);
+            Console.WriteLine(""ElapsedTicks: {0}"", stopwatch.ElapsedTicks);
+            return passed ? 0 : 1;
+        }
+    }
+}";
+
+        // Reports the faults of call-count conditions on methods called by several threads at once.
+        private const string ConcurrentWorkloadSource = @"
+using System;
+using System.Diagnostics;
+using System.Threading;
+
+namespace Workload
+{
+    static class Program
+    {
+        static int Nth() { return 0; }
+        static int EveryNth() { return 0; }
+
+        static int nthFaults;
+        static int everyNthFaults;
+
+        static void Run()
+        {
+            for (int i = 0; i < 25000; i++)
+            {
+                Interlocked.Add(ref nthFaults, Nth());
+                Interlocked.Add(ref everyNthFaults, EveryNth());
+            }
+        }
+
+        static int Main()
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            Thread[] threads = new Thread[4];
+            for (int i = 0; i < threads.Length; i++)
+            {
+                threads[i] = new Thread(Run);
+                threads[i].Start();
+            }
+            foreach (Thread thread in threads)
+            {
+                thread.Join();
+            }
+            stopwatch.Stop();
+
+            Console.WriteLine(""NthFaults: {0}"", nthFaults);
+            Console.WriteLine(""EveryNthFaults: {0}"", everyNthFaults);
+            Console.WriteLine(""ElapsedTicks: {0}"", stopwatch.ElapsedTicks);
+            return 0;
+        }
+    }
+}";
+
+        // Exits with 0 only if the number of faults is plausible for the sampling and rate limit.
+        private const string SamplingWorkloadSource = @"
+using System;
+using System.Diagnostics;
+
+namespace Workload
+{
+    static class Program
+    {
+        static int Sampled() { return 0; }
+        static int Limited() { return 0; }
+
+        static int Main()
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            int sampledFaults = 0;
+            int limitedFaults = 0;
+            for (int i = 0; i < 10000000; i++)
+            {
+                sampledFaults += Sampled();
+                limitedFaults += Limited();
+            }
+            stopwatch.Stop();
+
+            // 1% of 10 million calls, and 100 per second plus a burst of 100
+            double seconds = stopwatch.Elapsed.TotalSeconds;
+            bool passed = sampledFaults > 95000 && sampledFaults < 105000 &&
+                limitedFaults >= 100 && limitedFaults <= 100 * (seconds + 1) + 1;
+            Console.WriteLine(""{0} {1} in {2:F2}s"", sampledFaults, limitedFaults, seconds);
+            Console.WriteLine(""ElapsedTicks: {0}"", stopwatch.ElapsedTicks);
+            return passed ? 0 : 1;
+        }
+    }
+}";
+
+        #endregion
+
+        #region CallCountGateTest
+
+        /// <summary>
+        /// Verifies that call-count conditions trigger on the right calls, with both ways of counting calls
+        /// </summary>
+        [Fact]
+        public void CallCountGateTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("CallCountGateWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Program.Nth()",
+                    BuiltInConditions.TriggerOnNthCall(1000), BuiltInFaults.ReturnValueFault(1)),
+                new FaultRule("static Workload.Program.EveryNth()",
+                    BuiltInConditions.TriggerOnEveryNthCall(100), BuiltInFaults.ReturnValueFault(1)),
+                new FaultRule("static Workload.Program.Never()",
+                    BuiltInConditions.NeverTrigger, BuiltInFaults.ReturnValueFault(1)));
+
+            // The workload exits with non-zero if a fault occurs on a wrong call.
+            Console.WriteLine("{0,-8} : {1}", "ATOMIC", workload.Run(session, null));
+
+            Dictionary<string, string> environment = new Dictionary<string, string>();
+            environment[CallCountingVariable] = "FAST";
+            Console.WriteLine("{0,-8} : {1}", "FAST", workload.Run(session, environment));
+        }
+
+        /// <summary>
+        /// Verifies that call-count conditions trigger exactly as often as expected when several
+        /// threads call the faulted methods at once, and take each other's calls
+        /// </summary>
+        [Fact]
+        public void ConcurrentCallCountGateTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("ConcurrentCallCountGateWorkload", ConcurrentWorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Program.Nth()",
+                    BuiltInConditions.TriggerOnNthCall(1000), BuiltInFaults.ReturnValueFault(1)),
+                new FaultRule("static Workload.Program.EveryNth()",
+                    BuiltInConditions.TriggerOnEveryNthCall(100), BuiltInFaults.ReturnValueFault(1)));
+
+            // Atomic counting only, the fast one may lose concurrent calls.
+            WorkloadTiming timing = workload.Run(session, null);
+            Console.WriteLine(timing);
+            Assert.Equal("1", timing["NthFaults"]);
+            Assert.Equal("1000", timing["EveryNthFaults"]);
+        }
+
+        /// <summary>
+        /// Verifies that sampled and rate-limited faults occur as often as expected
+        /// </summary>
+        [Fact]
+        public void SamplingGateTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("SamplingGateWorkload", SamplingWorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Program.Sampled()",
+                    BuiltInConditions.TriggerWithProbability(0.01, 12345), BuiltInFaults.ReturnValueFault(1)),
+                new FaultRule("static Workload.Program.Limited()",
+                    BuiltInConditions.TriggerAtMostPerSecond(100), BuiltInFaults.ReturnValueFault(1)));
+
+            // The workload exits with non-zero if there are too many or too few faults.
+            Console.WriteLine(workload.Run(session, null));
+        }
+
+        #endregion
+    }
+}
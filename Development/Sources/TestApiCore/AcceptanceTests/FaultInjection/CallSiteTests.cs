@@ -0,0 +1,127 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Tests which verify that faults restricted to caller scopes occur only on the calls made
+    /// by the callers in the scopes, the faulted method being left unmodified
+    /// </summary>
+    public class CallSiteTests
+    {
+        #region Private Data
+
+        // Reports how many of the calls made by each caller were faulted.
+        private const string WorkloadSource = @"
+using System;
+using System.Diagnostics;
+
+namespace Workload
+{
+    static class Helper
+    {
+        public static int Compute(int value) { return value; }
+        public static void Send() { }
+
+        // The rank of the array, 19, is the value of ELEMENT_TYPE_VAR.
+        public static int[,,,,,,,,,,,,,,,,,,] Grid() { return null; }
+    }
+
+    static class Client
+    {
+        public static bool Send()
+        {
+            try { Helper.Send(); return false; }
+            catch (InvalidOperationException) { return true; }
+        }
+
+        public static bool Grid()
+        {
+            try { Helper.Grid(); return false; }
+            catch (InvalidOperationException) { return true; }
+        }
+    }
+
+    static class Program
+    {
+        const int Calls = 1000;
+
+        static int Covered() { return Helper.Compute(1); }
+        static int Uncovered() { return Helper.Compute(1); }
+
+        static bool Unscoped()
+        {
+            try { Helper.Send(); return false; }
+            catch (InvalidOperationException) { return true; }
+        }
+
+        static int Main()
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            int covered = 0, uncovered = 0, direct = 0, client = 0, unscoped = 0, grid = 0;
+            for (int i = 0; i < Calls; i++)
+            {
+                if (Covered() == 42) { covered++; }
+                if (Uncovered() == 42) { uncovered++; }
+                if (Helper.Compute(1) == 42) { direct++; }
+                if (Client.Send()) { client++; }
+                if (Unscoped()) { unscoped++; }
+                if (Client.Grid()) { grid++; }
+            }
+            stopwatch.Stop();
+            Console.WriteLine(""Covered: {0}"", covered);
+            Console.WriteLine(""Uncovered: {0}"", uncovered);
+            Console.WriteLine(""Direct: {0}"", direct);
+            Console.WriteLine(""Client: {0}"", client);
+            Console.WriteLine(""Unscoped: {0}"", unscoped);
+            Console.WriteLine(""Grid: {0}"", grid);
+            Console.WriteLine(""ElapsedTicks: {0}"", stopwatch.ElapsedTicks);
+            return 0;
+        }
+    }
+}";
+
+        #endregion
+
+        #region CallSiteTest
+
+        /// <summary>
+        /// Verifies that return value and exception faults occur on the calls made in a method scope and
+        /// in a type scope, and not on the other calls to the same methods
+        /// </summary>
+        [Fact]
+        public void CallSiteTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("CallSiteWorkload", WorkloadSource);
+
+            FaultRule computeRule = new FaultRule("static Workload.Helper.Compute(int)",
+                BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(42));
+            computeRule.CallerScopes = new string[] { "Workload.Program.Covered" };
+            FaultRule sendRule = new FaultRule("static Workload.Helper.Send()",
+                BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ThrowExceptionFault(new InvalidOperationException()));
+            sendRule.CallerScopes = new string[] { "Workload.Client." };
+            FaultRule gridRule = new FaultRule("static Workload.Helper.Grid()",
+                BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ThrowExceptionFault(new InvalidOperationException()));
+            gridRule.CallerScopes = new string[] { "Workload.Client.Grid" };
+            FaultSession session = new FaultSession(computeRule, sendRule, gridRule);
+
+            // Every call made in a scope is faulted, and none of the others.
+            WorkloadTiming timing = workload.Run(session, null);
+            Console.WriteLine(timing);
+            Assert.Equal("1000", timing["Covered"]);
+            Assert.Equal("0", timing["Uncovered"]);
+            Assert.Equal("0", timing["Direct"]);
+            Assert.Equal("1000", timing["Client"]);
+            Assert.Equal("0", timing["Unscoped"]);
+            Assert.Equal("1000", timing["Grid"]);
+        }
+
+        #endregion
+    }
+}
@@ -0,0 +1,109 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Tests which verify faults compiled into the faulted methods by the engine
+    /// </summary>
+    public class CompiledFaultTests
+    {
+        #region Private Data
+
+        // Exits with 0 only if every compiled fault occurs, and reports the special reals it got.
+        private const string WorkloadSource = @"
+using System;
+using System.Diagnostics;
+using System.Globalization;
+
+namespace Workload
+{
+    static class Program
+    {
+        static int Number() { return 1; }
+        static double Real() { return 1.0; }
+        static double NotANumber() { return 1.0; }
+        static double Overflow() { return 1.0; }
+        static float Underflow() { return 1.0f; }
+        static string Text() { return ""text""; }
+        static void Fail() { }
+
+        static int Main()
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            bool thrown = false;
+            try
+            {
+                Fail();
+            }
+            catch (InvalidOperationException)
+            {
+                thrown = true;
+            }
+            stopwatch.Stop();
+
+            bool faulted = thrown && Number() == 42 && Real() == 0.5 && Text() == null;
+            Console.WriteLine(faulted);
+            Console.WriteLine(""NotANumber: {0}"", NotANumber().ToString(""R"", CultureInfo.InvariantCulture));
+            Console.WriteLine(""Overflow: {0}"", Overflow().ToString(""R"", CultureInfo.InvariantCulture));
+            Console.WriteLine(""Underflow: {0}"", Underflow().ToString(""R"", CultureInfo.InvariantCulture));
+            Console.WriteLine(""ElapsedTicks: {0}"", stopwatch.ElapsedTicks);
+            return faulted ? 0 : 1;
+        }
+    }
+}";
+
+        #endregion
+
+        #region CompiledFaultTest
+
+        /// <summary>
+        /// Verifies that unconditional faults marked to be compiled occur
+        /// </summary>
+        [Fact]
+        public void CompiledFaultTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("CompiledFaultWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                Compiled(new FaultRule("static Workload.Program.Number()",
+                    BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(42))),
+                Compiled(new FaultRule("static Workload.Program.Real()",
+                    BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(0.5))),
+                Compiled(new FaultRule("static Workload.Program.NotANumber()",
+                    BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(double.NaN))),
+                Compiled(new FaultRule("static Workload.Program.Overflow()",
+                    BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(double.PositiveInfinity))),
+                Compiled(new FaultRule("static Workload.Program.Underflow()",
+                    BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(float.NegativeInfinity))),
+                Compiled(new FaultRule("static Workload.Program.Text()",
+                    BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnFault())),
+                Compiled(new FaultRule("static Workload.Program.Fail()",
+                    BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ThrowExceptionFault(new InvalidOperationException()))));
+
+            // The workload exits with non-zero if a fault does not occur.
+            WorkloadTiming timing = workload.Run(session, null);
+            Console.WriteLine(timing);
+            Assert.Equal("NaN", timing["NotANumber"]);
+            Assert.Equal("Infinity", timing["Overflow"]);
+            Assert.Equal("-Infinity", timing["Underflow"]);
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private static FaultRule Compiled(FaultRule rule)
+        {
+            rule.CompileIntoMethod = true;
+            return rule;
+        }
+
+        #endregion
+    }
+}
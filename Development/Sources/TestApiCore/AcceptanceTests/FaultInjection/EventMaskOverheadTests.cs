@@ -0,0 +1,193 @@
+﻿// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Collections.Generic;
+using System.Globalization;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Measures what every profiler flag requested by the engine costs on a reference workload.
+    /// The engine is told to request exactly one flag through FAULT_INJECTION_EVENT_MASK. The
+    /// time of the measured section is compared with a run without the engine on the same machine,
+    /// and must stay within the overhead budget of the flag.
+    /// </summary>
+    public class EventMaskOverheadTests
+    {
+        #region Private Data
+
+        private const string EventMaskVariable = "FAULT_INJECTION_EVENT_MASK";
+        private const int Runs = 3;
+
+        // Profiler flags measured one at a time, with the slowdown of the measured section each
+        // may cost. Flags which only add callbacks at JIT time must not slow the steady state;
+        // disabled inlining does, on the small methods of the workload.
+        private static readonly ProfilerFlag[] Flags = new ProfilerFlag[]
+        {
+            new ProfilerFlag("COR_PRF_MONITOR_NONE",            0x00000000, 1.15),
+            new ProfilerFlag("COR_PRF_MONITOR_JIT_COMPILATION", 0x00000020, 1.15),
+            new ProfilerFlag("COR_PRF_MONITOR_CACHE_SEARCHES",  0x00020000, 1.15),
+            new ProfilerFlag("COR_PRF_DISABLE_INLINING",        0x00200000, 4.0),
+            new ProfilerFlag("COR_PRF_MONITOR_ENTERLEAVE",      0x00001000, 4.0),
+        };
+
+        // What the engine requested before the mask was selected: enter/leave events without hooks,
+        // on top of the flags it needs. The selected mask must not cost more.
+        private const uint LegacyMask = 0x00001000 | 0x00020000 | 0x00200000 | 0x00000020;
+
+        // Tolerance of comparisons between two runs under the engine, for noise.
+        private const double Tolerance = 1.10;
+
+        // What the engine requests at startup for a method filter which traps methods: JIT
+        // compilations, module loads, disabled inlining and cache searches.
+        private const uint SelectedMask = 0x00000020 | 0x00000004 | 0x00200000 | 0x00020000;
+
+        private const string WorkloadSource = @"
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Runtime.InteropServices;
+using System.Text;
+
+namespace Workload
+{
+    abstract class Shape { public abstract double Area(); }
+    sealed class Square : Shape { double s; public Square(double s) { this.s = s; } public override double Area() { return s * s; } }
+    sealed class Circle : Shape { double r; public Circle(double r) { this.r = r; } public override double Area() { return 3.14159 * r * r; } }
+
+    static class Program
+    {
+        [DllImport(""FaultInjectionEngine.dll"")]
+        static extern bool FaultEngineGetEventMask(out uint eventMask);
+
+        static int Add(int a, int b) { return a + b; }
+        static int Twice(int a) { return Add(a, a); }
+
+        // Referenced by the fault rule, never called.
+        static void Target() { }
+
+        static int Main()
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+
+            long sum = 0;
+            for (int i = 0; i < 20000000; i++)
+            {
+                sum += Twice(i & 0xFF);
+            }
+
+            List<Shape> shapes = new List<Shape>();
+            for (int i = 0; i < 1000; i++)
+            {
+                shapes.Add(i % 2 == 0 ? (Shape)new Square(i) : new Circle(i));
+            }
+            double area = 0;
+            for (int n = 0; n < 2000; n++)
+            {
+                foreach (Shape shape in shapes) { area += shape.Area(); }
+            }
+
+            Dictionary<string, int> words = new Dictionary<string, int>();
+            StringBuilder builder = new StringBuilder();
+            for (int i = 0; i < 200000; i++)
+            {
+                builder.Length = 0;
+                string word = builder.Append('w').Append(i % 1000).ToString();
+                int count;
+                words.TryGetValue(word, out count);
+                words[word] = count + 1;
+            }
+
+            stopwatch.Stop();
+            Console.WriteLine(sum + area + words.Count);
+
+            // The engine is only there when the workload is profiled.
+            uint eventMask;
+            if (Environment.GetEnvironmentVariable(""COR_ENABLE_PROFILING"") == ""1"" && FaultEngineGetEventMask(out eventMask))
+            {
+                Console.WriteLine(""EventMask: 0x{0:X8}"", eventMask);
+            }
+            Console.WriteLine(""ElapsedTicks: {0}"", stopwatch.ElapsedTicks);
+            return 0;
+        }
+    }
+}";
+
+        #endregion
+
+        #region Performance tests
+
+        [Fact]
+        public void TestEventMaskOverheadPerFlag()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("EventMaskWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(new FaultRule(
+                "Workload.Program.Target()", BuiltInConditions.NeverTrigger, BuiltInFaults.ReturnFault()));
+
+            WorkloadTiming baseline = ProfiledWorkload.BestOf(Runs, () => workload.Run());
+            Console.WriteLine("{0,-32} : {1}", "(no engine)", baseline);
+
+            WorkloadTiming selected = ProfiledWorkload.BestOf(Runs, () => workload.Run(session, null));
+            Console.WriteLine("{0,-32} : {1} ({2:F2}x)", "(mask selected by engine)", selected, Overhead(selected, baseline));
+            Assert.Equal(FormatMask(SelectedMask), selected["EventMask"]);
+
+            WorkloadTiming legacy = RunWithMask(workload, session, LegacyMask);
+            Console.WriteLine("{0,-32} : {1} ({2:F2}x)", "(mask requested before)", legacy, Overhead(legacy, baseline));
+            Assert.True(Overhead(selected, legacy) <= Tolerance, string.Format(CultureInfo.InvariantCulture,
+                "The selected mask costs {0:F2}x the mask requested before", Overhead(selected, legacy)));
+
+            foreach (ProfilerFlag flag in Flags)
+            {
+                WorkloadTiming timing = RunWithMask(workload, session, flag.Mask);
+                double overhead = Overhead(timing, baseline);
+                Console.WriteLine("{0,-32} : {1} ({2:F2}x)", flag.Name, timing, overhead);
+                Assert.Equal(FormatMask(flag.Mask), timing["EventMask"]);
+                Assert.True(overhead <= flag.Budget, string.Format(CultureInfo.InvariantCulture,
+                    "{0} costs {1:F2}x, over its budget of {2:F2}x", flag.Name, overhead, flag.Budget));
+            }
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private static WorkloadTiming RunWithMask(ProfiledWorkload workload, FaultSession session, uint mask)
+        {
+            Dictionary<string, string> environment = new Dictionary<string, string>();
+            environment[EventMaskVariable] = FormatMask(mask);
+            return ProfiledWorkload.BestOf(Runs, () => workload.Run(session, environment));
+        }
+
+        // Slowdown of the measured (steady state) section of a run, relative to a reference run.
+        private static double Overhead(WorkloadTiming timing, WorkloadTiming reference)
+        {
+            return timing.Measured.Ticks / (double)Math.Max(1, reference.Measured.Ticks);
+        }
+
+        private static string FormatMask(uint mask)
+        {
+            return string.Format(CultureInfo.InvariantCulture, "0x{0:X8}", mask);
+        }
+
+        private sealed class ProfilerFlag
+        {
+            public ProfilerFlag(string name, uint mask, double budget)
+            {
+                Name = name;
+                Mask = mask;
+                Budget = budget;
+            }
+
+            public string Name { get; private set; }
+            public uint Mask { get; private set; }
+            public double Budget { get; private set; }
+        }
+
+        #endregion
+    }
+}
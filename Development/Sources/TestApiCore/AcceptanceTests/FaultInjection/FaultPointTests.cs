@@ -0,0 +1,144 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Diagnostics;
+using System.IO;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Tests which verify that methods carrying the fault point attribute are trapped, found from
+    /// the metadata of their module rather than from the method filter
+    /// </summary>
+    public class FaultPointTests
+    {
+        #region Private Data
+
+        // Exits with 0 only if the fault point is faulted, and the unmarked method is not.
+        private const string WorkloadSource = @"
+using System;
+
+namespace Workload
+{
+    [AttributeUsage(AttributeTargets.Method)]
+    sealed class FaultPointAttribute : Attribute { }
+
+    static class Program
+    {
+        [FaultPoint]
+        static int Answer() { return 0; }
+
+        static int Unmarked() { return 0; }
+
+        static int Main()
+        {
+            bool passed = true;
+            for (int i = 0; i < 1000; i++)
+            {
+                passed &= Answer() == 42 && Unmarked() == 0;
+            }
+            Console.WriteLine(passed);
+            return passed ? 0 : 1;
+        }
+    }
+}";
+
+        // Exits with 0 only if the fault point gets faulted within 30 seconds, ReJIT rewriting it in
+        // the background, and the unmarked method is not.
+        private const string ReJitWorkloadSource = @"
+using System;
+using System.Diagnostics;
+using System.Threading;
+
+namespace Workload
+{
+    [AttributeUsage(AttributeTargets.Method)]
+    sealed class FaultPointAttribute : Attribute { }
+
+    static class Program
+    {
+        [FaultPoint]
+        static int Answer() { return 0; }
+
+        static int Unmarked() { return 0; }
+
+        static int Main()
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            while (Answer() != 42 && stopwatch.Elapsed < TimeSpan.FromSeconds(30))
+            {
+                Thread.Sleep(100);
+            }
+            bool passed = Answer() == 42 && Unmarked() == 0;
+            Console.WriteLine(passed);
+            return passed ? 0 : 1;
+        }
+    }
+}";
+
+        #endregion
+
+        #region FaultPointTest
+
+        /// <summary>
+        /// Verifies that a method carrying the fault point attribute is faulted by its rule while the
+        /// method filter is empty, and that a method without the attribute is left alone
+        /// </summary>
+        [Fact]
+        public void FaultPointTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("FaultPointWorkload", WorkloadSource);
+            RunWithEmptyMethodFilter("FaultPointWorkload", CreateSession());
+        }
+
+        /// <summary>
+        /// Verifies that a method carrying the fault point attribute is faulted when methods are
+        /// rewritten on demand, ReJIT rewriting the fault points found at module load
+        /// </summary>
+        [Fact]
+        public void RewriteOnDemandFaultPointTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("ReJitFaultPointWorkload", ReJitWorkloadSource);
+            FaultSession session = CreateSession();
+            session.RewriteOnDemand = true;
+            RunWithEmptyMethodFilter("ReJitFaultPointWorkload", session);
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private static FaultSession CreateSession()
+        {
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Program.Answer()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(42)),
+                new FaultRule("static Workload.Program.Unmarked()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(42)));
+            session.FaultPointAttribute = "FaultPointAttribute";
+            return session;
+        }
+
+        private static void RunWithEmptyMethodFilter(string workloadName, FaultSession session)
+        {
+            string workloadPath = Path.Combine(Path.Combine(Path.GetTempPath(), "FaultInjectionWorkloads"), workloadName + ".exe");
+
+            // Empty the method filter, so only the attribute can trap a method. The rules are still
+            // read by the dispatcher, which finds the rule of a trapped method from its signature.
+            ProcessStartInfo psi = session.GetProcessStartInfo(workloadPath);
+            File.WriteAllText(psi.EnvironmentVariables["FAULT_INJECTION_METHOD_FILTER"], string.Empty);
+            psi.RedirectStandardOutput = true;
+            using (Process process = Process.Start(psi))
+            {
+                Console.WriteLine(process.StandardOutput.ReadToEnd());
+                process.WaitForExit();
+                Assert.Equal(0, process.ExitCode);
+            }
+        }
+
+        #endregion
+    }
+}
@@ -0,0 +1,101 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Diagnostics;
+using System.IO;
+using System.Runtime.InteropServices;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Tests which resolve the method filter of a session against a workload on disk with the
+    /// filter analyzer of the engine, without running the workload.
+    /// </summary>
+    public class FilterAnalyzerTests
+    {
+        #region Private Data
+
+        // Only compiled: the analyzer reads its metadata.
+        private const string WorkloadSource = @"
+using System;
+
+namespace Workload
+{
+    static class Program
+    {
+        static int Answer() { return 0; }
+
+        static int Answer(int value) { return value; }
+
+        static string Name() { return ""original""; }
+
+        static int Main()
+        {
+            return Answer() + Answer(1) + Name().Length;
+        }
+    }
+}";
+
+        [DllImport("FaultInjectionEngine.dll", CharSet = CharSet.Unicode)]
+        private static extern bool FaultEngineAnalyzeFilter(string[] assemblyPaths, uint assemblyCount,
+            string methodFilterFile, string reportFile, out uint resolvedCount, out uint unresolvedCount);
+
+        #endregion
+
+        #region AnalyzeTest
+
+        /// <summary>
+        /// Verifies that the lines of the filter are resolved to the overloads their parameter types
+        /// select, each counted on its own line, that lines without a method are reported, and
+        /// prints the time spent analyzing.
+        /// </summary>
+        [Fact]
+        public void AnalyzeTest()
+        {
+            new ProfiledWorkload("FilterAnalyzerWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Program.Answer()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(42)),
+                new FaultRule("static Workload.Program.Answer(int)", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(43)),
+                new FaultRule("static Workload.Program.Name()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault("faulted")),
+                new FaultRule("static Workload.Program.Missing()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnFault()));
+
+            string workloadFolder = Path.Combine(Path.GetTempPath(), "FaultInjectionWorkloads");
+            string workloadPath = Path.Combine(workloadFolder, "FilterAnalyzerWorkload.exe");
+            string reportPath = Path.Combine(workloadFolder, "FilterAnalyzerReport.txt");
+            ProcessStartInfo psi = session.GetProcessStartInfo(workloadPath);
+
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            uint resolvedCount;
+            uint unresolvedCount;
+            Assert.True(FaultEngineAnalyzeFilter(new string[] { workloadPath }, 1,
+                psi.EnvironmentVariables["FAULT_INJECTION_METHOD_FILTER"], reportPath, out resolvedCount, out unresolvedCount));
+            stopwatch.Stop();
+            Assert.Equal(3u, resolvedCount);
+            Assert.Equal(1u, unresolvedCount);
+
+            // Lines are told apart by the hash of their parameter list.
+            string[] report = File.ReadAllLines(reportPath);
+            Assert.Equal(2, CountLines(report, "Resolved\tWorkload.Program.Answer\t", "\t1 overloads"));
+            Assert.Equal(1, CountLines(report, "Resolved\tWorkload.Program.Name\t", "\t1 overloads"));
+            Assert.Equal(1, CountLines(report, "Unresolved\tWorkload.Program.Missing\t", string.Empty));
+            Console.WriteLine("Filter analyzed in {0:F1} ms", stopwatch.Elapsed.TotalMilliseconds);
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private static int CountLines(string[] report, string start, string end)
+        {
+            return Array.FindAll(report, line => line.StartsWith(start, StringComparison.Ordinal)
+                && line.EndsWith(end, StringComparison.Ordinal)).Length;
+        }
+
+        #endregion
+    }
+}
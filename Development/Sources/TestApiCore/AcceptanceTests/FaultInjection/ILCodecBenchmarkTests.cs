@@ -0,0 +1,109 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Diagnostics;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Benchmarks the IL instruction decoder and encoder of the engine on the code of mscorlib.
+    /// </summary>
+    public class ILCodecBenchmarkTests
+    {
+        #region Private Data
+
+        // Decodes and encodes the IL code of every method of mscorlib, prints the throughput, and
+        // exits with 0 only if all code round-trips and none of it grows.
+        private const string WorkloadSource = @"
+using System;
+using System.Diagnostics;
+using System.Reflection;
+using System.Runtime.CompilerServices;
+using System.Runtime.InteropServices;
+
+namespace Workload
+{
+    static class Program
+    {
+        [DllImport(""FaultInjectionEngine.dll"")]
+        static extern bool FaultEngineBenchmarkILCodec(byte[] code, uint codeSize, uint iterations, out long ticks, out uint encodedSize);
+
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        static int Target() { return 0; }
+
+        static int Main()
+        {
+            const BindingFlags All = BindingFlags.Public | BindingFlags.NonPublic | BindingFlags.Instance | BindingFlags.Static | BindingFlags.DeclaredOnly;
+            const uint Iterations = 10;
+
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            int methods = 0, failures = 0;
+            long bytes = 0, encodedBytes = 0, ticks = 0;
+            foreach (Type type in typeof(object).Assembly.GetTypes())
+            {
+                foreach (MethodBase method in type.GetMethods(All))
+                {
+                    MethodBody body = method.IsAbstract ? null : method.GetMethodBody();
+                    byte[] code = body == null ? null : body.GetILAsByteArray();
+                    if (code == null || code.Length == 0)
+                    {
+                        continue;
+                    }
+
+                    long methodTicks;
+                    uint encodedSize;
+                    if (!FaultEngineBenchmarkILCodec(code, (uint)code.Length, Iterations, out methodTicks, out encodedSize) || encodedSize > code.Length)
+                    {
+                        failures++;
+                        continue;
+                    }
+                    methods++;
+                    bytes += code.Length;
+                    encodedBytes += encodedSize;
+                    ticks += methodTicks;
+                }
+            }
+            stopwatch.Stop();
+
+            double seconds = (double)ticks / Stopwatch.Frequency;
+            Console.WriteLine(""{0} methods, {1} bytes of IL re-encoded as {2} bytes, {3:F1} MB/s, {4} failures"",
+                methods, bytes, encodedBytes, bytes * Iterations / seconds / (1024 * 1024), failures);
+            Console.WriteLine(stopwatch.ElapsedTicks);
+            return (Target() == 1) && (methods > 0) && (failures == 0) ? 0 : 1;
+        }
+    }
+}";
+
+        #endregion
+
+        #region ThroughputTest
+
+        /// <summary>
+        /// Verifies that the IL code of mscorlib decodes and encodes to equivalent code, and prints
+        /// the throughput in MB of IL per second.
+        /// </summary>
+        [Fact]
+        public void ThroughputTest()
+        {
+            // The rule only makes the engine load into the workload, which calls its exports.
+            ProfiledWorkload workload = new ProfiledWorkload("ILCodecBenchmarkWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Program.Target()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(1)));
+
+            using (Process process = workload.Start(session, null))
+            {
+                Console.WriteLine(process.StandardOutput.ReadLine());
+                process.StandardOutput.ReadToEnd();
+                process.WaitForExit();
+                Assert.Equal(0, process.ExitCode);
+            }
+        }
+
+        #endregion
+    }
+}
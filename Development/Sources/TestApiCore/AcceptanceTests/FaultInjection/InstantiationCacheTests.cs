@@ -0,0 +1,114 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Tests which trap many methods returning the same generic types, and verify that the engine
+    /// instantiates the dispatcher once per return type.
+    /// </summary>
+    public class InstantiationCacheTests
+    {
+        #region Private Data
+
+        // Four methods return List<int>, two return Dictionary<string, int>. Each is faulted once,
+        // then the workload prints the instantiation counters of the engine.
+        private const string WorkloadSource = @"
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Runtime.InteropServices;
+
+namespace Workload
+{
+    static class Corpus
+    {
+        public static List<int> Empty() { return new List<int>(); }
+        public static List<int> One() { return new List<int> { 1 }; }
+        public static List<int> Two() { return new List<int> { 1, 2 }; }
+        public static List<int> Sized(int capacity) { return new List<int>(capacity); }
+        public static Dictionary<string, int> Map() { return new Dictionary<string, int>(); }
+        public static Dictionary<string, int> MapOne() { return new Dictionary<string, int> { { ""one"", 1 } }; }
+    }
+
+    static class Program
+    {
+        [DllImport(""FaultInjectionEngine.dll"")]
+        static extern bool FaultEngineGetInstantiationCounters(out uint lookups, out uint hits);
+
+        static int Main()
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            bool passed = Corpus.Empty() == null && Corpus.One() == null && Corpus.Two() == null
+                && Corpus.Sized(4) == null && Corpus.Map() == null && Corpus.MapOne() == null;
+            passed &= Corpus.Two().Count == 2 && Corpus.MapOne().Count == 1;
+            stopwatch.Stop();
+
+            uint lookups, hits;
+            FaultEngineGetInstantiationCounters(out lookups, out hits);
+            Console.WriteLine(""{0} {1}"", lookups, hits);
+            Console.WriteLine(stopwatch.ElapsedTicks);
+            return passed ? 0 : 1;
+        }
+    }
+}";
+
+        #endregion
+
+        #region InstantiationCacheTest
+
+        /// <summary>
+        /// Verifies that methods returning the same type share the instantiation of the dispatcher,
+        /// with the default and the compact prologue.
+        /// </summary>
+        [Fact]
+        public void InstantiationCacheTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("InstantiationCacheWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Corpus.Empty()", BuiltInConditions.TriggerOnNthCall(1), BuiltInFaults.ReturnFault()),
+                new FaultRule("static Workload.Corpus.One()", BuiltInConditions.TriggerOnNthCall(1), BuiltInFaults.ReturnFault()),
+                new FaultRule("static Workload.Corpus.Two()", BuiltInConditions.TriggerOnNthCall(1), BuiltInFaults.ReturnFault()),
+                new FaultRule("static Workload.Corpus.Sized(int)", BuiltInConditions.TriggerOnNthCall(1), BuiltInFaults.ReturnFault()),
+                new FaultRule("static Workload.Corpus.Map()", BuiltInConditions.TriggerOnNthCall(1), BuiltInFaults.ReturnFault()),
+                new FaultRule("static Workload.Corpus.MapOne()", BuiltInConditions.TriggerOnNthCall(1), BuiltInFaults.ReturnFault()));
+
+            Run(workload, session, "DEFAULT");
+            Run(workload, session, "COMPACT");
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private static void Run(ProfiledWorkload workload, FaultSession session, string prologue)
+        {
+            Dictionary<string, string> environment = new Dictionary<string, string>();
+            environment["FAULT_INJECTION_PROLOGUE"] = prologue;
+
+            string[] counters;
+            using (Process process = workload.Start(session, environment))
+            {
+                counters = process.StandardOutput.ReadLine().Split(' ');
+                process.StandardOutput.ReadToEnd();
+                process.WaitForExit();
+                Assert.Equal(0, process.ExitCode);
+            }
+
+            // One instantiation per method, all but the first per return type found in the cache
+            Assert.Equal(6, int.Parse(counters[0], CultureInfo.InvariantCulture));
+            Assert.Equal(4, int.Parse(counters[1], CultureInfo.InvariantCulture));
+        }
+
+        #endregion
+    }
+}
@@ -0,0 +1,122 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Benchmarks the latency faults, comparing the achieved distribution of delays with the requested one.
+    /// </summary>
+    public class LatencyFaultTests
+    {
+        #region Private Data
+
+        // Prints the percentiles of the achieved delays next to the requested ones, and exits with 0
+        // only if they are close enough.
+        private const string WorkloadSource = @"
+using System;
+using System.Diagnostics;
+
+namespace Workload
+{
+    static class Program
+    {
+        static int FixedSpin() { return 0; }
+        static int FixedSpinTrapped() { return 0; }
+        static int UniformYield() { return 0; }
+        static int LogNormalSleep() { return 0; }
+
+        delegate int Target();
+
+        static double[] Measure(Target target, int count)
+        {
+            double[] microseconds = new double[count];
+            for (int i = 0; i < count; i++)
+            {
+                long start = Stopwatch.GetTimestamp();
+                target();
+                microseconds[i] = (Stopwatch.GetTimestamp() - start) * 1e6 / Stopwatch.Frequency;
+            }
+            Array.Sort(microseconds);
+            return microseconds;
+        }
+
+        static double Percentile(double[] sorted, double p)
+        {
+            return sorted[(int)(p * (sorted.Length - 1))];
+        }
+
+        // Percentiles 10, 50 and 90 of the achieved delay must be within the tolerance of the requested ones.
+        static bool Report(string name, double[] sorted, double p10, double p50, double p90, double tolerance)
+        {
+            double[] expected = new double[] { p10, p50, p90 };
+            double[] achieved = new double[] { Percentile(sorted, 0.1), Percentile(sorted, 0.5), Percentile(sorted, 0.9) };
+            bool passed = true;
+            for (int i = 0; i < 3; i++)
+            {
+                passed &= Math.Abs(achieved[i] - expected[i]) <= tolerance;
+            }
+            Console.WriteLine(""{0,-18} requested p10/p50/p90 {1,8:F1} {2,8:F1} {3,8:F1} us, achieved {4,8:F1} {5,8:F1} {6,8:F1} us, max {7,8:F1} us{8}"",
+                name, p10, p50, p90, achieved[0], achieved[1], achieved[2], sorted[sorted.Length - 1], passed ? """" : "" (out of tolerance)"");
+            return passed;
+        }
+
+        static int Main()
+        {
+            // JIT-compile the targets first
+            FixedSpin(); FixedSpinTrapped(); UniformYield(); LogNormalSleep();
+
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            bool passed = true;
+            passed &= Report(""fixed/spin"", Measure(FixedSpin, 20000), 50, 50, 50, 10);
+            passed &= Report(""fixed/spin/trapped"", Measure(FixedSpinTrapped, 20000), 50, 50, 50, 20);
+            passed &= Report(""uniform/yield"", Measure(UniformYield, 20000), 26, 50, 74, 10);
+            passed &= Report(""lognormal/sleep"", Measure(LogNormalSleep, 500), 1054, 2000, 3793, 1000);
+            stopwatch.Stop();
+
+            Console.WriteLine(""ElapsedTicks: {0}"", stopwatch.ElapsedTicks);
+            return passed ? 0 : 1;
+        }
+    }
+}";
+
+        #endregion
+
+        #region Performance tests
+
+        [Fact]
+        public void TestLatencyDistribution()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("LatencyFaultWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                Compiled(new FaultRule("static Workload.Program.FixedSpin()", BuiltInConditions.TriggerOnEveryCall,
+                    BuiltInFaults.LatencyFault(TimeSpan.FromTicks(500), LatencyMode.Spin))),
+                new FaultRule("static Workload.Program.FixedSpinTrapped()", BuiltInConditions.TriggerOnEveryCall,
+                    BuiltInFaults.LatencyFault(TimeSpan.FromTicks(500), LatencyMode.Spin)),
+                Compiled(new FaultRule("static Workload.Program.UniformYield()", BuiltInConditions.TriggerOnEveryCall,
+                    BuiltInFaults.UniformLatencyFault(TimeSpan.FromTicks(200), TimeSpan.FromTicks(800), LatencyMode.Yield))),
+                Compiled(new FaultRule("static Workload.Program.LogNormalSleep()", BuiltInConditions.TriggerOnEveryCall,
+                    BuiltInFaults.LogNormalLatencyFault(TimeSpan.FromMilliseconds(2), 0.5, LatencyMode.Sleep))));
+
+            // The workload prints the distributions, and exits with non-zero if one is off.
+            Console.WriteLine(workload.Run(session, null));
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private static FaultRule Compiled(FaultRule rule)
+        {
+            rule.CompileIntoMethod = true;
+            return rule;
+        }
+
+        #endregion
+    }
+}
@@ -0,0 +1,175 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.Runtime.InteropServices;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Tests which trap methods whose stack is deeper than the prologue, or shallower, and verify
+    /// that the max stack computed by the engine lets them run. The stack analyzer of the engine is
+    /// also checked on its own with IL byte arrays, which needs the engine built with its test exports.
+    /// </summary>
+    public class MaxStackTests
+    {
+        #region Private Data
+
+        // Deep needs a stack of 10 slots, Tiny of 1. Each method is faulted once and called once
+        // without fault, since a wrong max stack makes the JIT reject the method.
+        private const string WorkloadSource = @"
+using System;
+using System.Diagnostics;
+using System.Runtime.InteropServices;
+
+namespace Workload
+{
+    static class Corpus
+    {
+        static int Add(int a, int b, int c, int d, int e, int f, int g, int h) { return a + b + c + d + e + f + g + h; }
+
+        public static int Deep(int x)
+        {
+            return Add(x, x + 1, x + 2, x + 3, x + 4, x + 5, x + 6, Add(x, x, x, x, x, x, x, x + 1));
+        }
+
+        public static int Switch(int x)
+        {
+            switch (x)
+            {
+                case 0: return 10;
+                case 1: return 11;
+                case 2: return 12;
+                case 3: return 13;
+                default: return x;
+            }
+        }
+
+        public static int Guarded(int x)
+        {
+            try { return 100 / x; }
+            catch (DivideByZeroException) { return -2; }
+            finally { Console.Write(string.Empty); }
+        }
+
+        public static int Tiny() { return 7; }
+    }
+
+    static class Program
+    {
+        [DllImport(""FaultInjectionEngine.dll"")]
+        static extern bool FaultEngineGetCodeSizeCounters(out uint bodies, out uint originalBytes, out uint rewrittenBytes, out uint tinyBodies);
+
+        static int Main()
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            bool passed = Corpus.Deep(1) == -1 && Corpus.Switch(2) == -1 && Corpus.Guarded(0) == -1 && Corpus.Tiny() == -1;
+            passed &= Corpus.Deep(1) == 37 && Corpus.Switch(2) == 12 && Corpus.Guarded(0) == -2 && Corpus.Tiny() == 7;
+            stopwatch.Stop();
+
+            uint bodies, originalBytes, rewrittenBytes, tinyBodies;
+            FaultEngineGetCodeSizeCounters(out bodies, out originalBytes, out rewrittenBytes, out tinyBodies);
+            Console.WriteLine(""{0} {1}"", bodies, tinyBodies);
+            Console.WriteLine(stopwatch.ElapsedTicks);
+            return passed ? 0 : 1;
+        }
+    }
+}";
+
+        [DllImport("FaultInjectionEngine.dll")]
+        private static extern bool FaultEngineComputeMaxStack(byte[] code, uint codeSize, out uint maxStack);
+
+        #endregion
+
+        #region MaxStackTest
+
+        /// <summary>
+        /// Verifies that deep, branching and guarded methods run with the default and the compact
+        /// prologue, and that a tiny method stays tiny with the compact one.
+        /// </summary>
+        [Fact]
+        public void MaxStackTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("MaxStackWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Corpus.Deep(int)", BuiltInConditions.TriggerOnNthCall(1), BuiltInFaults.ReturnValueFault(-1)),
+                new FaultRule("static Workload.Corpus.Switch(int)", BuiltInConditions.TriggerOnNthCall(1), BuiltInFaults.ReturnValueFault(-1)),
+                new FaultRule("static Workload.Corpus.Guarded(int)", BuiltInConditions.TriggerOnNthCall(1), BuiltInFaults.ReturnValueFault(-1)),
+                new FaultRule("static Workload.Corpus.Tiny()", BuiltInConditions.TriggerOnNthCall(1), BuiltInFaults.ReturnValueFault(-1)));
+
+            Assert.Equal(0, Run(workload, session, "DEFAULT"));
+            Assert.True(Run(workload, session, "COMPACT") > 0, "No tiny method stayed tiny.");
+        }
+
+        #endregion
+
+        #region ComputeMaxStackTest
+
+        /// <summary>
+        /// Verifies the max stack computed for straight and branching code, and that code with a
+        /// stack underflow, inconsistent depths at a join, or a non-empty stack at its end is rejected.
+        /// </summary>
+        [Fact]
+        public void ComputeMaxStackTest()
+        {
+            // ldc.i4.1; ldc.i4.2; add; pop; ret
+            Assert.Equal(2u, ComputeMaxStack(0x17, 0x18, 0x58, 0x26, 0x2A));
+
+            // ldc.i4.0; brtrue.s +1; ret; ldc.i4.1; ldc.i4.2; ldc.i4.3; pop; pop; pop; ret
+            // The deepest code is reached only by the branch.
+            Assert.Equal(3u, ComputeMaxStack(0x16, 0x2D, 0x01, 0x2A, 0x17, 0x18, 0x19, 0x26, 0x26, 0x26, 0x2A));
+
+            // ldc.i4.1; dup; brfalse.s +2; pop; ret; pop
+            // As in the compact prologue, the value left by the branch is popped after a ret, then
+            // the code goes on with the following code with an empty stack.
+            Assert.Equal(2u, ComputeMaxStack(0x17, 0x25, 0x2C, 0x02, 0x26, 0x2A, 0x26));
+
+            uint maxStack;
+            // pop; ret
+            Assert.False(FaultEngineComputeMaxStack(new byte[] { 0x26, 0x2A }, 2, out maxStack));
+            // ldc.i4.0; brtrue.s +1; ldc.i4.1; ret (depth 0 by the branch, 1 by the fall through)
+            Assert.False(FaultEngineComputeMaxStack(new byte[] { 0x16, 0x2D, 0x01, 0x17, 0x2A }, 5, out maxStack));
+            // ldc.i4.0; ldc.i4.0; brfalse.s +0 (reaches the end with a value on the stack)
+            Assert.False(FaultEngineComputeMaxStack(new byte[] { 0x16, 0x16, 0x2C, 0x00 }, 4, out maxStack));
+            // call 0x0A000001; ret (no metadata to read the signature from)
+            Assert.False(FaultEngineComputeMaxStack(new byte[] { 0x28, 0x01, 0x00, 0x00, 0x0A, 0x2A }, 6, out maxStack));
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private static uint ComputeMaxStack(params byte[] code)
+        {
+            uint maxStack;
+            Assert.True(FaultEngineComputeMaxStack(code, (uint)code.Length, out maxStack));
+            return maxStack;
+        }
+
+        private static int Run(ProfiledWorkload workload, FaultSession session, string prologue)
+        {
+            Dictionary<string, string> environment = new Dictionary<string, string>();
+            environment["FAULT_INJECTION_PROLOGUE"] = prologue;
+
+            string[] counters;
+            using (Process process = workload.Start(session, environment))
+            {
+                counters = process.StandardOutput.ReadLine().Split(' ');
+                process.StandardOutput.ReadToEnd();
+                process.WaitForExit();
+                Assert.Equal(0, process.ExitCode);
+            }
+            Assert.Equal(4, int.Parse(counters[0], CultureInfo.InvariantCulture));
+            return int.Parse(counters[1], CultureInfo.InvariantCulture);
+        }
+
+        #endregion
+    }
+}
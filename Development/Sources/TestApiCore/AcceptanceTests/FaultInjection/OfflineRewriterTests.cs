@@ -0,0 +1,120 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Diagnostics;
+using System.IO;
+using System.Runtime.InteropServices;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Tests which rewrite a workload on disk with the offline rewriter of the engine, then run it
+    /// without the profiler.
+    /// </summary>
+    public class OfflineRewriterTests
+    {
+        #region Private Data
+
+        // Exits with 0 only if the rewritten methods fault, without the engine loaded.
+        private const string WorkloadSource = @"
+using System;
+using System.Diagnostics;
+using System.Runtime.CompilerServices;
+
+namespace Workload
+{
+    static class Program
+    {
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        static int Answer() { return 0; }
+
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        static string Name() { return ""original""; }
+
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        static void Fail() { }
+
+        static int Main()
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            bool passed = Answer() == 42 && Name() == ""faulted"";
+            try
+            {
+                Fail();
+                passed = false;
+            }
+            catch (InvalidOperationException)
+            {
+            }
+            foreach (ProcessModule module in Process.GetCurrentProcess().Modules)
+            {
+                passed &= !module.ModuleName.Equals(""FaultInjectionEngine.dll"", StringComparison.OrdinalIgnoreCase);
+            }
+            stopwatch.Stop();
+
+            Console.WriteLine(passed);
+            Console.WriteLine(stopwatch.ElapsedTicks);
+            return passed ? 0 : 1;
+        }
+    }
+}";
+
+        [DllImport("FaultInjectionEngine.dll", CharSet = CharSet.Unicode)]
+        private static extern bool FaultEngineRewriteAssemblies(string[] assemblyPaths, uint assemblyCount,
+            string outputFolder, string methodFilterFile, out uint methodCount);
+
+        #endregion
+
+        #region RewriteTest
+
+        /// <summary>
+        /// Verifies that the methods of the rules fault in a rewritten workload which runs without
+        /// the profiler, and prints the time spent rewriting it.
+        /// </summary>
+        [Fact]
+        public void RewriteTest()
+        {
+            // Only the compiled workload is needed; it never runs under the profiler.
+            new ProfiledWorkload("OfflineRewriterWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Program.Answer()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(42)),
+                new FaultRule("static Workload.Program.Name()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault("faulted")),
+                new FaultRule("static Workload.Program.Fail()", BuiltInConditions.TriggerOnEveryCall,
+                    BuiltInFaults.ThrowExceptionFault(new InvalidOperationException())));
+
+            string workloadPath = Path.Combine(Path.Combine(Path.GetTempPath(), "FaultInjectionWorkloads"), "OfflineRewriterWorkload.exe");
+            string outputFolder = Path.Combine(Path.Combine(Path.GetTempPath(), "FaultInjectionWorkloads"), "Rewritten");
+            Directory.CreateDirectory(outputFolder);
+
+            // The filter written for the engine is the one the rewriter reads.
+            ProcessStartInfo psi = session.GetProcessStartInfo(Path.Combine(outputFolder, "OfflineRewriterWorkload.exe"));
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            uint methodCount;
+            Assert.True(FaultEngineRewriteAssemblies(new string[] { workloadPath }, 1, outputFolder,
+                psi.EnvironmentVariables["FAULT_INJECTION_METHOD_FILTER"], out methodCount));
+            stopwatch.Stop();
+            Assert.Equal(3u, methodCount);
+            Console.WriteLine("{0} methods rewritten in {1:F1} ms", methodCount, stopwatch.Elapsed.TotalMilliseconds);
+
+            // Run the rewritten workload next to the dispatcher, with the rules but without the profiler.
+            string dispatcherPath = typeof(FaultSession).Assembly.Location;
+            File.Copy(dispatcherPath, Path.Combine(outputFolder, Path.GetFileName(dispatcherPath)), true);
+            psi.EnvironmentVariables.Remove("COR_ENABLE_PROFILING");
+            psi.RedirectStandardOutput = true;
+            using (Process process = Process.Start(psi))
+            {
+                Console.WriteLine(process.StandardOutput.ReadLine());
+                process.StandardOutput.ReadToEnd();
+                process.WaitForExit();
+                Assert.Equal(0, process.ExitCode);
+            }
+        }
+
+        #endregion
+    }
+}
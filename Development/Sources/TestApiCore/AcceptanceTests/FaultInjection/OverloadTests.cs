@@ -0,0 +1,140 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Runtime.InteropServices;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Tests which verify that the engine traps only the overloads named by the rules, telling
+    /// them apart by their parameter types
+    /// </summary>
+    public class OverloadTests
+    {
+        #region Private Data
+
+        // Reports the value each overload returned on its last call, 0 if not faulted.
+        private const string WorkloadSource = @"
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+
+namespace Workload
+{
+    static class Program
+    {
+        static int Compute(int value) { return 0; }
+        static int Compute(long value) { return 0; }
+        static int Compute(string value) { return 0; }
+        static int Compute(int[] values, ref string text) { return 0; }
+        static int Compute(List<int> values) { return 0; }
+
+        static int Main()
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            int[] results = new int[5];
+            string text = null;
+            for (int i = 0; i < 1000; i++)
+            {
+                results[0] = Compute(1);
+                results[1] = Compute(1L);
+                results[2] = Compute(""text"");
+                results[3] = Compute(new int[1], ref text);
+                results[4] = Compute(new List<int>());
+            }
+            stopwatch.Stop();
+            Console.WriteLine(""Int32: {0}"", results[0]);
+            Console.WriteLine(""Int64: {0}"", results[1]);
+            Console.WriteLine(""String: {0}"", results[2]);
+            Console.WriteLine(""ArrayAndRef: {0}"", results[3]);
+            Console.WriteLine(""List: {0}"", results[4]);
+            Console.WriteLine(""ElapsedTicks: {0}"", stopwatch.ElapsedTicks);
+            return 0;
+        }
+    }
+}";
+
+        [DllImport("FaultInjectionEngine.dll", CharSet = CharSet.Unicode)]
+        private static extern ulong FaultEngineHashCanonicalParameters(string parameters);
+
+        #endregion
+
+        #region OverloadTest
+
+        /// <summary>
+        /// Verifies that faults compiled into overloads of the same name, and faults of the
+        /// dispatcher, occur on their own overloads only
+        /// </summary>
+        [Fact]
+        public void OverloadTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("OverloadWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                Compiled(new FaultRule("static Workload.Program.Compute(int)",
+                    BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(1))),
+                Compiled(new FaultRule("static Workload.Program.Compute(string)",
+                    BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(2))),
+                new FaultRule("static Workload.Program.Compute(int[], ref string)",
+                    BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(3)),
+                new FaultRule("static Workload.Program.Compute(System.Collections.Generic.List<int>)",
+                    BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(4)));
+
+            // Each overload gets the fault of its own rule, and Compute(long) none.
+            WorkloadTiming timing = workload.Run(session, null);
+            Console.WriteLine(timing);
+            Assert.Equal("1", timing["Int32"]);
+            Assert.Equal("0", timing["Int64"]);
+            Assert.Equal("2", timing["String"]);
+            Assert.Equal("3", timing["ArrayAndRef"]);
+            Assert.Equal("4", timing["List"]);
+        }
+
+        #endregion
+
+        #region HashCanonicalParametersTest
+
+        /// <summary>
+        /// Verifies that parameter lists which name the same types hash alike, that lists of other
+        /// types do not, and that lists naming types no signature can have are not hashed
+        /// </summary>
+        [Fact]
+        public void HashCanonicalParametersTest()
+        {
+            ulong hash = FaultEngineHashCanonicalParameters("System.Int32,System.String&");
+            Assert.NotEqual(0ul, hash);
+            Assert.Equal(hash, FaultEngineHashCanonicalParameters(" System.Int32 , System.String & "));
+            Assert.NotEqual(hash, FaultEngineHashCanonicalParameters("System.Int32,System.String"));
+            Assert.NotEqual(FaultEngineHashCanonicalParameters("System.Int32"),
+                FaultEngineHashCanonicalParameters("System.Int64"));
+            Assert.NotEqual(FaultEngineHashCanonicalParameters("System.Int32[][,]"),
+                FaultEngineHashCanonicalParameters("System.Int32[,][]"));
+            Assert.NotEqual(FaultEngineHashCanonicalParameters("System.Collections.Generic.List<System.Int32>"),
+                FaultEngineHashCanonicalParameters("System.Collections.Generic.List<System.Int64>"));
+
+            // A method without parameters is an overload of its own.
+            Assert.NotEqual(0ul, FaultEngineHashCanonicalParameters(string.Empty));
+
+            // Type parameters and pointers select all overloads instead.
+            Assert.Equal(0ul, FaultEngineHashCanonicalParameters("T"));
+            Assert.Equal(0ul, FaultEngineHashCanonicalParameters("System.Int32*"));
+            Assert.Equal(0ul, FaultEngineHashCanonicalParameters("System.Collections.Generic.List<T>"));
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private static FaultRule Compiled(FaultRule rule)
+        {
+            rule.CompileIntoMethod = true;
+            return rule;
+        }
+
+        #endregion
+    }
+}
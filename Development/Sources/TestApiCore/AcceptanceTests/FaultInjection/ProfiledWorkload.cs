@@ -0,0 +1,262 @@
+﻿// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.CodeDom.Compiler;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Runtime.InteropServices;
+using Microsoft.CSharp;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// A small reference program which is compiled on the fly and run in a separate process,
+    /// optionally under the fault injection engine. The program reports the time spent in its
+    /// measured section, and any other result, as tagged lines ("Tag: value") on the standard output.
+    /// </summary>
+    public sealed class ProfiledWorkload
+    {
+        #region Public Data
+
+        /// <summary>
+        /// Tag of the line which reports the stopwatch ticks spent in the measured section.
+        /// </summary>
+        public const string ElapsedTicksTag = "ElapsedTicks";
+
+        #endregion
+
+        #region Private Data
+
+        private readonly string executablePath;
+
+        #endregion
+
+        #region Constructors
+
+        /// <summary>
+        /// Compiles the given C# source into an executable. The program must write the number
+        /// of stopwatch ticks spent in its measured section on a line tagged "ElapsedTicks: ",
+        /// anywhere in its output.
+        /// </summary>
+        public ProfiledWorkload(string name, string source)
+        {
+            executablePath = GetExecutablePath(name);
+
+            CompilerParameters parameters = new CompilerParameters();
+            parameters.GenerateExecutable = true;
+            parameters.CompilerOptions = "/optimize+";
+            parameters.OutputAssembly = executablePath;
+            parameters.ReferencedAssemblies.Add("System.dll");
+
+            using (CSharpCodeProvider provider = new CSharpCodeProvider())
+            {
+                CompilerResults results = provider.CompileAssemblyFromSource(parameters, source);
+                Assert.Equal(0, results.Errors.Count);
+            }
+        }
+
+        private ProfiledWorkload(string executablePath)
+        {
+            this.executablePath = executablePath;
+        }
+
+        #endregion
+
+        #region Public Members
+
+        /// <summary>
+        /// Assembles the given IL source into an executable with the IL assembler of the runtime,
+        /// for workloads which C# can not express. The same output contract applies.
+        /// </summary>
+        public static ProfiledWorkload FromIL(string name, string source)
+        {
+            string executablePath = GetExecutablePath(name);
+            string sourcePath = Path.ChangeExtension(executablePath, ".il");
+            File.WriteAllText(sourcePath, source);
+
+            ProcessStartInfo psi = new ProcessStartInfo(
+                Path.Combine(RuntimeEnvironment.GetRuntimeDirectory(), "ilasm.exe"),
+                string.Format(CultureInfo.InvariantCulture, "/exe /quiet /output=\"{0}\" \"{1}\"", executablePath, sourcePath));
+            psi.UseShellExecute = false;
+            psi.RedirectStandardOutput = true;
+            using (Process process = Process.Start(psi))
+            {
+                Console.Write(process.StandardOutput.ReadToEnd());
+                process.WaitForExit();
+                Assert.Equal(0, process.ExitCode);
+            }
+            return new ProfiledWorkload(executablePath);
+        }
+
+        /// <summary>
+        /// Runs the workload without the engine.
+        /// </summary>
+        public WorkloadTiming Run()
+        {
+            return Run(new ProcessStartInfo(executablePath) { UseShellExecute = false });
+        }
+
+        /// <summary>
+        /// Runs the workload under the engine, with extra environment variables for the engine.
+        /// </summary>
+        public WorkloadTiming Run(FaultSession session, IDictionary<string, string> environment)
+        {
+            ProcessStartInfo psi = session.GetProcessStartInfo(executablePath);
+            if (environment != null)
+            {
+                foreach (KeyValuePair<string, string> pair in environment)
+                {
+                    psi.EnvironmentVariables[pair.Key] = pair.Value;
+                }
+            }
+            return Run(psi);
+        }
+
+        /// <summary>
+        /// Starts the workload without the engine and returns at once, for workloads driven through
+        /// their standard input.
+        /// </summary>
+        public Process Start()
+        {
+            return Start(new ProcessStartInfo(executablePath) { UseShellExecute = false });
+        }
+
+        /// <summary>
+        /// Starts the workload under the engine and returns at once, for workloads driven through
+        /// their standard input while the test changes the session.
+        /// </summary>
+        public Process Start(FaultSession session, IDictionary<string, string> environment)
+        {
+            ProcessStartInfo psi = session.GetProcessStartInfo(executablePath);
+            if (environment != null)
+            {
+                foreach (KeyValuePair<string, string> pair in environment)
+                {
+                    psi.EnvironmentVariables[pair.Key] = pair.Value;
+                }
+            }
+            return Start(psi);
+        }
+
+        /// <summary>
+        /// Runs the workload several times and returns the fastest run, to filter out noise.
+        /// </summary>
+        public static WorkloadTiming BestOf(int count, Func<WorkloadTiming> run)
+        {
+            WorkloadTiming best = null;
+            for (int i = 0; i < count; i++)
+            {
+                WorkloadTiming timing = run();
+                if (best == null || timing.Total < best.Total)
+                {
+                    best = timing;
+                }
+            }
+            return best;
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private static string GetExecutablePath(string name)
+        {
+            string directory = Path.Combine(Path.GetTempPath(), "FaultInjectionWorkloads");
+            Directory.CreateDirectory(directory);
+            return Path.Combine(directory, name + ".exe");
+        }
+
+        private static Process Start(ProcessStartInfo psi)
+        {
+            psi.RedirectStandardInput = true;
+            psi.RedirectStandardOutput = true;
+            return Process.Start(psi);
+        }
+
+        private static WorkloadTiming Run(ProcessStartInfo psi)
+        {
+            psi.RedirectStandardOutput = true;
+
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            Dictionary<string, string> results = new Dictionary<string, string>();
+            using (Process process = Process.Start(psi))
+            {
+                string line;
+                while ((line = process.StandardOutput.ReadLine()) != null)
+                {
+                    // Untagged lines are only echoed. A tag reported twice keeps its last value.
+                    int colon = line.IndexOf(": ", StringComparison.Ordinal);
+                    if (colon > 0 && line.IndexOf(' ') >= colon)
+                    {
+                        results[line.Substring(0, colon)] = line.Substring(colon + 2).Trim();
+                    }
+                    else
+                    {
+                        Console.WriteLine(line);
+                    }
+                }
+                process.WaitForExit();
+                stopwatch.Stop();
+                Assert.Equal(0, process.ExitCode);
+            }
+
+            Assert.True(results.ContainsKey(ElapsedTicksTag), "The workload did not report its elapsed ticks");
+            return new WorkloadTiming(
+                stopwatch.Elapsed,
+                TimeSpan.FromSeconds(long.Parse(results[ElapsedTicksTag], CultureInfo.InvariantCulture) / (double)Stopwatch.Frequency),
+                results);
+        }
+
+        #endregion
+    }
+
+    /// <summary>
+    /// Timing of one workload run, and the other results reported by the workload.
+    /// </summary>
+    public sealed class WorkloadTiming
+    {
+        private readonly IDictionary<string, string> results;
+
+        public WorkloadTiming(TimeSpan total, TimeSpan measured, IDictionary<string, string> results)
+        {
+            Total = total;
+            Measured = measured;
+            this.results = results;
+        }
+
+        /// <summary>
+        /// Wall clock time of the whole process, including start-up and JIT compilation.
+        /// </summary>
+        public TimeSpan Total { get; private set; }
+
+        /// <summary>
+        /// Time spent in the measured section of the workload (steady state).
+        /// </summary>
+        public TimeSpan Measured { get; private set; }
+
+        /// <summary>
+        /// Gets the value the workload reported on the line with the given tag.
+        /// </summary>
+        public string this[string tag]
+        {
+            get
+            {
+                Assert.True(results.ContainsKey(tag), "The workload did not report " + tag);
+                return results[tag];
+            }
+        }
+
+        public override string ToString()
+        {
+            return string.Format(CultureInfo.InvariantCulture, "total {0,8:F1} ms, measured {1,8:F1} ms",
+                Total.TotalMilliseconds, Measured.TotalMilliseconds);
+        }
+    }
+}
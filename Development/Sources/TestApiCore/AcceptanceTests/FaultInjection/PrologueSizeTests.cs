@@ -0,0 +1,170 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Measures the growth of the IL code of trapped methods, with the default and the compact prologue.
+    /// </summary>
+    public class PrologueSizeTests
+    {
+        #region Private Data
+
+        private const string PrologueVariable = "FAULT_INJECTION_PROLOGUE";
+        private const string CallCountingVariable = "FAULT_INJECTION_CALL_COUNTING";
+
+        // A corpus of method shapes: tiny getters, setters and constants, methods with local variables,
+        // and with exception handlers. Every method is faulted once, then the workload prints the code
+        // size counters of the engine, and exits with 0 only if all faults occurred.
+        private const string WorkloadSource = @"
+using System;
+using System.Diagnostics;
+using System.Runtime.InteropServices;
+
+namespace Workload
+{
+    class Corpus
+    {
+        int value = 3;
+
+        public int Get() { return value; }
+        public void Set(int newValue) { value = newValue; }
+        public static int Constant() { return 7; }
+        public static void Touch() { }
+        public static long Wide(long x) { return x + 1; }
+        public static string Name() { return ""corpus""; }
+
+        public static int Sum(int count)
+        {
+            int sum = 0;
+            for (int i = 0; i < count; i++) { sum += i; }
+            return sum;
+        }
+
+        public static int Guarded(int x)
+        {
+            try { return 100 / x; }
+            catch (DivideByZeroException) { return -1; }
+            finally { value2++; }
+        }
+
+        static int value2;
+    }
+
+    static class Program
+    {
+        [DllImport(""FaultInjectionEngine.dll"")]
+        static extern bool FaultEngineGetCodeSizeCounters(out uint bodies, out uint originalBytes, out uint rewrittenBytes, out uint tinyBodies);
+
+        static bool Throws(Action action)
+        {
+            try { action(); return false; }
+            catch (InvalidOperationException) { return true; }
+        }
+
+        static int Main()
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            Corpus corpus = new Corpus();
+            bool passed = corpus.Get() == -1 && Corpus.Constant() == -1 && Corpus.Sum(10) == -1 && Corpus.Guarded(5) == -1
+                && Corpus.Wide(1) == 0 && Corpus.Name() == null
+                && Throws(delegate { corpus.Set(1); }) && Throws(delegate { Corpus.Touch(); });
+            stopwatch.Stop();
+
+            uint bodies, originalBytes, rewrittenBytes, tinyBodies;
+            FaultEngineGetCodeSizeCounters(out bodies, out originalBytes, out rewrittenBytes, out tinyBodies);
+            Console.WriteLine(""{0} {1} {2} {3}"", bodies, originalBytes, rewrittenBytes, tinyBodies);
+            Console.WriteLine(stopwatch.ElapsedTicks);
+            return passed ? 0 : 1;
+        }
+    }
+}";
+
+        #endregion
+
+        #region CodeSizeTest
+
+        /// <summary>
+        /// Verifies that faults work with every prologue, that the compact prologue makes the rewritten
+        /// corpus smaller and keeps tiny methods tiny, and that the default prologue has no padding.
+        /// </summary>
+        [Fact]
+        public void CodeSizeTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("PrologueSizeWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("Workload.Corpus.Get()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(-1)),
+                new FaultRule("Workload.Corpus.Set(int)", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ThrowExceptionFault(new InvalidOperationException())),
+                new FaultRule("static Workload.Corpus.Constant()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(-1)),
+                new FaultRule("static Workload.Corpus.Touch()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ThrowExceptionFault(new InvalidOperationException())),
+                new FaultRule("static Workload.Corpus.Wide(long)", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(0L)),
+                new FaultRule("static Workload.Corpus.Name()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnFault()),
+                new FaultRule("static Workload.Corpus.Sum(int)", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(-1)),
+                new FaultRule("static Workload.Corpus.Guarded(int)", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(-1)));
+
+            CodeSize standard = Measure(workload, session, "DEFAULT", null);
+            CodeSize standardFast = Measure(workload, session, "DEFAULT", "FAST");
+            CodeSize compact = Measure(workload, session, "COMPACT", "ATOMIC");
+            CodeSize compactFast = Measure(workload, session, "COMPACT", "FAST");
+
+            Assert.Equal(8, standard.Bodies);
+            Assert.Equal(0, standard.TinyBodies);
+            Assert.True(standard.RewrittenBytes < standardFast.RewrittenBytes, "The atomic count should not be padded to the size of the fast one.");
+            Assert.True(compact.RewrittenBytes < standard.RewrittenBytes, "The compact prologue is not smaller.");
+            Assert.True(compact.TinyBodies > 0, "No tiny method stayed tiny.");
+            Assert.True(compactFast.RewrittenBytes > compact.RewrittenBytes, "Fast counting should take more code.");
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private static CodeSize Measure(ProfiledWorkload workload, FaultSession session, string prologue, string callCounting)
+        {
+            Dictionary<string, string> environment = new Dictionary<string, string>();
+            environment[PrologueVariable] = prologue;
+            if (callCounting != null)
+            {
+                environment[CallCountingVariable] = callCounting;
+            }
+
+            string[] counters;
+            using (Process process = workload.Start(session, environment))
+            {
+                counters = process.StandardOutput.ReadLine().Split(' ');
+                process.StandardOutput.ReadToEnd();
+                process.WaitForExit();
+                Assert.Equal(0, process.ExitCode);
+            }
+
+            CodeSize size = new CodeSize();
+            size.Bodies = int.Parse(counters[0], CultureInfo.InvariantCulture);
+            size.OriginalBytes = int.Parse(counters[1], CultureInfo.InvariantCulture);
+            size.RewrittenBytes = int.Parse(counters[2], CultureInfo.InvariantCulture);
+            size.TinyBodies = int.Parse(counters[3], CultureInfo.InvariantCulture);
+            Console.WriteLine("{0,-8} {1,-7}: {2} methods, {3} bytes of IL became {4} bytes (+{5:F0}%), {6} tiny",
+                prologue, callCounting, size.Bodies, size.OriginalBytes, size.RewrittenBytes,
+                100.0 * (size.RewrittenBytes - size.OriginalBytes) / size.OriginalBytes, size.TinyBodies);
+            return size;
+        }
+
+        private class CodeSize
+        {
+            public int Bodies;
+            public int OriginalBytes;
+            public int RewrittenBytes;
+            public int TinyBodies;
+        }
+
+        #endregion
+    }
+}
@@ -0,0 +1,177 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Diagnostics;
+using System.Globalization;
+using System.Threading;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Tests which arm and disarm rules of a running process, with methods rewritten on demand.
+    /// </summary>
+    public class ReJitTests
+    {
+        #region Private Data
+
+        private const string Method = "static Workload.Program.Target()";
+        private static readonly TimeSpan Timeout = TimeSpan.FromSeconds(30);
+
+        // Calls Target a million times per "measure" line read from the standard input, and prints
+        // the number of faults and the stopwatch ticks spent.
+        private const string WorkloadSource = @"
+using System;
+using System.Diagnostics;
+
+namespace Workload
+{
+    static class Program
+    {
+        static int Target() { return 0; }
+
+        static int Main()
+        {
+            string command;
+            while ((command = Console.ReadLine()) == ""measure"")
+            {
+                Stopwatch stopwatch = Stopwatch.StartNew();
+                int faults = 0;
+                for (int i = 0; i < 1000000; i++)
+                {
+                    faults += Target();
+                }
+                stopwatch.Stop();
+                Console.WriteLine(""{0} {1}"", faults, stopwatch.ElapsedTicks);
+            }
+            return 0;
+        }
+    }
+}";
+
+        // Reports how many of the calls made by each caller were faulted.
+        private const string CallSiteWorkloadSource = @"
+using System;
+using System.Diagnostics;
+
+namespace Workload
+{
+    static class Helper
+    {
+        public static int Compute(int value) { return value; }
+    }
+
+    static class Program
+    {
+        static int Covered() { return Helper.Compute(1); }
+        static int Uncovered() { return Helper.Compute(1); }
+
+        static int Main()
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            int covered = 0, uncovered = 0;
+            for (int i = 0; i < 1000; i++)
+            {
+                if (Covered() == 42) { covered++; }
+                if (Uncovered() == 42) { uncovered++; }
+            }
+            stopwatch.Stop();
+            Console.WriteLine(""Covered: {0}"", covered);
+            Console.WriteLine(""Uncovered: {0}"", uncovered);
+            Console.WriteLine(""ElapsedTicks: {0}"", stopwatch.ElapsedTicks);
+            return 0;
+        }
+    }
+}";
+
+        #endregion
+
+        #region ArmAndDisarmTest
+
+        /// <summary>
+        /// Verifies that a disarmed method stops faulting without restarting the process, and runs
+        /// as fast as a method which was never armed.
+        /// </summary>
+        [Fact]
+        public void ArmAndDisarmTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("ReJitWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule(Method, BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(1)));
+            session.RewriteOnDemand = true;
+            session.Disarm();
+
+            using (Process process = workload.Start(session, null))
+            {
+                TimeSpan neverArmed = Measure(process, false);
+
+                session.Arm(Method);
+                TimeSpan armed = Measure(process, true);
+
+                session.Disarm(Method);
+                TimeSpan disarmed = Measure(process, false);
+
+                process.StandardInput.WriteLine("exit");
+                process.WaitForExit();
+                Assert.Equal(0, process.ExitCode);
+
+                Console.WriteLine("never armed {0,8:F1} ms, armed {1,8:F1} ms, disarmed {2,8:F1} ms",
+                    neverArmed.TotalMilliseconds, armed.TotalMilliseconds, disarmed.TotalMilliseconds);
+            }
+        }
+
+        #endregion
+
+        #region CallSiteTest
+
+        /// <summary>
+        /// Verifies that calls made in the caller scope of a rule are faulted when rewriting on
+        /// demand, ReJIT compiling only the methods of the method filter
+        /// </summary>
+        [Fact]
+        public void CallSiteTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("ReJitCallSiteWorkload", CallSiteWorkloadSource);
+            FaultRule rule = new FaultRule("static Workload.Helper.Compute(int)",
+                BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(42));
+            rule.CallerScopes = new string[] { "Workload.Program.Covered" };
+            FaultSession session = new FaultSession(rule);
+            session.RewriteOnDemand = true;
+
+            WorkloadTiming timing = workload.Run(session, null);
+            Console.WriteLine(timing);
+            Assert.Equal("1000", timing["Covered"]);
+            Assert.Equal("0", timing["Uncovered"]);
+        }
+
+        #endregion
+
+        #region Private Members
+
+        // The engine compiles the method again in the background, so measure until the expected
+        // state is reached.
+        private static TimeSpan Measure(Process process, bool faulted)
+        {
+            Stopwatch timeout = Stopwatch.StartNew();
+            for (;;)
+            {
+                process.StandardInput.WriteLine("measure");
+                string[] result = process.StandardOutput.ReadLine().Split(' ');
+                int faults = int.Parse(result[0], CultureInfo.InvariantCulture);
+                if (faults == (faulted ? 1000000 : 0))
+                {
+                    return TimeSpan.FromSeconds(long.Parse(result[1], CultureInfo.InvariantCulture) / (double)Stopwatch.Frequency);
+                }
+
+                Assert.True(timeout.Elapsed < Timeout, faulted ? "Method was not armed." : "Method was not disarmed.");
+                Thread.Sleep(100);
+            }
+        }
+
+        #endregion
+    }
+}
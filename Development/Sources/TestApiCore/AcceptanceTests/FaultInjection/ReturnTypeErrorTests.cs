@@ -15,6 +15,82 @@ namespace Microsoft.Test.AcceptanceTests.FaultInjection
     /// </summary>
     public class ReturnTypeErrorTests
     {
+        #region Private Data
+
+        // Pointers and function pointers can not be generic arguments, so methods returning them
+        // can not be trapped, nor the calls to them. C# has no function pointer types, hence IL.
+        // Each method returns 1, and the workload reports what it got, calling it directly and
+        // through Caller. Nothing is measured.
+        private const string UnsupportedReturnTypeWorkloadSource = @"
+.assembly extern mscorlib { .publickeytoken = (B7 7A 5C 56 19 34 E0 89) .ver 4:0:0:0 }
+.assembly UnsupportedReturnTypeWorkload { }
+.module UnsupportedReturnTypeWorkload.exe
+
+.class private abstract auto ansi sealed Workload.Program extends [mscorlib]System.Object
+{
+    .method private hidebysig static int32* Pointer() cil managed noinlining
+    {
+        .maxstack 1
+        ldc.i4.1
+        conv.u
+        ret
+    }
+
+    .method private hidebysig static method void *() FunctionPointer() cil managed noinlining
+    {
+        .maxstack 1
+        ldc.i4.1
+        conv.u
+        ret
+    }
+
+    .method private hidebysig static uint64 Caller(bool pointer) cil managed noinlining
+    {
+        .maxstack 1
+        ldarg.0
+        brfalse.s FUNCTION_POINTER
+        call int32* Workload.Program::Pointer()
+        conv.u8
+        ret
+    FUNCTION_POINTER:
+        call method void *() Workload.Program::FunctionPointer()
+        conv.u8
+        ret
+    }
+
+    .method private hidebysig static int32 Main() cil managed
+    {
+        .entrypoint
+        .maxstack 2
+        ldstr ""Pointer: {0}""
+        call int32* Workload.Program::Pointer()
+        conv.u8
+        box [mscorlib]System.UInt64
+        call void [mscorlib]System.Console::WriteLine(string, object)
+        ldstr ""FunctionPointer: {0}""
+        call method void *() Workload.Program::FunctionPointer()
+        conv.u8
+        box [mscorlib]System.UInt64
+        call void [mscorlib]System.Console::WriteLine(string, object)
+        ldstr ""CallerPointer: {0}""
+        ldc.i4.1
+        call uint64 Workload.Program::Caller(bool)
+        box [mscorlib]System.UInt64
+        call void [mscorlib]System.Console::WriteLine(string, object)
+        ldstr ""CallerFunctionPointer: {0}""
+        ldc.i4.0
+        call uint64 Workload.Program::Caller(bool)
+        box [mscorlib]System.UInt64
+        call void [mscorlib]System.Console::WriteLine(string, object)
+        ldstr ""ElapsedTicks: 0""
+        call void [mscorlib]System.Console::WriteLine(string)
+        ldc.i4.0
+        ret
+    }
+}";
+
+        #endregion
+
         #region NullValueTypeTestInt
 
         /// <summary>
@@ -154,5 +230,51 @@ public bool ReturnTypeMismatchBoolInt()
         }
 
         #endregion
+
+        #region UnsupportedReturnTypeTest
+
+        /// <summary>
+        /// Verifies that methods returning a pointer or a function pointer are left unmodified,
+        /// instead of failing at run time with a generic argument they can not have
+        /// </summary>
+        [Fact]
+        public void UnsupportedReturnTypeTest()
+        {
+            ProfiledWorkload workload = ProfiledWorkload.FromIL("UnsupportedReturnTypeWorkload",
+                UnsupportedReturnTypeWorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Program.Pointer()", BuiltInConditions.TriggerOnEveryCall,
+                    BuiltInFaults.ReturnFault()),
+                new FaultRule("static Workload.Program.FunctionPointer()", BuiltInConditions.TriggerOnEveryCall,
+                    BuiltInFaults.ReturnFault()));
+
+            WorkloadTiming timing = workload.Run(session, null);
+            Assert.Equal("1", timing["Pointer"]);
+            Assert.Equal("1", timing["FunctionPointer"]);
+        }
+
+        /// <summary>
+        /// Verifies that calls to methods returning a pointer or a function pointer are left
+        /// untrapped in the caller scopes of their rules
+        /// </summary>
+        [Fact]
+        public void UnsupportedReturnTypeCallSiteTest()
+        {
+            ProfiledWorkload workload = ProfiledWorkload.FromIL("UnsupportedReturnTypeWorkload",
+                UnsupportedReturnTypeWorkloadSource);
+            FaultRule pointerRule = new FaultRule("static Workload.Program.Pointer()",
+                BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnFault());
+            pointerRule.CallerScopes = new string[] { "Workload.Program.Caller" };
+            FaultRule functionPointerRule = new FaultRule("static Workload.Program.FunctionPointer()",
+                BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnFault());
+            functionPointerRule.CallerScopes = new string[] { "Workload.Program.Caller" };
+            FaultSession session = new FaultSession(pointerRule, functionPointerRule);
+
+            WorkloadTiming timing = workload.Run(session, null);
+            Assert.Equal("1", timing["CallerPointer"]);
+            Assert.Equal("1", timing["CallerFunctionPointer"]);
+        }
+
+        #endregion
     }
 }
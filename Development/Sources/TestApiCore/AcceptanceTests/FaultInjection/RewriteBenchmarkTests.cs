@@ -0,0 +1,132 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.Text;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Benchmarks the rewriting of IL bodies with many exception handlers, in the small and the fat format.
+    /// </summary>
+    public class RewriteBenchmarkTests
+    {
+        #region Private Data
+
+        private const int MethodCount = 64;
+
+        // The small format of exception handlers holds at most 20 clauses, so 32 blocks of
+        // try/catch/finally (64 clauses) are always in the fat format.
+        private const int SmallBlockCount = 4;
+        private const int FatBlockCount = 32;
+
+        // {0} is the generated methods, {1} the calls checking that every method is faulted.
+        // The workload prints the number of rewritten bodies and the time taken to build them.
+        private const string WorkloadSource = @"
+using System;
+using System.Diagnostics;
+using System.Runtime.InteropServices;
+
+namespace Workload
+{{
+    static class Corpus
+    {{
+        static int counter;
+{0}
+    }}
+
+    static class Program
+    {{
+        [DllImport(""FaultInjectionEngine.dll"")]
+        static extern bool FaultEngineGetCodeSizeCounters(out uint bodies, out uint originalBytes, out uint rewrittenBytes, out uint tinyBodies);
+
+        [DllImport(""FaultInjectionEngine.dll"")]
+        static extern bool FaultEngineGetRewriteTime(out long ticks, out long frequency);
+
+        static int Main()
+        {{
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            bool passed = true;
+{1}
+            stopwatch.Stop();
+
+            uint bodies, originalBytes, rewrittenBytes, tinyBodies;
+            long ticks, frequency;
+            FaultEngineGetCodeSizeCounters(out bodies, out originalBytes, out rewrittenBytes, out tinyBodies);
+            FaultEngineGetRewriteTime(out ticks, out frequency);
+            Console.WriteLine(""{{0}} {{1}} {{2}} {{3}}"", bodies, rewrittenBytes, ticks, frequency);
+            Console.WriteLine(stopwatch.ElapsedTicks);
+            return passed ? 0 : 1;
+        }}
+    }}
+}}";
+
+        #endregion
+
+        #region ExceptionHandlerTest
+
+        /// <summary>
+        /// Verifies that methods with small and with fat exception handlers are faulted, and prints
+        /// the time taken to rewrite each body.
+        /// </summary>
+        [Fact]
+        public void ExceptionHandlerTest()
+        {
+            Measure("small-eh", SmallBlockCount);
+            Measure("fat-eh", FatBlockCount);
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private static void Measure(string shape, int blockCount)
+        {
+            StringBuilder methods = new StringBuilder();
+            StringBuilder calls = new StringBuilder();
+            List<FaultRule> rules = new List<FaultRule>();
+            for (int i = 0; i < MethodCount; i++)
+            {
+                methods.AppendFormat(CultureInfo.InvariantCulture, "        public static int Guarded{0}(int x)\n        {{\n            int result = 0;\n", i);
+                for (int j = 0; j < blockCount; j++)
+                {
+                    methods.AppendFormat(CultureInfo.InvariantCulture,
+                        "            try {{ result += {0} / x; }} catch (DivideByZeroException) {{ result = -2; }} finally {{ counter++; }}\n", j);
+                }
+                methods.Append("            return result;\n        }\n");
+                calls.AppendFormat(CultureInfo.InvariantCulture, "            passed &= Corpus.Guarded{0}(1) == -1;\n", i);
+                rules.Add(new FaultRule(
+                    String.Format(CultureInfo.InvariantCulture, "static Workload.Corpus.Guarded{0}(int)", i),
+                    BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(-1)));
+            }
+
+            ProfiledWorkload workload = new ProfiledWorkload("RewriteBenchmarkWorkload",
+                String.Format(CultureInfo.InvariantCulture, WorkloadSource, methods, calls));
+            string[] counters;
+            using (Process process = workload.Start(new FaultSession(rules.ToArray()), null))
+            {
+                counters = process.StandardOutput.ReadLine().Split(' ');
+                process.StandardOutput.ReadToEnd();
+                process.WaitForExit();
+                Assert.Equal(0, process.ExitCode);
+            }
+
+            int bodies = int.Parse(counters[0], CultureInfo.InvariantCulture);
+            int rewrittenBytes = int.Parse(counters[1], CultureInfo.InvariantCulture);
+            long ticks = long.Parse(counters[2], CultureInfo.InvariantCulture);
+            long frequency = long.Parse(counters[3], CultureInfo.InvariantCulture);
+            Console.WriteLine("{0,-8}: {1} methods with {2} clauses, {3} bytes on average, rewritten in {4:F2} us each",
+                shape, bodies, 2 * blockCount, rewrittenBytes / bodies, ticks * 1e6 / frequency / bodies);
+            Assert.Equal(MethodCount, bodies);
+        }
+
+        #endregion
+    }
+}
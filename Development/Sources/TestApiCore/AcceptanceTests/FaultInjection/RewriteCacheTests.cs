@@ -0,0 +1,86 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Tests which compile the same method more than once, and verify that the engine rewrites
+    /// or bypasses it only at the first compilation.
+    /// </summary>
+    public class RewriteCacheTests
+    {
+        #region Private Data
+
+        // Each value-type instantiation of Echo is a JIT compilation of the same method-def, like
+        // the compilations of a method at several tiers. The workload reads the counters of the
+        // engine before and after, and exits with 0 only if the repeated compilations were skipped
+        // and Target is still faulted.
+        private const string WorkloadSource = @"
+using System;
+using System.Diagnostics;
+using System.Runtime.CompilerServices;
+using System.Runtime.InteropServices;
+
+namespace Workload
+{
+    struct Small { public int Value; }
+    struct Large { public long First; public long Second; public long Third; }
+
+    static class Program
+    {
+        [DllImport(""FaultInjectionEngine.dll"")]
+        static extern bool FaultEngineGetJitCounters(out uint compilations, out uint skipped);
+
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        static int Target() { return 0; }
+
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        static T Echo<T>(T value) { return value; }
+
+        static int Main()
+        {
+            uint compilations, skippedBefore, skippedAfter;
+            FaultEngineGetJitCounters(out compilations, out skippedBefore);
+
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            Echo(1); Echo(1L); Echo(1.0); Echo(1.0m); Echo(Guid.Empty);
+            Echo(new Small()); Echo(new Large()); Echo(DateTime.MinValue);
+            stopwatch.Stop();
+
+            FaultEngineGetJitCounters(out compilations, out skippedAfter);
+            int faults = Target();
+            Console.WriteLine(""compilations {0}, skipped {1}, faults {2}"", compilations, skippedAfter - skippedBefore, faults);
+            Console.WriteLine(""ElapsedTicks: {0}"", stopwatch.ElapsedTicks);
+            return (skippedAfter - skippedBefore >= 7) && (faults == 1) ? 0 : 1;
+        }
+    }
+}";
+
+        #endregion
+
+        #region RepeatedCompilationTest
+
+        /// <summary>
+        /// Verifies that the eight compilations of a generic method count seven skipped ones, and
+        /// that trapping a method still works alongside.
+        /// </summary>
+        [Fact]
+        public void RepeatedCompilationTest()
+        {
+            ProfiledWorkload workload = new ProfiledWorkload("RewriteCacheWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Program.Target()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(1)));
+
+            // The workload exits with non-zero if a repeated compilation was not skipped.
+            Console.WriteLine(workload.Run(session, null));
+        }
+
+        #endregion
+    }
+}
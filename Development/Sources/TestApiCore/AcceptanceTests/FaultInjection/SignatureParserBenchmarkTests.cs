@@ -0,0 +1,53 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Diagnostics;
+using System.Runtime.InteropServices;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Benchmarks the signature parser of the engine on every method signature of the system
+    /// assembly, against the recursive walk it replaced.
+    /// </summary>
+    public class SignatureParserBenchmarkTests
+    {
+        #region Private Data
+
+        [DllImport("FaultInjectionEngine.dll", CharSet = CharSet.Unicode)]
+        private static extern bool FaultEngineBenchmarkSignatures(string assemblyPath, uint iterations,
+            out long ticks, out long referenceTicks, out uint signatureCount);
+
+        #endregion
+
+        #region BenchmarkTest
+
+        /// <summary>
+        /// Verifies that the parser and the recursive walk agree on every method signature of the
+        /// system assembly, and prints the time per signature of both.
+        /// </summary>
+        [Fact]
+        public void BenchmarkTest()
+        {
+            const uint Iterations = 20;
+
+            long ticks;
+            long referenceTicks;
+            uint signatureCount;
+            Assert.True(FaultEngineBenchmarkSignatures(typeof(object).Assembly.Location, Iterations,
+                out ticks, out referenceTicks, out signatureCount));
+            Assert.True(signatureCount > 0);
+
+            double nanoseconds = ticks * 1e9 / Stopwatch.Frequency / (Iterations * signatureCount);
+            double referenceNanoseconds = referenceTicks * 1e9 / Stopwatch.Frequency / (Iterations * signatureCount);
+            Console.WriteLine("{0} signatures parsed {1} times, {2:F1} ns per signature, {3:F1} ns recursively ({4:F2}x)",
+                signatureCount, Iterations, nanoseconds, referenceNanoseconds, referenceNanoseconds / nanoseconds);
+        }
+
+        #endregion
+    }
+}
@@ -0,0 +1,89 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Diagnostics;
+using System.IO;
+using System.Runtime.InteropServices;
+using Microsoft.Test.FaultInjection;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Benchmarks the rewriting of the JIT hook of the engine on a workload on disk, with the
+    /// metadata read from the files instead of the runtime.
+    /// </summary>
+    public class SnapshotBenchmarkTests
+    {
+        #region Private Data
+
+        // Only compiled: its methods are rewritten, never run.
+        private const string WorkloadSource = @"
+using System;
+using System.Collections.Generic;
+
+namespace Workload
+{
+    static class Program
+    {
+        static int Answer() { return 0; }
+
+        static string Name() { return ""original""; }
+
+        static void Fail() { }
+
+        static List<string> Names() { return new List<string>(); }
+
+        static int Main()
+        {
+            return Answer() + Name().Length + Names().Count;
+        }
+    }
+}";
+
+        [DllImport("FaultInjectionEngine.dll", CharSet = CharSet.Unicode)]
+        private static extern bool FaultEngineBenchmarkSnapshot(string assemblyPath, string[] referencePaths,
+            uint referenceCount, string methodFilterFile, uint iterations, out long ticks, out uint methodCount);
+
+        #endregion
+
+        #region BenchmarkTest
+
+        /// <summary>
+        /// Verifies that the prologue is inserted into the methods of the rules without a runtime,
+        /// and prints the time per method.
+        /// </summary>
+        [Fact]
+        public void BenchmarkTest()
+        {
+            const uint Iterations = 100;
+
+            new ProfiledWorkload("SnapshotBenchmarkWorkload", WorkloadSource);
+            FaultSession session = new FaultSession(
+                new FaultRule("static Workload.Program.Answer()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault(42)),
+                new FaultRule("static Workload.Program.Name()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnValueFault("faulted")),
+                new FaultRule("static Workload.Program.Fail()", BuiltInConditions.TriggerOnEveryCall,
+                    BuiltInFaults.ThrowExceptionFault(new InvalidOperationException())),
+                new FaultRule("static Workload.Program.Names()", BuiltInConditions.TriggerOnEveryCall, BuiltInFaults.ReturnFault()));
+
+            string workloadPath = Path.Combine(Path.Combine(Path.GetTempPath(), "FaultInjectionWorkloads"), "SnapshotBenchmarkWorkload.exe");
+            ProcessStartInfo psi = session.GetProcessStartInfo(workloadPath);
+
+            // The prologue refers to the dispatcher and to the system assembly.
+            string[] referencePaths = new string[] { typeof(FaultSession).Assembly.Location, typeof(object).Assembly.Location };
+            long ticks;
+            uint methodCount;
+            Assert.True(FaultEngineBenchmarkSnapshot(workloadPath, referencePaths, (uint)referencePaths.Length,
+                psi.EnvironmentVariables["FAULT_INJECTION_METHOD_FILTER"], Iterations, out ticks, out methodCount));
+            Assert.Equal(4u, methodCount);
+
+            double microseconds = ticks * 1e6 / Stopwatch.Frequency / (Iterations * methodCount);
+            Console.WriteLine("{0} methods rewritten {1} times, {2:F1} us per method", methodCount, Iterations, microseconds);
+        }
+
+        #endregion
+    }
+}
@@ -0,0 +1,159 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Runtime.InteropServices;
+using Xunit;
+
+namespace Microsoft.Test.AcceptanceTests.FaultInjection
+{
+    /// <summary>
+    /// Unit checks of the trap table of the engine, which is loaded into the test process and
+    /// fed with made-up module ids and tokens. The engine must be built with its test exports.
+    /// </summary>
+    public class TrapTableTests
+    {
+        #region Private Data
+
+        // Module ids are addresses in the runtime, so made-up ones can not collide with real modules.
+        private static readonly IntPtr ModuleA = new IntPtr(0x7A000010);
+        private static readonly IntPtr ModuleB = new IntPtr(0x7B000010);
+        private static readonly Guid ModuleVersionIdA = Guid.NewGuid();
+        private static readonly Guid ModuleVersionIdB = Guid.NewGuid();
+        private const ulong CacheLineSize = 64;
+
+        [DllImport("FaultInjectionEngine.dll")]
+        private static extern uint FaultEngineRegisterTrap(IntPtr moduleId, ref Guid moduleVersionId, uint methodDefToken);
+
+        [DllImport("FaultInjectionEngine.dll")]
+        private static extern uint FaultEngineRegisterCallSiteTrap(IntPtr moduleId, ref Guid moduleVersionId, uint calleeToken);
+
+        [DllImport("FaultInjectionEngine.dll")]
+        private static extern bool FaultEngineGetTrapInfo(uint trapId, out Guid moduleVersionId, out uint methodDefToken);
+
+        [DllImport("FaultInjectionEngine.dll")]
+        private static extern bool FaultEngineSetTrapThreshold(uint trapId, int threshold);
+
+        [DllImport("FaultInjectionEngine.dll")]
+        private static extern bool FaultEngineGetTrapGate(uint trapId, out UIntPtr address, out bool armed, out int threshold);
+
+        #endregion
+
+        #region RegisterTest
+
+        /// <summary>
+        /// Verifies that a method keeps its trap id when it is registered again, and that methods
+        /// with the same token in different modules get different ids.
+        /// </summary>
+        [Fact]
+        public void RegisterTest()
+        {
+            Guid mvidA = ModuleVersionIdA;
+            Guid mvidB = ModuleVersionIdB;
+
+            uint first = FaultEngineRegisterTrap(ModuleA, ref mvidA, 0x06000001);
+            uint second = FaultEngineRegisterTrap(ModuleA, ref mvidA, 0x06000002);
+            uint other = FaultEngineRegisterTrap(ModuleB, ref mvidB, 0x06000001);
+
+            Assert.NotEqual(first, second);
+            Assert.NotEqual(first, other);
+            Assert.NotEqual(second, other);
+            Assert.Equal(first, FaultEngineRegisterTrap(ModuleA, ref mvidA, 0x06000001));
+            Assert.Equal(other, FaultEngineRegisterTrap(ModuleB, ref mvidB, 0x06000001));
+
+            AssertTrapInfo(first, ModuleVersionIdA, 0x06000001);
+            AssertTrapInfo(second, ModuleVersionIdA, 0x06000002);
+            AssertTrapInfo(other, ModuleVersionIdB, 0x06000001);
+        }
+
+        #endregion
+
+        #region RegisterCallSiteTest
+
+        /// <summary>
+        /// Verifies that the call sites of a callee get a trap id of their own, even with the
+        /// method-def token the callee is trapped with, and keep it when registered again.
+        /// </summary>
+        [Fact]
+        public void RegisterCallSiteTest()
+        {
+            Guid mvidA = ModuleVersionIdA;
+
+            uint method = FaultEngineRegisterTrap(ModuleA, ref mvidA, 0x06000021);
+            uint callSite = FaultEngineRegisterCallSiteTrap(ModuleA, ref mvidA, 0x06000021);
+            uint memberRefCallSite = FaultEngineRegisterCallSiteTrap(ModuleA, ref mvidA, 0x0A000021);
+
+            Assert.NotEqual(method, callSite);
+            Assert.NotEqual(callSite, memberRefCallSite);
+            Assert.Equal(method, FaultEngineRegisterTrap(ModuleA, ref mvidA, 0x06000021));
+            Assert.Equal(callSite, FaultEngineRegisterCallSiteTrap(ModuleA, ref mvidA, 0x06000021));
+
+            AssertTrapInfo(method, ModuleVersionIdA, 0x06000021);
+            AssertTrapInfo(callSite, ModuleVersionIdA, 0x06000021);
+            AssertTrapInfo(memberRefCallSite, ModuleVersionIdA, 0x0A000021);
+
+            UIntPtr address;
+            UIntPtr callSiteAddress;
+            bool armed;
+            int threshold;
+            Assert.True(FaultEngineGetTrapGate(method, out address, out armed, out threshold));
+            Assert.True(FaultEngineGetTrapGate(callSite, out callSiteAddress, out armed, out threshold));
+            Assert.NotEqual(address, callSiteAddress);
+        }
+
+        #endregion
+
+        #region GateTest
+
+        /// <summary>
+        /// Verifies that a gate is armed when registered, disarmed by a threshold of Int32.MaxValue
+        /// and armed again by any other, and that the gates of two methods do not share a cache line.
+        /// </summary>
+        [Fact]
+        public void GateTest()
+        {
+            Guid mvidA = ModuleVersionIdA;
+            uint first = FaultEngineRegisterTrap(ModuleA, ref mvidA, 0x06000011);
+            uint second = FaultEngineRegisterTrap(ModuleA, ref mvidA, 0x06000012);
+
+            UIntPtr address;
+            bool armed;
+            int threshold;
+            Assert.True(FaultEngineGetTrapGate(first, out address, out armed, out threshold));
+            Assert.True(armed);
+            Assert.Equal(0, threshold);
+
+            Assert.True(FaultEngineSetTrapThreshold(first, int.MaxValue));
+            Assert.True(FaultEngineGetTrapGate(first, out address, out armed, out threshold));
+            Assert.False(armed);
+
+            Assert.True(FaultEngineSetTrapThreshold(first, 5));
+            Assert.True(FaultEngineGetTrapGate(first, out address, out armed, out threshold));
+            Assert.True(armed);
+            Assert.Equal(5, threshold);
+
+            UIntPtr secondAddress;
+            Assert.True(FaultEngineGetTrapGate(second, out secondAddress, out armed, out threshold));
+            Assert.Equal(0ul, address.ToUInt64() % CacheLineSize);
+            Assert.Equal(0ul, secondAddress.ToUInt64() % CacheLineSize);
+            Assert.NotEqual(address, secondAddress);
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private static void AssertTrapInfo(uint trapId, Guid expectedModuleVersionId, uint expectedToken)
+        {
+            Guid moduleVersionId;
+            uint token;
+            Assert.True(FaultEngineGetTrapInfo(trapId, out moduleVersionId, out token));
+            Assert.Equal(expectedModuleVersionId, moduleVersionId);
+            Assert.Equal(expectedToken, token);
+        }
+
+        #endregion
+    }
+}
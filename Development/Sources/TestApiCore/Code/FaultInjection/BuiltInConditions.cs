@@ -3,6 +3,7 @@
 // Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
 // All other rights reserved.
 
+using System;
 using System.Reflection;
 using Microsoft.Test.FaultInjection.Conditions;
 using Microsoft.Test.FaultInjection.SignatureParsing;
@@ -107,6 +108,48 @@ public static ICondition TriggerOnFirstCall
         }
 
 
+        /// <summary>
+        /// A built-in condition which triggers a fault on a random sample of the calls to the faulted method.
+        /// </summary>
+        /// <param name="probability">The probability that a call is faulted, in (0, 1].</param>
+        /// <remarks>
+        /// A System.Argument exception is thrown if probability is out of range. The calls which are
+        /// not sampled do not call the dispatcher, so this condition suits methods called very often.
+        /// </remarks>
+        public static ICondition TriggerWithProbability(double probability)
+        {
+            return new TriggerWithProbability(probability, Environment.TickCount);
+        }
+
+        /// <summary>
+        /// A built-in condition which triggers a fault on a random sample of the calls to the faulted method.
+        /// The same calls are sampled in every run with the same seed.
+        /// </summary>
+        /// <param name="probability">The probability that a call is faulted, in (0, 1].</param>
+        /// <param name="seed">The seed of the sampling.</param>
+        /// <remarks>
+        /// A System.Argument exception is thrown if probability is out of range.
+        /// </remarks>
+        public static ICondition TriggerWithProbability(double probability, int seed)
+        {
+            return new TriggerWithProbability(probability, seed);
+        }
+
+        /// <summary>
+        /// A built-in condition which triggers a fault on every call to the faulted method, but at most
+        /// n times per second. Bursts of up to n faults are allowed.
+        /// </summary>
+        /// <param name="n">A positive number.</param>
+        /// <remarks>
+        /// A System.Argument exception is thrown if n is not positive. While no fault is allowed, the
+        /// calls do not call the dispatcher.
+        /// </remarks>
+        [System.Diagnostics.CodeAnalysis.SuppressMessage("Microsoft.Naming", "CA1704")]
+        public static ICondition TriggerAtMostPerSecond(int n)
+        {
+            return new TriggerAtMostPerSecond(n);
+        }
+
         /// <summary>
         /// A built-in condition which never triggers a fault. This condition can be used to turn off a fault rule.
         /// </summary>
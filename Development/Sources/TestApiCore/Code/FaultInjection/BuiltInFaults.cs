@@ -79,6 +79,51 @@ public static IFault ThrowExceptionRuntimeFault(string exceptionExpression)
             return new ThrowExceptionRuntimeFault(exceptionExpression);
         }
 
+        /// <summary>
+        /// A built-in fault which delays the faulted method by a fixed time when triggered. The faulted
+        /// method then runs its original code.
+        /// </summary>
+        /// <param name="delay">The delay.</param>
+        /// <param name="mode">How the delay is waited.</param>
+        /// <remarks>
+        /// The delay is waited by the fault injection engine, which is precise to microseconds in
+        /// <see cref="LatencyMode.Spin"/> mode.
+        /// </remarks>
+        public static IFault LatencyFault(TimeSpan delay, LatencyMode mode)
+        {
+            return new LatencyFault(mode, Faults.LatencyFault.Distribution.Fixed, ToNanoseconds(delay), 0);
+        }
+
+        /// <summary>
+        /// A built-in fault which delays the faulted method by a time uniformly distributed between
+        /// minimum and maximum when triggered. The faulted method then runs its original code.
+        /// </summary>
+        /// <param name="minimum">The shortest delay.</param>
+        /// <param name="maximum">The longest delay.</param>
+        /// <param name="mode">How the delay is waited.</param>
+        public static IFault UniformLatencyFault(TimeSpan minimum, TimeSpan maximum, LatencyMode mode)
+        {
+            return new LatencyFault(mode, Faults.LatencyFault.Distribution.Uniform, ToNanoseconds(minimum), ToNanoseconds(maximum));
+        }
+
+        /// <summary>
+        /// A built-in fault which delays the faulted method by a log-normally distributed time when
+        /// triggered, which models the latency of a real dependency well. The faulted method then runs
+        /// its original code.
+        /// </summary>
+        /// <param name="median">The median delay.</param>
+        /// <param name="sigma">The standard deviation of the logarithm of the delay, 0.5 is typical.</param>
+        /// <param name="mode">How the delay is waited.</param>
+        public static IFault LogNormalLatencyFault(TimeSpan median, double sigma, LatencyMode mode)
+        {
+            return new LatencyFault(mode, Faults.LatencyFault.Distribution.LogNormal, ToNanoseconds(median), sigma);
+        }
+
+        private static double ToNanoseconds(TimeSpan time)
+        {
+            return time.Ticks * 100.0;
+        }
+
     #endregion
     }
 }
@@ -130,11 +130,7 @@ internal static void AutoRegister()
             registered = true;
         }
 
-        #endregion
-
-        #region Private Members
-
-        private static string CalculateEnginePath()
+        internal static string CalculateEnginePath()
         {
             string assemblyDir = Path.GetDirectoryName(Assembly.GetExecutingAssembly().Location);
             //determine if we are in a 32 or 64 bit process
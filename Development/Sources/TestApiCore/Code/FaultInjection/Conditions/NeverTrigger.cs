@@ -8,11 +8,16 @@
 namespace Microsoft.Test.FaultInjection.Conditions
 {
     [Serializable()]
-    internal sealed class NeverTrigger : ICondition
+    internal sealed class NeverTrigger : ICondition, ICallCountCondition
     {
         public bool Trigger(IRuntimeContext context)
         {
             return false;
         }
+
+        public int GetNextTriggeringCall(int calledTimes)
+        {
+            return int.MaxValue;
+        }
     }
 }
\ No newline at end of file
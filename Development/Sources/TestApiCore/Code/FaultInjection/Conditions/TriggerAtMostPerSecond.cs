@@ -0,0 +1,76 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Diagnostics;
+
+namespace Microsoft.Test.FaultInjection.Conditions
+{
+    // A token bucket, which holds up to n tokens and gets n tokens per second. Each fault takes
+    // one token. While the bucket is empty the prologue skips Trap, until it is refilled.
+    [Serializable()]
+    internal sealed class TriggerAtMostPerSecond : ICondition, IRateLimitedCondition
+    {
+        public TriggerAtMostPerSecond(int n)
+        {
+            if (n <= 0)
+            {
+                throw new ArgumentException("The parameter of TriggerAtMostPerSecond(int) should be a positive number");
+            }
+            this.n = n;
+        }
+
+        public bool Trigger(IRuntimeContext context)
+        {
+            lock (this)
+            {
+                Refill();
+                if (tokens < 1)
+                {
+                    return false;
+                }
+                tokens -= 1;
+                return true;
+            }
+        }
+
+        public TimeSpan GetTimeUntilTrigger()
+        {
+            lock (this)
+            {
+                Refill();
+                if (tokens >= 1)
+                {
+                    return TimeSpan.Zero;
+                }
+                return TimeSpan.FromSeconds((1 - tokens) / n);
+            }
+        }
+
+        // The bucket is not serialized, it starts full in the process of the faulted method.
+        private void Refill()
+        {
+            long now = Stopwatch.GetTimestamp();
+            if (!started)
+            {
+                started = true;
+                tokens = n;
+            }
+            else
+            {
+                tokens = Math.Min(n, tokens + (now - lastRefill) * (double)n / Stopwatch.Frequency);
+            }
+            lastRefill = now;
+        }
+
+        private int n;
+        [NonSerialized]
+        private bool started;
+        [NonSerialized]
+        private double tokens;
+        [NonSerialized]
+        private long lastRefill;
+    }
+}
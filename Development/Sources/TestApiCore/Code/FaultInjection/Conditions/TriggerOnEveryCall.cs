@@ -8,11 +8,16 @@
 namespace Microsoft.Test.FaultInjection.Conditions
 {
     [Serializable()]
-    internal sealed class TriggerOnEveryCall : ICondition
+    internal sealed class TriggerOnEveryCall : ICondition, ICallCountCondition
     {
         public bool Trigger(IRuntimeContext context)
         {
             return true;
         }
+
+        public int GetNextTriggeringCall(int calledTimes)
+        {
+            return calledTimes + 1;
+        }
     }
 }
\ No newline at end of file
@@ -8,7 +8,7 @@
 namespace Microsoft.Test.FaultInjection.Conditions
 {
     [Serializable()]
-    internal sealed class TriggerOnEveryNthCall : ICondition
+    internal sealed class TriggerOnEveryNthCall : ICondition, ICallCountCondition
     {
         public TriggerOnEveryNthCall(int nth)
         {
@@ -27,6 +27,12 @@ public bool Trigger(IRuntimeContext context)
             }
             return false;
         }
+
+        public int GetNextTriggeringCall(int calledTimes)
+        {
+            long next = ((long)calledTimes / n + 1) * n;
+            return next < int.MaxValue ? (int)next : int.MaxValue;
+        }
         private int n;
     }
 }
\ No newline at end of file
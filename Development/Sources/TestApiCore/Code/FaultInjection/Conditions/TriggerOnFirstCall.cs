@@ -8,7 +8,7 @@
 namespace Microsoft.Test.FaultInjection.Conditions
 {
     [Serializable()]
-    internal sealed class TriggerOnFirstCall : ICondition
+    internal sealed class TriggerOnFirstCall : ICondition, ICallCountCondition
     {
         public bool Trigger(IRuntimeContext context)
         {
@@ -19,6 +19,11 @@ public bool Trigger(IRuntimeContext context)
             }
             return false;
         }
+
+        public int GetNextTriggeringCall(int calledTimes)
+        {
+            return triggered ? int.MaxValue : calledTimes + 1;
+        }
         private bool triggered = false;
     }
 }
\ No newline at end of file
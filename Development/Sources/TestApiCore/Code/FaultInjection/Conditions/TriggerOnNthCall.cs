@@ -8,7 +8,7 @@
 namespace Microsoft.Test.FaultInjection.Conditions
 {
     [Serializable()]
-    internal sealed class TriggerOnNthCall : ICondition
+    internal sealed class TriggerOnNthCall : ICondition, ICallCountCondition
     {
         public TriggerOnNthCall(int nth)
         {
@@ -27,6 +27,11 @@ public bool Trigger(IRuntimeContext context)
             }
             return false;
         }
+
+        public int GetNextTriggeringCall(int calledTimes)
+        {
+            return calledTimes < n ? n : int.MaxValue;
+        }
         private int n;
     }
 }
\ No newline at end of file
@@ -0,0 +1,67 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+
+namespace Microsoft.Test.FaultInjection.Conditions
+{
+    // Whether a call is sampled is a hash of its number and the seed, so the same calls are
+    // sampled in every run with the same seed, on any thread, and the next sampled call can
+    // be found in advance. The prologue then skips Trap for all calls in between.
+    [Serializable()]
+    internal sealed class TriggerWithProbability : ICondition, ICallCountCondition
+    {
+        public TriggerWithProbability(double probability, int seed)
+        {
+            if (!(probability > 0 && probability <= 1))
+            {
+                throw new ArgumentException("The first parameter of TriggerWithProbability(double, int) should be in (0, 1]");
+            }
+            this.threshold = (probability == 1) ? uint.MaxValue : (uint)(probability * 4294967296.0);
+            this.seed = (uint)seed;
+        }
+
+        public bool Trigger(IRuntimeContext context)
+        {
+            return IsSampled(context.CalledTimes);
+        }
+
+        public int GetNextTriggeringCall(int calledTimes)
+        {
+            // Scanning is bounded, so a very small probability costs a call to Trap now and then
+            // instead of a long scan at once.
+            int last = (calledTimes > int.MaxValue - MaxCallsToScan) ? int.MaxValue - 1 : calledTimes + MaxCallsToScan;
+            for (int call = calledTimes + 1; call < last; ++call)
+            {
+                if (IsSampled(call))
+                {
+                    return call;
+                }
+            }
+            return last;
+        }
+
+        private bool IsSampled(int call)
+        {
+            if (threshold == uint.MaxValue)
+            {
+                return true;
+            }
+
+            // Finalizer of MurmurHash3, which mixes consecutive numbers well.
+            uint x = unchecked(((uint)call * 0x9E3779B9u) ^ seed);
+            x ^= x >> 16;
+            x = unchecked(x * 0x85EBCA6Bu);
+            x ^= x >> 13;
+            x = unchecked(x * 0xC2B2AE35u);
+            x ^= x >> 16;
+            return x < threshold;
+        }
+
+        private const int MaxCallsToScan = 1 << 20;
+        private uint threshold;
+        private uint seed;
+    }
+}
@@ -20,6 +20,8 @@ internal static class ApiErrorMessages
         public const string RegisterEngineAccessDenied = "Register fault injection engine file \"{1}\" failed. You should run fault injection tool as Administrator(e.g. Run cmd or Visual Studio as Administrator), error code 0x{0:X}.";
         public const string RegisterEngineFileNotFound = "Cannot find fault injection engine file \"{1}\". Please check if the file exists, error code 0x{0:X}.";
         public const string LogDirectoryNullOrEmpty = "Directory for log files can't be null or empty.";
+        public const string AttachEngineFailed = "Attach of the fault injection engine to process {0} failed with HRESULT 0x{1:X8}. The process must run .NET Framework 4 or later, with the same bitness as this process, and no other profiler.";
+        public const string FaultRuleNotFound = "There is no FaultRule for method \"{0}\" in this FaultSession.";
 
         // Error messages for FaultScope
         public const string FaultScopeExists = "A FaultScope is already open in this process. Dispose that FaultScope before creating a new one.";
@@ -15,6 +15,8 @@ internal static class EnvironmentVariable
         public const string MethodFilter = "FAULT_INJECTION_METHOD_FILTER";
         public const string LogDirectory = "FAULT_INJECTION_LOG_DIR";
         public const string LogVerboseLevel = "FAULT_INJECTION_LOG_LEVEL";
+        public const string ReJit = "FAULT_INJECTION_REJIT";
+        public const string FaultPointAttribute = "FAULT_INJECTION_FAULT_POINT_ATTRIBUTE";
 
         // This flag is necessary to enable code injection in CLR4 binaries
         public const string ProfilerCompatibilityForCLR4 = "COMPLUS_ProfAPI_ProfilerCompatibilitySetting";
@@ -8,10 +8,12 @@
 using System.Text;
 using System.Diagnostics;
 using System.Reflection;
+using System.Runtime.CompilerServices;
 using System.Threading;
 using System.Globalization;
 using System.IO;
 using Microsoft.Test.FaultInjection.Constants;
+using Microsoft.Test.FaultInjection.Faults;
 using Microsoft.Test.FaultInjection.SignatureParsing;
 
 namespace Microsoft.Test.FaultInjection
@@ -27,6 +29,103 @@ public static class FaultDispatcher
     {
         #region Public Members
 
+        /// <summary>
+        /// Injected into the prologue of the target method, which returns a value.
+        /// </summary>
+        /// <typeparam name="T">Return type of the target method</typeparam>
+        /// <param name="trapId">Id assigned to the target method by the engine</param>
+        /// <param name="exceptionValue">Exception thrown by fault</param>
+        /// <param name="returnValue">Value to return from fault</param>
+        /// <returns></returns>
+        /// <remarks>
+        /// The target method is identified by its trap id, so no stack walk is needed unless
+        /// the fault condition asks for the call stack. The prologue counts calls on its own and
+        /// skips the call to Trap until a call-count condition may trigger, or forever if the
+        /// method has no rule. The return value is typed, so the prologue needs neither an object
+        /// local nor an unbox.
+        /// </remarks>
+        public static bool Trap<T>(int trapId, out Exception exceptionValue, out T returnValue)
+        {
+            returnValue = default(T);
+            Object value;
+            if (!TrapById(trapId, out exceptionValue, out value))
+            {
+                return false;
+            }
+
+            // The type of value has been checked against the return type of the target method.
+            if (exceptionValue == null && value != null)
+            {
+                returnValue = (T)value;
+            }
+            return true;
+        }
+
+        /// <summary>
+        /// Injected into the prologue of the target method, which returns void or is a constructor.
+        /// </summary>
+        /// <param name="trapId">Id assigned to the target method by the engine</param>
+        /// <param name="exceptionValue">Exception thrown by fault</param>
+        /// <returns></returns>
+        public static bool Trap(int trapId, out Exception exceptionValue)
+        {
+            Object value;
+            return TrapById(trapId, out exceptionValue, out value);
+        }
+
+        /// <summary>
+        /// Injected into the compact prologue of the target method.
+        /// </summary>
+        /// <param name="trapId">Id assigned to the target method by the engine</param>
+        /// <returns>True if the prologue should take the outcome of the fault and return</returns>
+        /// <remarks>
+        /// The compact prologue adds no local variable to the target method, so the outcome of
+        /// the fault is kept on the current thread until the prologue takes it with
+        /// <see cref="TakeFaultedException"/> and <see cref="TakeFaultedReturnValue{T}"/>.
+        /// </remarks>
+        public static bool Trap(int trapId)
+        {
+            Exception exceptionValue;
+            Object value;
+            if (!TrapById(trapId, out exceptionValue, out value))
+            {
+                return false;
+            }
+
+            faultedException = exceptionValue;
+            faultedReturnValue = value;
+            return true;
+        }
+
+        /// <summary>
+        /// Injected into the compact prologue of the target method, after <see cref="Trap(int)"/> returned true.
+        /// </summary>
+        /// <returns>Exception thrown by fault, or null if the fault returns a value</returns>
+        public static Exception TakeFaultedException()
+        {
+            Exception exceptionValue = faultedException;
+            faultedException = null;
+            if (exceptionValue != null)
+            {
+                faultedReturnValue = null;
+            }
+            return exceptionValue;
+        }
+
+        /// <summary>
+        /// Injected into the compact prologue of the target method, which returns a value, when the
+        /// fault throws no exception.
+        /// </summary>
+        /// <typeparam name="T">Return type of the target method</typeparam>
+        /// <returns>Value to return from fault</returns>
+        public static T TakeFaultedReturnValue<T>()
+        {
+            // The type of value has been checked against the return type of the target method.
+            Object value = faultedReturnValue;
+            faultedReturnValue = null;
+            return (value == null) ? default(T) : (T)value;
+        }
+
         /// <summary>
         /// Injected into the prologue of the target method.
         /// </summary>
@@ -42,16 +141,7 @@ public static bool Trap(out Exception exceptionValue, out Object returnValue)
         {
             exceptionValue = null;
             returnValue = null;
-            FaultRule[] newRules;
-            try
-            {
-                newRules = FaultRuleLoader.Load();
-            }
-            catch (Exception e)
-            {
-                throw new FaultInjectionException(FaultDispatcherMessages.LoadFaultRuleError, e);
-            }
-
+            FaultRule[] newRules = LoadRules();
             if (newRules == null || newRules.Length == 0)
             {
                 return false;
@@ -84,12 +174,114 @@ public static bool Trap(out Exception exceptionValue, out Object returnValue)
                         break;
                     }
                 }
+            }
+            catch (System.Exception e)
+            {
+                throw new FaultInjectionException(FaultDispatcherMessages.UnknownExceptionInTrap, e);
+            }
 
-                //Using ICondition and IFault
-                if (rule == null)
+            if (rule == null)
+            {
+                return false;
+            }
+
+            return Dispatch(rule, currentContext, stackFrame.GetMethod(), currentFunction, out exceptionValue, out returnValue);
+        }
+
+        #endregion
+
+        #region Private Members
+
+        // Outcome of the last fault of the current thread, until the compact prologue takes it.
+        [ThreadStatic]
+        private static Exception faultedException;
+        [ThreadStatic]
+        private static Object faultedReturnValue;
+
+        private static bool TrapById(int trapId, out Exception exceptionValue, out Object returnValue)
+        {
+            exceptionValue = null;
+            returnValue = null;
+            int generation = TrapTable.Generation;
+            FaultRule[] newRules = LoadRules();
+            if (newRules == null || newRules.Length == 0)
+            {
+                TrapTable.Disarm(trapId, generation);
+                return false;
+            }
+
+            FaultRule rule;
+            TrapPoint trapPoint;
+            try
+            {
+                trapPoint = TrapTable.Get(trapId);
+                if (trapPoint == null)
                 {
                     return false;
                 }
+                rule = trapPoint.FindRule(newRules);
+            }
+            catch (System.Exception e)
+            {
+                throw new FaultInjectionException(FaultDispatcherMessages.UnknownExceptionInTrap, e);
+            }
+
+            if (rule == null)
+            {
+                // No rule is active for the method, so its prologue need not call Trap until
+                // the rules are replaced.
+                TrapTable.Disarm(trapId, generation);
+                return false;
+            }
+
+            RuntimeContext currentContext = new RuntimeContext(CaptureTrappedMethodStackTrace);
+            lock (trapPoint)
+            {
+                // The prologue counted the calls which skipped Trap. Take them and set the next
+                // threshold in one go, so concurrent calls are neither lost nor counted twice.
+                currentContext.CalledTimes = rule.AddAndChargeCall(TrapTable.TakeCalls(trapId));
+                TimeSpan reopenDelay = GetTimeUntilTrigger(rule.Condition);
+                if (reopenDelay > TimeSpan.Zero)
+                {
+                    // Closed until the condition may trigger again, a timer opens it then.
+                    TrapTable.Disarm(trapId, generation);
+                    trapPoint.ReopenAfter(reopenDelay);
+                }
+                else
+                {
+                    TrapTable.SetThreshold(trapId, rule.GetCallsUntilTrigger(), generation);
+                }
+            }
+
+            return Dispatch(rule, currentContext, trapPoint.Method, trapPoint.FormalSignature, out exceptionValue, out returnValue);
+        }
+
+        private static TimeSpan GetTimeUntilTrigger(ICondition condition)
+        {
+            IRateLimitedCondition rateLimitedCondition = condition as IRateLimitedCondition;
+            return (rateLimitedCondition == null) ? TimeSpan.Zero : rateLimitedCondition.GetTimeUntilTrigger();
+        }
+
+        private static FaultRule[] LoadRules()
+        {
+            try
+            {
+                return FaultRuleLoader.Load();
+            }
+            catch (Exception e)
+            {
+                throw new FaultInjectionException(FaultDispatcherMessages.LoadFaultRuleError, e);
+            }
+        }
+
+        private static bool Dispatch(FaultRule rule, RuntimeContext currentContext, MethodBase trappedMethod,
+            String currentFunction, out Exception exceptionValue, out Object returnValue)
+        {
+            exceptionValue = null;
+            returnValue = null;
+            try
+            {
+                //Using ICondition and IFault
                 bool triggered = false;
                 try
                 {
@@ -107,6 +299,11 @@ public static bool Trap(out Exception exceptionValue, out Object returnValue)
                 {
                     return false;
                 }
+                if (rule.Fault is LatencyFault)
+                {
+                    // The call has been delayed and goes on with the original code.
+                    return false;
+                }
             }
             catch (System.Exception e)
             {
@@ -117,19 +314,45 @@ public static bool Trap(out Exception exceptionValue, out Object returnValue)
             // check return-value's type if not to throw exception
             if (null == exceptionValue)
             {
-                if (stackFrame.GetMethod() is ConstructorInfo)
+                if (trappedMethod is ConstructorInfo)
                 {
                     return true;
                 }
-                Type returnTypeOfTrappedMethod = ((MethodInfo)stackFrame.GetMethod()).ReturnType;
+                Type returnTypeOfTrappedMethod = ((MethodInfo)trappedMethod).ReturnType;
                 return CheckReturnType(returnTypeOfTrappedMethod, returnValue, currentFunction);
             }
             return true;
         }
 
-        #endregion
+        // Stack trace starting from the trapped method. It is captured on demand from inside a
+        // fault condition, so the number of frames above Trap() is not known in advance. The
+        // frames of the current call into FaultDispatcher are the nearest ones above the caller
+        // of this method, and the trapped method is right below them.
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        private static StackTrace CaptureTrappedMethodStackTrace()
+        {
+            StackTrace fullStackTrace = new StackTrace();
+            int i = 1;
+            while (i < fullStackTrace.FrameCount && !IsDispatcherFrame(fullStackTrace.GetFrame(i)))
+            {
+                ++i;
+            }
+            if (i == fullStackTrace.FrameCount)
+            {
+                return fullStackTrace;
+            }
+            while (i < fullStackTrace.FrameCount && IsDispatcherFrame(fullStackTrace.GetFrame(i)))
+            {
+                ++i;
+            }
+            return new StackTrace(i);
+        }
 
-        #region Private Members
+        private static bool IsDispatcherFrame(StackFrame frame)
+        {
+            MethodBase method = frame.GetMethod();
+            return method != null && method.DeclaringType == typeof(FaultDispatcher);
+        }
 
         private static bool CheckReturnType(Type returnTypeOfTrappedMethod, Object returnValue, String currentFunction)
         {
@@ -82,6 +82,9 @@ public sealed class FaultRule
         private IFault fault = new ReturnFault();
         private int serializationVersion = 0;
         private int numTimesCalled = 0;
+        private int numTimesCharged = 0;
+        private bool compileIntoMethod = false;
+        private string[] callerScopes = null;
 
         #endregion
 
@@ -166,6 +169,38 @@ public IFault Fault
             }
         }
 
+        /// <summary>
+        /// Whether the fault may be compiled into the faulted method when the method is compiled.
+        /// </summary>
+        /// <remarks>
+        /// Only a fault which occurs on every call and does not depend on the call can be compiled:
+        /// throwing an exception created by its default constructor, returning null, or returning
+        /// a constant of a primitive type. A compiled fault occurs at the cost of a normal method call,
+        /// without calling FaultDispatcher. Changes to the rule after the faulted process has started
+        /// have no effect on a compiled fault. Other faults are injected as usual.
+        /// </remarks>
+        public bool CompileIntoMethod
+        {
+            get { return compileIntoMethod; }
+            set { compileIntoMethod = value; }
+        }
+
+        /// <summary>
+        /// The callers whose calls to the faulted method are faulted, or null to fault every call.
+        /// </summary>
+        /// <remarks>
+        /// Each scope is the full name of a method, e.g. "MyApp.Client.Send", or a namespace or
+        /// type ending with a dot, e.g. "MyApp.Client.", which contains all the methods below it.
+        /// The faulted method itself is left unmodified: the calls made by the callers in the scopes
+        /// are trapped where they are made, when the callers are compiled. Calls to generic methods,
+        /// and to methods returning a type parameter or a reference, can not be faulted this way.
+        /// </remarks>
+        public string[] CallerScopes
+        {
+            get { return callerScopes; }
+            set { callerScopes = value; }
+        }
+
         #endregion
 
         #region Internal Members
@@ -195,6 +230,57 @@ internal int IncrementAndReturnNumTimesCalled()
             return Interlocked.Increment(ref numTimesCalled);
         }
 
+        /// <summary>
+        /// Adds calls counted by the prologue of the associated method, and returns the number
+        /// of the call of the current thread. Concurrent threads may take each other's calls, so
+        /// each is charged a number of its own, the next triggering call first. To be called
+        /// under the lock of the trap point.
+        /// </summary>
+        internal int AddAndChargeCall(int calls)
+        {
+            int calledTimes = Interlocked.Add(ref numTimesCalled, calls);
+            int nextTriggeringCall = GetNextTriggeringCall(numTimesCharged);
+            if (nextTriggeringCall <= calledTimes)
+            {
+                numTimesCharged = nextTriggeringCall;
+            }
+            else if (calls > 0)
+            {
+                // The other calls taken skipped Trap.
+                numTimesCharged = calledTimes;
+            }
+            else if (numTimesCharged < calledTimes)
+            {
+                // Another thread took this call.
+                ++numTimesCharged;
+            }
+            else
+            {
+                // The fast count lost this call.
+                numTimesCharged = Interlocked.Increment(ref numTimesCalled);
+            }
+            return numTimesCharged;
+        }
+
+        /// <summary>
+        /// Gets the number of calls the prologue of the associated method may count before it
+        /// calls Trap again. Conditions other than call-count ones are evaluated on every call.
+        /// </summary>
+        internal int GetCallsUntilTrigger()
+        {
+            if (!(condition is ICallCountCondition))
+            {
+                return 0;
+            }
+
+            int nextTriggeringCall = GetNextTriggeringCall(numTimesCharged);
+            if (nextTriggeringCall == int.MaxValue)
+            {
+                return int.MaxValue;
+            }
+            return Math.Max(nextTriggeringCall - numTimesCalled, 0);
+        }
+
         /// <summary>
         /// Copies the number of times the FaultRule has been called from another fault rule.
         /// This is used when this is a new fault rule that has just been deserialized and it
@@ -204,6 +290,17 @@ internal int IncrementAndReturnNumTimesCalled()
         internal void CopyNumTimesCalled(FaultRule f)
         {
             numTimesCalled = f.numTimesCalled;
+            numTimesCharged = f.numTimesCharged;
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private int GetNextTriggeringCall(int calledTimes)
+        {
+            ICallCountCondition callCountCondition = condition as ICallCountCondition;
+            return (callCountCondition == null) ? calledTimes + 1 : callCountCondition.GetNextTriggeringCall(calledTimes);
         }
 
         #endregion
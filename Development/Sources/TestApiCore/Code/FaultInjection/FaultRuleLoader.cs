@@ -19,6 +19,7 @@ internal static class FaultRuleLoader
         private static FaultRule[] currentRules;
         private static object initializeLock = new object();
         private static object accessCurrentRuleLock = new object();
+        private static FileSystemWatcher ruleFileWatcher;  // Keeps trapped methods calling Trap after the rules change
         private static string serializationFileName = Environment.GetEnvironmentVariable(EnvironmentVariable.RuleRepository);
 
         #endregion
@@ -46,6 +47,7 @@ public static FaultRule[] Load()
                 {
                     fileReadWriteMutex = new Mutex(false, Path.GetFileName(serializationFileName));
                     currentRules = Serializer.DeserializeRules(serializationFileName, fileReadWriteMutex);
+                    WatchRuleFile();
 
                     return currentRules;
                 }
@@ -59,10 +61,14 @@ public static FaultRule[] Load()
             }
 
             FaultRule[] loadedRules = Serializer.DeserializeRules(serializationFileName, fileReadWriteMutex);
-            MergeRuleArray(swapBuffer, loadedRules);
-            lock (accessCurrentRuleLock)
+            if (MergeRuleArray(swapBuffer, loadedRules))
             {
-                currentRules = swapBuffer;
+                // Replace the rule set only if it changed. Trapped methods cache the rule found
+                // in the current rule set.
+                lock (accessCurrentRuleLock)
+                {
+                    currentRules = swapBuffer;
+                }
             }
 
             return currentRules;
@@ -72,8 +78,23 @@ public static FaultRule[] Load()
 
         #region Private Members
 
-        private static void MergeRuleArray(FaultRule[] current, FaultRule[] loaded)
+        // Trapped methods skip Trap until a call-count condition may trigger, so they would not
+        // load rules changed by the tester in the meantime. Reset their gates on every change,
+        // keeping the calls counted so far, which the merged rules carry on counting.
+        private static void WatchRuleFile()
+        {
+            ruleFileWatcher = new FileSystemWatcher(Path.GetDirectoryName(Path.GetFullPath(serializationFileName)),
+                Path.GetFileName(serializationFileName));
+            ruleFileWatcher.NotifyFilter = NotifyFilters.FileName | NotifyFilters.LastWrite | NotifyFilters.Size;
+            ruleFileWatcher.Changed += delegate { TrapTable.ArmAll(false); };
+            ruleFileWatcher.Created += delegate { TrapTable.ArmAll(false); };
+            ruleFileWatcher.Renamed += delegate { TrapTable.ArmAll(false); };
+            ruleFileWatcher.EnableRaisingEvents = true;
+        }
+
+        private static bool MergeRuleArray(FaultRule[] current, FaultRule[] loaded)
         {
+            bool changed = false;
             foreach (FaultRule loadedRule in loaded)
             {
                 int i = Array.FindIndex(
@@ -84,8 +105,10 @@ private static void MergeRuleArray(FaultRule[] current, FaultRule[] loaded)
                 {
                     loadedRule.CopyNumTimesCalled(current[i]);
                     current[i] = loadedRule;
+                    changed = true;
                 }
             }
+            return changed;
         }
 
         #endregion
@@ -40,6 +40,9 @@ public FaultScope(params FaultRule[] rules)
                 Current = this;
                 FaultRules = rules;
             }
+
+            // Methods gated under the previous rules may have another rule in this scope.
+            TrapTable.ArmAll(true);
         }
 
         /// <summary>
@@ -54,6 +57,7 @@ public void Dispose()
                     Current = null;
                 }
             }
+            TrapTable.ArmAll(true);
         }
 
         /// <summary>
@@ -140,7 +144,7 @@ public void AssertFaultInjectionEnabled()
                     List<string> methodFilterContents = new List<string>();
                     while (!methodFilterFile.EndOfStream)
                     {
-                        methodFilterContents.Add(methodFilterFile.ReadLine().Trim());
+                        methodFilterContents.Add(MethodFilterHelper.GetMethodName(methodFilterFile.ReadLine()).Trim());
                     }
 
                     bool allEntriesFound = true;
@@ -179,7 +183,8 @@ public void AssertFaultInjectionEnabled()
             }
 
             // Verify FaultDispatcher.Trap() method exists and can be loaded by the current runtime
-            FaultDispatcherDelegate t = FaultDispatcher.Trap;
+            FaultDispatcherDelegate<object> t = FaultDispatcher.Trap<object>;
+            VoidFaultDispatcherDelegate v = FaultDispatcher.Trap;
 
             // Verify FaultDispatcher assembly has the public key token that the engine expects
             string faultDispatcherAssemblyName = typeof(FaultDispatcher).Assembly.FullName;
@@ -195,6 +200,7 @@ public void AssertFaultInjectionEnabled()
             }
         }
 
-        private delegate bool FaultDispatcherDelegate(out Exception e, out object o);
+        private delegate bool FaultDispatcherDelegate<T>(int trapId, out Exception e, out T o);
+        private delegate bool VoidFaultDispatcherDelegate(int trapId, out Exception e);
     }
 }
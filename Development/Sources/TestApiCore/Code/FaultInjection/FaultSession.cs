@@ -8,6 +8,8 @@
 using System.Diagnostics;
 using System.Globalization;
 using System.IO;
+using System.Runtime.InteropServices;
+using System.Text;
 using System.Threading;
 using Microsoft.Test.FaultInjection.Constants;
 using Microsoft.Test.FaultInjection.SignatureParsing;
@@ -96,6 +98,11 @@ public sealed class FaultSession
         private readonly string serializationFileName;
         private readonly Mutex serializationMutex;  // Shared with tester and testee process
         private readonly string methodFilterFileName;
+        private readonly List<FaultRule> rules = new List<FaultRule>();  // in the order of the method filter
+        private readonly HashSet<string> disarmedRules = new HashSet<string>();  // formal signatures
+        private bool rewriteOnDemand;
+        private string faultPointAttribute;
+        private const int AttachTimeoutMilliseconds = 10000;
         private string logDirectory = Directory.GetCurrentDirectory();
 
         #endregion
@@ -112,6 +119,7 @@ public FaultSession(params FaultRule[] rules)
             ComRegistrar.AutoRegister();
 
             AddRulesToDict(rules);
+            this.rules.AddRange(rules);
 
             serializationFileName = Path.Combine(this.logDirectory, DateTime.Now.ToString("yyyyMMddHHmmssff", CultureInfo.CurrentCulture) + ".rul");
             {
@@ -162,6 +170,33 @@ public void NotifyRuleChanges()
             SerializeRules();
         }
 
+        /// <summary>
+        /// Arms the rules of the specified methods again after Disarm, in all test applications
+        /// launched with RewriteOnDemand.
+        /// </summary>
+        /// <param name="methods">The signatures of the methods. If none is specified, all rules are armed.</param>
+        /// <exception cref="FaultInjectionException">There is no rule for one of the methods.</exception>
+        public void Arm(params string[] methods)
+        {
+            SetArmed(methods, true);
+        }
+
+        /// <summary>
+        /// Disarms the rules of the specified methods, in all test applications launched with
+        /// RewriteOnDemand. The methods run their original code, as if no fault injection took place,
+        /// until Arm is called. Test applications launched later start with these rules disarmed.
+        /// </summary>
+        /// <remarks>
+        /// Once all rules are disarmed, an engine attached with AttachTo unloads itself from the test
+        /// application, provided that no method has been faulted yet. Attach again to resume.
+        /// </remarks>
+        /// <param name="methods">The signatures of the methods. If none is specified, all rules are disarmed.</param>
+        /// <exception cref="FaultInjectionException">There is no rule for one of the methods.</exception>
+        public void Disarm(params string[] methods)
+        {
+            SetArmed(methods, false);
+        }
+
         /// <summary>
         /// Creates a ProcessStartInfo with the appropriate environment variables set
         /// for fault injection.
@@ -177,6 +212,68 @@ public ProcessStartInfo GetProcessStartInfo(string file)
             return psi;
         }
 
+        /// <summary>
+        /// Gets or sets whether the methods of the rules are rewritten only while their rules are armed.
+        /// A disarmed method then runs its original code, at full speed. Requires .NET Framework 4.5 or
+        /// later in the test application; otherwise methods are rewritten when first compiled, and
+        /// Arm and Disarm have no effect on running applications. Applies to applications launched
+        /// after it is set.
+        /// </summary>
+        public bool RewriteOnDemand
+        {
+            get { return rewriteOnDemand; }
+            set { rewriteOnDemand = value; }
+        }
+
+        /// <summary>
+        /// Gets or sets the name of an attribute which marks methods as fault points. Methods carrying
+        /// it are trapped when first compiled, found from the metadata of their module rather than by
+        /// matching their names, and faulted by the rules naming them. The name is the full name of the
+        /// attribute type, or its name alone to match the type in any namespace. Not supported with
+        /// RewriteOnDemand. Applies to applications launched after it is set.
+        /// </summary>
+        public string FaultPointAttribute
+        {
+            get { return faultPointAttribute; }
+            set { faultPointAttribute = value; }
+        }
+
+        /// <summary>
+        /// Starts injecting faults into a test application which is already running, without restarting it.
+        /// </summary>
+        /// <remarks>
+        /// The application must run .NET Framework 4 or later, with the same bitness as the calling process.
+        /// Only methods compiled after the call are faulted; methods which already ran, or are loaded from
+        /// native images, keep their code. To fault those as well, launch the application with
+        /// RewriteOnDemand and all rules disarmed, and arm them when needed.
+        /// </remarks>
+        /// <param name="process">The test application.</param>
+        /// <exception cref="FaultInjectionException">The engine could not be attached.</exception>
+        public void AttachTo(Process process)
+        {
+            SerializeRules();
+
+            // The engine gets no environment variables of its own, so they are passed along.
+            StringBuilder environmentBlock = new StringBuilder();
+            foreach (KeyValuePair<string, string> variable in GetEngineVariables(this))
+            {
+                environmentBlock.Append(variable.Key).Append('=').Append(variable.Value).Append('\0');
+            }
+            environmentBlock.Append('\0');
+            byte[] clientData = Encoding.Unicode.GetBytes(environmentBlock.ToString());
+
+            ICLRProfiling profiling = (ICLRProfiling)RuntimeEnvironment.GetRuntimeInterfaceAsObject(
+                NativeMethods.CLSID_CLRProfiling, NativeMethods.IID_ICLRProfiling);
+            Guid clsid = new Guid(ComRegistrar.Clsid);
+            int hr = profiling.AttachProfiler(process.Id, AttachTimeoutMilliseconds, ref clsid,
+                ComRegistrar.CalculateEnginePath(), clientData, clientData.Length);
+            if (hr < 0)
+            {
+                throw new FaultInjectionException(
+                    string.Format(CultureInfo.CurrentCulture, ApiErrorMessages.AttachEngineFailed, process.Id, hr));
+            }
+        }
+
         /// <summary>
         /// Directory for all log files written by applications launched by this session.
         /// </summary>
@@ -217,6 +314,43 @@ private void AddRulesToDict(FaultRule[] rules)
             }
         }
 
+        private void SetArmed(string[] methods, bool armed)
+        {
+            List<string> keys = new List<string>();
+            if (methods == null || methods.Length == 0)
+            {
+                keys.AddRange(ruleDict.Keys);
+            }
+            else
+            {
+                foreach (string method in methods)
+                {
+                    string key = Signature.ConvertSignature(method, SignatureStyle.Formal);
+                    if (!ruleDict.ContainsKey(key))
+                    {
+                        throw new FaultInjectionException(
+                            string.Format(CultureInfo.CurrentCulture, ApiErrorMessages.FaultRuleNotFound, method));
+                    }
+                    keys.Add(key);
+                }
+            }
+
+            foreach (string key in keys)
+            {
+                if (armed)
+                {
+                    disarmedRules.Remove(key);
+                }
+                else
+                {
+                    disarmedRules.Add(key);
+                }
+            }
+
+            // The engine watches the method filter, and compiles the methods again when it changes.
+            MethodFilterHelper.WriteMethodFilter(methodFilterFileName, rules.ToArray(), disarmedRules);
+        }
+
         private void SerializeRules()
         {
             List<FaultRule> rules = new List<FaultRule>();
@@ -285,6 +419,34 @@ private static void SetProcessEnvironmentVariables(FaultSession session, Process
             processStartInfo.EnvironmentVariables.Add(EnvironmentVariable.LogDirectory, session.LogDirectory);
 
             processStartInfo.EnvironmentVariables.Add(EnvironmentVariable.ProfilerCompatibilityForCLR4, "EnableV2Profiler");
+
+            if (session.RewriteOnDemand)
+            {
+                processStartInfo.EnvironmentVariables.Add(EnvironmentVariable.ReJit, "ON");
+            }
+
+            if (!string.IsNullOrEmpty(session.FaultPointAttribute))
+            {
+                processStartInfo.EnvironmentVariables.Add(EnvironmentVariable.FaultPointAttribute, session.FaultPointAttribute);
+            }
+        }
+
+        // Variables read by the engine and the dispatcher in the test application
+        private static Dictionary<string, string> GetEngineVariables(FaultSession session)
+        {
+            Dictionary<string, string> variables = new Dictionary<string, string>();
+            variables.Add(EnvironmentVariable.MethodFilter, session.methodFilterFileName);
+            variables.Add(EnvironmentVariable.RuleRepository, session.serializationFileName);
+            variables.Add(EnvironmentVariable.LogDirectory, session.LogDirectory);
+            if (session.RewriteOnDemand)
+            {
+                variables.Add(EnvironmentVariable.ReJit, "ON");
+            }
+            if (!string.IsNullOrEmpty(session.FaultPointAttribute))
+            {
+                variables.Add(EnvironmentVariable.FaultPointAttribute, session.FaultPointAttribute);
+            }
+            return variables;
         }
 
         private static void SetEnvironmentVariable(FaultSession session, EnvironmentVariableTarget target)
@@ -301,6 +463,10 @@ private static void SetEnvironmentVariable(FaultSession session, EnvironmentVari
             Environment.SetEnvironmentVariable(EnvironmentVariable.LogDirectory, session.LogDirectory, target);
 
             Environment.SetEnvironmentVariable(EnvironmentVariable.ProfilerCompatibilityForCLR4, "EnableV2Profiler", target);
+
+            Environment.SetEnvironmentVariable(EnvironmentVariable.ReJit, session.RewriteOnDemand ? "ON" : string.Empty, target);
+
+            Environment.SetEnvironmentVariable(EnvironmentVariable.FaultPointAttribute, session.FaultPointAttribute ?? string.Empty, target);
         }
 
         private static void ClearEnvironmentVariable(EnvironmentVariableTarget target)
@@ -316,6 +482,10 @@ private static void ClearEnvironmentVariable(EnvironmentVariableTarget target)
             Environment.SetEnvironmentVariable(EnvironmentVariable.LogDirectory, string.Empty, target);
 
             Environment.SetEnvironmentVariable(EnvironmentVariable.ProfilerCompatibilityForCLR4, string.Empty, target);
+
+            Environment.SetEnvironmentVariable(EnvironmentVariable.ReJit, string.Empty, target);
+
+            Environment.SetEnvironmentVariable(EnvironmentVariable.FaultPointAttribute, string.Empty, target);
         }
 
         private static bool ArrayEquals(byte[] lhs, byte[] rhs)
@@ -0,0 +1,98 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Diagnostics;
+using System.Globalization;
+using System.Threading;
+
+namespace Microsoft.Test.FaultInjection.Faults
+{
+    // Delays the call, which then runs the original code of the faulted method. The delay is
+    // waited by the engine. The values of the enumerations and the descriptor must match
+    // CLatencyFault of the engine.
+    [Serializable()]
+    internal sealed class LatencyFault : IFault
+    {
+        public enum Distribution
+        {
+            Fixed = 0,
+            Uniform = 1,
+            LogNormal = 2
+        }
+
+        public LatencyFault(LatencyMode mode, Distribution distribution, double parameter1, double parameter2)
+        {
+            if (parameter1 < 0 || parameter2 < 0 || (distribution == Distribution.Uniform && parameter1 > parameter2))
+            {
+                throw new ArgumentException("The delay of a latency fault should not be negative, and the minimum should not exceed the maximum");
+            }
+            this.mode = mode;
+            this.distribution = distribution;
+            this.parameter1 = parameter1;
+            this.parameter2 = parameter2;
+        }
+
+        public void Retrieve(IRuntimeContext rtx, out Exception exceptionValue, out object returnValue)
+        {
+            exceptionValue = null;
+            returnValue = null;
+            try
+            {
+                NativeMethods.FaultEngineInjectLatency((int)mode, (int)distribution, parameter1, parameter2);
+            }
+            catch (DllNotFoundException)
+            {
+                WaitWithoutEngine();
+            }
+            catch (EntryPointNotFoundException)
+            {
+                WaitWithoutEngine();
+            }
+        }
+
+        /// <summary>
+        /// Descriptor of the fault, for the engine to compile it into the faulted method.
+        /// </summary>
+        internal string Descriptor
+        {
+            get
+            {
+                return string.Format(CultureInfo.InvariantCulture, "delay={0}:{1}:{2:R}:{3:R}",
+                    mode.ToString().ToLowerInvariant(), distribution.ToString().ToLowerInvariant(), parameter1, parameter2);
+            }
+        }
+
+        // Only the mean delay, with the precision of the managed primitives.
+        private void WaitWithoutEngine()
+        {
+            double nanoseconds = (distribution == Distribution.Uniform) ? (parameter1 + parameter2) / 2 : parameter1;
+            TimeSpan delay = TimeSpan.FromTicks((long)(nanoseconds / 100));
+            if (mode == LatencyMode.Sleep)
+            {
+                Thread.Sleep(delay);
+                return;
+            }
+
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            while (stopwatch.Elapsed < delay)
+            {
+                if (mode == LatencyMode.Spin)
+                {
+                    Thread.SpinWait(20);
+                }
+                else
+                {
+                    Thread.Yield();
+                }
+            }
+        }
+
+        private readonly LatencyMode mode;
+        private readonly Distribution distribution;
+        private readonly double parameter1;  // nanoseconds: delay, minimum or median
+        private readonly double parameter2;  // nanoseconds: unused or maximum; sigma of the log-normal
+    }
+}
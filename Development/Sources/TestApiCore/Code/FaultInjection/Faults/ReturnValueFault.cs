@@ -19,6 +19,11 @@ public void Retrieve(IRuntimeContext rtx, out Exception exceptionValue, out obje
             exceptionValue = null;
             returnValue = this.returnValue;
         }
+        internal object ReturnValue
+        {
+            get { return returnValue; }
+        }
+
         private readonly object returnValue;
     }
 }
\ No newline at end of file
@@ -24,6 +24,11 @@ public void Retrieve(IRuntimeContext rtx, out Exception exceptionValue, out obje
             returnValue = null;
             exceptionValue = this.exceptionValue;
         }
+        internal Exception ExceptionValue
+        {
+            get { return exceptionValue; }
+        }
+
         private readonly Exception exceptionValue;
     }
 }
\ No newline at end of file
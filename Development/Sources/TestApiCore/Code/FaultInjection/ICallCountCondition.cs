@@ -0,0 +1,22 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+namespace Microsoft.Test.FaultInjection
+{
+    /// <summary>
+    /// Implemented by conditions which depend only on the number of times the faulted method
+    /// has been called. The prologue of the method counts calls on its own and calls Trap only
+    /// when such a condition may trigger.
+    /// </summary>
+    internal interface ICallCountCondition
+    {
+        /// <summary>
+        /// Gets the number of the next call on which the condition may trigger.
+        /// </summary>
+        /// <param name="calledTimes">The number of the current call.</param>
+        /// <returns>A number greater than calledTimes, or Int32.MaxValue if the condition never triggers again.</returns>
+        int GetNextTriggeringCall(int calledTimes);
+    }
+}
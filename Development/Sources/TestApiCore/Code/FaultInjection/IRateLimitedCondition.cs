@@ -0,0 +1,22 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+
+namespace Microsoft.Test.FaultInjection
+{
+    /// <summary>
+    /// Implemented by conditions which can not trigger for a while after they have triggered
+    /// often enough. The prologue of the faulted method skips Trap until then.
+    /// </summary>
+    internal interface IRateLimitedCondition
+    {
+        /// <summary>
+        /// Gets the time until the condition may trigger again.
+        /// </summary>
+        /// <returns>TimeSpan.Zero if the condition may trigger on the next call.</returns>
+        TimeSpan GetTimeUntilTrigger();
+    }
+}
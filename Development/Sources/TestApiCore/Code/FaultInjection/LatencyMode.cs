@@ -0,0 +1,29 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+namespace Microsoft.Test.FaultInjection
+{
+    /// <summary>
+    /// Specifies how a latency fault waits for its delay.
+    /// </summary>
+    public enum LatencyMode
+    {
+        /// <summary>
+        /// Busy-waits on the processor. The most precise mode, suitable for delays of microseconds.
+        /// </summary>
+        Spin = 0,
+
+        /// <summary>
+        /// Yields the processor to other threads until the delay has passed.
+        /// </summary>
+        Yield = 1,
+
+        /// <summary>
+        /// Sleeps on a timer for most of the delay, and yields for the rest of it.
+        /// Suitable for delays of milliseconds or longer.
+        /// </summary>
+        Sleep = 2
+    }
+}
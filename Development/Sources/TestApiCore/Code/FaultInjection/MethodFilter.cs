@@ -3,7 +3,14 @@
 // Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
 // All other rights reserved.
 
+using System;
+using System.Collections.Generic;
+using System.Globalization;
 using System.IO;
+using System.Reflection;
+using System.Threading;
+using Microsoft.Test.FaultInjection.Conditions;
+using Microsoft.Test.FaultInjection.Faults;
 using Microsoft.Test.FaultInjection.SignatureParsing;
 
 namespace Microsoft.Test.FaultInjection
@@ -14,7 +21,19 @@ internal static class MethodFilterHelper
 
         public static void WriteMethodFilter(string file, FaultRule[] rules)
         {
-            using (Stream stream = File.Open(file, FileMode.Create))
+            WriteMethodFilter(file, rules, null);
+        }
+
+        /// <summary>
+        /// Writes the method filter file. The methods of disarmed rules are written with a prefix, so an
+        /// engine rewriting methods on demand runs their original code until they are armed again.
+        /// </summary>
+        public static void WriteMethodFilter(string file, FaultRule[] rules, ICollection<string> disarmedSignatures)
+        {
+            // The engine may read the file at any time once the process runs, so it must never see
+            // a partly written one. Write a new file, then replace the old one with it.
+            string temporaryFile = file + ".tmp";
+            using (Stream stream = File.Open(temporaryFile, FileMode.Create))
             {
                 using (StreamWriter writer = new StreamWriter(stream))
                 {
@@ -22,12 +41,178 @@ public static void WriteMethodFilter(string file, FaultRule[] rules)
                     {
                         if (rule != null)
                         {
-                            string signature = Signature.ConvertSignature(rule.MethodSignature, SignatureStyle.Com);
+                            string signature = Signature.ConvertSignature(rule.MethodSignature, SignatureStyle.Com)
+                                + GetParameterList(rule);
+                            string staticFault = GetStaticFault(rule);
+                            bool disarmed = disarmedSignatures != null && disarmedSignatures.Contains(rule.FormalSignature);
+                            if (disarmed)
+                            {
+                                signature = DisarmedPrefix + signature;
+                            }
+                            if (rule.CallerScopes != null && rule.CallerScopes.Length > 0)
+                            {
+                                // The engine traps the calls made in the scopes instead of the method,
+                                // also while the rule is disarmed, since FaultDispatcher decides then.
+                                signature += StaticFaultSeparator + CallerScopesPrefix + string.Join(";", rule.CallerScopes);
+                            }
+                            else if (!disarmed && staticFault != null)
+                            {
+                                // The engine compiles the fault into the method instead of a call to FaultDispatcher.
+                                signature += StaticFaultSeparator + staticFault;
+                            }
                             writer.WriteLine(signature);
                         }
                     }
                 }
             }
+            ReplaceFile(temporaryFile, file);
+        }
+
+        /// <summary>
+        /// Gets the method name of a line in the method filter file, without its parameter list.
+        /// </summary>
+        public static string GetMethodName(string line)
+        {
+            int separator = line.IndexOf(StaticFaultSeparator);
+            string methodName = separator < 0 ? line : line.Substring(0, separator);
+            int parameters = methodName.IndexOf(ParameterListStart);
+            if (parameters >= 0)
+            {
+                methodName = methodName.Substring(0, parameters);
+            }
+            return methodName.TrimStart(DisarmedPrefix);
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private const char StaticFaultSeparator = '\t';
+        private const char DisarmedPrefix = '#';
+        private const string CallerScopesPrefix = "callers=";
+        private const char ParameterListStart = '(';
+        private const int ReplaceAttempts = 50;
+
+        private static readonly Type[] constantTypes = new Type[]
+        {
+            typeof(bool), typeof(char), typeof(sbyte), typeof(byte), typeof(short), typeof(ushort),
+            typeof(int), typeof(uint), typeof(long), typeof(ulong), typeof(float), typeof(double)
+        };
+
+        // Parameter types of the method, e.g. "(System.Int32,System.String&)". The engine hashes them
+        // to trap only the overload of the rule, instead of every method with the same name.
+        private static string GetParameterList(FaultRule rule)
+        {
+            string formalSignature = Signature.ConvertSignature(rule.MethodSignature, SignatureStyle.Formal);
+            return formalSignature.Substring(formalSignature.IndexOf(ParameterListStart));
+        }
+
+        // Descriptor of the fault for the engine, or null if the fault depends on the call.
+        private static string GetStaticFault(FaultRule rule)
+        {
+            if (!rule.CompileIntoMethod || !(rule.Condition is TriggerOnEveryCall))
+            {
+                return null;
+            }
+
+            if (rule.Fault is ReturnFault)
+            {
+                return "return=null";
+            }
+
+            ReturnValueFault returnValueFault = rule.Fault as ReturnValueFault;
+            if (returnValueFault != null)
+            {
+                object value = returnValueFault.ReturnValue;
+                if (value == null)
+                {
+                    return "return=null";
+                }
+                if (Array.IndexOf(constantTypes, value.GetType()) < 0)
+                {
+                    return null;
+                }
+                string text;
+                if (value is bool)
+                {
+                    text = (bool)value ? "1" : "0";
+                }
+                else if (value is char)
+                {
+                    text = ((int)(char)value).ToString(CultureInfo.InvariantCulture);
+                }
+                else
+                {
+                    text = ((IFormattable)value).ToString(value is float || value is double ? "R" : null, CultureInfo.InvariantCulture);
+                }
+                return "return=" + value.GetType().FullName + ":" + text;
+            }
+
+            LatencyFault latencyFault = rule.Fault as LatencyFault;
+            if (latencyFault != null)
+            {
+                return latencyFault.Descriptor;
+            }
+
+            ThrowExceptionFault throwExceptionFault = rule.Fault as ThrowExceptionFault;
+            if (throwExceptionFault != null && IsDefaultConstructed(throwExceptionFault.ExceptionValue))
+            {
+                Type type = throwExceptionFault.ExceptionValue.GetType();
+                return "throw=[" + type.Assembly.GetName().Name + "]" + type.FullName;
+            }
+
+            return null;
+        }
+
+        // The engine opens the method filter without sharing delete access while reading it, which
+        // takes a few milliseconds at most.
+        private static void ReplaceFile(string source, string destination)
+        {
+            for (int attempt = 1; ; attempt++)
+            {
+                try
+                {
+                    if (File.Exists(destination))
+                    {
+                        File.Replace(source, destination, null);
+                    }
+                    else
+                    {
+                        File.Move(source, destination);
+                    }
+                    return;
+                }
+                catch (IOException)
+                {
+                    if (attempt == ReplaceAttempts)
+                    {
+                        throw;
+                    }
+                    Thread.Sleep(10);
+                }
+            }
+        }
+
+        // The engine throws a new exception created by the default constructor, so the exception
+        // given by the rule must not carry anything else.
+        private static bool IsDefaultConstructed(Exception exception)
+        {
+            Type type = exception.GetType();
+            if (type.IsNested || type.IsGenericType || type.GetConstructor(Type.EmptyTypes) == null ||
+                exception.InnerException != null || exception.Data.Count != 0)
+            {
+                return false;
+            }
+
+            try
+            {
+                Exception defaultException = (Exception)Activator.CreateInstance(type);
+                return exception.Message == defaultException.Message;
+            }
+            catch (TargetInvocationException)
+            {
+                return false;
+            }
         }
 
         #endregion
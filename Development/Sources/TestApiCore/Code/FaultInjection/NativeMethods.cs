@@ -0,0 +1,50 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Runtime.InteropServices;
+using Microsoft.Test.FaultInjection.Constants;
+
+namespace Microsoft.Test.FaultInjection
+{
+    // Functions exported by the fault injection engine, which is already loaded into the
+    // process by the CLR when a trapped method is called.
+    internal static class NativeMethods
+    {
+        [DllImport(EngineInfo.FaultEngineFileName)]
+        [return: MarshalAs(UnmanagedType.Bool)]
+        internal static extern bool FaultEngineGetTrapInfo(int trapId, out Guid moduleVersionId, out int methodDefToken);
+
+        [DllImport(EngineInfo.FaultEngineFileName)]
+        internal static extern int FaultEngineGetTrapCount();
+
+        [DllImport(EngineInfo.FaultEngineFileName)]
+        internal static extern int FaultEngineTakeTrapCalls(int trapId);
+
+        [DllImport(EngineInfo.FaultEngineFileName)]
+        [return: MarshalAs(UnmanagedType.Bool)]
+        internal static extern bool FaultEngineSetTrapThreshold(int trapId, int threshold);
+
+        [DllImport(EngineInfo.FaultEngineFileName)]
+        internal static extern void FaultEngineResetTraps([MarshalAs(UnmanagedType.Bool)] bool discardCalls);
+
+        [DllImport(EngineInfo.FaultEngineFileName)]
+        internal static extern void FaultEngineInjectLatency(int mode, int distribution, double parameter1, double parameter2);
+
+        internal static readonly Guid CLSID_CLRProfiling = new Guid("BD097ED8-733E-43FE-8ED7-A95FF9A8448C");
+        internal static readonly Guid IID_ICLRProfiling = new Guid("B349ABE3-B56F-4689-BFCD-76BF39D888EA");
+    }
+
+    // Loads a profiler into a running process of CLR 4 or later. Obtained from the runtime of this process.
+    [ComImport]
+    [Guid("B349ABE3-B56F-4689-BFCD-76BF39D888EA")]
+    [InterfaceType(ComInterfaceType.InterfaceIsIUnknown)]
+    internal interface ICLRProfiling
+    {
+        [PreserveSig]
+        int AttachProfiler(int processId, int timeoutMilliseconds, [In] ref Guid profilerClsid,
+            [MarshalAs(UnmanagedType.LPWStr)] string profilerPath, [In] byte[] clientData, int clientDataSize);
+    }
+}
@@ -3,6 +3,7 @@
 // Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
 // All other rights reserved.
 
+using System;
 using System.Diagnostics;
 
 namespace Microsoft.Test.FaultInjection
@@ -17,6 +18,7 @@ public class RuntimeContext : IRuntimeContext
         private int calledTimes = 0;
         private StackTrace callStackTrace = null;
         private CallStack callStack = null;
+        private Func<StackTrace> captureCallStackTrace = null;
 
         #endregion
 
@@ -28,6 +30,15 @@ public RuntimeContext()
         {
         }
 
+        /// <summary>
+        /// Initializes a new instance of the RuntimeContext class, whose stack trace is captured
+        /// only when it is asked for.
+        /// </summary>
+        internal RuntimeContext(Func<StackTrace> captureCallStackTrace)
+        {
+            this.captureCallStackTrace = captureCallStackTrace;
+        }
+
         #endregion
 
         #region Public Members
@@ -56,10 +67,12 @@ public StackTrace CallStackTrace
         {
             get
             {
+                EnsureCallStackCaptured();
                 return callStackTrace;
             }
             set
             {
+                captureCallStackTrace = null;
                 callStackTrace = value;
             }
         }
@@ -71,10 +84,12 @@ public CallStack CallStack
         {
             get
             {
+                EnsureCallStackCaptured();
                 return callStack;
             }
             set
             {
+                captureCallStackTrace = null;
                 callStack = value;
             }
         }
@@ -86,9 +101,9 @@ public string Caller
         {
             get
             {
-                if (callStack != null)
+                if (CallStack != null)
                 {
-                    return callStack[1];
+                    return CallStack[1];
                 }
                 else
                 {
@@ -98,5 +113,19 @@ public string Caller
         }
 
         #endregion
+
+        #region Private Members
+
+        private void EnsureCallStackCaptured()
+        {
+            if (captureCallStackTrace != null)
+            {
+                callStackTrace = captureCallStackTrace();
+                callStack = new CallStack(callStackTrace);
+                captureCallStackTrace = null;
+            }
+        }
+
+        #endregion
     }
 }
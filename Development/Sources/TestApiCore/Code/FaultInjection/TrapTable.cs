@@ -0,0 +1,301 @@
+// (c) Copyright Microsoft Corporation.
+// This source is subject to the Microsoft Public License (Ms-PL).
+// Please see http://go.microsoft.com/fwlink/?LinkID=131993 for details.
+// All other rights reserved.
+
+using System;
+using System.Reflection;
+using System.Threading;
+using Microsoft.Test.FaultInjection.SignatureParsing;
+
+namespace Microsoft.Test.FaultInjection
+{
+    /// <summary>
+    /// Maps trap ids, assigned by the engine to trapped methods, to the methods themselves.
+    /// Each id is resolved through the engine once, later lookups are an array index.
+    /// </summary>
+    /// <remarks>
+    /// The prologue of a trapped method counts its calls and calls Trap only when the count
+    /// reaches the threshold set by the dispatcher. A method without a rule in the current rule
+    /// set is disarmed: its prologue skips both the count and the call. All gates are armed and
+    /// reset whenever the rule set is replaced, so the next call of every method calls Trap again.
+    /// </remarks>
+    internal static class TrapTable
+    {
+        #region Private Data
+
+        private static TrapPoint[] trapPoints = new TrapPoint[0];
+        private static object syncRoot = new object();
+        private static int generation;
+
+        #endregion
+
+        #region Public Members
+
+        public static TrapPoint Get(int trapId)
+        {
+            TrapPoint[] points = trapPoints; // save in case it is replaced on another thread
+            if (trapId >= 0 && trapId < points.Length && points[trapId] != null)
+            {
+                return points[trapId];
+            }
+
+            return Resolve(trapId);
+        }
+
+        /// <summary>
+        /// Number of times the gates have been reset. Read it before loading the rules which a
+        /// threshold is computed from.
+        /// </summary>
+        public static int Generation
+        {
+            get { return Thread.VolatileRead(ref generation); }
+        }
+
+        /// <summary>
+        /// Takes the calls of the trapped method counted by its prologue since last time,
+        /// including the current one.
+        /// </summary>
+        public static int TakeCalls(int trapId)
+        {
+            try
+            {
+                return NativeMethods.FaultEngineTakeTrapCalls(trapId);
+            }
+            catch (DllNotFoundException)
+            {
+                return 1;
+            }
+            catch (EntryPointNotFoundException)
+            {
+                return 1;
+            }
+        }
+
+        /// <summary>
+        /// Lets the prologue of the trapped method skip the call to Trap until it has been
+        /// called threshold more times. Int32.MaxValue disarms the method.
+        /// </summary>
+        public static void SetThreshold(int trapId, int threshold, int generationOfRules)
+        {
+            if (!SetThreshold(trapId, threshold))
+            {
+                return;
+            }
+
+            // The gates may have been reset for new rules since the rules were loaded. Do not
+            // leave the method gated by the old rules.
+            if (generationOfRules != Generation)
+            {
+                SetThreshold(trapId, 0);
+            }
+        }
+
+        /// <summary>
+        /// Lets the prologue of the trapped method call Trap on the next call.
+        /// </summary>
+        public static void Open(int trapId)
+        {
+            SetThreshold(trapId, 0);
+        }
+
+        /// <summary>
+        /// Disarms the trapped method, which has no rule in the rules loaded at the given generation.
+        /// </summary>
+        public static void Disarm(int trapId, int generationOfRules)
+        {
+            SetThreshold(trapId, int.MaxValue, generationOfRules);
+        }
+
+        /// <summary>
+        /// Resets the gates of all trapped methods, to be called after the rule set is replaced.
+        /// The calls counted so far are discarded if the new rules count calls from scratch.
+        /// </summary>
+        public static void ArmAll(bool discardCalls)
+        {
+            Interlocked.Increment(ref generation);
+            try
+            {
+                NativeMethods.FaultEngineResetTraps(discardCalls);
+            }
+            catch (DllNotFoundException)
+            {
+            }
+            catch (EntryPointNotFoundException)
+            {
+            }
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private static TrapPoint Resolve(int trapId)
+        {
+            Guid moduleVersionId;
+            int methodDefToken;
+            try
+            {
+                if (!NativeMethods.FaultEngineGetTrapInfo(trapId, out moduleVersionId, out methodDefToken))
+                {
+                    return null;
+                }
+            }
+            catch (DllNotFoundException)
+            {
+                return null;
+            }
+            catch (EntryPointNotFoundException)
+            {
+                return null;
+            }
+
+            Module module = FindModule(moduleVersionId);
+            if (module == null)
+            {
+                return null;
+            }
+            TrapPoint point = new TrapPoint(trapId, module.ResolveMethod(methodDefToken));
+
+            lock (syncRoot)
+            {
+                TrapPoint[] points = trapPoints;
+                if (trapId >= points.Length)
+                {
+                    // Ids are dense, so grow the table geometrically.
+                    TrapPoint[] newPoints = new TrapPoint[Math.Max(trapId + 1, points.Length * 2)];
+                    points.CopyTo(newPoints, 0);
+                    points = newPoints;
+                }
+                points[trapId] = point;
+                trapPoints = points;
+            }
+            return point;
+        }
+
+        private static bool SetThreshold(int trapId, int threshold)
+        {
+            try
+            {
+                return NativeMethods.FaultEngineSetTrapThreshold(trapId, threshold);
+            }
+            catch (DllNotFoundException)
+            {
+                return false;
+            }
+            catch (EntryPointNotFoundException)
+            {
+                return false;
+            }
+        }
+
+        private static Module FindModule(Guid moduleVersionId)
+        {
+            foreach (Assembly assembly in AppDomain.CurrentDomain.GetAssemblies())
+            {
+                if (assembly.IsDynamic)
+                {
+                    continue;
+                }
+                foreach (Module module in assembly.GetModules())
+                {
+                    if (module.ModuleVersionId == moduleVersionId)
+                    {
+                        return module;
+                    }
+                }
+            }
+            return null;
+        }
+
+        #endregion
+    }
+
+    /// <summary>
+    /// A trapped method, and the fault rule found for it in the latest rule set.
+    /// </summary>
+    internal sealed class TrapPoint
+    {
+        #region Private Data
+
+        private RuleLookup lastLookup;
+        private Timer reopenTimer;
+
+        #endregion
+
+        #region Constructors
+
+        public TrapPoint(int trapId, MethodBase method)
+        {
+            TrapId = trapId;
+            Method = method;
+            FormalSignature = MethodSignatureTranslator.GetFormalMethodString(method);
+        }
+
+        #endregion
+
+        #region Public Members
+
+        public int TrapId { get; private set; }
+
+        public MethodBase Method { get; private set; }
+
+        public string FormalSignature { get; private set; }
+
+        public FaultRule FindRule(FaultRule[] rules)
+        {
+            // A rule set is replaced, not modified, when rules change. So the rule found in the
+            // same rule set last time is still the right one.
+            RuleLookup lookup = lastLookup;
+            if (lookup != null && lookup.Rules == rules)
+            {
+                return lookup.Rule;
+            }
+
+            FaultRule rule = null;
+            for (int i = 0; i < rules.Length; ++i)
+            {
+                if (rules[i].FormalSignature != null && FormalSignature.Equals(rules[i].FormalSignature))
+                {
+                    rule = rules[i];
+                    break;
+                }
+            }
+            lastLookup = new RuleLookup(rules, rule);
+            return rule;
+        }
+
+        /// <summary>
+        /// Lets the prologue call Trap again after the given time, replacing an earlier request.
+        /// </summary>
+        public void ReopenAfter(TimeSpan delay)
+        {
+            lock (this)
+            {
+                if (reopenTimer == null)
+                {
+                    reopenTimer = new Timer(delegate { TrapTable.Open(TrapId); });
+                }
+                reopenTimer.Change(delay, TimeSpan.FromMilliseconds(Timeout.Infinite));
+            }
+        }
+
+        #endregion
+
+        #region Private Members
+
+        private sealed class RuleLookup
+        {
+            public RuleLookup(FaultRule[] rules, FaultRule rule)
+            {
+                Rules = rules;
+                Rule = rule;
+            }
+
+            public FaultRule[] Rules { get; private set; }
+            public FaultRule Rule { get; private set; }
+        }
+
+        #endregion
+    }
+}